@@ -39,22 +39,41 @@ static int set_working_dir(options_t *opt)
 	return 0;
 }
 
+/* Files up to this many blocks can be read by the reader threads */
+#define MAX_THREADED_FILE_BLOCKS (16)
+
 static int pack_files(sqfs_block_processor_t *data, fstree_t *fs,
 		      options_t *opt)
 {
 	sqfs_inode_generic_t **inode_ptr;
+	int flags, ret, status = -1;
 	sqfs_u64 filesize;
 	sqfs_file_t *file;
 	tree_node_t *node;
 	const char *path;
 	char *node_path;
 	file_info_t *fi;
-	int flags;
-	int ret;
+#ifdef HAVE_PTHREAD
+	file_readers_t *readers = NULL;
+#endif
 
 	if (set_working_dir(opt))
 		return -1;
 
+#ifdef HAVE_PTHREAD
+	if (opt->read_threads > 0) {
+		readers = file_readers_create(opt->read_threads,
+					      opt->cfg.block_size);
+		if (readers == NULL)
+			return -1;
+	}
+#else
+	if (opt->read_threads > 0) {
+		fputs("Built without thread support, ignoring "
+		      "--read-threads.\n", stderr);
+	}
+#endif
+
 	for (fi = fs->files; fi != NULL; fi = fi->next) {
 		if (fi->input_file == NULL) {
 			node = container_of(fi, tree_node_t, data.file);
@@ -62,7 +81,7 @@ static int pack_files(sqfs_block_processor_t *data, fstree_t *fs,
 			node_path = fstree_get_path(node);
 			if (node_path == NULL) {
 				perror("reconstructing file path");
-				return -1;
+				goto out;
 			}
 
 			ret = canonicalize_name(node_path);
@@ -81,26 +100,60 @@ static int pack_files(sqfs_block_processor_t *data, fstree_t *fs,
 		if (file == NULL) {
 			perror(path);
 			free(node_path);
-			return -1;
+			goto out;
 		}
 
-		flags = 0;
+		flags = SQFS_BLK_EARLY_DEDUPLICATE;
 		filesize = file->get_size(file);
 
 		if (opt->no_tail_packing && filesize > opt->cfg.block_size)
 			flags |= SQFS_BLK_DONT_FRAGMENT;
 
+		if (opt->verify_dedup)
+			flags |= SQFS_BLK_VERIFY_DEDUPLICATE;
+
 		inode_ptr = (sqfs_inode_generic_t **)&fi->user_ptr;
 
+#ifdef HAVE_PTHREAD
+		if (readers != NULL && filesize <= MAX_THREADED_FILE_BLOCKS *
+		    (sqfs_u64)opt->cfg.block_size) {
+			ret = file_readers_submit(readers, data, path,
+						  inode_ptr, file, flags);
+			free(node_path);
+
+			if (ret)
+				goto out;
+			continue;
+		}
+
+		/* large files are read in order, after the pending ones */
+		if (readers != NULL && file_readers_flush(readers, data)) {
+			sqfs_destroy(file);
+			free(node_path);
+			goto out;
+		}
+#endif
+
 		ret = write_data_from_file(path, data, inode_ptr, file, flags);
 		sqfs_destroy(file);
 		free(node_path);
 
 		if (ret)
-			return -1;
+			goto out;
 	}
 
-	return 0;
+#ifdef HAVE_PTHREAD
+	if (readers != NULL && file_readers_flush(readers, data))
+		goto out;
+#endif
+
+	status = 0;
+out:
+#ifdef HAVE_PTHREAD
+	if (readers != NULL)
+		file_readers_destroy(readers);
+#endif
+	return status;
 }
 
 static int relabel_tree_dfs(const char *filename, sqfs_xattr_writer_t *xwr,
@@ -46,6 +46,8 @@ typedef struct {
 	const char *packdir;
 	const char *selinux;
 	bool no_tail_packing;
+	bool verify_dedup;
+	unsigned int read_threads;
 
 	unsigned int force_uid_value;
 	unsigned int force_gid_value;
@@ -61,6 +63,9 @@ enum {
 	DIR_SCAN_READ_XATTR = 0x04,
 };
 
+/* Reads small input files in parallel, see sqfs_block_processor_open_file */
+typedef struct file_readers_t file_readers_t;
+
 void process_command_line(options_t *opt, int argc, char **argv);
 
 int fstree_from_dir(fstree_t *fs, const char *path, void *selinux_handle,
@@ -74,4 +79,19 @@ int selinux_relable_node(void *sehnd, sqfs_xattr_writer_t *xwr,
 
 void selinux_close_context_file(void *sehnd);
 
+#ifdef HAVE_PTHREAD
+file_readers_t *file_readers_create(unsigned int num_threads,
+				    size_t block_size);
+
+void file_readers_destroy(file_readers_t *rd);
+
+/* takes ownership of the file, which is read and destroyed in a thread */
+int file_readers_submit(file_readers_t *rd, sqfs_block_processor_t *data,
+			const char *path, sqfs_inode_generic_t **inode,
+			sqfs_file_t *file, int flags);
+
+/* wait for all submitted files and hand them to the block processor */
+int file_readers_flush(file_readers_t *rd, sqfs_block_processor_t *data);
+#endif
+
 #endif /* MKFS_H */
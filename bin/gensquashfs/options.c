@@ -8,6 +8,10 @@
 
 enum {
 	ALL_ROOT_OPTION = 1,
+	VERIFY_DEDUP_OPTION,
+	ENTROPY_THRESHOLD_OPTION,
+	IO_THREAD_OPTION,
+	READ_THREADS_OPTION,
 };
 
 static struct option long_opts[] = {
@@ -30,6 +34,11 @@ static struct option long_opts[] = {
 	{ "one-file-system", no_argument, NULL, 'o' },
 	{ "exportable", no_argument, NULL, 'e' },
 	{ "no-tail-packing", no_argument, NULL, 'T' },
+	{ "verify-dedup", no_argument, NULL, VERIFY_DEDUP_OPTION },
+	{ "entropy-threshold", required_argument, NULL,
+	  ENTROPY_THRESHOLD_OPTION },
+	{ "io-thread", no_argument, NULL, IO_THREAD_OPTION },
+	{ "read-threads", required_argument, NULL, READ_THREADS_OPTION },
 	{ "force", no_argument, NULL, 'f' },
 	{ "quiet", no_argument, NULL, 'q' },
 #ifdef WITH_SELINUX
@@ -89,7 +98,9 @@ static const char *help_string =
 "                                 gid=<value>    0 if not set.\n"
 "                                 mode=<value>   0755 if not set.\n"
 "                                 mtime=<value>  0 if not set.\n"
-"\n"
+"\n";
+
+static const char *help_options =
 "  --set-uid, -u <number>      Force the owners user ID for ALL inodes to\n"
 "                              this value, no matter what the pack file or\n"
 "                              directory entries actually specify.\n"
@@ -112,6 +123,15 @@ static const char *help_string =
 "  --exportable, -e            Generate an export table for NFS support.\n"
 "  --no-tail-packing, -T       Do not perform tail end packing on files that\n"
 "                              are larger than block size.\n"
+"  --verify-dedup              Only treat blocks and fragments as duplicates\n"
+"                              if they are byte-for-byte identical, instead\n"
+"                              of relying on a matching hash and size.\n"
+"  --io-thread                 Write the image from a separate thread, so\n"
+"                              slow output devices don't stall packing.\n"
+"  --read-threads <count>      Read small input files with this many threads\n"
+"                              in parallel. Defaults to 0 (read in order).\n"
+"  --entropy-threshold <pct>   Do not compress blocks that look this random,\n"
+"                              e.g. 98 percent. Defaults to 0 (off).\n"
 "  --force, -f                 Overwrite the output file if it exists.\n"
 "  --quiet, -q                 Do not print out progress reports.\n"
 "  --help, -h                  Print help text and exit.\n"
@@ -194,6 +214,23 @@ void process_command_line(options_t *opt, int argc, char **argv)
 		case 'T':
 			opt->no_tail_packing = true;
 			break;
+		case VERIFY_DEDUP_OPTION:
+			opt->verify_dedup = true;
+			break;
+		case IO_THREAD_OPTION:
+			opt->cfg.io_thread = true;
+			break;
+		case READ_THREADS_OPTION:
+			opt->read_threads = strtoul(optarg, NULL, 0);
+			break;
+		case ENTROPY_THRESHOLD_OPTION:
+			opt->cfg.entropy_threshold = strtoul(optarg, NULL, 0);
+			if (opt->cfg.entropy_threshold > 100) {
+				fputs("Entropy threshold must be a percentage "
+				      "between 0 and 100\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+			break;
 		case 'c':
 			have_compressor = true;
 			ret = sqfs_compressor_id_from_name(optarg);
@@ -277,6 +314,7 @@ void process_command_line(options_t *opt, int argc, char **argv)
 		case 'h':
 			printf(help_string,
 			       SQFS_DEFAULT_BLOCK_SIZE, SQFS_DEVBLK_SIZE);
+			fputs(help_options, stdout);
 			fputs(help_details, stdout);
 			compressor_print_available();
 			exit(EXIT_SUCCESS);
@@ -0,0 +1,264 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * readers.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "mkfs.h"
+
+#include <pthread.h>
+#include <signal.h>
+
+typedef struct read_job_t {
+	struct read_job_t *next;
+	sqfs_block_processor_file_t *handle;
+	sqfs_file_t *file;
+	char *path;
+} read_job_t;
+
+struct file_readers_t {
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+
+	read_job_t *queue;
+	read_job_t *queue_last;
+	bool terminate;
+	int status;
+
+	size_t block_size;
+	size_t max_pending;
+
+	unsigned int num_threads;
+	pthread_t threads[];
+};
+
+static int read_file(read_job_t *job, sqfs_u8 *buffer, size_t block_size)
+{
+	sqfs_u64 filesz, offset;
+	size_t diff;
+	int ret;
+
+	filesz = job->file->get_size(job->file);
+
+	for (offset = 0; offset < filesz; offset += diff) {
+		if (filesz - offset > block_size) {
+			diff = block_size;
+		} else {
+			diff = filesz - offset;
+		}
+
+		ret = job->file->read_at(job->file, offset, buffer, diff);
+		if (ret) {
+			sqfs_perror(job->path, "reading file range", ret);
+			return -1;
+		}
+
+		ret = sqfs_block_processor_file_append(job->handle,
+						       buffer, diff);
+		if (ret) {
+			sqfs_perror(job->path, "buffering file data", ret);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void *reader_proc(void *arg)
+{
+	file_readers_t *rd = arg;
+	sqfs_u8 *buffer;
+	read_job_t *job;
+	int ret;
+
+	buffer = malloc(rd->block_size);
+
+	for (;;) {
+		pthread_mutex_lock(&rd->mtx);
+		while (rd->queue == NULL && !rd->terminate)
+			pthread_cond_wait(&rd->cond, &rd->mtx);
+
+		job = rd->queue;
+		if (job != NULL) {
+			rd->queue = job->next;
+			if (rd->queue == NULL)
+				rd->queue_last = NULL;
+		}
+
+		ret = rd->status;
+		pthread_mutex_unlock(&rd->mtx);
+
+		if (job == NULL)
+			break;
+
+		/* after an error, files are only closed to unblock the main
+		   thread, which bails out anyway */
+		if (ret == 0) {
+			if (buffer == NULL) {
+				perror(job->path);
+				ret = -1;
+			} else {
+				ret = read_file(job, buffer, rd->block_size);
+			}
+		}
+
+		sqfs_block_processor_file_close(job->handle);
+
+		if (ret) {
+			pthread_mutex_lock(&rd->mtx);
+			rd->status = -1;
+			pthread_mutex_unlock(&rd->mtx);
+		}
+
+		sqfs_destroy(job->file);
+		free(job->path);
+		free(job);
+	}
+
+	free(buffer);
+	return NULL;
+}
+
+static int get_status(file_readers_t *rd)
+{
+	int ret;
+
+	pthread_mutex_lock(&rd->mtx);
+	ret = rd->status;
+	pthread_mutex_unlock(&rd->mtx);
+
+	return ret;
+}
+
+file_readers_t *file_readers_create(unsigned int num_threads,
+				    size_t block_size)
+{
+	file_readers_t *rd;
+	sigset_t set, oldset;
+	unsigned int i;
+	int ret;
+
+	rd = calloc(1, sizeof(*rd) + num_threads * sizeof(rd->threads[0]));
+	if (rd == NULL) {
+		perror("creating file reader threads");
+		return NULL;
+	}
+
+	rd->mtx = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+	rd->cond = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
+	rd->block_size = block_size;
+	rd->max_pending = 4 * num_threads;
+
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+
+	for (i = 0; i < num_threads; ++i) {
+		ret = pthread_create(rd->threads + i, NULL, reader_proc, rd);
+		if (ret != 0)
+			break;
+
+		rd->num_threads += 1;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	if (rd->num_threads < num_threads) {
+		errno = ret;
+		perror("creating file reader threads");
+		file_readers_destroy(rd);
+		return NULL;
+	}
+
+	return rd;
+}
+
+void file_readers_destroy(file_readers_t *rd)
+{
+	read_job_t *job;
+	unsigned int i;
+
+	pthread_mutex_lock(&rd->mtx);
+	rd->terminate = true;
+	pthread_cond_broadcast(&rd->cond);
+	pthread_mutex_unlock(&rd->mtx);
+
+	for (i = 0; i < rd->num_threads; ++i)
+		pthread_join(rd->threads[i], NULL);
+
+	while (rd->queue != NULL) {
+		job = rd->queue;
+		rd->queue = job->next;
+
+		sqfs_block_processor_file_close(job->handle);
+		sqfs_destroy(job->file);
+		free(job->path);
+		free(job);
+	}
+
+	pthread_cond_destroy(&rd->cond);
+	pthread_mutex_destroy(&rd->mtx);
+	free(rd);
+}
+
+int file_readers_submit(file_readers_t *rd, sqfs_block_processor_t *data,
+			const char *path, sqfs_inode_generic_t **inode,
+			sqfs_file_t *file, int flags)
+{
+	read_job_t *job;
+	int ret;
+
+	job = calloc(1, sizeof(*job));
+	if (job == NULL)
+		goto fail_errno;
+
+	job->path = strdup(path);
+	if (job->path == NULL)
+		goto fail_errno;
+
+	ret = sqfs_block_processor_open_file(data, inode, flags, &job->handle);
+	if (ret) {
+		sqfs_perror(path, "beginning file data blocks", ret);
+		goto fail;
+	}
+
+	job->file = file;
+
+	pthread_mutex_lock(&rd->mtx);
+	if (rd->queue_last == NULL) {
+		rd->queue = job;
+	} else {
+		rd->queue_last->next = job;
+	}
+	rd->queue_last = job;
+	pthread_cond_signal(&rd->cond);
+	pthread_mutex_unlock(&rd->mtx);
+
+	ret = sqfs_block_processor_commit_files(data, rd->max_pending);
+	if (ret) {
+		sqfs_perror(path, "packing file data", ret);
+		return -1;
+	}
+
+	return get_status(rd);
+fail_errno:
+	perror(path);
+fail:
+	if (job != NULL)
+		free(job->path);
+	free(job);
+	sqfs_destroy(file);
+	return -1;
+}
+
+int file_readers_flush(file_readers_t *rd, sqfs_block_processor_t *data)
+{
+	int ret;
+
+	ret = sqfs_block_processor_commit_files(data, 0);
+	if (ret) {
+		sqfs_perror(NULL, "packing file data", ret);
+		return -1;
+	}
+
+	return get_status(rd);
+}
@@ -64,34 +64,34 @@ static int count_int_chars(unsigned int i)
 	return count;
 }
 
-static void print_node_size(const sqfs_tree_node_t *n, char *buffer)
+static void print_node_size(const sqfs_inode_generic_t *inode, char *buffer)
 {
-	switch (n->inode->base.mode & S_IFMT) {
+	switch (inode->base.mode & S_IFMT) {
 	case S_IFLNK:
-		print_size(strlen((const char *)n->inode->extra), buffer, true);
+		print_size(strlen((const char *)inode->extra), buffer, true);
 		break;
 	case S_IFREG: {
 		sqfs_u64 size;
-		sqfs_inode_get_file_size(n->inode, &size);
+		sqfs_inode_get_file_size(inode, &size);
 		print_size(size, buffer, true);
 		break;
 	}
 	case S_IFDIR:
-		if (n->inode->base.type == SQFS_INODE_EXT_DIR) {
-			print_size(n->inode->data.dir_ext.size, buffer, true);
+		if (inode->base.type == SQFS_INODE_EXT_DIR) {
+			print_size(inode->data.dir_ext.size, buffer, true);
 		} else {
-			print_size(n->inode->data.dir.size, buffer, true);
+			print_size(inode->data.dir.size, buffer, true);
 		}
 		break;
 	case S_IFBLK:
 	case S_IFCHR: {
 		sqfs_u32 devno;
 
-		if (n->inode->base.type == SQFS_INODE_EXT_BDEV ||
-		    n->inode->base.type == SQFS_INODE_EXT_CDEV) {
-			devno = n->inode->data.dev_ext.devno;
+		if (inode->base.type == SQFS_INODE_EXT_BDEV ||
+		    inode->base.type == SQFS_INODE_EXT_CDEV) {
+			devno = inode->data.dev_ext.devno;
 		} else {
-			devno = n->inode->data.dev.devno;
+			devno = inode->data.dev.devno;
 		}
 
 		sprintf(buffer, "%u:%u", major(devno), minor(devno));
@@ -104,53 +104,156 @@ static void print_node_size(const sqfs_tree_node_t *n, char *buffer)
 	}
 }
 
-void list_files(const sqfs_tree_node_t *node)
+static int get_ids(const sqfs_id_table_t *idtbl,
+		   const sqfs_inode_generic_t *inode,
+		   sqfs_u32 *uid, sqfs_u32 *gid)
 {
-	int i, max_uid_chars = 0, max_gid_chars = 0, max_sz_chars = 0;
-	char modestr[12], sizestr[32];
-	const sqfs_tree_node_t *n;
+	int ret;
 
-	if (S_ISDIR(node->inode->base.mode)) {
-		for (n = node->children; n != NULL; n = n->next) {
-			i = count_int_chars(n->uid);
-			max_uid_chars = i > max_uid_chars ? i : max_uid_chars;
+	ret = sqfs_id_table_index_to_id(idtbl, inode->base.uid_idx, uid);
+	if (ret)
+		return ret;
 
-			i = count_int_chars(n->gid);
-			max_gid_chars = i > max_gid_chars ? i : max_gid_chars;
+	return sqfs_id_table_index_to_id(idtbl, inode->base.gid_idx, gid);
+}
 
-			print_node_size(n, sizestr);
-			i = strlen(sizestr);
-			max_sz_chars = i > max_sz_chars ? i : max_sz_chars;
-		}
+/* same filter rules as sqfs_dir_reader_get_full_hierarchy without
+   recursion, which also means that sub directories count as empty */
+static bool should_skip(const sqfs_inode_generic_t *inode, unsigned int flags)
+{
+	switch (inode->base.mode & S_IFMT) {
+	case S_IFBLK:
+	case S_IFCHR:
+		return (flags & SQFS_TREE_NO_DEVICES) != 0;
+	case S_IFLNK:
+		return (flags & SQFS_TREE_NO_SLINKS) != 0;
+	case S_IFSOCK:
+		return (flags & SQFS_TREE_NO_SOCKETS) != 0;
+	case S_IFIFO:
+		return (flags & SQFS_TREE_NO_FIFO) != 0;
+	case S_IFDIR:
+		return (flags & SQFS_TREE_NO_EMPTY) != 0;
+	}
+
+	return false;
+}
+
+static const char *get_name(const char *path)
+{
+	const char *name = path, *ptr;
 
-		for (n = node->children; n != NULL; n = n->next) {
-			mode_to_str(n->inode->base.mode, modestr);
-			print_node_size(n, sizestr);
-
-			printf("%s %*u/%-*u %*s %s", modestr,
-			       max_uid_chars, n->uid,
-			       max_gid_chars, n->gid,
-			       max_sz_chars, sizestr,
-			       n->name);
-
-			if (S_ISLNK(n->inode->base.mode)) {
-				printf(" -> %s\n",
-				       (const char *)n->inode->extra);
-			} else {
-				fputc('\n', stdout);
-			}
+	for (ptr = path; *ptr != '\0'; ++ptr) {
+		if ((ptr[0] == '/' || ptr[0] == '\\') &&
+		    ptr[1] != '/' && ptr[1] != '\\' && ptr[1] != '\0') {
+			name = ptr + 1;
 		}
+	}
+
+	return name;
+}
+
+static void print_entry(const sqfs_inode_generic_t *inode,
+			sqfs_u32 uid, sqfs_u32 gid, const char *name,
+			int uid_chars, int gid_chars, int sz_chars)
+{
+	char modestr[12], sizestr[32];
+
+	mode_to_str(inode->base.mode, modestr);
+	print_node_size(inode, sizestr);
+
+	printf("%s %*u/%-*u %*s %s", modestr, uid_chars, uid,
+	       gid_chars, gid, sz_chars, sizestr, name);
+
+	if (S_ISLNK(inode->base.mode)) {
+		printf(" -> %s\n", (const char *)inode->extra);
 	} else {
-		mode_to_str(node->inode->base.mode, modestr);
-		print_node_size(node, sizestr);
+		fputc('\n', stdout);
+	}
+}
 
-		printf("%s %u/%u %s %s", modestr,
-		       node->uid, node->gid, sizestr, node->name);
+static int list_dir(sqfs_dir_reader_t *dr, const sqfs_id_table_t *idtbl,
+		    const sqfs_inode_generic_t *dir, unsigned int flags)
+{
+	int i, max_uid_chars = 0, max_gid_chars = 0, max_sz_chars = 0;
+	sqfs_dir_listing_t *list;
+	const sqfs_dir_node_t *n;
+	sqfs_u32 uid, gid;
+	char sizestr[32];
+	size_t j;
+	int ret;
 
-		if (S_ISLNK(node->inode->base.mode)) {
-			printf(" -> %s\n", (const char *)node->inode->extra);
-		} else {
-			fputc('\n', stdout);
+	ret = sqfs_dir_reader_open_dir(dr, dir);
+	if (ret)
+		return ret;
+
+	ret = sqfs_dir_reader_read_all(dr, 0, &list);
+	if (ret)
+		return ret;
+
+	for (j = 0; j < list->count; ++j) {
+		n = list->entries[j];
+
+		if (should_skip(n->inode, flags)) {
+			list->entries[j] = NULL;
+			continue;
 		}
+
+		if (n->inode->base.inode_number == dir->base.inode_number) {
+			ret = SQFS_ERROR_LINK_LOOP;
+			goto out;
+		}
+
+		ret = get_ids(idtbl, n->inode, &uid, &gid);
+		if (ret)
+			goto out;
+
+		i = count_int_chars(uid);
+		max_uid_chars = i > max_uid_chars ? i : max_uid_chars;
+
+		i = count_int_chars(gid);
+		max_gid_chars = i > max_gid_chars ? i : max_gid_chars;
+
+		print_node_size(n->inode, sizestr);
+		i = strlen(sizestr);
+		max_sz_chars = i > max_sz_chars ? i : max_sz_chars;
 	}
+
+	for (j = 0; j < list->count; ++j) {
+		n = list->entries[j];
+		if (n == NULL)
+			continue;
+
+		get_ids(idtbl, n->inode, &uid, &gid);
+		print_entry(n->inode, uid, gid, (const char *)n->name,
+			    max_uid_chars, max_gid_chars, max_sz_chars);
+	}
+out:
+	free(list);
+	return ret;
+}
+
+int list_files(sqfs_dir_reader_t *dr, const sqfs_id_table_t *idtbl,
+	       const char *path, unsigned int flags)
+{
+	sqfs_inode_generic_t *inode;
+	sqfs_u32 uid, gid;
+	int ret;
+
+	if (path == NULL)
+		path = "";
+
+	ret = sqfs_dir_reader_find_by_path(dr, NULL, path, &inode);
+	if (ret)
+		return ret;
+
+	if (S_ISDIR(inode->base.mode)) {
+		ret = list_dir(dr, idtbl, inode, flags);
+	} else {
+		ret = get_ids(idtbl, inode, &uid, &gid);
+		if (ret == 0)
+			print_entry(inode, uid, gid, get_name(path), 0, 0, 0);
+	}
+
+	free(inode);
+	return ret;
 }
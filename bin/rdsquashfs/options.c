@@ -18,6 +18,7 @@ static struct option long_opts[] = {
 	{ "no-slink", no_argument, NULL, 'L' },
 	{ "no-empty-dir", no_argument, NULL, 'E' },
 	{ "no-sparse", no_argument, NULL, 'Z' },
+	{ "num-jobs", required_argument, NULL, 'j' },
 #ifdef HAVE_SYS_XATTR_H
 	{ "set-xattr", no_argument, NULL, 'X' },
 #endif
@@ -79,6 +80,9 @@ static const char *help_string =
 "  --chown, -O               Change ownership of unpacked files to the\n"
 "                            UID/GID set in the squashfs image.\n"
 "  --quiet, -q               Do not print out progress while unpacking.\n"
+"  --num-jobs, -j <count>    Number of threads that decompress data blocks\n"
+"                            ahead of time. Defaults to 1, i.e. no extra\n"
+"                            threads are used.\n"
 "\n"
 "  --help, -h                Print help text and exit.\n"
 "  --version, -V             Print version information and exit.\n"
@@ -115,6 +119,7 @@ void process_command_line(options_t *opt, int argc, char **argv)
 	opt->cmdpath = NULL;
 	opt->unpack_root = NULL;
 	opt->image_name = NULL;
+	opt->num_jobs = 1;
 
 	for (;;) {
 		i = getopt_long(argc, argv, short_opts, long_opts, NULL);
@@ -181,6 +186,9 @@ void process_command_line(options_t *opt, int argc, char **argv)
 		case 'q':
 			opt->flags |= UNPACK_QUIET;
 			break;
+		case 'j':
+			opt->num_jobs = strtol(optarg, NULL, 0);
+			break;
 		case 'h':
 			fputs(help_string, stdout);
 			free(opt->cmdpath);
@@ -194,6 +202,9 @@ void process_command_line(options_t *opt, int argc, char **argv)
 		}
 	}
 
+	if (opt->num_jobs < 1)
+		opt->num_jobs = 1;
+
 	if (opt->op == OP_NONE) {
 		fputs("No operation specified\n", stderr);
 		goto fail_arg;
@@ -10,6 +10,7 @@ int main(int argc, char **argv)
 {
 	sqfs_xattr_reader_t *xattr = NULL;
 	sqfs_compressor_config_t cfg;
+	sqfs_meta_cache_t *mcache;
 	int status = EXIT_FAILURE;
 	sqfs_data_reader_t *data;
 	sqfs_dir_reader_t *dirrd;
@@ -51,14 +52,23 @@ int main(int argc, char **argv)
 		goto out_file;
 	}
 
+	mcache = sqfs_meta_cache_create(META_CACHE_SIZE);
+	if (mcache == NULL) {
+		sqfs_perror(opt.image_name, "creating meta data cache",
+			    SQFS_ERROR_ALLOC);
+		goto out_cmp;
+	}
+
 	if (!(super.flags & SQFS_FLAG_NO_XATTRS)) {
 		xattr = sqfs_xattr_reader_create(0);
 		if (xattr == NULL) {
 			sqfs_perror(opt.image_name, "creating xattr reader",
 				    SQFS_ERROR_ALLOC);
-			goto out_cmp;
+			goto out_mcache;
 		}
 
+		sqfs_xattr_reader_set_cache(xattr, mcache);
+
 		ret = sqfs_xattr_reader_load(xattr, &super, file, cmp);
 		if (ret) {
 			sqfs_perror(opt.image_name, "loading xattr table",
@@ -87,6 +97,17 @@ int main(int argc, char **argv)
 		goto out_id;
 	}
 
+	sqfs_dir_reader_set_cache(dirrd, mcache);
+
+	if (opt.op == OP_UNPACK || opt.op == OP_DESCRIBE) {
+		ret = sqfs_dir_reader_preload(dirrd, META_PRELOAD_SIZE);
+		if (ret && ret != SQFS_ERROR_OVERFLOW) {
+			sqfs_perror(opt.image_name, "loading meta data tables",
+				    ret);
+			goto out_dr;
+		}
+	}
+
 	data = sqfs_data_reader_create(file, super.block_size, cmp);
 	if (data == NULL) {
 		sqfs_perror(opt.image_name, "creating data reader",
@@ -100,6 +121,27 @@ int main(int argc, char **argv)
 		goto out_data;
 	}
 
+	if (opt.num_jobs > 1) {
+		ret = sqfs_data_reader_set_read_ahead(data, opt.num_jobs,
+						      4 * opt.num_jobs);
+		if (ret && ret != SQFS_ERROR_UNSUPPORTED) {
+			sqfs_perror(opt.image_name,
+				    "starting read ahead threads", ret);
+			goto out_data;
+		}
+	}
+
+	if (opt.op == OP_LS) {
+		ret = list_files(dirrd, idtbl, opt.cmdpath, opt.rdtree_flags);
+		if (ret) {
+			sqfs_perror(opt.image_name, "reading filesystem tree",
+				    ret);
+		} else {
+			status = EXIT_SUCCESS;
+		}
+		goto out_data;
+	}
+
 	ret = sqfs_dir_reader_get_full_hierarchy(dirrd, idtbl, opt.cmdpath,
 						 opt.rdtree_flags, &n);
 	if (ret) {
@@ -108,9 +150,6 @@ int main(int argc, char **argv)
 	}
 
 	switch (opt.op) {
-	case OP_LS:
-		list_files(n);
-		break;
 	case OP_CAT:
 		if (!S_ISREG(n->inode->base.mode)) {
 			fprintf(stderr, "/%s: not a regular file\n",
@@ -165,6 +204,8 @@ out_id:
 out_xr:
 	if (xattr != NULL)
 		sqfs_destroy(xattr);
+out_mcache:
+	sqfs_destroy(mcache);
 out_cmp:
 	sqfs_destroy(cmp);
 out_file:
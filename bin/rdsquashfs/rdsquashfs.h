@@ -56,9 +56,11 @@ typedef struct {
 	char *cmdpath;
 	const char *unpack_root;
 	const char *image_name;
+	unsigned int num_jobs;
 } options_t;
 
-void list_files(const sqfs_tree_node_t *node);
+int list_files(sqfs_dir_reader_t *dr, const sqfs_id_table_t *idtbl,
+	       const char *path, unsigned int flags);
 
 int restore_fstree(sqfs_tree_node_t *root, int flags);
 
@@ -23,12 +23,13 @@ static struct option long_opts[] = {
 	{ "no-skip", no_argument, NULL, 's' },
 	{ "no-xattr", no_argument, NULL, 'X' },
 	{ "no-hard-links", no_argument, NULL, 'L' },
+	{ "num-jobs", required_argument, NULL, 'j' },
 	{ "help", no_argument, NULL, 'h' },
 	{ "version", no_argument, NULL, 'V' },
 	{ NULL, 0, NULL, 0 },
 };
 
-static const char *short_opts = "d:kr:sXLhV";
+static const char *short_opts = "d:kr:sXLj:hV";
 
 static const char *usagestr =
 "Usage: sqfs2tar [OPTIONS...] <sqfsfile>\n"
@@ -60,6 +61,9 @@ static const char *usagestr =
 "  --no-xattr, -X            Do not copy extended attributes.\n"
 "  --no-hard-links, -L       Do not generate hard links. Produce duplicate\n"
 "                            entries instead.\n"
+"  --num-jobs, -j <count>    Number of threads that decompress data blocks\n"
+"                            ahead of time. Defaults to 1, i.e. no extra\n"
+"                            threads are used.\n"
 "\n"
 "  --no-skip, -s             Abort if a file cannot be stored in a tar\n"
 "                            archive. By default, it is simply skipped\n"
@@ -81,6 +85,7 @@ static bool dont_skip = false;
 static bool keep_as_dir = false;
 static bool no_xattr = false;
 static bool no_links = false;
+static unsigned int num_jobs = 1;
 
 static char *root_becomes = NULL;
 static char **subdirs = NULL;
@@ -162,6 +167,9 @@ static void process_args(int argc, char **argv)
 		case 'L':
 			no_links = true;
 			break;
+		case 'j':
+			num_jobs = strtol(optarg, NULL, 0);
+			break;
 		case 'h':
 			fputs(usagestr, stdout);
 			goto out_success;
@@ -509,6 +517,7 @@ int main(int argc, char **argv)
 	sqfs_tree_node_t *root = NULL, *subtree;
 	int flags, ret, status = EXIT_FAILURE;
 	sqfs_compressor_config_t cfg;
+	sqfs_meta_cache_t *mcache;
 	sqfs_compressor_t *cmp;
 	sqfs_id_table_t *idtbl;
 	sqfs_dir_reader_t *dr;
@@ -557,11 +566,18 @@ int main(int argc, char **argv)
 		goto out_fd;
 	}
 
+	mcache = sqfs_meta_cache_create(META_CACHE_SIZE);
+	if (mcache == NULL) {
+		sqfs_perror(filename, "creating meta data cache",
+			    SQFS_ERROR_ALLOC);
+		goto out_cmp;
+	}
+
 	idtbl = sqfs_id_table_create(0);
 
 	if (idtbl == NULL) {
 		perror("creating ID table");
-		goto out_cmp;
+		goto out_mcache;
 	}
 
 	ret = sqfs_id_table_read(idtbl, file, &super, cmp);
@@ -583,6 +599,16 @@ int main(int argc, char **argv)
 		goto out_data;
 	}
 
+	if (num_jobs > 1) {
+		ret = sqfs_data_reader_set_read_ahead(data, num_jobs,
+						      4 * num_jobs);
+		if (ret && ret != SQFS_ERROR_UNSUPPORTED) {
+			sqfs_perror(filename, "starting read ahead threads",
+				    ret);
+			goto out_data;
+		}
+	}
+
 	dr = sqfs_dir_reader_create(&super, cmp, file);
 	if (dr == NULL) {
 		sqfs_perror(filename, "creating dir reader",
@@ -590,6 +616,14 @@ int main(int argc, char **argv)
 		goto out_data;
 	}
 
+	sqfs_dir_reader_set_cache(dr, mcache);
+
+	ret = sqfs_dir_reader_preload(dr, META_PRELOAD_SIZE);
+	if (ret && ret != SQFS_ERROR_OVERFLOW) {
+		sqfs_perror(filename, "loading meta data tables", ret);
+		goto out_dr;
+	}
+
 	if (!no_xattr && !(super.flags & SQFS_FLAG_NO_XATTRS)) {
 		xr = sqfs_xattr_reader_create(0);
 		if (xr == NULL) {
@@ -598,6 +632,8 @@ int main(int argc, char **argv)
 			goto out_dr;
 		}
 
+		sqfs_xattr_reader_set_cache(xr, mcache);
+
 		ret = sqfs_xattr_reader_load(xr, &super, file, cmp);
 		if (ret) {
 			sqfs_perror(filename, "loading xattr table", ret);
@@ -675,6 +711,8 @@ out_data:
 	sqfs_destroy(data);
 out_id:
 	sqfs_destroy(idtbl);
+out_mcache:
+	sqfs_destroy(mcache);
 out_cmp:
 	sqfs_destroy(cmp);
 out_fd:
@@ -67,6 +67,12 @@ static int open_sfqs(sqfs_state_t *state, const char *path)
 		goto fail_id;
 	}
 
+	ret = sqfs_dir_reader_preload(state->dr, META_PRELOAD_SIZE);
+	if (ret && ret != SQFS_ERROR_OVERFLOW) {
+		sqfs_perror(path, "loading meta data tables", ret);
+		goto fail_dr;
+	}
+
 	ret = sqfs_dir_reader_get_full_hierarchy(state->dr, state->idtbl,
 						 NULL, 0, &state->root);
 	if (ret) {
@@ -19,6 +19,12 @@
 #include <io.h>
 #endif
 
+enum {
+	VERIFY_DEDUP_OPTION = 1,
+	ENTROPY_THRESHOLD_OPTION,
+	IO_THREAD_OPTION,
+};
+
 static struct option long_opts[] = {
 	{ "root-becomes", required_argument, NULL, 'r' },
 	{ "compressor", required_argument, NULL, 'c' },
@@ -33,6 +39,10 @@ static struct option long_opts[] = {
 	{ "no-keep-time", no_argument, NULL, 'k' },
 	{ "exportable", no_argument, NULL, 'e' },
 	{ "no-tail-packing", no_argument, NULL, 'T' },
+	{ "verify-dedup", no_argument, NULL, VERIFY_DEDUP_OPTION },
+	{ "entropy-threshold", required_argument, NULL,
+	  ENTROPY_THRESHOLD_OPTION },
+	{ "io-thread", no_argument, NULL, IO_THREAD_OPTION },
 	{ "force", no_argument, NULL, 'f' },
 	{ "quiet", no_argument, NULL, 'q' },
 	{ "help", no_argument, NULL, 'h' },
@@ -88,6 +98,13 @@ static const char *usagestr =
 "  --exportable, -e            Generate an export table for NFS support.\n"
 "  --no-tail-packing, -T       Do not perform tail end packing on files that\n"
 "                              are larger than block size.\n"
+"  --verify-dedup              Only treat blocks and fragments as duplicates\n"
+"                              if they are byte-for-byte identical, instead\n"
+"                              of relying on a matching hash and size.\n"
+"  --io-thread                 Write the image from a separate thread, so\n"
+"                              slow output devices don't stall packing.\n"
+"  --entropy-threshold <pct>   Do not compress blocks that look this random,\n"
+"                              e.g. 98 percent. Defaults to 0 (off).\n"
 "  --force, -f                 Overwrite the output file if it exists.\n"
 "  --quiet, -q                 Do not print out progress reports.\n"
 "  --help, -h                  Print help text and exit.\n"
@@ -103,6 +120,7 @@ static const char *usagestr =
 static bool dont_skip = false;
 static bool keep_time = true;
 static bool no_tail_pack = false;
+static bool verify_dedup = false;
 static sqfs_writer_cfg_t cfg;
 static sqfs_writer_t sqfs;
 static FILE *input_file = NULL;
@@ -124,6 +142,20 @@ static void process_args(int argc, char **argv)
 		case 'T':
 			no_tail_pack = true;
 			break;
+		case VERIFY_DEDUP_OPTION:
+			verify_dedup = true;
+			break;
+		case IO_THREAD_OPTION:
+			cfg.io_thread = true;
+			break;
+		case ENTROPY_THRESHOLD_OPTION:
+			cfg.entropy_threshold = strtoul(optarg, NULL, 0);
+			if (cfg.entropy_threshold > 100) {
+				fputs("Entropy threshold must be a percentage "
+				      "between 0 and 100\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+			break;
 		case 'b':
 			if (parse_size("Block size", &cfg.block_size,
 				       optarg, 0)) {
@@ -251,23 +283,44 @@ fail_arg:
 static int write_file(tar_header_decoded_t *hdr, file_info_t *fi,
 		      sqfs_u64 filesize)
 {
+	sqfs_inode_generic_t **inode;
+	const sparse_map_t *it;
+	sqfs_u64 datasize;
 	sqfs_file_t *file;
 	int flags;
 	int ret;
 
-	file = sqfs_get_stdin_file(input_file, hdr->sparse, filesize);
+	if (hdr->sparse == NULL) {
+		datasize = filesize;
+	} else {
+		datasize = 0;
+		for (it = hdr->sparse; it != NULL; it = it->next)
+			datasize += it->count;
+	}
+
+	file = sqfs_get_stdin_file(input_file, datasize);
 	if (file == NULL) {
 		perror("packing files");
 		return -1;
 	}
 
-	flags = 0;
+	flags = SQFS_BLK_EARLY_DEDUPLICATE;
 	if (no_tail_pack && filesize > cfg.block_size)
 		flags |= SQFS_BLK_DONT_FRAGMENT;
 
-	ret = write_data_from_file(hdr->name, sqfs.data,
-				   (sqfs_inode_generic_t **)&fi->user_ptr,
-				   file, flags);
+	if (verify_dedup)
+		flags |= SQFS_BLK_VERIFY_DEDUPLICATE;
+
+	inode = (sqfs_inode_generic_t **)&fi->user_ptr;
+
+	if (hdr->sparse == NULL) {
+		ret = write_data_from_file(hdr->name, sqfs.data, inode,
+					   file, flags);
+	} else {
+		ret = write_data_from_file_condensed(hdr->name, sqfs.data,
+						     inode, file, hdr->sparse,
+						     filesize, flags);
+	}
 	sqfs_destroy(file);
 
 	if (ret)
@@ -17,6 +17,7 @@
 #include "sqfs/table.h"
 #include "sqfs/error.h"
 #include "sqfs/meta_writer.h"
+#include "sqfs/meta_reader.h"
 #include "sqfs/data_reader.h"
 #include "sqfs/block_processor.h"
 #include "sqfs/block_writer.h"
@@ -34,6 +35,13 @@
 
 #include <stddef.h>
 
+/* memory the unpacking tools use for caching uncompressed meta data blocks */
+#define META_CACHE_SIZE (4 * 1024 * 1024)
+
+/* tables up to this size are loaded into memory entirely when unpacking
+   the whole filesystem tree */
+#define META_PRELOAD_SIZE (128 * 1024 * 1024)
+
 typedef struct {
 	const char *filename;
 	sqfs_block_writer_t *blkwr;
@@ -58,6 +66,7 @@ typedef struct {
 	size_t devblksize;
 	size_t max_backlog;
 	size_t num_jobs;
+	unsigned int entropy_threshold;
 
 	int outmode;
 	SQFS_COMPRESSOR comp_id;
@@ -65,6 +74,7 @@ typedef struct {
 	bool exportable;
 	bool no_xattr;
 	bool quiet;
+	bool io_thread;
 } sqfs_writer_cfg_t;
 
 typedef struct sqfs_hard_link_t {
@@ -105,6 +115,8 @@ int compressor_cfg_init_options(sqfs_compressor_config_t *cfg,
 
 void compressor_print_help(SQFS_COMPRESSOR id);
 
+const char *compressor_flag_name(SQFS_COMPRESSOR id, sqfs_u16 flag);
+
 int inode_stat(const sqfs_tree_node_t *node, struct stat *sb);
 
 char *sqfs_tree_node_get_path(const sqfs_tree_node_t *node);
@@ -113,13 +125,23 @@ int sqfs_data_reader_dump(const char *name, sqfs_data_reader_t *data,
 			  const sqfs_inode_generic_t *inode,
 			  FILE *fp, size_t block_size, bool allow_sparse);
 
-sqfs_file_t *sqfs_get_stdin_file(FILE *fp, const sparse_map_t *map,
-				 sqfs_u64 size);
+sqfs_file_t *sqfs_get_stdin_file(FILE *fp, sqfs_u64 size);
 
 int write_data_from_file(const char *filename, sqfs_block_processor_t *data,
 			 sqfs_inode_generic_t **inode,
 			 sqfs_file_t *file, int flags);
 
+/*
+  Like write_data_from_file, but the file only contains the data regions
+  of a sparse file, as described by the map. The holes in between are
+  added to the block processor as such.
+ */
+int write_data_from_file_condensed(const char *filename,
+				   sqfs_block_processor_t *data,
+				   sqfs_inode_generic_t **inode,
+				   sqfs_file_t *file, const sparse_map_t *map,
+				   sqfs_u64 filesize, int flags);
+
 void sqfs_writer_cfg_init(sqfs_writer_cfg_t *cfg);
 
 int sqfs_writer_init(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *wrcfg);
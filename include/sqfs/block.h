@@ -96,6 +96,47 @@ typedef enum {
 	 */
 	SQFS_BLK_DONT_DEDUPLICATE = 0x0008,
 
+	/**
+	 * @brief Confirm deduplication matches with a byte-for-byte compare.
+	 *
+	 * By default, blocks and fragments are considered duplicates if their
+	 * 64 bit hash and size matches. If this flag is set on fragments or
+	 * the last block of a file, a hash match is only accepted if the
+	 * actual data is identical as well.
+	 *
+	 * Data blocks are read back from the output file for this. Fragments
+	 * are compared against the fragment blocks that are still in flight,
+	 * or read back and decompressed if already written. If the output
+	 * file cannot be read from, a match is never confirmed and the data
+	 * is stored again.
+	 */
+	SQFS_BLK_VERIFY_DEDUPLICATE = 0x0010,
+
+	/**
+	 * @brief Look for a duplicate of the whole file before compressing it.
+	 *
+	 * If set, the @ref sqfs_block_processor_t holds back the blocks of
+	 * a file and hashes them, until the file is complete. If an earlier
+	 * file with the same content is known, the new file simply refers to
+	 * its data and nothing is compressed or written. Files that are larger
+	 * than a few dozen blocks are passed on as usual and deduplicated by
+	 * the @ref sqfs_block_writer_t instead.
+	 *
+	 * This has no effect if @ref SQFS_BLK_DONT_DEDUPLICATE or
+	 * @ref SQFS_BLK_VERIFY_DEDUPLICATE is set as well. The inode pointer
+	 * of the earlier file must stay valid until the block processor is
+	 * finished.
+	 */
+	SQFS_BLK_EARLY_DEDUPLICATE = 0x0020,
+
+	/**
+	 * @brief Set by the @ref sqfs_block_processor_t if it did not try to
+	 *        compress a block, because it looked incompressible.
+	 *
+	 * See @ref sqfs_block_processor_set_entropy_threshold.
+	 */
+	SQFS_BLK_IS_INCOMPRESSIBLE = 0x0200,
+
 	/**
 	 * @brief Set by the @ref sqfs_block_processor_t if it determines a
 	 *        block of a file to be sparse, i.e. only zero bytes.
@@ -135,7 +176,7 @@ typedef enum {
 	/**
 	 * @brief The combination of all flags that are user settable.
 	 */
-	SQFS_BLK_USER_SETTABLE_FLAGS = 0x000F,
+	SQFS_BLK_USER_SETTABLE_FLAGS = 0x003F,
 } SQFS_BLK_FLAGS;
 
 #endif /* SQFS_BLOCK_H */
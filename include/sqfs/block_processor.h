@@ -47,6 +47,95 @@
  * This object is not copyable, i.e. @ref sqfs_copy will always return NULL.
  */
 
+/**
+ * @struct sqfs_block_processor_file_t
+ *
+ * @brief A file that is buffered until the block processor gets to it.
+ *
+ * Created by @ref sqfs_block_processor_open_file, this allows several files
+ * to be filled at the same time, e.g. by multiple threads reading the input
+ * files, while the block processor still gets them in a deterministic order.
+ */
+
+/**
+ * @enum SQFS_BLOCK_PROCESSOR_FLAGS
+ *
+ * @brief Possible flags for @ref sqfs_block_processor_desc_t.
+ */
+typedef enum {
+	/**
+	 * @brief Write the output from a dedicated thread.
+	 *
+	 * Normally, finished blocks are written by the thread that feeds
+	 * data into the block processor, while it waits for room in the
+	 * backlog. If set, a separate thread does the writing, so a slow
+	 * output device does not hold up submitting new data. The blocks
+	 * being written still count against the backlog.
+	 *
+	 * The hooks of the @ref sqfs_block_writer_t are then called from
+	 * that thread, as are the write_at and read_at functions of the
+	 * output file. Reading back fragment blocks to verify fragment
+	 * deduplication (see @ref SQFS_BLK_VERIFY_DEDUPLICATE) still happens
+	 * on the calling thread, but never while the I/O thread is writing,
+	 * so the file does not need to support concurrent access. This flag
+	 * has no effect if libsquashfs was built without thread support.
+	 */
+	SQFS_BLOCK_PROCESSOR_IO_THREAD = 0x01,
+
+	SQFS_BLOCK_PROCESSOR_ALL_FLAGS = 0x01,
+} SQFS_BLOCK_PROCESSOR_FLAGS;
+
+/**
+ * @struct sqfs_block_processor_desc_t
+ *
+ * @brief Describes a block processor for
+ *        @ref sqfs_block_processor_create_ex.
+ */
+struct sqfs_block_processor_desc_t {
+	/**
+	 * @brief Holds the size of the structure.
+	 *
+	 * Must be set to the size of the structure, so a later version of
+	 * libsquashfs can tell which fields the caller knows about.
+	 */
+	size_t size;
+
+	/**
+	 * @brief The maximum size of a data block.
+	 */
+	size_t max_block_size;
+
+	/**
+	 * @brief The number of worker threads to create.
+	 */
+	unsigned int num_workers;
+
+	/**
+	 * @brief The maximum number of blocks currently in flight.
+	 */
+	size_t max_backlog;
+
+	/**
+	 * @brief A combination of @ref SQFS_BLOCK_PROCESSOR_FLAGS.
+	 */
+	sqfs_u32 flags;
+
+	/**
+	 * @brief The compressor to use, copied for each worker.
+	 */
+	sqfs_compressor_t *cmp;
+
+	/**
+	 * @brief The block writer to send finished blocks to.
+	 */
+	sqfs_block_writer_t *wr;
+
+	/**
+	 * @brief The fragment table to store fragment locations in.
+	 */
+	sqfs_frag_table_t *tbl;
+};
+
 /**
  * @struct sqfs_block_processor_stats_t
  *
@@ -99,6 +188,45 @@ struct sqfs_block_processor_stats_t {
 	 * eliminated by deduplication.
 	 */
 	sqfs_u64 actual_frag_count;
+
+	/**
+	 * @brief Total number of tail-end fragments with a matching hash
+	 *        that could not be confirmed as duplicates.
+	 *
+	 * This is only counted for fragments with the
+	 * @ref SQFS_BLK_VERIFY_DEDUPLICATE flag set. It includes actual
+	 * hash collisions, as well as matches inside fragment blocks that
+	 * could not be read back for comparison.
+	 */
+	sqfs_u64 frag_verify_failed;
+
+	/**
+	 * @brief Number of files that were found to be duplicates before
+	 *        compressing them.
+	 *
+	 * See @ref SQFS_BLK_EARLY_DEDUPLICATE and
+	 * @ref sqfs_block_processor_set_file_digest.
+	 */
+	sqfs_u64 early_dedup_file_count;
+
+	/**
+	 * @brief Total size of the files counted by early_dedup_file_count.
+	 */
+	sqfs_u64 early_dedup_bytes;
+
+	/**
+	 * @brief Number of blocks that were not compressed, because they
+	 *        looked incompressible.
+	 *
+	 * See @ref sqfs_block_processor_set_entropy_threshold.
+	 */
+	sqfs_u64 incompressible_block_count;
+
+	/**
+	 * @brief Total size of the blocks counted by
+	 *        incompressible_block_count.
+	 */
+	sqfs_u64 incompressible_bytes;
 };
 
 #ifdef __cplusplus
@@ -134,6 +262,53 @@ sqfs_block_processor_t *sqfs_block_processor_create(size_t max_block_size,
 						    sqfs_block_writer_t *wr,
 						    sqfs_frag_table_t *tbl);
 
+/**
+ * @brief Create a data block writer with extended options.
+ *
+ * @memberof sqfs_block_processor_t
+ *
+ * This works just like @ref sqfs_block_processor_create, but takes its
+ * arguments from a description structure that can be extended in the future.
+ *
+ * @param desc A pointer to a description of the block processor to create.
+ * @param out Returns a pointer to the block processor on success.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure. If the
+ *         size of the description is wrong, @ref SQFS_ERROR_ARG_INVALID,
+ *         if unknown flags are set, @ref SQFS_ERROR_UNSUPPORTED.
+ */
+SQFS_API
+int sqfs_block_processor_create_ex(const sqfs_block_processor_desc_t *desc,
+				   sqfs_block_processor_t **out);
+
+/**
+ * @brief Skip compressing blocks that look incompressible.
+ *
+ * @memberof sqfs_block_processor_t
+ *
+ * If enabled, the byte entropy of each block is estimated from a sample of
+ * its data before compressing it. If it is at least the given percentage of
+ * the maximum of 8 bits per byte, the block is stored uncompressed right
+ * away. Files that start with the signature of a known compressed format
+ * (e.g. gzip, xz, zstd, JPEG or PNG) are not compressed at all.
+ *
+ * Skipped blocks are flagged with @ref SQFS_BLK_IS_INCOMPRESSIBLE and
+ * counted in the statistics. A threshold around 98 percent only catches
+ * data that is practically random, while lower values trade compression
+ * ratio for speed.
+ *
+ * This must be set before the first file is started.
+ *
+ * @param proc A pointer to a data writer object.
+ * @param threshold The entropy threshold in percent, at most 100. Zero
+ *                  disables the check, which is the default.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API
+int sqfs_block_processor_set_entropy_threshold(sqfs_block_processor_t *proc,
+					       unsigned int threshold);
+
 /**
  * @brief Start writing a file.
  *
@@ -168,6 +343,37 @@ SQFS_API int sqfs_block_processor_begin_file(sqfs_block_processor_t *proc,
 					     sqfs_inode_generic_t **inode,
 					     sqfs_u32 flags);
 
+/**
+ * @brief Provide a content digest for the current file.
+ *
+ * @memberof sqfs_block_processor_t
+ *
+ * This can be called after @ref sqfs_block_processor_begin_file and before
+ * appending any data, if the caller already knows a cryptographic digest
+ * of the file contents, e.g. from a package manifest.
+ *
+ * If an earlier file with the same digest and the same layout flags was
+ * processed, all data appended to the current file is discarded right away
+ * and the file simply refers to the data of the earlier one. Otherwise, the
+ * file is processed as usual and the digest is memorized. The digest is
+ * trusted as is, only the file size is checked when the file is ended.
+ *
+ * The inode pointer of the earlier file must stay valid until
+ * @ref sqfs_block_processor_finish returns.
+ *
+ * @param proc A pointer to a data writer object.
+ * @param digest A pointer to the digest bytes.
+ * @param size The size of the digest in bytes.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure. If the size
+ *         of a duplicate file does not match the earlier file,
+ *         @ref sqfs_block_processor_end_file reports
+ *         @ref SQFS_ERROR_CORRUPTED.
+ */
+SQFS_API int sqfs_block_processor_set_file_digest(sqfs_block_processor_t *proc,
+						  const void *digest,
+						  size_t size);
+
 /**
  * @brief Append data to the current file.
  *
@@ -185,6 +391,24 @@ SQFS_API int sqfs_block_processor_begin_file(sqfs_block_processor_t *proc,
 SQFS_API int sqfs_block_processor_append(sqfs_block_processor_t *proc,
 					 const void *data, size_t size);
 
+/**
+ * @brief Append a run of zero bytes to the current file.
+ *
+ * @memberof sqfs_block_processor_t
+ *
+ * This has the same effect as calling @ref sqfs_block_processor_append with
+ * a buffer full of zeros, but whole blocks inside the run are marked as
+ * sparse right away, without ever filling in or scanning their data. Only
+ * the parts that share a block with actual file data are written out.
+ *
+ * @param proc A pointer to a data writer object.
+ * @param size The number of zero bytes to add to the file.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_block_processor_append_sparse(sqfs_block_processor_t *proc,
+						sqfs_u64 size);
+
 /**
  * @brief Stop writing the current file and flush everything that is
  *        buffered internally.
@@ -203,6 +427,98 @@ SQFS_API int sqfs_block_processor_append(sqfs_block_processor_t *proc,
  */
 SQFS_API int sqfs_block_processor_end_file(sqfs_block_processor_t *proc);
 
+/**
+ * @brief Open a file that can be filled independently of other files.
+ *
+ * @memberof sqfs_block_processor_t
+ *
+ * Unlike @ref sqfs_block_processor_begin_file, any number of such files can
+ * be open at the same time. Their data is buffered in the returned handle
+ * and only handed to the block processor by
+ * @ref sqfs_block_processor_commit_files, strictly in the order in which the
+ * files were opened. The output is thus exactly the same as when processing
+ * the files one after another with @ref sqfs_block_processor_begin_file.
+ *
+ * This function and @ref sqfs_block_processor_commit_files must be called
+ * from the thread that uses the block processor, while the handle itself can
+ * be passed on to a different thread, e.g. one that reads the file contents
+ * from disk. Since the entire file is buffered in memory, this is meant for
+ * small files.
+ *
+ * While files opened this way are still pending,
+ * @ref sqfs_block_processor_begin_file cannot be used.
+ *
+ * @param proc A pointer to a data writer object.
+ * @param inode A pointer to a pointer to an inode. When the file is
+ *              committed, the block processor creates a file inode and
+ *              stores a pointer to it here, just like
+ *              @ref sqfs_block_processor_begin_file.
+ * @param flags A combination of @ref SQFS_BLK_FLAGS that can be used to
+ *              micro manage how the data is processed.
+ * @param out Returns a handle for the file.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_block_processor_open_file(sqfs_block_processor_t *proc,
+					    sqfs_inode_generic_t **inode,
+					    sqfs_u32 flags,
+					    sqfs_block_processor_file_t **out);
+
+/**
+ * @brief Append data to a file opened with
+ *        @ref sqfs_block_processor_open_file.
+ *
+ * @memberof sqfs_block_processor_file_t
+ *
+ * This can be called from any thread, but a single handle must not be used
+ * by more than one thread at a time.
+ *
+ * @param file A pointer to a file handle.
+ * @param data A pointer to a buffer to read data from.
+ * @param size How many bytes should be copied out of the given buffer.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_block_processor_file_append(sqfs_block_processor_file_t *file,
+					      const void *data, size_t size);
+
+/**
+ * @brief Mark a file opened with @ref sqfs_block_processor_open_file as
+ *        complete.
+ *
+ * @memberof sqfs_block_processor_file_t
+ *
+ * This can be called from any thread. Afterwards, the handle belongs to the
+ * block processor again and must not be used anymore. It is released when
+ * the file is committed.
+ *
+ * @param file A pointer to a file handle.
+ */
+SQFS_API void sqfs_block_processor_file_close(sqfs_block_processor_file_t *file);
+
+/**
+ * @brief Hand completed files over to the block processor.
+ *
+ * @memberof sqfs_block_processor_t
+ *
+ * Files opened with @ref sqfs_block_processor_open_file are processed in the
+ * order they were opened. Processing stops at the first file that has not
+ * been closed yet, unless more than the given number of files would remain
+ * pending. In that case, the function waits for the files to be closed by
+ * the threads filling them.
+ *
+ * Passing zero thus waits until all open files are processed, which is also
+ * done by @ref sqfs_block_processor_finish. Without thread support, the
+ * function cannot wait and fails with @ref SQFS_ERROR_SEQUENCE instead.
+ *
+ * @param proc A pointer to a data writer object.
+ * @param max_pending The maximum number of files left open after returning.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_block_processor_commit_files(sqfs_block_processor_t *proc,
+					       size_t max_pending);
+
 /**
  * @brief Wait for the in-flight data blocks to finish.
  *
@@ -246,6 +562,29 @@ SQFS_API int sqfs_block_processor_finish(sqfs_block_processor_t *proc);
 SQFS_API const sqfs_block_processor_stats_t
 *sqfs_block_processor_get_stats(const sqfs_block_processor_t *proc);
 
+/**
+ * @brief Get the accumulated runtime statistics of the compressors used by
+ *        a block processor.
+ *
+ * @memberof sqfs_block_processor_t
+ *
+ * This adds up the counters of the compressor that the block processor
+ * was created with and of the copies that it made of it, e.g. for its
+ * worker threads. The worker threads update their counters without any
+ * locking, so this function may only be called while no blocks are in
+ * flight, i.e. after @ref sqfs_block_processor_sync or
+ * @ref sqfs_block_processor_finish returned successfully.
+ *
+ * @param proc A pointer to a block processor object.
+ * @param stats A pointer to a structure to write the counters to.
+ *
+ * @return Zero on success, @ref SQFS_ERROR_UNSUPPORTED if the compressor
+ *         does not keep statistics.
+ */
+SQFS_API int
+sqfs_block_processor_get_compressor_stats(const sqfs_block_processor_t *proc,
+					  sqfs_compressor_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -156,6 +156,33 @@ struct sqfs_block_writer_stats_t {
 	 *        deduplicated blocks.
 	 */
 	sqfs_u64 blocks_written;
+
+	/**
+	 * @brief Number of files that were checked for an earlier
+	 *        duplicate.
+	 */
+	sqfs_u64 dedup_lookups;
+
+	/**
+	 * @brief Number of earlier positions with a matching first block
+	 *        that were compared against a file.
+	 */
+	sqfs_u64 dedup_candidates;
+
+	/**
+	 * @brief Number of files that turned out to be duplicates and
+	 *        have been removed again.
+	 */
+	sqfs_u64 dedup_hits;
+
+	/**
+	 * @brief Number of matches that had the same hash, but turned out
+	 *        to be different when compared byte-for-byte.
+	 *
+	 * This is only counted for files that have the
+	 * @ref SQFS_BLK_VERIFY_DEDUPLICATE flag set.
+	 */
+	sqfs_u64 dedup_collisions;
 };
 
 #ifdef __cplusplus
@@ -201,7 +228,10 @@ SQFS_API int sqfs_block_writer_set_hooks(sqfs_block_writer_t *wr,
  * If the @ref SQFS_BLK_FIRST_BLOCK flag is set, the data block writer
  * memorizes the starting location and block index of the block. If the
  * @ref SQFS_BLK_LAST_BLOCK flag is set, it uses those stored locations
- * to do block deduplication.
+ * to do block deduplication. Blocks are considered equal if their size and
+ * checksum match. If the @ref SQFS_BLK_VERIFY_DEDUPLICATE flag is set as well,
+ * a match is additionally confirmed by reading both copies back from the
+ * file, which requires the file to implement the read_at callback.
  *
  * If the flag @ref SQFS_BLK_ALIGN is set in combination with the
  * @ref SQFS_BLK_FIRST_BLOCK, the file size is padded to a multiple of the
@@ -209,7 +239,10 @@ SQFS_API int sqfs_block_writer_set_hooks(sqfs_block_writer_t *wr,
  * @ref SQFS_BLK_LAST_BLOCK flag, the padding is added afterwards.
  *
  * @param wr A pointer to a block writer.
- * @param block The block to write to disk next.
+ * @param size The size of the block data in bytes.
+ * @param checksum A 64 bit hash of the uncompressed block data.
+ * @param flags A combination of @ref SQFS_BLK_FLAGS describing the block.
+ * @param data A pointer to the (possibly compressed) block data.
  * @param location Returns the location where the block has been written.
  *                 If the @ref SQFS_BLK_LAST_BLOCK flag was set, deduplication
  *                 is performed and this returns the (new) location of the
@@ -218,10 +251,21 @@ SQFS_API int sqfs_block_writer_set_hooks(sqfs_block_writer_t *wr,
  * @return Zero on success, an @ref SQFS_ERROR error on failure.
  */
 SQFS_API int sqfs_block_writer_write(sqfs_block_writer_t *wr,
-				     sqfs_u32 size, sqfs_u32 checksum,
+				     sqfs_u32 size, sqfs_u64 checksum,
 				     sqfs_u32 flags, const sqfs_u8 *data,
 				     sqfs_u64 *location);
 
+/**
+ * @brief Get the file that a block writer writes to.
+ *
+ * @memberof sqfs_block_writer_t
+ *
+ * @param wr A pointer to a block writer.
+ *
+ * @return A pointer to the underlying file.
+ */
+SQFS_API sqfs_file_t *sqfs_block_writer_get_file(const sqfs_block_writer_t *wr);
+
 /**
  * @brief Get access to a block writers run time statistics.
  *
@@ -130,6 +130,10 @@ struct sqfs_compressor_config_t {
 			/**
 			 * @brief Compression level. Value between 1 and 9.
 			 *
+			 * If libsquashfs uses libdeflate for gzip, this can
+			 * go up to @ref SQFS_GZIP_MAX_LEVEL_EXT. The levels
+			 * above 9 are stored as 9 in the image.
+			 *
 			 * Default is 9, i.e. best compression.
 			 */
 			sqfs_u16 level;
@@ -137,11 +141,24 @@ struct sqfs_compressor_config_t {
 			/**
 			 * @brief Deflate window size. Value between 8 and 15.
 			 *
+			 * If libsquashfs uses libdeflate for gzip, only 15 is
+			 * supported for compressing and none of the strategy
+			 * flags can be set. Decompressing works either way.
+			 *
 			 * Default is 15, i.e. 32k window.
 			 */
 			sqfs_u16 window_size;
 
-			sqfs_u32 padd0[3];
+			/**
+			 * @brief How to pick a strategy for a block.
+			 *
+			 * An @ref SQFS_GZIP_STRATEGY_SEARCH value. Only used
+			 * for compressing and not stored in the image. Default
+			 * is @ref SQFS_GZIP_SEARCH_FULL.
+			 */
+			sqfs_u32 strategy_search;
+
+			sqfs_u32 padd0[2];
 		} gzip;
 
 		/**
@@ -155,7 +172,35 @@ struct sqfs_compressor_config_t {
 			 */
 			sqfs_u16 level;
 
-			sqfs_u16 padd0[7];
+			/**
+			 * @brief Base 2 logarithm of the match window size.
+			 *
+			 * Either 0 to let the compression level decide, which
+			 * is the default, or a value between
+			 * @ref SQFS_ZSTD_MIN_WINDOW and the smallest window
+			 * that covers an entire block.
+			 */
+			sqfs_u16 window_log;
+
+			/**
+			 * @brief Match finder strategy.
+			 *
+			 * An @ref SQFS_ZSTD_STRATEGY value. Default is
+			 * @ref SQFS_ZSTD_STRATEGY_DEFAULT, i.e. let the
+			 * compression level decide.
+			 */
+			sqfs_u16 strategy;
+
+			/**
+			 * @brief Minimum length of a match.
+			 *
+			 * Either 0 to let the compression level decide, which
+			 * is the default, or a value between
+			 * @ref SQFS_ZSTD_MIN_MATCH and @ref SQFS_ZSTD_MAX_MATCH.
+			 */
+			sqfs_u16 min_match;
+
+			sqfs_u16 padd0[4];
 		} zstd;
 
 		/**
@@ -199,13 +244,61 @@ struct sqfs_compressor_config_t {
 			 */
 			sqfs_u32 dict_size;
 
-			sqfs_u32 padd0[3];
+			/**
+			 * @brief How to pick a BCJ filter for a block.
+			 *
+			 * An @ref SQFS_XZ_FILTER_SELECT value. Only used for
+			 * compressing and not stored in the image. Default is
+			 * @ref SQFS_XZ_SELECT_BEST.
+			 */
+			sqfs_u32 filter_select;
+
+			sqfs_u32 padd0[2];
 		} xz;
 
 		sqfs_u64 padd0[2];
 	} opt;
 };
 
+/**
+ * @struct sqfs_compressor_stats_t
+ *
+ * @brief Used to store runtime statistics about a @ref sqfs_compressor_t.
+ */
+struct sqfs_compressor_stats_t {
+	/**
+	 * @brief Holds the size of the structure.
+	 *
+	 * If a later version of libsquashfs expands this structure, the value
+	 * of this field can be used to check at runtime whether the newer
+	 * fields are avaialable or not.
+	 */
+	size_t size;
+
+	/**
+	 * @brief Number of blocks for which the compressor had to choose
+	 *        between several of the options enabled by its flags.
+	 */
+	sqfs_u64 search_count;
+
+	/**
+	 * @brief Number of trial runs made while choosing, including runs
+	 *        over only a part of a block.
+	 */
+	sqfs_u64 trial_count;
+
+	/**
+	 * @brief Total number of input bytes fed into the trial runs.
+	 */
+	sqfs_u64 trial_bytes;
+
+	/**
+	 * @brief For each bit in the compressor flags, how many blocks were
+	 *        compressed using the option selected by that flag.
+	 */
+	sqfs_u64 flag_wins[16];
+};
+
 /**
  * @enum SQFS_COMP_FLAG
  *
@@ -296,6 +389,69 @@ typedef enum {
 	SQFS_LZO1X_999	= 4,
 } SQFS_LZO_ALGORITHM;
 
+/**
+ * @enum SQFS_ZSTD_STRATEGY
+ *
+ * @brief The match finder strategies of zstd, from fastest to strongest.
+ */
+typedef enum {
+	SQFS_ZSTD_STRATEGY_DEFAULT = 0,
+	SQFS_ZSTD_FAST = 1,
+	SQFS_ZSTD_DFAST = 2,
+	SQFS_ZSTD_GREEDY = 3,
+	SQFS_ZSTD_LAZY = 4,
+	SQFS_ZSTD_LAZY2 = 5,
+	SQFS_ZSTD_BTLAZY2 = 6,
+	SQFS_ZSTD_BTOPT = 7,
+	SQFS_ZSTD_BTULTRA = 8,
+	SQFS_ZSTD_BTULTRA2 = 9,
+} SQFS_ZSTD_STRATEGY;
+
+/**
+ * @enum SQFS_GZIP_STRATEGY_SEARCH
+ *
+ * @brief How the gzip compressor chooses between the enabled strategies.
+ */
+typedef enum {
+	/**
+	 * @brief Compress every block once with each enabled strategy, then
+	 *        compress it again with the one that gave the smallest result.
+	 */
+	SQFS_GZIP_SEARCH_FULL = 0,
+
+	/**
+	 * @brief Only try the strategies on a small sample from the start
+	 *        of a block and compress the whole block with the winner.
+	 */
+	SQFS_GZIP_SEARCH_SAMPLE = 1,
+} SQFS_GZIP_STRATEGY_SEARCH;
+
+/**
+ * @enum SQFS_XZ_FILTER_SELECT
+ *
+ * @brief How the xz compressor chooses between the enabled BCJ filters.
+ */
+typedef enum {
+	/**
+	 * @brief Compress every block once without a filter and once with
+	 *        each enabled filter, then keep the smallest result.
+	 */
+	SQFS_XZ_SELECT_BEST = 0,
+
+	/**
+	 * @brief Guess the architecture from executable headers or from
+	 *        branch instruction patterns and only compress with the
+	 *        most likely filter, or without one if nothing matches.
+	 */
+	SQFS_XZ_SELECT_GUESS = 1,
+
+	/**
+	 * @brief Like @ref SQFS_XZ_SELECT_GUESS, but also try the second
+	 *        most likely choice and keep the smaller result.
+	 */
+	SQFS_XZ_SELECT_GUESS_VERIFY = 2,
+} SQFS_XZ_FILTER_SELECT;
+
 #define SQFS_GZIP_DEFAULT_LEVEL (9)
 #define SQFS_GZIP_DEFAULT_WINDOW (15)
 
@@ -306,6 +462,7 @@ typedef enum {
 
 #define SQFS_GZIP_MIN_LEVEL (1)
 #define SQFS_GZIP_MAX_LEVEL (9)
+#define SQFS_GZIP_MAX_LEVEL_EXT (12)
 
 #define SQFS_LZO_MIN_LEVEL (0)
 #define SQFS_LZO_MAX_LEVEL (9)
@@ -313,6 +470,11 @@ typedef enum {
 #define SQFS_ZSTD_MIN_LEVEL (1)
 #define SQFS_ZSTD_MAX_LEVEL (22)
 
+#define SQFS_ZSTD_MIN_WINDOW (10)
+
+#define SQFS_ZSTD_MIN_MATCH (3)
+#define SQFS_ZSTD_MAX_MATCH (7)
+
 #define SQFS_GZIP_MIN_WINDOW (8)
 #define SQFS_GZIP_MAX_WINDOW (15)
 
@@ -355,6 +517,26 @@ SQFS_API int sqfs_compressor_config_init(sqfs_compressor_config_t *cfg,
 SQFS_API int sqfs_compressor_create(const sqfs_compressor_config_t *cfg,
 				    sqfs_compressor_t **out);
 
+/**
+ * @brief Get runtime statistics from a compressor.
+ *
+ * The counters only cover the blocks processed by this instance. Copies of
+ * a compressor keep their own counters, starting at zero, so they can be
+ * used from different threads. For the copies that a
+ * @ref sqfs_block_processor_t makes for its worker threads, use
+ * @ref sqfs_block_processor_get_compressor_stats instead.
+ *
+ * Currently, only the gzip compressor keeps statistics.
+ *
+ * @param cmp A pointer to a compressor object.
+ * @param stats A pointer to a structure to write the counters to.
+ *
+ * @return Zero on success, @ref SQFS_ERROR_UNSUPPORTED if the compressor
+ *         does not keep statistics.
+ */
+SQFS_API int sqfs_compressor_get_stats(const sqfs_compressor_t *cmp,
+				       sqfs_compressor_stats_t *stats);
+
 /**
  * @brief Get the name of a compressor backend from its ID.
  *
@@ -47,7 +47,73 @@
  *
  * The data reader abstracts all of this away in a simple interface that allows
  * reading file data through an inode description and a location in the file.
+ *
+ * Decompressed data and fragment blocks are kept in a least recently used
+ * cache, keyed by their on-disk location, so that interleaved reads from
+ * several files or repeated accesses to a shared fragment block do not have
+ * to decompress the same blocks over and over again. The cache is bounded in
+ * size and owned by the reader, a copy created through @ref sqfs_copy starts
+ * out with an empty cache of its own.
+ */
+
+/**
+ * @struct sqfs_data_reader_stats_t
+ *
+ * @brief Collects run time statistics of the @ref sqfs_data_reader_t
+ *        block cache.
  */
+struct sqfs_data_reader_stats_t {
+	/**
+	 * @brief Holds the size of the structure.
+	 *
+	 * If a later version of libsquashfs expands this structure, the value
+	 * of this field can be used to check at runtime whether the newer
+	 * fields are avaialable or not.
+	 */
+	size_t size;
+
+	/**
+	 * @brief Number of block accesses served from the cache.
+	 */
+	sqfs_u64 hits;
+
+	/**
+	 * @brief Number of block accesses that had to read and decompress
+	 *        the block from disk on the calling thread.
+	 */
+	sqfs_u64 misses;
+
+	/**
+	 * @brief Number of blocks removed from the cache to make
+	 *        room for others.
+	 */
+	sqfs_u64 evictions;
+
+	/**
+	 * @brief Number of blocks currently held in the cache.
+	 */
+	sqfs_u64 cached_blocks;
+
+	/**
+	 * @brief Number of bytes of memory currently used by cached blocks,
+	 *        including book keeping overhead.
+	 */
+	sqfs_u64 cached_bytes;
+
+	/**
+	 * @brief Number of blocks handed to the read ahead workers.
+	 */
+	sqfs_u64 read_ahead_blocks;
+
+	/**
+	 * @brief Number of block accesses served by a block that was
+	 *        decompressed by a read ahead worker.
+	 *
+	 * These are not counted as misses. The blocks are moved into the
+	 * cache, so accessing them again counts as a hit.
+	 */
+	sqfs_u64 read_ahead_hits;
+};
 
 #ifdef __cplusplus
 extern "C" {
@@ -70,6 +136,65 @@ SQFS_API sqfs_data_reader_t *sqfs_data_reader_create(sqfs_file_t *file,
 						     size_t block_size,
 						     sqfs_compressor_t *cmp);
 
+/**
+ * @brief Set the maximum amount of memory used for cached blocks.
+ *
+ * @memberof sqfs_data_reader_t
+ *
+ * By default, the cache can hold four full sized blocks. If the limit is
+ * lowered, the least recently used blocks are dropped immediately. The block
+ * accessed last is always kept, even if it alone exceeds the limit, so a
+ * size of zero effectively reduces the cache to a single block.
+ *
+ * @param data A pointer to a data reader object.
+ * @param size The maximum number of bytes to use, including book keeping.
+ *
+ * @return Zero on succcess, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_data_reader_set_cache_size(sqfs_data_reader_t *data,
+					     size_t size);
+
+/**
+ * @brief Get access to the block cache statistics of a data reader.
+ *
+ * @memberof sqfs_data_reader_t
+ *
+ * @param data A pointer to a data reader object.
+ *
+ * @return A pointer to the internal statistics counters.
+ */
+SQFS_API const sqfs_data_reader_stats_t
+*sqfs_data_reader_get_stats(const sqfs_data_reader_t *data);
+
+/**
+ * @brief Decompress upcoming data blocks on worker threads.
+ *
+ * @memberof sqfs_data_reader_t
+ *
+ * If a file is read sequentially, either through @ref sqfs_data_reader_read
+ * or block by block, the compressed data of the following blocks is read
+ * ahead and decompressed by a pool of worker threads. The blocks are moved
+ * into the block cache once the reader gets to them, so the data read is the
+ * same as without read ahead. All accesses to the underlying file still happen on the thread
+ * calling into the data reader.
+ *
+ * In addition to the block cache, up to num_blocks blocks are kept by the
+ * read ahead logic. Only one file is read ahead at a time. The setting is
+ * not carried over to copies of the data reader.
+ *
+ * @param data A pointer to a data reader object.
+ * @param num_workers The number of worker threads to use. Zero disables
+ *                    read ahead and stops any existing workers.
+ * @param num_blocks The maximum number of blocks to read ahead.
+ *
+ * @return Zero on succcess, an @ref SQFS_ERROR value on failure,
+ *         @ref SQFS_ERROR_UNSUPPORTED if libsquashfs was built without
+ *         thread support.
+ */
+SQFS_API int sqfs_data_reader_set_read_ahead(sqfs_data_reader_t *data,
+					     unsigned int num_workers,
+					     size_t num_blocks);
+
 /**
  * @brief Read and decode the fragment table from disk.
  *
@@ -100,11 +225,59 @@ SQFS_API int sqfs_data_reader_get_fragment(sqfs_data_reader_t *data,
 					   const sqfs_inode_generic_t *inode,
 					   size_t *size, sqfs_u8 **out);
 
+/**
+ * @brief Get the tail end of a file into a caller provided buffer.
+ *
+ * @memberof sqfs_data_reader_t
+ *
+ * @param data A pointer to a data reader object.
+ * @param inode A pointer to the inode describing the file.
+ * @param buffer A pointer to a buffer to copy the data to.
+ * @param buffer_size The size of the buffer. A buffer of the block size
+ *                    from the super block is always large enough.
+ * @param size Returns the size of the data read.
+ *
+ * @return Zero on succcess, an @ref SQFS_ERROR value on failure,
+ *         @ref SQFS_ERROR_OVERFLOW if the buffer is too small.
+ */
+SQFS_API int
+sqfs_data_reader_get_fragment_into(sqfs_data_reader_t *data,
+				   const sqfs_inode_generic_t *inode,
+				   sqfs_u8 *buffer, size_t buffer_size,
+				   size_t *size);
+
+/**
+ * @brief Get a pointer to the tail end of a file inside the block cache.
+ *
+ * @memberof sqfs_data_reader_t
+ *
+ * The returned pointer remains valid until the next call to a function
+ * that reads data through the same data reader object, or changes its
+ * settings, and must not be freed.
+ *
+ * @param data A pointer to a data reader object.
+ * @param inode A pointer to the inode describing the file.
+ * @param size Returns the size of the data.
+ * @param out Returns a pointer to the data, NULL if the file does not
+ *            have a tail end.
+ *
+ * @return Zero on succcess, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_data_reader_borrow_fragment(sqfs_data_reader_t *data,
+					      const sqfs_inode_generic_t *inode,
+					      size_t *size,
+					      const sqfs_u8 **out);
+
 /**
  * @brief Get a full sized data block of a file by block index.
  *
  * @memberof sqfs_data_reader_t
  *
+ * If the block is already in the cache, it is copied from there. Otherwise,
+ * the block is decompressed into the returned buffer directly, without adding
+ * it to the cache, so reading a large file block by block does not push out
+ * blocks that are accessed more frequently.
+ *
  * @param data A pointer to a data reader object.
  * @param inode A pointer to the inode describing the file.
  * @param index The block index in the inodes block list.
@@ -119,14 +292,65 @@ SQFS_API int sqfs_data_reader_get_block(sqfs_data_reader_t *data,
 					size_t index, size_t *size,
 					sqfs_u8 **out);
 
+/**
+ * @brief Get a full sized data block of a file into a caller
+ *        provided buffer.
+ *
+ * @memberof sqfs_data_reader_t
+ *
+ * This works like @ref sqfs_data_reader_get_block, except that the block is
+ * decompressed into the given buffer directly, so no memory is allocated.
+ *
+ * @param data A pointer to a data reader object.
+ * @param inode A pointer to the inode describing the file.
+ * @param index The block index in the inodes block list.
+ * @param buffer A pointer to a buffer to decompress the data to.
+ * @param buffer_size The size of the buffer. A buffer of the block size
+ *                    from the super block is always large enough.
+ * @param size Returns the size of the data read.
+ *
+ * @return Zero on succcess, an @ref SQFS_ERROR value on failure,
+ *         @ref SQFS_ERROR_OVERFLOW if the buffer is too small.
+ */
+SQFS_API int sqfs_data_reader_get_block_into(sqfs_data_reader_t *data,
+					     const sqfs_inode_generic_t *inode,
+					     size_t index, sqfs_u8 *buffer,
+					     size_t buffer_size, size_t *size);
+
+/**
+ * @brief Get a pointer to a full sized data block of a file inside
+ *        the block cache.
+ *
+ * @memberof sqfs_data_reader_t
+ *
+ * Unlike @ref sqfs_data_reader_get_block, the block is added to the cache if
+ * it is not in there yet. The returned pointer remains valid until the next
+ * call to a function that reads data through the same data reader object, or
+ * changes its settings, and must not be freed.
+ *
+ * @param data A pointer to a data reader object.
+ * @param inode A pointer to the inode describing the file.
+ * @param index The block index in the inodes block list.
+ * @param size Returns the size of the data.
+ * @param out Returns a pointer to the data.
+ *
+ * @return Zero on succcess, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_data_reader_borrow_block(sqfs_data_reader_t *data,
+					   const sqfs_inode_generic_t *inode,
+					   size_t index, size_t *size,
+					   const sqfs_u8 **out);
+
 /**
  * @brief A simple UNIX-read-like function to read data from a file.
  *
  * @memberof sqfs_data_reader_t
  *
  * This function acts like the read system call in a Unix-like OS. It takes
- * care of reading accross data blocks and fragment internally, using a
- * data and fragment block cache.
+ * care of reading accross data blocks and fragment internally, using the
+ * block cache. Whole, block aligned data blocks that are not cached are
+ * decompressed into the buffer directly, like with
+ * @ref sqfs_data_reader_get_block_into.
  *
  * @param data A pointer to a data reader object.
  * @param inode A pointer to the inode describing the file.
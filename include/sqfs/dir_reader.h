@@ -50,8 +50,64 @@
  *
  * The reader also abstracts easy access to the underlying inodes, allowing
  * direct access to the inode referred to by a directory entry.
+ *
+ * Optionally, the reader can remember the outcome of path component lookups
+ * done by @ref sqfs_dir_reader_find_by_path, including names that were not
+ * found, so that resolving many paths with a common prefix does not walk
+ * the same directories over and over again. The cache is bounded in size
+ * and owned by the reader, a copy created through @ref sqfs_copy starts
+ * out with an empty cache of its own.
  */
 
+/**
+ * @struct sqfs_dir_reader_stats_t
+ *
+ * @brief Collects run time statistics of the @ref sqfs_dir_reader_t
+ *        path lookup cache.
+ */
+struct sqfs_dir_reader_stats_t {
+	/**
+	 * @brief Holds the size of the structure.
+	 *
+	 * If a later version of libsquashfs expands this structure, the value
+	 * of this field can be used to check at runtime whether the newer
+	 * fields are avaialable or not.
+	 */
+	size_t size;
+
+	/**
+	 * @brief Number of path components resolved from the cache.
+	 */
+	sqfs_u64 hits;
+
+	/**
+	 * @brief Number of path components found in the cache to not exist.
+	 */
+	sqfs_u64 negative_hits;
+
+	/**
+	 * @brief Number of path components that had to be looked up in
+	 *        the directory listing.
+	 */
+	sqfs_u64 misses;
+
+	/**
+	 * @brief Number of entries removed from the cache to make
+	 *        room for others.
+	 */
+	sqfs_u64 evictions;
+
+	/**
+	 * @brief Number of entries currently held in the cache.
+	 */
+	sqfs_u64 cached_entries;
+
+	/**
+	 * @brief Number of bytes of memory currently used by cached entries.
+	 */
+	sqfs_u64 cached_bytes;
+};
+
 /**
  * @enum SQFS_TREE_FILTER_FLAGS
  *
@@ -105,6 +161,24 @@ typedef enum {
 	SQFS_TREE_ALL_FLAGS = 0x7F,
 } SQFS_TREE_FILTER_FLAGS;
 
+/**
+ * @enum SQFS_DIR_LISTING_FLAGS
+ *
+ * @brief Flags for @ref sqfs_dir_reader_read_all
+ */
+typedef enum {
+	/**
+	 * @brief Return the entries in the order in which their inodes are
+	 *        stored on disk, instead of sorted by name.
+	 *
+	 * The inodes are read in this order in any case, so they are
+	 * read sequentially.
+	 */
+	SQFS_DIR_LISTING_SORT_INODES = 0x01,
+
+	SQFS_DIR_LISTING_ALL_FLAGS = 0x01,
+} SQFS_DIR_LISTING_FLAGS;
+
 /**
  * @struct sqfs_tree_node_t
  *
@@ -148,6 +222,64 @@ struct sqfs_tree_node_t {
 	sqfs_u8 name[];
 };
 
+/**
+ * @struct sqfs_dir_node_t
+ *
+ * @brief A directory entry and its inode, as returned by
+ *        @ref sqfs_dir_reader_read_all.
+ */
+struct sqfs_dir_node_t {
+	/**
+	 * @brief The decoded inode the entry refers to.
+	 */
+	sqfs_inode_generic_t *inode;
+
+	/**
+	 * @brief The location of the inode in the inode table.
+	 *
+	 * The upper 48 bits are the location of the meta data block relative
+	 * to the start of the inode table, the lower 16 bits are the offset
+	 * into the uncompressed block.
+	 */
+	sqfs_u64 inode_ref;
+
+	/**
+	 * @brief The inode number stored in the directory entry.
+	 */
+	sqfs_u32 inode_number;
+
+	/**
+	 * @brief The basic @ref SQFS_INODE_TYPE from the directory entry.
+	 */
+	sqfs_u16 type;
+
+	/**
+	 * @brief null-terminated entry name.
+	 */
+	sqfs_u8 name[];
+};
+
+/**
+ * @struct sqfs_dir_listing_t
+ *
+ * @brief The entire contents of a directory, as returned by
+ *        @ref sqfs_dir_reader_read_all.
+ *
+ * The listing, the entries, their names and inodes are all stored in a
+ * single allocation that can be freed with a single free call.
+ */
+struct sqfs_dir_listing_t {
+	/**
+	 * @brief The number of entries in the directory.
+	 */
+	size_t count;
+
+	/**
+	 * @brief An array of pointers to the entries.
+	 */
+	sqfs_dir_node_t **entries;
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -168,6 +300,72 @@ SQFS_API sqfs_dir_reader_t *sqfs_dir_reader_create(const sqfs_super_t *super,
 						   sqfs_compressor_t *cmp,
 						   sqfs_file_t *file);
 
+/**
+ * @brief Attach a meta data block cache to a directory reader.
+ *
+ * @memberof sqfs_dir_reader_t
+ *
+ * The cache is used for both the inode and the directory table. Copies of
+ * the reader share the same cache. The reader does not take ownership of
+ * the cache.
+ *
+ * @param rd A pointer to a directory reader.
+ * @param cache A pointer to a meta data cache, or NULL to stop using one.
+ */
+SQFS_API void sqfs_dir_reader_set_cache(sqfs_dir_reader_t *rd,
+					sqfs_meta_cache_t *cache);
+
+/**
+ * @brief Load the entire inode and directory tables into memory.
+ *
+ * @memberof sqfs_dir_reader_t
+ *
+ * This is intended for programs that are going to walk the entire
+ * filesystem tree anyway. Each table is read from disk in one go and
+ * uncompressed in memory, see @ref sqfs_meta_reader_preload. Tables that
+ * are too large for the memory limit are read on demand as usual.
+ *
+ * @param rd A pointer to a directory reader.
+ * @param max_size The maximum amount of memory to use for each of the
+ *                 uncompressed tables.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure,
+ *         @ref SQFS_ERROR_OVERFLOW if at least one of the tables did not
+ *         fit into the memory limit. In that case, the directory reader can
+ *         still be used as usual.
+ */
+SQFS_API int sqfs_dir_reader_preload(sqfs_dir_reader_t *rd, size_t max_size);
+
+/**
+ * @brief Set the maximum amount of memory used for cached path lookups.
+ *
+ * @memberof sqfs_dir_reader_t
+ *
+ * The cache is disabled by default. If the limit is lowered, the least
+ * recently used entries are dropped immediately, a size of zero disables
+ * the cache again and frees all entries.
+ *
+ * @param rd A pointer to a directory reader.
+ * @param size The maximum number of bytes to use for cached entries.
+ *
+ * @return Zero on succcess, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_dir_reader_set_dentry_cache_size(sqfs_dir_reader_t *rd,
+						   size_t size);
+
+/**
+ * @brief Get access to the path lookup cache statistics of a
+ *        directory reader.
+ *
+ * @memberof sqfs_dir_reader_t
+ *
+ * @param rd A pointer to a directory reader.
+ *
+ * @return A pointer to the internal statistics counters.
+ */
+SQFS_API const sqfs_dir_reader_stats_t
+*sqfs_dir_reader_get_stats(const sqfs_dir_reader_t *rd);
+
 /**
  * @brief Navigate a directory reader to the location of a directory
  *        represented by an inode.
@@ -235,6 +433,29 @@ SQFS_API int sqfs_dir_reader_find(sqfs_dir_reader_t *rd, const char *name);
 SQFS_API int sqfs_dir_reader_read(sqfs_dir_reader_t *rd,
 				  sqfs_dir_entry_t **out);
 
+/**
+ * @brief Read an entire directory, including the inodes of all entries.
+ *
+ * @memberof sqfs_dir_reader_t
+ *
+ * This function rewinds the currently open directory and decodes all of its
+ * entries and the inodes they refer to into one block of memory. Compared to
+ * calling @ref sqfs_dir_reader_read and @ref sqfs_dir_reader_get_inode for
+ * every entry, this saves two allocations per entry, and the inodes are read
+ * in the order of their location on disk. Afterwards, the reader is at the
+ * end of the directory.
+ *
+ * @param rd A pointer to a directory reader.
+ * @param flags A combination of @ref SQFS_DIR_LISTING_FLAGS.
+ * @param out Returns a pointer to the listing that can be freed with a
+ *            single free call.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_dir_reader_read_all(sqfs_dir_reader_t *rd,
+				      sqfs_u32 flags,
+				      sqfs_dir_listing_t **out);
+
 /**
  * @brief Read the inode that the current directory entry points to.
  *
@@ -269,6 +490,11 @@ SQFS_API int sqfs_dir_reader_get_root_inode(sqfs_dir_reader_t *rd,
  *
  * @memberof sqfs_dir_reader_t
  *
+ * If the path lookup cache is enabled through
+ * @ref sqfs_dir_reader_set_dentry_cache_size, components found there are not
+ * looked up again. Afterwards, the position of the reader in the currently
+ * open directory is unspecified.
+ *
  * @param rd A pointer to a directory reader.
  * @param start If not NULL, path traversal starts at this node downwards. If
  *              set to NULL, start at the root node.
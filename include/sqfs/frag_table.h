@@ -160,13 +160,14 @@ SQFS_API size_t sqfs_frag_table_get_size(sqfs_frag_table_t *tbl);
  *              fragment block.
  * @param offset A byte offset into the actual fragment block itself.
  * @param size The size of the tail en inside the fragment block.
- * @param hash An arbitrary 32 bit data hash to memorize.
+ * @param hash An arbitrary 64 bit data hash to memorize. If a chunk with
+ *             the same hash and size is already known, it is replaced.
  *
  * @return Zero on success, an @ref SQFS_ERROR on faiure.
  */
 SQFS_API int sqfs_frag_table_add_tail_end(sqfs_frag_table_t *tbl,
 					  sqfs_u32 index, sqfs_u32 offset,
-					  sqfs_u32 size, sqfs_u32 hash);
+					  sqfs_u32 size, sqfs_u64 hash);
 
 /**
  * @brief RFetch a fragment block index and offset by hash and size
@@ -177,7 +178,7 @@ SQFS_API int sqfs_frag_table_add_tail_end(sqfs_frag_table_t *tbl,
  * memorized using @ref sqfs_frag_table_add_tail_end.
  *
  * @param tbl A pointer to the fragmen table object.
- * @param hash An arbitrary 32 bit data hash that describes the chunk.
+ * @param hash An arbitrary 64 bit data hash that describes the chunk.
  * @param size The size of the chunk to look for.
  * @param index Returns an index into the fragment table on success.
  * @param offset Returns a byte offset into the fragment block on success.
@@ -185,7 +186,7 @@ SQFS_API int sqfs_frag_table_add_tail_end(sqfs_frag_table_t *tbl,
  * @return Zero on success, non-zero if the chunk could not be found.
  */
 SQFS_API int sqfs_frag_table_find_tail_end(sqfs_frag_table_t *tbl,
-					   sqfs_u32 hash, sqfs_u32 size,
+					   sqfs_u64 hash, sqfs_u32 size,
 					   sqfs_u32 *index, sqfs_u32 *offset);
 
 #ifdef __cplusplus
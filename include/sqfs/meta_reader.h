@@ -47,6 +47,69 @@
  * from disk and reading transparently across block boarders if required.
  */
 
+/**
+ * @struct sqfs_meta_cache_t
+ *
+ * @implements sqfs_object_t
+ *
+ * @brief A size bounded cache of uncompressed meta data blocks.
+ *
+ * A meta data cache can be attached to any number of meta data readers that
+ * read from the same image, including the ones used internally by the
+ * @ref sqfs_dir_reader_t and @ref sqfs_xattr_reader_t. Blocks are looked up
+ * by their absolute on-disk location, so a block that was decompressed by one
+ * reader can be used by all of them, and seeking back to a recently used
+ * block does not require decompressing it again. If the cache is full, the
+ * least recently used blocks are dropped.
+ *
+ * The cache does no locking. All readers sharing one must be used from the
+ * same thread, and the cache must outlive them.
+ */
+
+/**
+ * @struct sqfs_meta_cache_stats_t
+ *
+ * @brief Collects run time statistics of a @ref sqfs_meta_cache_t.
+ */
+struct sqfs_meta_cache_stats_t {
+	/**
+	 * @brief Holds the size of the structure.
+	 *
+	 * If a later version of libsquashfs expands this structure, the value
+	 * of this field can be used to check at runtime whether the newer
+	 * fields are avaialable or not.
+	 */
+	size_t size;
+
+	/**
+	 * @brief Number of block seeks served from the cache.
+	 */
+	sqfs_u64 hits;
+
+	/**
+	 * @brief Number of block seeks that had to read and decompress
+	 *        the block from disk.
+	 */
+	sqfs_u64 misses;
+
+	/**
+	 * @brief Number of blocks removed from the cache to make
+	 *        room for others.
+	 */
+	sqfs_u64 evictions;
+
+	/**
+	 * @brief Number of blocks currently held in the cache.
+	 */
+	sqfs_u64 cached_blocks;
+
+	/**
+	 * @brief Number of bytes of memory currently used by cached blocks,
+	 *        including book keeping overhead.
+	 */
+	sqfs_u64 cached_bytes;
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -71,6 +134,74 @@ SQFS_API sqfs_meta_reader_t *sqfs_meta_reader_create(sqfs_file_t *file,
 						     sqfs_u64 start,
 						     sqfs_u64 limit);
 
+/**
+ * @brief Create a meta data block cache.
+ *
+ * @memberof sqfs_meta_cache_t
+ *
+ * @param max_size The maximum number of bytes of memory to use for cached
+ *                 blocks, including book keeping. The block accessed last
+ *                 is always kept, even if it alone exceeds the limit.
+ *
+ * @return A pointer to a meta data cache on success, NULL on
+ *         allocation failure.
+ */
+SQFS_API sqfs_meta_cache_t *sqfs_meta_cache_create(size_t max_size);
+
+/**
+ * @brief Get access to the statistics of a meta data cache.
+ *
+ * @memberof sqfs_meta_cache_t
+ *
+ * @param cache A pointer to a meta data cache.
+ *
+ * @return A pointer to the internal statistics counters.
+ */
+SQFS_API const sqfs_meta_cache_stats_t
+*sqfs_meta_cache_get_stats(const sqfs_meta_cache_t *cache);
+
+/**
+ * @brief Attach a meta data block cache to a meta data reader.
+ *
+ * @memberof sqfs_meta_reader_t
+ *
+ * Copies of the reader share the same cache. The reader does not take
+ * ownership of the cache.
+ *
+ * @param m A pointer to a meta data reader.
+ * @param cache A pointer to a meta data cache, or NULL to stop using one.
+ */
+SQFS_API void sqfs_meta_reader_set_cache(sqfs_meta_reader_t *m,
+					 sqfs_meta_cache_t *cache);
+
+/**
+ * @brief Load all meta data blocks between the start and limit of a meta
+ *        data reader into memory.
+ *
+ * @memberof sqfs_meta_reader_t
+ *
+ * The whole range is read from disk in one go and all blocks are
+ * uncompressed back to back into a single buffer. After that, seeking to
+ * any of them is a simple memory lookup. Locations that are not the start
+ * of a loaded block, e.g. blocks that failed to decompress, are still read
+ * from disk as usual.
+ *
+ * This is only useful if the range contains nothing but meta data blocks
+ * and most of them are going to be read, e.g. when walking the inode table
+ * of an entire image.
+ *
+ * @param m A pointer to a meta data reader.
+ * @param max_size The maximum amount of memory to use for the uncompressed
+ *                 blocks.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure,
+ *         @ref SQFS_ERROR_OVERFLOW if the range would not fit into the
+ *         memory limit. In that case, the meta data reader can still be
+ *         used as usual.
+ */
+SQFS_API int sqfs_meta_reader_preload(sqfs_meta_reader_t *m,
+				      size_t max_size);
+
 /**
  * @brief Seek to a specific meta data block and offset.
  *
@@ -74,16 +74,21 @@ typedef int32_t sqfs_s32;
 typedef int64_t sqfs_s64;
 
 typedef struct sqfs_block_processor_t sqfs_block_processor_t;
+typedef struct sqfs_block_processor_file_t sqfs_block_processor_file_t;
 typedef struct sqfs_compressor_config_t sqfs_compressor_config_t;
 typedef struct sqfs_compressor_t sqfs_compressor_t;
+typedef struct sqfs_compressor_stats_t sqfs_compressor_stats_t;
 typedef struct sqfs_dir_writer_t sqfs_dir_writer_t;
 typedef struct sqfs_dir_reader_t sqfs_dir_reader_t;
 typedef struct sqfs_id_table_t sqfs_id_table_t;
 typedef struct sqfs_meta_reader_t sqfs_meta_reader_t;
+typedef struct sqfs_meta_cache_t sqfs_meta_cache_t;
 typedef struct sqfs_meta_writer_t sqfs_meta_writer_t;
 typedef struct sqfs_xattr_reader_t sqfs_xattr_reader_t;
 typedef struct sqfs_file_t sqfs_file_t;
 typedef struct sqfs_tree_node_t sqfs_tree_node_t;
+typedef struct sqfs_dir_node_t sqfs_dir_node_t;
+typedef struct sqfs_dir_listing_t sqfs_dir_listing_t;
 typedef struct sqfs_data_reader_t sqfs_data_reader_t;
 typedef struct sqfs_block_hooks_t sqfs_block_hooks_t;
 typedef struct sqfs_xattr_writer_t sqfs_xattr_writer_t;
@@ -91,6 +96,10 @@ typedef struct sqfs_frag_table_t sqfs_frag_table_t;
 typedef struct sqfs_block_writer_t sqfs_block_writer_t;
 typedef struct sqfs_block_writer_stats_t sqfs_block_writer_stats_t;
 typedef struct sqfs_block_processor_stats_t sqfs_block_processor_stats_t;
+typedef struct sqfs_block_processor_desc_t sqfs_block_processor_desc_t;
+typedef struct sqfs_data_reader_stats_t sqfs_data_reader_stats_t;
+typedef struct sqfs_meta_cache_stats_t sqfs_meta_cache_stats_t;
+typedef struct sqfs_dir_reader_stats_t sqfs_dir_reader_stats_t;
 
 typedef struct sqfs_fragment_t sqfs_fragment_t;
 typedef struct sqfs_dir_header_t sqfs_dir_header_t;
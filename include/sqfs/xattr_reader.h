@@ -111,6 +111,20 @@ SQFS_API int sqfs_xattr_reader_load(sqfs_xattr_reader_t *xr,
 				    const sqfs_super_t *super,
 				    sqfs_file_t *file, sqfs_compressor_t *cmp);
 
+/**
+ * @brief Attach a meta data block cache to an xattr reader.
+ *
+ * @memberof sqfs_xattr_reader_t
+ *
+ * The setting is kept if the tables are loaded again. Copies of the reader
+ * share the same cache. The reader does not take ownership of the cache.
+ *
+ * @param xr A pointer to an xattr reader instance.
+ * @param cache A pointer to a meta data cache, or NULL to stop using one.
+ */
+SQFS_API void sqfs_xattr_reader_set_cache(sqfs_xattr_reader_t *xr,
+					  sqfs_meta_cache_t *cache);
+
 /**
  * @brief Resolve an xattr index from an inode to an xattr description
  *
@@ -30,4 +30,9 @@ void *alloc_array(size_t item_size, size_t nmemb);
 
 SQFS_INTERNAL sqfs_u32 xxh32(const void *input, const size_t len);
 
+SQFS_INTERNAL sqfs_u64 xxh64(const void *input, const size_t len);
+
+/* XXH3 with 64 bit output, much faster than xxh64 on larger inputs */
+SQFS_INTERNAL sqfs_u64 xxh3_64(const void *input, const size_t len);
+
 #endif /* SQFS_UTIL_H */
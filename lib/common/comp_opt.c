@@ -33,6 +33,29 @@ static const flag_t xz_flags[] = {
 	{ "sparc", SQFS_COMP_FLAG_XZ_SPARC },
 };
 
+static const char *zstd_strategies[] = {
+	[SQFS_ZSTD_FAST] = "fast",
+	[SQFS_ZSTD_DFAST] = "dfast",
+	[SQFS_ZSTD_GREEDY] = "greedy",
+	[SQFS_ZSTD_LAZY] = "lazy",
+	[SQFS_ZSTD_LAZY2] = "lazy2",
+	[SQFS_ZSTD_BTLAZY2] = "btlazy2",
+	[SQFS_ZSTD_BTOPT] = "btopt",
+	[SQFS_ZSTD_BTULTRA] = "btultra",
+	[SQFS_ZSTD_BTULTRA2] = "btultra2",
+};
+
+static const char *gzip_search[] = {
+	[SQFS_GZIP_SEARCH_FULL] = "full",
+	[SQFS_GZIP_SEARCH_SAMPLE] = "sample",
+};
+
+static const char *xz_select[] = {
+	[SQFS_XZ_SELECT_BEST] = "best",
+	[SQFS_XZ_SELECT_GUESS] = "guess",
+	[SQFS_XZ_SELECT_GUESS_VERIFY] = "verify",
+};
+
 static const flag_t lz4_flags[] = {
 	{ "hc", SQFS_COMP_FLAG_LZ4_HC },
 };
@@ -74,17 +97,88 @@ static int find_lzo_alg(sqfs_compressor_config_t *cfg, const char *name)
 	return -1;
 }
 
+static int find_zstd_strategy(sqfs_compressor_config_t *cfg, const char *name)
+{
+	size_t i;
+
+	for (i = SQFS_ZSTD_FAST; i <= SQFS_ZSTD_BTULTRA2; ++i) {
+		if (strcmp(zstd_strategies[i], name) == 0) {
+			cfg->opt.zstd.strategy = i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static int find_gzip_search(sqfs_compressor_config_t *cfg, const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(gzip_search) / sizeof(gzip_search[0]); ++i) {
+		if (strcmp(gzip_search[i], name) == 0) {
+			cfg->opt.gzip.strategy_search = i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static int find_xz_select(sqfs_compressor_config_t *cfg, const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(xz_select) / sizeof(xz_select[0]); ++i) {
+		if (strcmp(xz_select[i], name) == 0) {
+			cfg->opt.xz.filter_select = i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/*
+  The higher levels are only available if libsquashfs uses libdeflate, the
+  strategies and smaller windows only if it uses zlib.
+ */
+static bool is_gzip_supported(size_t block_size, sqfs_u16 flags,
+			      size_t level, size_t window)
+{
+	sqfs_compressor_config_t cfg;
+	sqfs_compressor_t *cmp;
+
+	sqfs_compressor_config_init(&cfg, SQFS_COMP_GZIP, block_size, flags);
+	cfg.opt.gzip.level = level;
+	cfg.opt.gzip.window_size = window;
+
+	if (sqfs_compressor_create(&cfg, &cmp))
+		return false;
+
+	sqfs_destroy(cmp);
+	return true;
+}
+
 enum {
 	OPT_WINDOW = 0,
 	OPT_LEVEL,
 	OPT_ALG,
 	OPT_DICT,
+	OPT_SELECT,
+	OPT_SEARCH,
+	OPT_STRATEGY,
+	OPT_MINMATCH,
 };
 static char *const token[] = {
 	[OPT_WINDOW] = (char *)"window",
 	[OPT_LEVEL] = (char *)"level",
 	[OPT_ALG] = (char *)"algorithm",
 	[OPT_DICT] = (char *)"dictsize",
+	[OPT_SELECT] = (char *)"select",
+	[OPT_SEARCH] = (char *)"search",
+	[OPT_STRATEGY] = (char *)"strategy",
+	[OPT_MINMATCH] = (char *)"minmatch",
 	NULL
 };
 
@@ -93,6 +187,7 @@ int compressor_cfg_init_options(sqfs_compressor_config_t *cfg,
 				size_t block_size, char *options)
 {
 	size_t num_flags = 0, min_level = 0, max_level = 0, level, dict_size;
+	size_t min_window = 0, max_window = 0, window;
 	const flag_t *flags = NULL;
 	char *subopts, *value;
 	int i, opt;
@@ -106,7 +201,9 @@ int compressor_cfg_init_options(sqfs_compressor_config_t *cfg,
 	switch (cfg->id) {
 	case SQFS_COMP_GZIP:
 		min_level = SQFS_GZIP_MIN_LEVEL;
-		max_level = SQFS_GZIP_MAX_LEVEL;
+		max_level = SQFS_GZIP_MAX_LEVEL_EXT;
+		min_window = SQFS_GZIP_MIN_WINDOW;
+		max_window = SQFS_GZIP_MAX_WINDOW;
 		flags = gzip_flags;
 		num_flags = sizeof(gzip_flags) / sizeof(gzip_flags[0]);
 		break;
@@ -117,6 +214,12 @@ int compressor_cfg_init_options(sqfs_compressor_config_t *cfg,
 	case SQFS_COMP_ZSTD:
 		min_level = SQFS_ZSTD_MIN_LEVEL;
 		max_level = SQFS_ZSTD_MAX_LEVEL;
+		min_window = SQFS_ZSTD_MIN_WINDOW;
+
+		/* no point in looking back further than one block */
+		for (max_window = min_window;
+		     ((size_t)1 << max_window) < block_size; ++max_window)
+			;
 		break;
 	case SQFS_COMP_XZ:
 		flags = xz_flags;
@@ -137,7 +240,8 @@ int compressor_cfg_init_options(sqfs_compressor_config_t *cfg,
 
 		switch (opt) {
 		case OPT_WINDOW:
-			if (cfg->id != SQFS_COMP_GZIP)
+			if (cfg->id != SQFS_COMP_GZIP &&
+			    cfg->id != SQFS_COMP_ZSTD)
 				goto fail_opt;
 
 			if (value == NULL)
@@ -149,11 +253,42 @@ int compressor_cfg_init_options(sqfs_compressor_config_t *cfg,
 			if (i < 1 || i > 3 || value[i] != '\0')
 				goto fail_window;
 
-			cfg->opt.gzip.window_size = atoi(value);
+			window = atoi(value);
 
-			if (cfg->opt.gzip.window_size < SQFS_GZIP_MIN_WINDOW ||
-			    cfg->opt.gzip.window_size > SQFS_GZIP_MAX_WINDOW)
+			if (window < min_window || window > max_window)
 				goto fail_window;
+
+			if (cfg->id == SQFS_COMP_GZIP) {
+				cfg->opt.gzip.window_size = window;
+			} else {
+				cfg->opt.zstd.window_log = window;
+			}
+			break;
+		case OPT_STRATEGY:
+			if (cfg->id != SQFS_COMP_ZSTD)
+				goto fail_opt;
+
+			if (value == NULL)
+				goto fail_value;
+
+			if (find_zstd_strategy(cfg, value))
+				goto fail_zstd_strategy;
+			break;
+		case OPT_MINMATCH:
+			if (cfg->id != SQFS_COMP_ZSTD)
+				goto fail_opt;
+
+			if (value == NULL)
+				goto fail_value;
+
+			if (!isdigit(value[0]) || value[1] != '\0')
+				goto fail_minmatch;
+
+			cfg->opt.zstd.min_match = atoi(value);
+
+			if (cfg->opt.zstd.min_match < SQFS_ZSTD_MIN_MATCH ||
+			    cfg->opt.zstd.min_match > SQFS_ZSTD_MAX_MATCH)
+				goto fail_minmatch;
 			break;
 		case OPT_LEVEL:
 			if (value == NULL)
@@ -208,6 +343,26 @@ int compressor_cfg_init_options(sqfs_compressor_config_t *cfg,
 
 			cfg->opt.xz.dict_size = dict_size;
 			break;
+		case OPT_SELECT:
+			if (cfg->id != SQFS_COMP_XZ)
+				goto fail_opt;
+
+			if (value == NULL)
+				goto fail_value;
+
+			if (find_xz_select(cfg, value))
+				goto fail_xz_select;
+			break;
+		case OPT_SEARCH:
+			if (cfg->id != SQFS_COMP_GZIP)
+				goto fail_opt;
+
+			if (value == NULL)
+				goto fail_value;
+
+			if (find_gzip_search(cfg, value))
+				goto fail_gzip_search;
+			break;
 		default:
 			if (set_flag(cfg, value, flags, num_flags))
 				goto fail_opt;
@@ -215,12 +370,50 @@ int compressor_cfg_init_options(sqfs_compressor_config_t *cfg,
 		}
 	}
 
+	if (cfg->id == SQFS_COMP_GZIP &&
+	    cfg->opt.gzip.level > SQFS_GZIP_MAX_LEVEL &&
+	    !is_gzip_supported(block_size, 0, cfg->opt.gzip.level,
+			       SQFS_GZIP_DEFAULT_WINDOW)) {
+		fprintf(stderr, "gzip compression levels above %d require "
+			"libsquashfs to be built with libdeflate.\n",
+			SQFS_GZIP_MAX_LEVEL);
+		return -1;
+	}
+
+	if (cfg->id == SQFS_COMP_GZIP &&
+	    ((cfg->flags & SQFS_COMP_FLAG_GZIP_ALL) != 0 ||
+	     cfg->opt.gzip.window_size != SQFS_GZIP_MAX_WINDOW) &&
+	    !is_gzip_supported(block_size,
+			       cfg->flags & SQFS_COMP_FLAG_GZIP_ALL,
+			       SQFS_GZIP_DEFAULT_LEVEL,
+			       cfg->opt.gzip.window_size)) {
+		fprintf(stderr, "gzip strategies and window sizes other than "
+			"%d are not available if libsquashfs is built with "
+			"libdeflate.\n", SQFS_GZIP_MAX_WINDOW);
+		return -1;
+	}
+
 	return 0;
 fail_lzo_alg:
 	fprintf(stderr, "Unknown lzo variant '%s'.\n", value);
 	return -1;
+fail_gzip_search:
+	fprintf(stderr, "Unknown gzip strategy search '%s'.\n", value);
+	return -1;
+fail_xz_select:
+	fprintf(stderr, "Unknown xz filter selection '%s'.\n", value);
+	return -1;
+fail_zstd_strategy:
+	fprintf(stderr, "Unknown zstd strategy '%s'.\n", value);
+	return -1;
+fail_minmatch:
+	fprintf(stderr, "Minimum match length must be a number between %d "
+		"and %d.\n", SQFS_ZSTD_MIN_MATCH, SQFS_ZSTD_MAX_MATCH);
+	return -1;
 fail_window:
-	fputs("Window size must be a number between 8 and 15.\n", stderr);
+	fprintf(stderr,
+		"Window size must be a number between " PRI_SZ " and "
+		PRI_SZ ".\n", min_window, max_window);
 	return -1;
 fail_level:
 	fprintf(stderr,
@@ -236,6 +429,36 @@ fail_value:
 	return -1;
 }
 
+const char *compressor_flag_name(SQFS_COMPRESSOR id, sqfs_u16 flag)
+{
+	const flag_t *flags;
+	size_t i, count;
+
+	switch (id) {
+	case SQFS_COMP_GZIP:
+		flags = gzip_flags;
+		count = sizeof(gzip_flags) / sizeof(gzip_flags[0]);
+		break;
+	case SQFS_COMP_XZ:
+		flags = xz_flags;
+		count = sizeof(xz_flags) / sizeof(xz_flags[0]);
+		break;
+	case SQFS_COMP_LZ4:
+		flags = lz4_flags;
+		count = sizeof(lz4_flags) / sizeof(lz4_flags[0]);
+		break;
+	default:
+		return NULL;
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (flags[i].flag == flag)
+			return flags[i].name;
+	}
+
+	return NULL;
+}
+
 typedef void (*compressor_help_fun_t)(void);
 
 static void gzip_print_help(void)
@@ -245,17 +468,25 @@ static void gzip_print_help(void)
 	printf(
 "Available options for gzip compressor:\n"
 "\n"
-"    level=<value>    Compression level. Value from 1 to 9.\n"
-"                     Defaults to %d.\n"
+"    level=<value>    Compression level. Value from 1 to 9, or up to %d\n"
+"                     if libsquashfs uses libdeflate. Levels above 9 are\n"
+"                     recorded as 9 in the image. Defaults to %d.\n"
 "    window=<size>    Deflate compression window size. Value from 8 to 15.\n"
-"                     Defaults to %d.\n"
+"                     Defaults to %d. If libsquashfs uses libdeflate,\n"
+"                     only %d is supported.\n"
+"    search=<mode>    How to choose between multiple strategies: 'full'\n"
+"                     compresses each block with every strategy, 'sample'\n"
+"                     only tries them on the first 16k of a block.\n"
+"                     Defaults to 'full'.\n"
 "\n"
 "In additon to the options, one or more strategies can be specified.\n"
 "If multiple stratgies are provided, the one yielding the best compression\n"
-"ratio will be used.\n"
+"ratio will be used. Strategies are not available if libsquashfs uses\n"
+"libdeflate.\n"
 "\n"
 "The following strategies are available:\n",
-	SQFS_GZIP_DEFAULT_LEVEL, SQFS_GZIP_DEFAULT_WINDOW);
+	SQFS_GZIP_MAX_LEVEL_EXT, SQFS_GZIP_DEFAULT_LEVEL,
+	SQFS_GZIP_DEFAULT_WINDOW, SQFS_GZIP_MAX_WINDOW);
 
 	for (i = 0; i < sizeof(gzip_flags) / sizeof(gzip_flags[0]); ++i)
 		printf("\t%s\n", gzip_flags[i].name);
@@ -302,10 +533,17 @@ static void xz_print_help(void)
 "                      The suffix '%' indicates a percentage. 'K' and 'M'\n"
 "                      can also be used for kibi and mebi bytes\n"
 "                      respecitively.\n"
+"    select=<mode>     How to choose between multiple bcj filters:\n"
+"                      'best' compresses each block with every filter\n"
+"                      and keeps the smallest result. 'guess' looks for\n"
+"                      executable headers and branch instructions and only\n"
+"                      compresses with the most likely filter. 'verify'\n"
+"                      also tries the second most likely choice.\n"
+"                      Defaults to 'best'.\n"
 "\n"
 "In additon to the options, one or more bcj filters can be specified.\n"
-"If multiple filters are provided, the one yielding the best compression\n"
-"ratio will be used.\n"
+"If multiple filters are provided, the 'select' option decides which one\n"
+"is used for a block.\n"
 "\n"
 "The following filters are available:\n",
 	stdout);
@@ -316,12 +554,28 @@ static void xz_print_help(void)
 
 static void zstd_print_help(void)
 {
+	size_t i;
+
 	printf("Available options for zstd compressor:\n"
 	       "\n"
 	       "    level=<value>    Set compression level. Defaults to %d.\n"
 	       "                     Maximum is %d.\n"
-	       "\n",
-	       SQFS_ZSTD_DEFAULT_LEVEL, SQFS_ZSTD_MAX_LEVEL);
+	       "    window=<size>    Base 2 logarithm of the match window\n"
+	       "                     size. At least %d, at most enough to\n"
+	       "                     cover a block. Defaults to a value based\n"
+	       "                     on the compression level.\n"
+	       "    strategy=<name>  Match finder strategy. Defaults to one\n"
+	       "                     based on the compression level.\n"
+	       "    minmatch=<value> Minimum match length, from %d to %d.\n"
+	       "                     Defaults to a value based on the\n"
+	       "                     compression level.\n"
+	       "\n"
+	       "Available strategies, from fastest to strongest:\n",
+	       SQFS_ZSTD_DEFAULT_LEVEL, SQFS_ZSTD_MAX_LEVEL,
+	       SQFS_ZSTD_MIN_WINDOW, SQFS_ZSTD_MIN_MATCH, SQFS_ZSTD_MAX_MATCH);
+
+	for (i = SQFS_ZSTD_FAST; i <= SQFS_ZSTD_BTULTRA2; ++i)
+		printf("\t%s\n", zstd_strategies[i]);
 }
 
 static const compressor_help_fun_t helpfuns[SQFS_COMP_MAX + 1] = {
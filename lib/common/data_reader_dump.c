@@ -40,8 +40,9 @@ int sqfs_data_reader_dump(const char *name, sqfs_data_reader_t *data,
 			  FILE *fp, size_t block_size, bool allow_sparse)
 {
 	size_t i, diff, chunk_size;
+	const sqfs_u8 *frag;
+	sqfs_u8 *chunk = NULL;
 	sqfs_u64 filesz;
-	sqfs_u8 *chunk;
 	int err;
 
 	sqfs_inode_get_file_size(inode, &filesz);
@@ -64,41 +65,49 @@ int sqfs_data_reader_dump(const char *name, sqfs_data_reader_t *data,
 			if (fseek(fp, diff, SEEK_CUR) < 0)
 				goto fail_sparse;
 		} else {
-			err = sqfs_data_reader_get_block(data, inode, i,
-							 &chunk_size, &chunk);
+			if (chunk == NULL) {
+				chunk = malloc(block_size);
+				if (chunk == NULL) {
+					perror(name);
+					return -1;
+				}
+			}
+
+			err = sqfs_data_reader_get_block_into(data, inode, i,
+							      chunk, block_size,
+							      &chunk_size);
 			if (err) {
 				sqfs_perror(name, "reading data block", err);
-				return -1;
+				goto fail;
 			}
 
-			err = append_block(fp, chunk, chunk_size);
-			free(chunk);
-
-			if (err)
-				return -1;
+			if (append_block(fp, chunk, chunk_size))
+				goto fail;
 		}
 
 		filesz -= diff;
 	}
 
+	free(chunk);
+
 	if (filesz > 0) {
-		err = sqfs_data_reader_get_fragment(data, inode,
-						    &chunk_size, &chunk);
+		err = sqfs_data_reader_borrow_fragment(data, inode,
+						       &chunk_size, &frag);
 		if (err) {
 			sqfs_perror(name, "reading fragment block", err);
 			return -1;
 		}
 
-		if (append_block(fp, chunk, chunk_size)) {
-			free(chunk);
+		if (append_block(fp, frag, chunk_size))
 			return -1;
-		}
-
-		free(chunk);
 	}
 
 	return 0;
 fail_sparse:
+	free(chunk);
 	perror("creating sparse output file");
 	return -1;
+fail:
+	free(chunk);
+	return -1;
 }
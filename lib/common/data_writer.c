@@ -8,27 +8,18 @@
 
 static sqfs_u8 buffer[4096];
 
-int write_data_from_file(const char *filename, sqfs_block_processor_t *data,
-			 sqfs_inode_generic_t **inode, sqfs_file_t *file,
-			 int flags)
+static int append_from_file(const char *filename,
+			    sqfs_block_processor_t *data, sqfs_file_t *file,
+			    sqfs_u64 offset, sqfs_u64 size)
 {
-	sqfs_u64 filesz, offset;
 	size_t diff;
 	int ret;
 
-	ret = sqfs_block_processor_begin_file(data, inode, flags);
-	if (ret) {
-		sqfs_perror(filename, "beginning file data blocks", ret);
-		return -1;
-	}
-
-	filesz = file->get_size(file);
-
-	for (offset = 0; offset < filesz; offset += diff) {
-		if (filesz - offset > sizeof(buffer)) {
+	while (size > 0) {
+		if (size > sizeof(buffer)) {
 			diff = sizeof(buffer);
 		} else {
-			diff = filesz - offset;
+			diff = size;
 		}
 
 		ret = file->read_at(file, offset, buffer, diff);
@@ -42,9 +33,48 @@ int write_data_from_file(const char *filename, sqfs_block_processor_t *data,
 			sqfs_perror(filename, "packing file data", ret);
 			return -1;
 		}
+
+		offset += diff;
+		size -= diff;
+	}
+
+	return 0;
+}
+
+static int append_sparse(const char *filename, sqfs_block_processor_t *data,
+			 sqfs_u64 size)
+{
+	int ret;
+
+	if (size == 0)
+		return 0;
+
+	ret = sqfs_block_processor_append_sparse(data, size);
+	if (ret) {
+		sqfs_perror(filename, "packing sparse file region", ret);
+		return -1;
 	}
 
-	ret = sqfs_block_processor_end_file(data);
+	return 0;
+}
+
+static int begin_file(const char *filename, sqfs_block_processor_t *data,
+		      sqfs_inode_generic_t **inode, int flags)
+{
+	int ret = sqfs_block_processor_begin_file(data, inode, flags);
+
+	if (ret) {
+		sqfs_perror(filename, "beginning file data blocks", ret);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int end_file(const char *filename, sqfs_block_processor_t *data)
+{
+	int ret = sqfs_block_processor_end_file(data);
+
 	if (ret) {
 		sqfs_perror(filename, "finishing file data", ret);
 		return -1;
@@ -52,3 +82,51 @@ int write_data_from_file(const char *filename, sqfs_block_processor_t *data,
 
 	return 0;
 }
+
+int write_data_from_file(const char *filename, sqfs_block_processor_t *data,
+			 sqfs_inode_generic_t **inode, sqfs_file_t *file,
+			 int flags)
+{
+	if (begin_file(filename, data, inode, flags))
+		return -1;
+
+	if (append_from_file(filename, data, file, 0, file->get_size(file)))
+		return -1;
+
+	return end_file(filename, data);
+}
+
+int write_data_from_file_condensed(const char *filename,
+				   sqfs_block_processor_t *data,
+				   sqfs_inode_generic_t **inode,
+				   sqfs_file_t *file, const sparse_map_t *map,
+				   sqfs_u64 filesize, int flags)
+{
+	sqfs_u64 offset = 0, poffset = 0;
+
+	if (begin_file(filename, data, inode, flags))
+		return -1;
+
+	for (; map != NULL; map = map->next) {
+		if (map->offset < offset || map->offset > filesize ||
+		    map->count > filesize - map->offset) {
+			fprintf(stderr, "%s: broken sparse file layout.\n",
+				filename);
+			return -1;
+		}
+
+		if (append_sparse(filename, data, map->offset - offset))
+			return -1;
+
+		if (append_from_file(filename, data, file, poffset, map->count))
+			return -1;
+
+		poffset += map->count;
+		offset = map->offset + map->count;
+	}
+
+	if (append_sparse(filename, data, filesize - offset))
+		return -1;
+
+	return end_file(filename, data);
+}
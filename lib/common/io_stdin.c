@@ -14,10 +14,8 @@
 typedef struct {
 	sqfs_file_t base;
 
-	const sparse_map_t *map;
 	sqfs_u64 offset;
-	sqfs_u64 real_size;
-	sqfs_u64 apparent_size;
+	sqfs_u64 size;
 	FILE *fp;
 } sqfs_file_stdinout_t;
 
@@ -29,7 +27,7 @@ static void stdinout_destroy(sqfs_object_t *base)
 
 static sqfs_u64 stdinout_get_size(const sqfs_file_t *base)
 {
-	return ((const sqfs_file_stdinout_t *)base)->apparent_size;
+	return ((const sqfs_file_stdinout_t *)base)->size;
 }
 
 static int stdinout_truncate(sqfs_file_t *base, sqfs_u64 size)
@@ -55,7 +53,7 @@ static int stdin_read_at(sqfs_file_t *base, sqfs_u64 offset,
 		temp = alloca(temp_size);
 	}
 
-	if (offset >= file->real_size || (offset + size) > file->real_size)
+	if (offset >= file->size || (offset + size) > file->size)
 		return SQFS_ERROR_OUT_OF_BOUNDS;
 
 	while (size > 0) {
@@ -86,60 +84,6 @@ static int stdin_read_at(sqfs_file_t *base, sqfs_u64 offset,
 	return 0;
 }
 
-static int stdin_read_condensed(sqfs_file_t *base, sqfs_u64 offset,
-				void *buffer, size_t size)
-{
-	sqfs_file_stdinout_t *file = (sqfs_file_stdinout_t *)base;
-	sqfs_u64 poffset = 0, src_start;
-	size_t dst_start, diff, count;
-	const sparse_map_t *it;
-	int err;
-
-	memset(buffer, 0, size);
-
-	for (it = file->map; it != NULL; it = it->next) {
-		if (it->offset + it->count <= offset) {
-			poffset += it->count;
-			continue;
-		}
-
-		if (it->offset >= offset + size) {
-			poffset += it->count;
-			continue;
-		}
-
-		count = size;
-
-		if (offset + count >= it->offset + it->count)
-			count = it->offset + it->count - offset;
-
-		if (it->offset < offset) {
-			diff = offset - it->offset;
-
-			src_start = poffset + diff;
-			dst_start = 0;
-			count -= diff;
-		} else if (it->offset > offset) {
-			diff = it->offset - offset;
-
-			src_start = poffset;
-			dst_start = diff;
-		} else {
-			src_start = poffset;
-			dst_start = 0;
-		}
-
-		err = stdin_read_at(base, src_start,
-				    (char *)buffer + dst_start, count);
-		if (err)
-			return err;
-
-		poffset += it->count;
-	}
-
-	return 0;
-}
-
 static int stdin_write_at(sqfs_file_t *base, sqfs_u64 offset,
 			  const void *buffer, size_t size)
 {
@@ -147,36 +91,21 @@ static int stdin_write_at(sqfs_file_t *base, sqfs_u64 offset,
 	return SQFS_ERROR_IO;
 }
 
-sqfs_file_t *sqfs_get_stdin_file(FILE *fp, const sparse_map_t *map,
-				 sqfs_u64 size)
+sqfs_file_t *sqfs_get_stdin_file(FILE *fp, sqfs_u64 size)
 {
 	sqfs_file_stdinout_t *file = calloc(1, sizeof(*file));
 	sqfs_file_t *base = (sqfs_file_t *)file;
-	const sparse_map_t *it;
 
 	if (file == NULL)
 		return NULL;
 
-	file->apparent_size = size;
-	file->map = map;
+	file->size = size;
 	file->fp = fp;
 
-	if (map != NULL) {
-		for (it = map; it != NULL; it = it->next)
-			file->real_size += map->count;
-	} else {
-		file->real_size = size;
-	}
-
 	((sqfs_object_t *)base)->destroy = stdinout_destroy;
 	base->write_at = stdin_write_at;
 	base->get_size = stdinout_get_size;
 	base->truncate = stdinout_truncate;
-
-	if (map == NULL) {
-		base->read_at = stdin_read_at;
-	} else {
-		base->read_at = stdin_read_condensed;
-	}
+	base->read_at = stdin_read_at;
 	return base;
 }
@@ -8,6 +8,35 @@
 
 #include <stdio.h>
 
+static void print_compressor_statistics(const sqfs_super_t *super,
+					const sqfs_block_processor_t *blk)
+{
+	sqfs_compressor_stats_t stats;
+	const char *name;
+	size_t i;
+
+	if (sqfs_block_processor_get_compressor_stats(blk, &stats) != 0)
+		return;
+
+	if (stats.search_count == 0)
+		return;
+
+	printf("Blocks with a compressor option search: " PRI_U64 "\n",
+	       stats.search_count);
+	printf("Trial compressor runs: " PRI_U64 "\n", stats.trial_count);
+
+	for (i = 0; i < sizeof(stats.flag_wins) / sizeof(stats.flag_wins[0]);
+	     ++i) {
+		name = compressor_flag_name(super->compression_id, 1 << i);
+
+		if (name != NULL && stats.flag_wins[i] > 0) {
+			printf("Blocks packed with '%s': " PRI_U64 "\n",
+			       name, stats.flag_wins[i]);
+		}
+	}
+	fputc('\n', stdout);
+}
+
 void sqfs_print_statistics(const sqfs_super_t *super,
 			   const sqfs_block_processor_t *blk,
 			   const sqfs_block_writer_t *wr)
@@ -41,15 +70,32 @@ void sqfs_print_statistics(const sqfs_super_t *super,
 	       proc_stats->frag_block_count);
 	printf("Duplicate blocks omitted: " PRI_U64 "\n",
 	       wr_stats->blocks_submitted - wr_stats->blocks_written);
+	printf("Duplicate files found: " PRI_U64 "\n",
+	       wr_stats->dedup_hits + proc_stats->early_dedup_file_count);
+	printf("Out of which before compressing them: " PRI_U64 "\n",
+	       proc_stats->early_dedup_file_count);
 	printf("Sparse blocks omitted: " PRI_U64 "\n",
 	       proc_stats->sparse_block_count);
+	if (proc_stats->incompressible_block_count > 0) {
+		printf("Blocks not compressed as incompressible: " PRI_U64 "\n",
+		       proc_stats->incompressible_block_count);
+	}
 	fputc('\n', stdout);
 
 	printf("Fragments actually written: " PRI_U64 "\n",
 	       proc_stats->actual_frag_count);
 	printf("Duplicated fragments omitted: " PRI_U64 "\n",
 	       proc_stats->total_frag_count - proc_stats->actual_frag_count);
+	if (wr_stats->dedup_collisions > 0 ||
+	    proc_stats->frag_verify_failed > 0) {
+		printf("Unconfirmed duplicate files: " PRI_U64 "\n",
+		       wr_stats->dedup_collisions);
+		printf("Unconfirmed duplicate fragments: " PRI_U64 "\n",
+		       proc_stats->frag_verify_failed);
+	}
 	printf("Total number of inodes: %u\n", super->inode_count);
 	printf("Number of unique group/user IDs: %u\n", super->id_count);
 	fputc('\n', stdout);
+
+	print_compressor_statistics(super, blk);
 }
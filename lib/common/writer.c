@@ -67,6 +67,7 @@ void sqfs_writer_cfg_init(sqfs_writer_cfg_t *cfg)
 
 int sqfs_writer_init(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *wrcfg)
 {
+	sqfs_block_processor_desc_t desc;
 	sqfs_compressor_config_t cfg;
 	int ret, flags;
 
@@ -138,15 +139,32 @@ int sqfs_writer_init(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *wrcfg)
 		goto fail_blkwr;
 	}
 
-	sqfs->data = sqfs_block_processor_create(sqfs->super.block_size,
-						 sqfs->cmp, wrcfg->num_jobs,
-						 wrcfg->max_backlog,
-						 sqfs->blkwr, sqfs->fragtbl);
-	if (sqfs->data == NULL) {
-		perror("creating data block processor");
+	memset(&desc, 0, sizeof(desc));
+	desc.size = sizeof(desc);
+	desc.max_block_size = sqfs->super.block_size;
+	desc.num_workers = wrcfg->num_jobs;
+	desc.max_backlog = wrcfg->max_backlog;
+	desc.cmp = sqfs->cmp;
+	desc.wr = sqfs->blkwr;
+	desc.tbl = sqfs->fragtbl;
+
+	if (wrcfg->io_thread)
+		desc.flags |= SQFS_BLOCK_PROCESSOR_IO_THREAD;
+
+	ret = sqfs_block_processor_create_ex(&desc, &sqfs->data);
+	if (ret) {
+		sqfs_perror(wrcfg->filename, "creating data block processor",
+			    ret);
 		goto fail_fragtbl;
 	}
 
+	ret = sqfs_block_processor_set_entropy_threshold(sqfs->data,
+						wrcfg->entropy_threshold);
+	if (ret) {
+		sqfs_perror(wrcfg->filename, "setting entropy threshold", ret);
+		goto fail_data;
+	}
+
 	sqfs->idtbl = sqfs_id_table_create(0);
 	if (sqfs->idtbl == NULL) {
 		sqfs_perror(wrcfg->filename, "creating ID table",
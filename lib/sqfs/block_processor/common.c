@@ -44,17 +44,282 @@ static int set_block_size(sqfs_inode_generic_t **inode,
 	return 0;
 }
 
-int process_completed_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
+sqfs_block_t *block_pool_get(sqfs_block_processor_t *proc)
 {
-	sqfs_u64 location;
+	sqfs_block_t *blk = proc->free_blocks;
+
+	if (blk == NULL)
+		return alloc_flex(sizeof(*blk), 1, proc->max_block_size);
+
+	proc->free_blocks = blk->next;
+	proc->num_free_blocks -= 1;
+
+	memset(blk, 0, offsetof(sqfs_block_t, data));
+	return blk;
+}
+
+void block_pool_put(sqfs_block_processor_t *proc, sqfs_block_t *blk)
+{
+	if (blk == NULL)
+		return;
+
+	if (proc->num_free_blocks >= proc->max_free_blocks) {
+		free(blk);
+		return;
+	}
+
+	blk->next = proc->free_blocks;
+	proc->free_blocks = blk;
+	proc->num_free_blocks += 1;
+}
+
+void block_pool_cleanup(sqfs_block_processor_t *proc)
+{
+	sqfs_block_t *blk;
+
+	while (proc->free_blocks != NULL) {
+		blk = proc->free_blocks;
+		proc->free_blocks = blk->next;
+		free(blk);
+	}
+
+	proc->num_free_blocks = 0;
+
+	free(proc->zero_block);
+	proc->zero_block = NULL;
+}
+
+void frag_cache_cleanup(sqfs_block_processor_t *proc)
+{
+	sqfs_block_t *blk;
+
+	while (proc->frag_cache != NULL) {
+		blk = proc->frag_cache;
+		proc->frag_cache = blk->next;
+		free(blk);
+	}
+
+	if (proc->uncmp != NULL)
+		sqfs_destroy(proc->uncmp);
+
+	free(proc->frag_readback);
+	free(proc->frag_raw);
+	proc->frag_cache_last = NULL;
+	proc->frag_readback = NULL;
+	proc->frag_raw = NULL;
+	proc->uncmp = NULL;
+}
+
+static int frag_cache_add(sqfs_block_processor_t *proc, const sqfs_block_t *blk)
+{
+	sqfs_block_t *copy = block_pool_get(proc);
+	if (copy == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	copy->index = blk->index;
+	copy->size = blk->size;
+	memcpy(copy->data, blk->data, blk->size);
+
+	if (proc->frag_cache_last == NULL) {
+		proc->frag_cache = copy;
+	} else {
+		proc->frag_cache_last->next = copy;
+	}
+
+	proc->frag_cache_last = copy;
+	return 0;
+}
+
+static void frag_cache_remove(sqfs_block_processor_t *proc, sqfs_u32 index)
+{
+	sqfs_block_t *it = proc->frag_cache, *prev = NULL;
+
+	while (it != NULL && it->index != index) {
+		prev = it;
+		it = it->next;
+	}
+
+	if (it == NULL)
+		return;
+
+	if (prev == NULL) {
+		proc->frag_cache = it->next;
+	} else {
+		prev->next = it->next;
+	}
+
+	if (proc->frag_cache_last == it)
+		proc->frag_cache_last = prev;
+
+	block_pool_put(proc, it);
+}
+
+static int frag_read_back(sqfs_block_processor_t *proc, sqfs_u32 index)
+{
+	sqfs_compressor_config_t cfg;
+	sqfs_file_t *file = sqfs_block_writer_get_file(proc->wr);
+	sqfs_fragment_t ent;
 	sqfs_u32 size;
+	sqfs_s32 ret;
 	int err;
 
-	err = sqfs_block_writer_write(proc->wr, blk->size, blk->checksum,
-				      blk->flags, blk->data, &location);
+	if (file->read_at == NULL)
+		return SQFS_ERROR_UNSUPPORTED;
+
+	if (proc->frag_readback == NULL) {
+		proc->frag_readback = alloc_flex(sizeof(sqfs_block_t), 1,
+						 proc->max_block_size);
+		proc->frag_raw = malloc(proc->max_block_size);
+
+		if (proc->frag_readback == NULL || proc->frag_raw == NULL)
+			return SQFS_ERROR_ALLOC;
+	} else if (proc->frag_readback->size > 0 &&
+		   proc->frag_readback->index == index) {
+		return 0;
+	}
+
+	proc->frag_readback->size = 0;
+
+	err = sqfs_frag_table_lookup(proc->frag_tbl, index, &ent);
 	if (err)
 		return err;
 
+	/*
+	  Not written yet, but flushed before verification was turned on, so
+	  there is no copy to compare against either.
+	 */
+	if (ent.size == 0)
+		return SQFS_ERROR_UNSUPPORTED;
+
+	size = SQFS_ON_DISK_BLOCK_SIZE(ent.size);
+	if (size == 0 || size > proc->max_block_size)
+		return SQFS_ERROR_CORRUPTED;
+
+	if (!SQFS_IS_BLOCK_COMPRESSED(ent.size)) {
+		err = read_output_file(proc, ent.start_offset,
+				       proc->frag_readback->data, size);
+		if (err)
+			return err;
+	} else {
+		if (proc->uncmp == NULL) {
+			proc->cmp->get_configuration(proc->cmp, &cfg);
+			cfg.flags |= SQFS_COMP_FLAG_UNCOMPRESS;
+
+			err = sqfs_compressor_create(&cfg, &proc->uncmp);
+			if (err)
+				return err;
+		}
+
+		err = read_output_file(proc, ent.start_offset,
+				       proc->frag_raw, size);
+		if (err)
+			return err;
+
+		ret = proc->uncmp->do_block(proc->uncmp, proc->frag_raw, size,
+					    proc->frag_readback->data,
+					    proc->max_block_size);
+		if (ret <= 0)
+			return ret < 0 ? ret : SQFS_ERROR_CORRUPTED;
+
+		size = ret;
+	}
+
+	proc->frag_readback->index = index;
+	proc->frag_readback->size = size;
+	return 0;
+}
+
+/*
+  Returns 0 if the fragment is stored at the given location, > 0 if it is
+  not or cannot be compared, < 0 on failure.
+ */
+static int verify_fragment(sqfs_block_processor_t *proc,
+			   const sqfs_block_t *frag,
+			   sqfs_u32 index, sqfs_u32 offset)
+{
+	const sqfs_block_t *blk;
+	int err;
+
+	if (proc->frag_block != NULL && proc->frag_block->index == index) {
+		blk = proc->frag_block;
+	} else {
+		blk = proc->frag_cache;
+
+		while (blk != NULL && blk->index != index)
+			blk = blk->next;
+	}
+
+	/* fragment blocks that are not in flight must be on disk already */
+	if (blk == NULL) {
+		err = frag_read_back(proc, index);
+		if (err == SQFS_ERROR_UNSUPPORTED)
+			return 1;
+		if (err)
+			return err;
+
+		blk = proc->frag_readback;
+	}
+
+	if (offset > blk->size || frag->size > (blk->size - offset))
+		return 1;
+
+	return memcmp(blk->data + offset, frag->data, frag->size) != 0;
+}
+
+static int copy_file_layout(sqfs_block_t *blk)
+{
+	const sqfs_inode_generic_t *orig = *(blk->dup_of);
+	sqfs_u32 frag_idx, frag_offset;
+	sqfs_u64 location;
+	size_t i, count;
+	int err;
+
+	count = orig->payload_bytes_used / sizeof(sqfs_u32);
+
+	for (i = 0; i < count; ++i) {
+		err = set_block_size(blk->inode, i, orig->extra[i]);
+		if (err)
+			return err;
+	}
+
+	if (orig->base.type == SQFS_INODE_EXT_FILE &&
+	    orig->data.file_ext.sparse > 0) {
+		sqfs_inode_make_extended(*(blk->inode));
+		(*(blk->inode))->data.file_ext.sparse =
+			orig->data.file_ext.sparse;
+	}
+
+	sqfs_inode_get_file_block_start(orig, &location);
+	sqfs_inode_set_file_block_start(*(blk->inode), location);
+
+	sqfs_inode_get_frag_location(orig, &frag_idx, &frag_offset);
+	sqfs_inode_set_frag_location(*(blk->inode), frag_idx, frag_offset);
+	return 0;
+}
+
+int write_completed_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
+{
+	const sqfs_u8 *data = blk->data;
+
+	if (blk->dup_of != NULL)
+		return 0;
+
+	/* holes added with sqfs_block_processor_append_sparse are not filled */
+	if ((blk->flags & SQFS_BLK_IS_SPARSE) && proc->zero_block != NULL)
+		data = proc->zero_block;
+
+	return sqfs_block_writer_write(proc->wr, blk->size, blk->checksum,
+				       blk->flags, data, &blk->location);
+}
+
+int update_written_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
+{
+	sqfs_u32 size;
+	int err;
+
+	if (blk->dup_of != NULL)
+		return copy_file_layout(blk);
+
 	if (blk->flags & SQFS_BLK_IS_SPARSE) {
 		sqfs_inode_make_extended(*(blk->inode));
 		(*(blk->inode))->data.file_ext.sparse += blk->size;
@@ -65,15 +330,23 @@ int process_completed_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
 
 		proc->stats.sparse_block_count += 1;
 	} else if (blk->size != 0) {
+		if (blk->flags & SQFS_BLK_IS_INCOMPRESSIBLE) {
+			proc->stats.incompressible_block_count += 1;
+			proc->stats.incompressible_bytes += blk->size;
+		}
+
 		size = blk->size;
 		if (!(blk->flags & SQFS_BLK_IS_COMPRESSED))
 			size |= 1 << 24;
 
 		if (blk->flags & SQFS_BLK_FRAGMENT_BLOCK) {
 			err = sqfs_frag_table_set(proc->frag_tbl, blk->index,
-						  location, size);
+						  blk->location, size);
 			if (err)
 				return err;
+
+			if (proc->verify_frags)
+				frag_cache_remove(proc, blk->index);
 		} else {
 			err = set_block_size(blk->inode, blk->index, size);
 			if (err)
@@ -83,43 +356,65 @@ int process_completed_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
 	}
 
 	if (blk->flags & SQFS_BLK_LAST_BLOCK)
-		sqfs_inode_set_file_block_start(*(blk->inode), location);
+		sqfs_inode_set_file_block_start(*(blk->inode), blk->location);
 
 	return 0;
 }
 
-static bool is_zero_block(unsigned char *ptr, size_t size)
+int process_completed_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
 {
-	return ptr[0] == 0 && memcmp(ptr, ptr + 1, size - 1) == 0;
+	int err = write_completed_block(proc, blk);
+
+	if (err)
+		return err;
+
+	return update_written_block(proc, blk);
 }
 
-int block_processor_do_block(sqfs_block_t *block, sqfs_compressor_t *cmp,
-			     sqfs_u8 *scratch, size_t scratch_size)
+int block_processor_do_block(const sqfs_block_processor_t *proc,
+			     sqfs_block_t **blk_ptr, sqfs_compressor_t *cmp,
+			     sqfs_block_t **scratch)
 {
+	sqfs_block_t *block = *blk_ptr, *out = *scratch;
 	sqfs_s32 ret;
 
 	if (block->size == 0)
 		return 0;
 
-	if (is_zero_block(block->data, block->size)) {
+	if ((block->flags & SQFS_BLK_IS_SPARSE) ||
+	    is_zero_block(block->data, block->size)) {
 		block->flags |= SQFS_BLK_IS_SPARSE;
 		return 0;
 	}
 
-	block->checksum = xxh32(block->data, block->size);
+	if (block->checksum == 0)
+		block->checksum = xxh3_64(block->data, block->size);
+
+	if (block->flags & (SQFS_BLK_IS_FRAGMENT | SQFS_BLK_DONT_COMPRESS |
+			    SQFS_BLK_IS_INCOMPRESSIBLE)) {
+		return 0;
+	}
 
-	if (block->flags & (SQFS_BLK_IS_FRAGMENT | SQFS_BLK_DONT_COMPRESS))
+	if (proc->entropy_threshold > 0 &&
+	    is_incompressible(block->data, block->size,
+			      proc->entropy_threshold)) {
+		block->flags |= SQFS_BLK_IS_INCOMPRESSIBLE;
 		return 0;
+	}
 
 	ret = cmp->do_block(cmp, block->data, block->size,
-			    scratch, scratch_size);
+			    out->data, proc->max_block_size);
 	if (ret < 0)
 		return ret;
 
 	if (ret > 0) {
-		memcpy(block->data, scratch, ret);
-		block->size = ret;
-		block->flags |= SQFS_BLK_IS_COMPRESSED;
+		/* swap the buffers instead of copying the compressed data */
+		memcpy(out, block, offsetof(sqfs_block_t, data));
+		out->size = ret;
+		out->flags |= SQFS_BLK_IS_COMPRESSED;
+
+		*blk_ptr = out;
+		*scratch = block;
 	}
 	return 0;
 }
@@ -146,6 +441,16 @@ int process_completed_fragment(sqfs_block_processor_t *proc, sqfs_block_t *frag,
 		err = sqfs_frag_table_find_tail_end(proc->frag_tbl,
 						    frag->checksum, frag->size,
 						    &index, &offset);
+
+		if (err == 0 && (frag->flags & SQFS_BLK_VERIFY_DEDUPLICATE)) {
+			err = verify_fragment(proc, frag, index, offset);
+			if (err < 0)
+				goto fail;
+
+			if (err > 0)
+				proc->stats.frag_verify_failed += 1;
+		}
+
 		if (err == 0) {
 			sqfs_inode_set_frag_location(*(frag->inode),
 						     index, offset);
@@ -157,19 +462,23 @@ int process_completed_fragment(sqfs_block_processor_t *proc, sqfs_block_t *frag,
 		size = proc->frag_block->size + frag->size;
 
 		if (size > proc->max_block_size) {
+			if (proc->verify_frags) {
+				err = frag_cache_add(proc, proc->frag_block);
+				if (err)
+					return err;
+			}
+
 			*blk_out = proc->frag_block;
 			proc->frag_block = NULL;
 		}
 	}
 
 	if (proc->frag_block == NULL) {
-		size = sizeof(sqfs_block_t) + proc->max_block_size;
-
 		err= sqfs_frag_table_append(proc->frag_tbl, 0, 0, &index);
 		if (err)
 			goto fail;
 
-		proc->frag_block = calloc(1, size);
+		proc->frag_block = block_pool_get(proc);
 		if (proc->frag_block == NULL) {
 			err = SQFS_ERROR_ALLOC;
 			goto fail;
@@ -198,14 +507,14 @@ int process_completed_fragment(sqfs_block_processor_t *proc, sqfs_block_t *frag,
 	proc->stats.actual_frag_count += 1;
 	return 0;
 fail:
-	free(*blk_out);
+	block_pool_put(proc, *blk_out);
 	*blk_out = NULL;
 	return err;
 }
 
 static int add_sentinel_block(sqfs_block_processor_t *proc)
 {
-	sqfs_block_t *blk = calloc(1, sizeof(*blk));
+	sqfs_block_t *blk = block_pool_get(proc);
 
 	if (blk == NULL)
 		return SQFS_ERROR_ALLOC;
@@ -213,7 +522,7 @@ static int add_sentinel_block(sqfs_block_processor_t *proc)
 	blk->inode = proc->inode;
 	blk->flags = proc->blk_flags | SQFS_BLK_LAST_BLOCK;
 
-	return append_to_work_queue(proc, blk);
+	return file_dedup_submit(proc, blk);
 }
 
 static int flush_block(sqfs_block_processor_t *proc)
@@ -226,15 +535,49 @@ static int flush_block(sqfs_block_processor_t *proc)
 	    !(block->flags & SQFS_BLK_DONT_FRAGMENT)) {
 		block->flags |= SQFS_BLK_IS_FRAGMENT;
 	} else {
+		/* skip the rest of already compressed files up front */
+		if ((proc->blk_flags & SQFS_BLK_FIRST_BLOCK) &&
+		    !(block->flags & SQFS_BLK_IS_SPARSE) &&
+		    proc->entropy_threshold > 0 &&
+		    is_compressed_format(block->data, block->size)) {
+			proc->blk_flags |= SQFS_BLK_IS_INCOMPRESSIBLE;
+			block->flags |= SQFS_BLK_IS_INCOMPRESSIBLE;
+		}
+
 		proc->blk_flags &= ~SQFS_BLK_FIRST_BLOCK;
 	}
 
 	block->index = proc->blk_index++;
-	return append_to_work_queue(proc, block);
+	return file_dedup_submit(proc, block);
 }
 
-int sqfs_block_processor_begin_file(sqfs_block_processor_t *proc,
-				    sqfs_inode_generic_t **inode, sqfs_u32 flags)
+sqfs_block_processor_t *sqfs_block_processor_create(size_t max_block_size,
+						    sqfs_compressor_t *cmp,
+						    unsigned int num_workers,
+						    size_t max_backlog,
+						    sqfs_block_writer_t *wr,
+						    sqfs_frag_table_t *tbl)
+{
+	sqfs_block_processor_desc_t desc;
+	sqfs_block_processor_t *out;
+
+	memset(&desc, 0, sizeof(desc));
+	desc.size = sizeof(desc);
+	desc.max_block_size = max_block_size;
+	desc.num_workers = num_workers;
+	desc.max_backlog = max_backlog;
+	desc.cmp = cmp;
+	desc.wr = wr;
+	desc.tbl = tbl;
+
+	if (sqfs_block_processor_create_ex(&desc, &out))
+		return NULL;
+
+	return out;
+}
+
+int block_processor_begin_file(sqfs_block_processor_t *proc,
+			       sqfs_inode_generic_t **inode, sqfs_u32 flags)
 {
 	if (proc->inode != NULL)
 		return SQFS_ERROR_SEQUENCE;
@@ -252,9 +595,25 @@ int sqfs_block_processor_begin_file(sqfs_block_processor_t *proc,
 	proc->inode = inode;
 	proc->blk_flags = flags | SQFS_BLK_FIRST_BLOCK;
 	proc->blk_index = 0;
+
+	proc->hold_blocks = (flags & SQFS_BLK_EARLY_DEDUPLICATE) &&
+		!(flags & (SQFS_BLK_DONT_DEDUPLICATE |
+			   SQFS_BLK_VERIFY_DEDUPLICATE));
+
+	if (flags & SQFS_BLK_VERIFY_DEDUPLICATE)
+		proc->verify_frags = true;
 	return 0;
 }
 
+int sqfs_block_processor_begin_file(sqfs_block_processor_t *proc,
+				    sqfs_inode_generic_t **inode, sqfs_u32 flags)
+{
+	if (proc->files_first != NULL)
+		return SQFS_ERROR_SEQUENCE;
+
+	return block_processor_begin_file(proc, inode, flags);
+}
+
 int sqfs_block_processor_append(sqfs_block_processor_t *proc, const void *data,
 				size_t size)
 {
@@ -266,9 +625,14 @@ int sqfs_block_processor_append(sqfs_block_processor_t *proc, const void *data,
 	sqfs_inode_get_file_size(*(proc->inode), &filesize);
 	sqfs_inode_set_file_size(*(proc->inode), filesize + size);
 
+	if (proc->dup_of != NULL) {
+		proc->stats.input_bytes_read += size;
+		return 0;
+	}
+
 	while (size > 0) {
 		if (proc->blk_current == NULL) {
-			new = alloc_flex(sizeof(*new), 1, proc->max_block_size);
+			new = block_pool_get(proc);
 			if (new == NULL)
 				return SQFS_ERROR_ALLOC;
 
@@ -307,6 +671,82 @@ int sqfs_block_processor_append(sqfs_block_processor_t *proc, const void *data,
 	return 0;
 }
 
+int sqfs_block_processor_append_sparse(sqfs_block_processor_t *proc,
+				       sqfs_u64 size)
+{
+	sqfs_block_t *new;
+	sqfs_u64 filesize;
+	size_t diff;
+	int err;
+
+	if (proc->inode == NULL)
+		return SQFS_ERROR_SEQUENCE;
+
+	sqfs_inode_get_file_size(*(proc->inode), &filesize);
+	sqfs_inode_set_file_size(*(proc->inode), filesize + size);
+
+	proc->stats.input_bytes_read += size;
+
+	if (proc->dup_of != NULL)
+		return 0;
+
+	while (size > 0) {
+		/* whole blocks of zeros are flagged, but never filled in */
+		if (proc->blk_current == NULL && size >= proc->max_block_size) {
+			if (proc->zero_block == NULL) {
+				proc->zero_block = calloc(1,
+							  proc->max_block_size);
+				if (proc->zero_block == NULL)
+					return SQFS_ERROR_ALLOC;
+			}
+
+			new = block_pool_get(proc);
+			if (new == NULL)
+				return SQFS_ERROR_ALLOC;
+
+			new->flags = proc->blk_flags | SQFS_BLK_IS_SPARSE;
+			new->inode = proc->inode;
+			new->size = proc->max_block_size;
+
+			proc->blk_current = new;
+			size -= proc->max_block_size;
+
+			err = flush_block(proc);
+			if (err)
+				return err;
+			continue;
+		}
+
+		if (proc->blk_current == NULL) {
+			new = block_pool_get(proc);
+			if (new == NULL)
+				return SQFS_ERROR_ALLOC;
+
+			proc->blk_current = new;
+			proc->blk_current->flags = proc->blk_flags;
+			proc->blk_current->inode = proc->inode;
+		}
+
+		diff = proc->max_block_size - proc->blk_current->size;
+		if (diff > size)
+			diff = size;
+
+		memset(proc->blk_current->data + proc->blk_current->size,
+		       0, diff);
+
+		size -= diff;
+		proc->blk_current->size += diff;
+
+		if (proc->blk_current->size == proc->max_block_size) {
+			err = flush_block(proc);
+			if (err)
+				return err;
+		}
+	}
+
+	return 0;
+}
+
 int sqfs_block_processor_end_file(sqfs_block_processor_t *proc)
 {
 	int err;
@@ -317,7 +757,7 @@ int sqfs_block_processor_end_file(sqfs_block_processor_t *proc)
 	if (!(proc->blk_flags & SQFS_BLK_FIRST_BLOCK)) {
 		if (proc->blk_current != NULL &&
 		    (proc->blk_flags & SQFS_BLK_DONT_FRAGMENT)) {
-			proc->blk_flags |= SQFS_BLK_LAST_BLOCK;
+			proc->blk_current->flags |= SQFS_BLK_LAST_BLOCK;
 		} else {
 			err = add_sentinel_block(proc);
 			if (err)
@@ -331,8 +771,36 @@ int sqfs_block_processor_end_file(sqfs_block_processor_t *proc)
 			return err;
 	}
 
+	err = file_dedup_end_file(proc);
+
+	free(proc->digest);
+	proc->digest = NULL;
+	proc->dup_of = NULL;
+	proc->hold_blocks = false;
+
 	proc->inode = NULL;
 	proc->blk_flags = 0;
+	return err;
+}
+
+int add_compressor_stats(sqfs_compressor_stats_t *stats,
+			 const sqfs_compressor_t *cmp)
+{
+	sqfs_compressor_stats_t temp;
+	size_t i;
+	int ret;
+
+	ret = sqfs_compressor_get_stats(cmp, &temp);
+	if (ret)
+		return ret;
+
+	stats->search_count += temp.search_count;
+	stats->trial_count += temp.trial_count;
+	stats->trial_bytes += temp.trial_bytes;
+
+	for (i = 0; i < sizeof(temp.flag_wins) / sizeof(temp.flag_wins[0]); ++i)
+		stats->flag_wins[i] += temp.flag_wins[i];
+
 	return 0;
 }
 
@@ -0,0 +1,300 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * file_dedup.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+#include "lib/util/hash_table.h"
+
+/*
+  Blocks of a file are held back at most up to this count while looking for
+  an earlier duplicate. Larger files are passed on to the workers and are
+  left to the block writer to deduplicate.
+ */
+#define MAX_HELD_BLOCKS (32)
+
+/* flags that change how a file ends up on disk */
+#define LAYOUT_FLAGS (SQFS_BLK_DONT_COMPRESS | SQFS_BLK_ALIGN | \
+		      SQFS_BLK_DONT_FRAGMENT)
+
+struct file_entry_t {
+	sqfs_inode_generic_t **inode;
+	sqfs_u64 hash;
+	sqfs_u64 size;
+	sqfs_u32 flags;
+
+	/* a caller provided digest, or zero-length if computed by us */
+	size_t digest_size;
+	sqfs_u8 digest[];
+};
+
+static uint32_t file_entry_hash(const void *key)
+{
+	const file_entry_t *ent = key;
+
+	return (uint32_t)(ent->hash ^ (ent->hash >> 32));
+}
+
+static bool file_entry_equals(const void *a, const void *b)
+{
+	const file_entry_t *lhs = a, *rhs = b;
+
+	if (lhs->hash != rhs->hash || lhs->flags != rhs->flags ||
+	    lhs->digest_size != rhs->digest_size) {
+		return false;
+	}
+
+	/* with a caller provided digest, the size is checked afterwards */
+	if (lhs->digest_size > 0)
+		return memcmp(lhs->digest, rhs->digest, lhs->digest_size) == 0;
+
+	return lhs->size == rhs->size;
+}
+
+static void delete_function(struct hash_entry *entry)
+{
+	free(entry->data);
+}
+
+static file_entry_t *find_file(sqfs_block_processor_t *proc,
+			       const file_entry_t *key)
+{
+	struct hash_entry *entry;
+
+	if (proc->files == NULL)
+		return NULL;
+
+	entry = hash_table_search_pre_hashed(proc->files, file_entry_hash(key),
+					     key);
+
+	return entry == NULL ? NULL : entry->data;
+}
+
+static int add_file(sqfs_block_processor_t *proc, const file_entry_t *key)
+{
+	file_entry_t *ent;
+
+	if (proc->files == NULL) {
+		proc->files = hash_table_create(file_entry_hash,
+						file_entry_equals);
+		if (proc->files == NULL)
+			return SQFS_ERROR_ALLOC;
+	}
+
+	ent = alloc_flex(sizeof(*ent), 1, key->digest_size);
+	if (ent == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	memcpy(ent, key, sizeof(*ent) + key->digest_size);
+
+	if (hash_table_insert_pre_hashed(proc->files, file_entry_hash(ent),
+					 ent, ent) == NULL) {
+		free(ent);
+		return SQFS_ERROR_ALLOC;
+	}
+
+	return 0;
+}
+
+static void drop_held_blocks(sqfs_block_processor_t *proc)
+{
+	sqfs_block_t *blk;
+
+	while (proc->held_first != NULL) {
+		blk = proc->held_first;
+		proc->held_first = blk->next;
+		block_pool_put(proc, blk);
+	}
+
+	proc->held_last = NULL;
+	proc->held_count = 0;
+}
+
+static int release_held_blocks(sqfs_block_processor_t *proc)
+{
+	sqfs_block_t *blk;
+	int err;
+
+	while (proc->held_first != NULL) {
+		blk = proc->held_first;
+		proc->held_first = blk->next;
+		blk->next = NULL;
+
+		err = append_to_work_queue(proc, blk);
+		if (err) {
+			drop_held_blocks(proc);
+			return err;
+		}
+	}
+
+	proc->held_last = NULL;
+	proc->held_count = 0;
+	return 0;
+}
+
+static int submit_reference(sqfs_block_processor_t *proc,
+			    const file_entry_t *orig)
+{
+	sqfs_block_t *blk = block_pool_get(proc);
+
+	if (blk == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	blk->inode = proc->inode;
+	blk->dup_of = orig->inode;
+
+	proc->stats.early_dedup_file_count += 1;
+	proc->stats.early_dedup_bytes += orig->size;
+	return append_to_work_queue(proc, blk);
+}
+
+static void make_key(const sqfs_block_processor_t *proc, file_entry_t *key)
+{
+	memset(key, 0, sizeof(*key));
+	key->inode = proc->inode;
+	key->flags = proc->blk_flags & LAYOUT_FLAGS;
+	sqfs_inode_get_file_size(*(proc->inode), &key->size);
+}
+
+int file_dedup_submit(sqfs_block_processor_t *proc, sqfs_block_t *blk)
+{
+	if (!proc->hold_blocks)
+		return append_to_work_queue(proc, blk);
+
+	/*
+	  Hashed here already, the workers won't do it again. Zero blocks get
+	  the same checksum as holes, which were never filled in.
+	 */
+	if (blk->size > 0 && !(blk->flags & SQFS_BLK_IS_SPARSE) &&
+	    is_zero_block(blk->data, blk->size)) {
+		blk->flags |= SQFS_BLK_IS_SPARSE;
+	}
+
+	if (blk->flags & SQFS_BLK_IS_SPARSE) {
+		blk->checksum = 0;
+	} else if (blk->size > 0) {
+		blk->checksum = xxh3_64(blk->data, blk->size);
+	}
+
+	if (proc->held_last == NULL) {
+		proc->held_first = blk;
+	} else {
+		proc->held_last->next = blk;
+	}
+
+	proc->held_last = blk;
+	proc->held_count += 1;
+
+	if (proc->held_count <= MAX_HELD_BLOCKS)
+		return 0;
+
+	proc->hold_blocks = false;
+	return release_held_blocks(proc);
+}
+
+int file_dedup_end_file(sqfs_block_processor_t *proc)
+{
+	sqfs_u64 sums[MAX_HELD_BLOCKS + 1];
+	file_entry_t key, *orig;
+	sqfs_block_t *blk;
+	size_t count = 0;
+	int err;
+
+	if (proc->dup_of != NULL) {
+		make_key(proc, &key);
+
+		if (key.size != proc->dup_of->size)
+			return SQFS_ERROR_CORRUPTED;
+
+		return submit_reference(proc, proc->dup_of);
+	}
+
+	if (proc->digest != NULL) {
+		proc->digest->inode = proc->inode;
+		sqfs_inode_get_file_size(*(proc->inode), &proc->digest->size);
+		return add_file(proc, proc->digest);
+	}
+
+	if (!proc->hold_blocks)
+		return 0;
+
+	make_key(proc, &key);
+	if (key.size == 0)
+		return release_held_blocks(proc);
+
+	for (blk = proc->held_first; blk != NULL; blk = blk->next) {
+		if (blk->size > 0)
+			sums[count++] = htole64(blk->checksum);
+	}
+
+	key.hash = xxh64(sums, count * sizeof(sums[0]));
+
+	orig = find_file(proc, &key);
+	if (orig != NULL) {
+		drop_held_blocks(proc);
+		return submit_reference(proc, orig);
+	}
+
+	err = add_file(proc, &key);
+	if (err) {
+		drop_held_blocks(proc);
+		return err;
+	}
+
+	return release_held_blocks(proc);
+}
+
+void file_dedup_cleanup(sqfs_block_processor_t *proc)
+{
+	drop_held_blocks(proc);
+
+	free(proc->digest);
+	proc->digest = NULL;
+	proc->dup_of = NULL;
+
+	if (proc->files != NULL) {
+		hash_table_destroy(proc->files, delete_function);
+		proc->files = NULL;
+	}
+}
+
+int sqfs_block_processor_set_file_digest(sqfs_block_processor_t *proc,
+					 const void *digest, size_t size)
+{
+	file_entry_t *key;
+
+	if (proc->inode == NULL || proc->digest != NULL ||
+	    proc->dup_of != NULL || proc->blk_current != NULL ||
+	    proc->blk_index != 0) {
+		return SQFS_ERROR_SEQUENCE;
+	}
+
+	if (size == 0)
+		return SQFS_ERROR_ARG_INVALID;
+
+	if (proc->blk_flags & SQFS_BLK_DONT_DEDUPLICATE)
+		return 0;
+
+	key = alloc_flex(sizeof(*key), 1, size);
+	if (key == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	key->hash = xxh64(digest, size);
+	key->flags = proc->blk_flags & LAYOUT_FLAGS;
+	key->digest_size = size;
+	memcpy(key->digest, digest, size);
+
+	proc->dup_of = find_file(proc, key);
+	proc->hold_blocks = false;
+
+	if (proc->dup_of != NULL) {
+		free(key);
+	} else {
+		proc->digest = key;
+	}
+
+	return 0;
+}
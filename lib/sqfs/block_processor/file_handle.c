@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * file_handle.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+static void free_file(sqfs_block_processor_file_t *file)
+{
+	sqfs_block_t *blk;
+
+	while (file->data_first != NULL) {
+		blk = file->data_first;
+		file->data_first = blk->next;
+		free(blk);
+	}
+
+	free(file);
+}
+
+static int commit_file(sqfs_block_processor_t *proc,
+		       sqfs_block_processor_file_t *file)
+{
+	sqfs_block_t *blk;
+	int err;
+
+	err = block_processor_begin_file(proc, file->inode, file->flags);
+	if (err)
+		return err;
+
+	for (blk = file->data_first; blk != NULL; blk = blk->next) {
+		err = sqfs_block_processor_append(proc, blk->data, blk->size);
+		if (err)
+			return err;
+	}
+
+	return sqfs_block_processor_end_file(proc);
+}
+
+void file_handle_cleanup(sqfs_block_processor_t *proc)
+{
+	sqfs_block_processor_file_t *file;
+
+	while (proc->files_first != NULL) {
+		file = proc->files_first;
+		proc->files_first = file->next;
+		free_file(file);
+	}
+
+	proc->files_last = NULL;
+	proc->files_pending = 0;
+}
+
+int sqfs_block_processor_open_file(sqfs_block_processor_t *proc,
+				   sqfs_inode_generic_t **inode,
+				   sqfs_u32 flags,
+				   sqfs_block_processor_file_t **out)
+{
+	sqfs_block_processor_file_t *file;
+
+	if (proc->inode != NULL)
+		return SQFS_ERROR_SEQUENCE;
+
+	if (flags & ~SQFS_BLK_USER_SETTABLE_FLAGS)
+		return SQFS_ERROR_UNSUPPORTED;
+
+	file = calloc(1, sizeof(*file));
+	if (file == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	file->proc = proc;
+	file->inode = inode;
+	file->flags = flags;
+
+	if (proc->files_last == NULL) {
+		proc->files_first = file;
+	} else {
+		proc->files_last->next = file;
+	}
+
+	proc->files_last = file;
+	proc->files_pending += 1;
+
+	*out = file;
+	return 0;
+}
+
+int sqfs_block_processor_file_append(sqfs_block_processor_file_t *file,
+				     const void *data, size_t size)
+{
+	size_t max_size = file->proc->max_block_size, diff;
+	sqfs_block_t *blk;
+
+	while (size > 0) {
+		blk = file->data_last;
+
+		if (blk == NULL || blk->size == max_size) {
+			blk = alloc_flex(sizeof(*blk), 1, max_size);
+			if (blk == NULL)
+				return SQFS_ERROR_ALLOC;
+
+			memset(blk, 0, offsetof(sqfs_block_t, data));
+
+			if (file->data_last == NULL) {
+				file->data_first = blk;
+			} else {
+				file->data_last->next = blk;
+			}
+
+			file->data_last = blk;
+		}
+
+		diff = max_size - blk->size;
+		if (diff > size)
+			diff = size;
+
+		memcpy(blk->data + blk->size, data, diff);
+		blk->size += diff;
+
+		data = (const char *)data + diff;
+		size -= diff;
+	}
+
+	return 0;
+}
+
+void sqfs_block_processor_file_close(sqfs_block_processor_file_t *file)
+{
+	file_handle_mark_closed(file->proc, file);
+}
+
+int sqfs_block_processor_commit_files(sqfs_block_processor_t *proc,
+				      size_t max_pending)
+{
+	sqfs_block_processor_file_t *file;
+	bool wait;
+	int err;
+
+	while (proc->files_first != NULL) {
+		file = proc->files_first;
+		wait = proc->files_pending > max_pending;
+
+		if (!file_handle_wait_closed(proc, file, wait))
+			return wait ? SQFS_ERROR_SEQUENCE : 0;
+
+		proc->files_first = file->next;
+		if (proc->files_first == NULL)
+			proc->files_last = NULL;
+		proc->files_pending -= 1;
+
+		err = commit_file(proc, file);
+		free_file(file);
+
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
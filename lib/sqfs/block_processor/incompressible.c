@@ -0,0 +1,125 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * incompressible.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+/*
+  The entropy of larger blocks is estimated from this many evenly spaced
+  chunks of this size, instead of looking at every byte.
+ */
+#define SAMPLE_CHUNK_COUNT (32)
+#define SAMPLE_CHUNK_SIZE (256)
+
+static const struct {
+	size_t offset;
+	size_t size;
+	const char *magic;
+} signatures[] = {
+	{ 0, 3, "\x1F\x8B\x08" },			/* gzip */
+	{ 0, 3, "BZh" },				/* bzip2 */
+	{ 0, 6, "\xFD" "7zXZ\x00" },			/* xz */
+	{ 0, 4, "LZIP" },				/* lzip */
+	{ 0, 4, "\x28\xB5\x2F\xFD" },			/* zstd */
+	{ 0, 6, "7z\xBC\xAF\x27\x1C" },			/* 7-Zip */
+	{ 0, 3, "\xFF\xD8\xFF" },			/* JPEG */
+	{ 0, 8, "\x89PNG\r\n\x1A\n" },			/* PNG */
+	{ 8, 4, "WEBP" },				/* WebP */
+	{ 4, 4, "ftyp" },				/* MP4, QuickTime */
+	{ 0, 4, "OggS" },				/* Ogg */
+	{ 0, 4, "fLaC" },				/* FLAC */
+	/*
+	  Zip archives are deliberately missing, their members can be stored
+	  without compression. The entropy check still catches the rest.
+	 */
+};
+
+/* log2(x) as a fixed point number with 16 fractional bits, x > 0 */
+static sqfs_u32 log2_fixed(sqfs_u32 x)
+{
+	sqfs_u32 msb = 31 - __builtin_clz(x), result = msb << 16;
+	sqfs_u64 y = ((sqfs_u64)x << 16) >> msb;
+	int i;
+
+	for (i = 15; i >= 0; --i) {
+		y = (y * y) >> 16;
+
+		if (y >= (2 << 16)) {
+			y >>= 1;
+			result |= 1 << i;
+		}
+	}
+
+	return result;
+}
+
+bool is_compressed_format(const sqfs_u8 *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(signatures) / sizeof(signatures[0]); ++i) {
+		if (size < signatures[i].offset + signatures[i].size)
+			continue;
+
+		if (memcmp(data + signatures[i].offset, signatures[i].magic,
+			   signatures[i].size) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool is_incompressible(const sqfs_u8 *data, size_t size,
+		       unsigned int threshold)
+{
+	sqfs_u32 histogram[256];
+	size_t i, j, count, stride;
+	sqfs_u64 sum, entropy;
+
+	memset(histogram, 0, sizeof(histogram));
+
+	if (size <= SAMPLE_CHUNK_COUNT * SAMPLE_CHUNK_SIZE) {
+		for (i = 0; i < size; ++i)
+			histogram[data[i]] += 1;
+
+		count = size;
+	} else {
+		stride = size / SAMPLE_CHUNK_COUNT;
+
+		for (i = 0; i < SAMPLE_CHUNK_COUNT; ++i) {
+			for (j = 0; j < SAMPLE_CHUNK_SIZE; ++j)
+				histogram[data[i * stride + j]] += 1;
+		}
+
+		count = SAMPLE_CHUNK_COUNT * SAMPLE_CHUNK_SIZE;
+	}
+
+	/* H = log2(n) - sum(c * log2(c)) / n */
+	sum = 0;
+
+	for (i = 0; i < 256; ++i) {
+		if (histogram[i] > 1)
+			sum += (sqfs_u64)histogram[i] * log2_fixed(histogram[i]);
+	}
+
+	entropy = log2_fixed(count) - sum / count;
+
+	return entropy * 100 >= (sqfs_u64)threshold * (8 << 16);
+}
+
+int sqfs_block_processor_set_entropy_threshold(sqfs_block_processor_t *proc,
+					       unsigned int threshold)
+{
+	if (threshold > 100)
+		return SQFS_ERROR_ARG_INVALID;
+
+	if (proc->inode != NULL || proc->stats.input_bytes_read > 0)
+		return SQFS_ERROR_SEQUENCE;
+
+	proc->entropy_threshold = threshold;
+	return 0;
+}
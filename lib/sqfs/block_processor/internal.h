@@ -20,9 +20,12 @@
 #include "sqfs/io.h"
 #include "util.h"
 
+#include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 
+typedef struct file_entry_t file_entry_t;
+
 typedef struct sqfs_block_t {
 	struct sqfs_block_t *next;
 	sqfs_inode_generic_t **inode;
@@ -31,14 +34,37 @@ typedef struct sqfs_block_t {
 	sqfs_u32 io_seq_num;
 	sqfs_u32 flags;
 	sqfs_u32 size;
-	sqfs_u32 checksum;
+	sqfs_u64 checksum;
+
+	/* Where the block writer put the block, or the file it ends. */
+	sqfs_u64 location;
 
 	/* Data block index within the inode or fragment block index. */
 	sqfs_u32 index;
 
+	/*
+	  If not NULL, the block is a place holder for a file that was found
+	  to be a duplicate of this one before compressing it.
+	 */
+	sqfs_inode_generic_t **dup_of;
+
 	sqfs_u8 data[];
 } sqfs_block_t;
 
+struct sqfs_block_processor_file_t {
+	sqfs_block_processor_file_t *next;
+	sqfs_block_processor_t *proc;
+	sqfs_inode_generic_t **inode;
+	sqfs_u32 flags;
+
+	/* buffered file data, in chunks of max_block_size bytes */
+	sqfs_block_t *data_first;
+	sqfs_block_t *data_last;
+
+	/* set by the block processor back end, once the file is complete */
+	bool closed;
+};
+
 struct sqfs_block_processor_t {
 	sqfs_object_t obj;
 
@@ -54,9 +80,112 @@ struct sqfs_block_processor_t {
 	sqfs_u32 blk_flags;
 	sqfs_u32 blk_index;
 
+	/* recycled blocks, each with room for max_block_size bytes */
+	sqfs_block_t *free_blocks;
+	size_t num_free_blocks;
+	size_t max_free_blocks;
+
+	/*
+	  For verifying fragment deduplication: uncompressed copies of the
+	  fragment blocks that are still in flight, only kept once a file has
+	  asked for verification. Fragment blocks that have already been
+	  written are read back and uncompressed instead.
+	 */
+	sqfs_block_t *frag_cache;
+	sqfs_block_t *frag_cache_last;
+	sqfs_block_t *frag_readback;
+	sqfs_u8 *frag_raw;
+	sqfs_compressor_t *uncmp;
+	bool verify_frags;
+
+	/*
+	  Early whole-file deduplication: previously seen files by content
+	  hash or caller provided digest, the blocks of the current file that
+	  are held back until it is complete, and what is known about the
+	  current file so far.
+	 */
+	struct hash_table *files;
+	sqfs_block_t *held_first;
+	sqfs_block_t *held_last;
+	size_t held_count;
+	bool hold_blocks;
+	file_entry_t *digest;
+	const file_entry_t *dup_of;
+
+	/* in percent of 8 bits per byte, 0 if disabled */
+	unsigned int entropy_threshold;
+
+	/* files opened with sqfs_block_processor_open_file, in order */
+	sqfs_block_processor_file_t *files_first;
+	sqfs_block_processor_file_t *files_last;
+	size_t files_pending;
+
+	/* read only, handed to the block writer in place of sparse blocks */
+	sqfs_u8 *zero_block;
+
 	size_t max_block_size;
 };
 
+SQFS_INTERNAL sqfs_block_t *block_pool_get(sqfs_block_processor_t *proc);
+
+SQFS_INTERNAL void block_pool_put(sqfs_block_processor_t *proc,
+				  sqfs_block_t *blk);
+
+SQFS_INTERNAL void block_pool_cleanup(sqfs_block_processor_t *proc);
+
+SQFS_INTERNAL void frag_cache_cleanup(sqfs_block_processor_t *proc);
+
+SQFS_INTERNAL void file_dedup_cleanup(sqfs_block_processor_t *proc);
+
+SQFS_INTERNAL int file_dedup_submit(sqfs_block_processor_t *proc,
+				    sqfs_block_t *blk);
+
+SQFS_INTERNAL int file_dedup_end_file(sqfs_block_processor_t *proc);
+
+/* sqfs_block_processor_begin_file, without checking for open file handles */
+SQFS_INTERNAL int block_processor_begin_file(sqfs_block_processor_t *proc,
+					     sqfs_inode_generic_t **inode,
+					     sqfs_u32 flags);
+
+SQFS_INTERNAL void file_handle_cleanup(sqfs_block_processor_t *proc);
+
+/* implemented by the back end, synchronized with file handle users */
+SQFS_INTERNAL void file_handle_mark_closed(sqfs_block_processor_t *proc,
+					   sqfs_block_processor_file_t *file);
+
+/* returns true if the file is closed, optionally waiting for it */
+SQFS_INTERNAL bool file_handle_wait_closed(sqfs_block_processor_t *proc,
+					   sqfs_block_processor_file_t *file,
+					   bool wait);
+
+SQFS_INTERNAL bool is_compressed_format(const sqfs_u8 *data, size_t size);
+
+/* uses the widest vector unit the CPU has, selected at run time */
+SQFS_INTERNAL bool is_zero_block(const sqfs_u8 *data, size_t size);
+
+SQFS_INTERNAL bool is_incompressible(const sqfs_u8 *data, size_t size,
+				     unsigned int threshold);
+
+/*
+  implemented by the back end, reads from the output file without racing
+  a thread that writes to it
+ */
+SQFS_INTERNAL int read_output_file(sqfs_block_processor_t *proc,
+				   sqfs_u64 offset, void *buffer, size_t size);
+
+/* add the counters of a compressor to the ones already in 'stats' */
+SQFS_INTERNAL int add_compressor_stats(sqfs_compressor_stats_t *stats,
+				       const sqfs_compressor_t *cmp);
+
+/* hand a block to the block writer, storing the resulting location */
+SQFS_INTERNAL int write_completed_block(sqfs_block_processor_t *proc,
+					sqfs_block_t *block);
+
+/* record the location of a written block in its inode or fragment table */
+SQFS_INTERNAL int update_written_block(sqfs_block_processor_t *proc,
+				       sqfs_block_t *block);
+
+/* both of the above in one go */
 SQFS_INTERNAL int process_completed_block(sqfs_block_processor_t *proc,
 					  sqfs_block_t *block);
 
@@ -65,8 +194,9 @@ int process_completed_fragment(sqfs_block_processor_t *proc, sqfs_block_t *frag,
 			       sqfs_block_t **blk_out);
 
 SQFS_INTERNAL
-int block_processor_do_block(sqfs_block_t *block, sqfs_compressor_t *cmp,
-			     sqfs_u8 *scratch, size_t scratch_size);
+int block_processor_do_block(const sqfs_block_processor_t *proc,
+			     sqfs_block_t **block, sqfs_compressor_t *cmp,
+			     sqfs_block_t **scratch);
 
 SQFS_INTERNAL
 int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block);
@@ -9,40 +9,57 @@
 
 typedef struct {
 	sqfs_block_processor_t base;
+	sqfs_block_t *scratch;
 	int status;
-	sqfs_u8 scratch[];
 } serial_block_processor_t;
 
 static void block_processor_destroy(sqfs_object_t *obj)
 {
+	serial_block_processor_t *sproc = (serial_block_processor_t *)obj;
 	sqfs_block_processor_t *proc = (sqfs_block_processor_t *)obj;
 
+	block_pool_cleanup(proc);
+	frag_cache_cleanup(proc);
+	file_dedup_cleanup(proc);
+	file_handle_cleanup(proc);
+	free(sproc->scratch);
 	free(proc->blk_current);
 	free(proc->frag_block);
 	free(proc);
 }
 
-sqfs_block_processor_t *sqfs_block_processor_create(size_t max_block_size,
-						    sqfs_compressor_t *cmp,
-						    unsigned int num_workers,
-						    size_t max_backlog,
-						    sqfs_block_writer_t *wr,
-						    sqfs_frag_table_t *tbl)
+int sqfs_block_processor_create_ex(const sqfs_block_processor_desc_t *desc,
+				   sqfs_block_processor_t **out)
 {
 	serial_block_processor_t *proc;
-	(void)num_workers; (void)max_backlog;
 
-	proc = alloc_flex(sizeof(*proc), 1, max_block_size);
+	if (desc->size != sizeof(sqfs_block_processor_desc_t))
+		return SQFS_ERROR_ARG_INVALID;
+
+	if (desc->flags & ~SQFS_BLOCK_PROCESSOR_ALL_FLAGS)
+		return SQFS_ERROR_UNSUPPORTED;
+
+	proc = calloc(1, sizeof(*proc));
 	if (proc == NULL)
-		return NULL;
+		return SQFS_ERROR_ALLOC;
+
+	proc->scratch = alloc_flex(sizeof(sqfs_block_t), 1,
+				   desc->max_block_size);
+	if (proc->scratch == NULL) {
+		free(proc);
+		return SQFS_ERROR_ALLOC;
+	}
 
-	proc->base.max_block_size = max_block_size;
-	proc->base.cmp = cmp;
-	proc->base.frag_tbl = tbl;
-	proc->base.wr = wr;
+	proc->base.max_block_size = desc->max_block_size;
+	proc->base.max_free_blocks = 2;
+	proc->base.cmp = desc->cmp;
+	proc->base.frag_tbl = desc->tbl;
+	proc->base.wr = desc->wr;
 	proc->base.stats.size = sizeof(proc->base.stats);
 	((sqfs_object_t *)proc)->destroy = block_processor_destroy;
-	return (sqfs_block_processor_t *)proc;
+
+	*out = (sqfs_block_processor_t *)proc;
+	return 0;
 }
 
 int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block)
@@ -53,9 +70,8 @@ int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block)
 	if (sproc->status != 0)
 		goto done;
 
-	sproc->status = block_processor_do_block(block, proc->cmp,
-						 sproc->scratch,
-						 proc->max_block_size);
+	sproc->status = block_processor_do_block(proc, &block, proc->cmp,
+						 &sproc->scratch);
 	if (sproc->status != 0)
 		goto done;
 
@@ -65,22 +81,53 @@ int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block)
 		if (fragblk == NULL)
 			goto done;
 
-		free(block);
+		block_pool_put(proc, block);
 		block = fragblk;
 
-		sproc->status = block_processor_do_block(block, proc->cmp,
-							 sproc->scratch,
-							 proc->max_block_size);
+		sproc->status = block_processor_do_block(proc, &block,
+							 proc->cmp,
+							 &sproc->scratch);
 		if (sproc->status != 0)
 			goto done;
 	}
 
 	sproc->status = process_completed_block(proc, block);
 done:
-	free(block);
+	block_pool_put(proc, block);
 	return sproc->status;
 }
 
+int read_output_file(sqfs_block_processor_t *proc, sqfs_u64 offset,
+		     void *buffer, size_t size)
+{
+	sqfs_file_t *file = sqfs_block_writer_get_file(proc->wr);
+
+	return file->read_at(file, offset, buffer, size);
+}
+
+void file_handle_mark_closed(sqfs_block_processor_t *proc,
+			     sqfs_block_processor_file_t *file)
+{
+	(void)proc;
+	file->closed = true;
+}
+
+bool file_handle_wait_closed(sqfs_block_processor_t *proc,
+			     sqfs_block_processor_file_t *file, bool wait)
+{
+	(void)proc; (void)wait;
+	return file->closed;
+}
+
+int sqfs_block_processor_get_compressor_stats(const sqfs_block_processor_t *proc,
+					      sqfs_compressor_stats_t *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->size = sizeof(*stats);
+
+	return add_compressor_stats(stats, proc->cmp);
+}
+
 int sqfs_block_processor_sync(sqfs_block_processor_t *proc)
 {
 	return ((serial_block_processor_t *)proc)->status;
@@ -89,19 +136,23 @@ int sqfs_block_processor_sync(sqfs_block_processor_t *proc)
 int sqfs_block_processor_finish(sqfs_block_processor_t *proc)
 {
 	serial_block_processor_t *sproc = (serial_block_processor_t *)proc;
+	int ret;
+
+	ret = sqfs_block_processor_commit_files(proc, 0);
+	if (ret != 0)
+		return ret;
 
 	if (proc->frag_block == NULL || sproc->status != 0)
 		goto out;
 
-	sproc->status = block_processor_do_block(proc->frag_block, proc->cmp,
-						 sproc->scratch,
-						 proc->max_block_size);
+	sproc->status = block_processor_do_block(proc, &proc->frag_block,
+						 proc->cmp, &sproc->scratch);
 	if (sproc->status != 0)
 		goto out;
 
 	sproc->status = process_completed_block(proc, proc->frag_block);
 out:
-	free(proc->frag_block);
+	block_pool_put(proc, proc->frag_block);
 	proc->frag_block = NULL;
 	return sproc->status;
 }
@@ -13,6 +13,7 @@
 #	define LOCK(mtx) EnterCriticalSection(mtx)
 #	define UNLOCK(mtx) LeaveCriticalSection(mtx)
 #	define AWAIT(cond, mtx) SleepConditionVariableCS(cond, mtx, INFINITE)
+#	define SIGNAL(cond) WakeConditionVariable(cond)
 #	define SIGNAL_ALL(cond) WakeAllConditionVariable(cond)
 #	define THREAD_JOIN(t) \
 		if (t != NULL) { \
@@ -33,6 +34,7 @@
 #	define LOCK(mtx) pthread_mutex_lock(mtx)
 #	define UNLOCK(mtx) pthread_mutex_unlock(mtx)
 #	define AWAIT(cond, mtx) pthread_cond_wait(cond, mtx)
+#	define SIGNAL(cond) pthread_cond_signal(cond)
 #	define SIGNAL_ALL(cond) pthread_cond_broadcast(cond)
 #	define THREAD_JOIN(t) if (t != (pthread_t)0) { pthread_join(t, NULL); }
 #	define MUTEX_DESTROY(mtx) pthread_mutex_destroy(mtx)
@@ -48,11 +50,24 @@
 typedef struct compress_worker_t compress_worker_t;
 typedef struct thread_pool_processor_t thread_pool_processor_t;
 
+/*
+  A fixed size reorder window. A block is stored in the slot selected by its
+  sequence number and a bitmap records which slots are filled, so the next
+  block in order can be taken out in constant time and runs of consecutive
+  blocks can be found one bitmap word at a time.
+ */
+typedef struct {
+	sqfs_block_t **slots;
+	sqfs_u32 *ready;
+	sqfs_u32 mask;
+	sqfs_u32 next;
+} reorder_window_t;
+
 struct compress_worker_t {
 	thread_pool_processor_t *shared;
 	sqfs_compressor_t *cmp;
 	THREAD_HANDLE thread;
-	sqfs_u8 scratch[];
+	sqfs_block_t *scratch;
 };
 
 struct thread_pool_processor_t {
@@ -61,20 +76,44 @@ struct thread_pool_processor_t {
 	MUTEX_TYPE mtx;
 	CONDITION_TYPE queue_cond;
 	CONDITION_TYPE done_cond;
+	CONDITION_TYPE file_cond;
+
+	/*
+	  The work queue is a bounded ring buffer and the completed blocks
+	  and the I/O queue are reorder windows, all indexed by sequence
+	  number. At most max_backlog blocks are in flight, so the sequence
+	  numbers in a ring never collide.
+	 */
+	sqfs_block_t **proc_queue;
+	reorder_window_t done;
+	reorder_window_t io_queue;
+	sqfs_u32 ring_mask;
 
-	sqfs_block_t *proc_queue;
-	sqfs_block_t *proc_queue_last;
-
-	sqfs_block_t *io_queue;
-	sqfs_block_t *done;
 	size_t backlog;
 	int status;
 
 	sqfs_u32 proc_enq_id;
-	sqfs_u32 proc_deq_id;
+	sqfs_u32 proc_work_id;
 
 	sqfs_u32 io_enq_id;
-	sqfs_u32 io_deq_id;
+
+	/*
+	  With a dedicated I/O thread, it takes runs of blocks out of the I/O
+	  queue, writes them and puts them on the written list. The main
+	  thread then updates the inodes and the fragment table from them.
+	  Until then, the blocks still count against the backlog.
+
+	  The I/O thread holds file_mtx while writing, so the main thread
+	  can read back from the output file without the two interfering,
+	  e.g. moving the file pointer of a shared handle.
+	 */
+	bool have_io_thread;
+	MUTEX_TYPE file_mtx;
+	THREAD_HANDLE io_thread;
+	CONDITION_TYPE io_cond;
+	sqfs_block_t *written;
+	sqfs_block_t *written_last;
+	size_t written_count;
 
 	unsigned int num_workers;
 	size_t max_backlog;
@@ -82,31 +121,114 @@ struct thread_pool_processor_t {
 	compress_worker_t *workers[];
 };
 
-static void free_blk_list(sqfs_block_t *list)
+static void release_blk_list(sqfs_block_processor_t *proc, sqfs_block_t *list)
 {
 	sqfs_block_t *it;
 
 	while (list != NULL) {
 		it = list;
 		list = list->next;
-		free(it);
+		block_pool_put(proc, it);
 	}
 }
 
+static void free_blk_ring(sqfs_block_t **ring, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; ++i)
+		free(ring[i]);
+}
+
+static int window_init(reorder_window_t *win, sqfs_u32 size)
+{
+	win->slots = alloc_array(sizeof(win->slots[0]), size);
+	if (win->slots == NULL)
+		return -1;
+
+	win->ready = alloc_array(sizeof(win->ready[0]), size / 32);
+	if (win->ready == NULL) {
+		free(win->slots);
+		win->slots = NULL;
+		return -1;
+	}
+
+	win->mask = size - 1;
+	win->next = 0;
+	return 0;
+}
+
+static void window_cleanup(reorder_window_t *win)
+{
+	if (win->slots != NULL)
+		free_blk_ring(win->slots, win->mask + 1);
+
+	free(win->slots);
+	free(win->ready);
+}
+
+static void window_put(reorder_window_t *win, sqfs_u32 seq_num,
+		       sqfs_block_t *blk)
+{
+	sqfs_u32 idx = seq_num & win->mask;
+
+	win->slots[idx] = blk;
+	win->ready[idx / 32] |= 1U << (idx % 32);
+}
+
+static sqfs_block_t *window_pop(reorder_window_t *win)
+{
+	sqfs_u32 idx = win->next & win->mask;
+	sqfs_block_t *blk;
+
+	if (!(win->ready[idx / 32] & (1U << (idx % 32))))
+		return NULL;
+
+	win->ready[idx / 32] &= ~(1U << (idx % 32));
+	blk = win->slots[idx];
+	win->slots[idx] = NULL;
+	win->next += 1;
+	return blk;
+}
+
+/* number of consecutive blocks that window_pop can return right now */
+static sqfs_u32 window_ready_count(const reorder_window_t *win)
+{
+	sqfs_u32 idx = win->next & win->mask, count = 0, avail, word, run;
+
+	while (count <= win->mask) {
+		avail = 32 - (idx % 32);
+		word = ~(win->ready[idx / 32] >> (idx % 32));
+		run = word ? (sqfs_u32)__builtin_ctz(word) : 32;
+
+		if (run > avail)
+			run = avail;
+
+		count += run;
+		if (run < avail)
+			break;
+
+		idx = (idx + run) & win->mask;
+	}
+
+	return count > (win->mask + 1) ? (win->mask + 1) : count;
+}
+
 static sqfs_block_t *get_next_work_item(thread_pool_processor_t *shared)
 {
 	sqfs_block_t *blk = NULL;
+	sqfs_u32 idx;
 
-	while (shared->proc_queue == NULL && shared->status == 0)
+	while (shared->proc_work_id == shared->proc_enq_id &&
+	       shared->status == 0) {
 		AWAIT(&shared->queue_cond, &shared->mtx);
+	}
 
 	if (shared->status == 0) {
-		blk = shared->proc_queue;
-		shared->proc_queue = blk->next;
-		blk->next = NULL;
+		idx = shared->proc_work_id++ & shared->ring_mask;
 
-		if (shared->proc_queue == NULL)
-			shared->proc_queue_last = NULL;
+		blk = shared->proc_queue[idx];
+		shared->proc_queue[idx] = NULL;
 	}
 
 	return blk;
@@ -115,27 +237,14 @@ static sqfs_block_t *get_next_work_item(thread_pool_processor_t *shared)
 static void store_completed_block(thread_pool_processor_t *shared,
 				  sqfs_block_t *blk, int status)
 {
-	sqfs_block_t *it = shared->done, *prev = NULL;
-
-	while (it != NULL) {
-		if (it->proc_seq_num >= blk->proc_seq_num)
-			break;
-		prev = it;
-		it = it->next;
-	}
-
-	if (prev == NULL) {
-		blk->next = shared->done;
-		shared->done = blk;
-	} else {
-		blk->next = prev->next;
-		prev->next = blk;
-	}
+	window_put(&shared->done, blk->proc_seq_num, blk);
 
 	if (status != 0 && shared->status == 0)
 		shared->status = status;
 
-	SIGNAL_ALL(&shared->done_cond);
+	/* only the main thread waits, and only for the next block in order */
+	if (blk->proc_seq_num == shared->done.next || status != 0)
+		SIGNAL(&shared->done_cond);
 }
 
 static THREAD_TYPE worker_proc(THREAD_ARG arg)
@@ -156,14 +265,89 @@ static THREAD_TYPE worker_proc(THREAD_ARG arg)
 		if (blk == NULL)
 			break;
 
-		status = block_processor_do_block(blk, worker->cmp,
-						  worker->scratch,
-						  shared->base.max_block_size);
+		status = block_processor_do_block(&shared->base, &blk,
+						  worker->cmp,
+						  &worker->scratch);
 	}
 
 	return THREAD_EXIT_SUCCESS;
 }
 
+static sqfs_block_t *dequeue_io_run(thread_pool_processor_t *proc,
+				    sqfs_block_t **list_last,
+				    sqfs_u32 *list_count)
+{
+	sqfs_u32 i, count = window_ready_count(&proc->io_queue);
+	sqfs_block_t *list = NULL, *last = NULL, *blk;
+
+	for (i = 0; i < count; ++i) {
+		blk = window_pop(&proc->io_queue);
+		if (blk == NULL)
+			break;
+
+		blk->next = NULL;
+
+		if (last == NULL) {
+			list = blk;
+		} else {
+			last->next = blk;
+		}
+
+		last = blk;
+	}
+
+	*list_last = last;
+	*list_count = i;
+	return list;
+}
+
+static THREAD_TYPE io_thread_proc(THREAD_ARG arg)
+{
+	thread_pool_processor_t *shared = arg;
+	sqfs_block_t *list, *last, *it;
+	sqfs_u32 count;
+	int status = 0;
+
+	LOCK(&shared->mtx);
+	for (;;) {
+		while (shared->status == 0 &&
+		       window_ready_count(&shared->io_queue) == 0) {
+			AWAIT(&shared->io_cond, &shared->mtx);
+		}
+
+		if (shared->status != 0)
+			break;
+
+		list = dequeue_io_run(shared, &last, &count);
+		UNLOCK(&shared->mtx);
+
+		LOCK(&shared->file_mtx);
+		for (it = list; it != NULL && status == 0; it = it->next)
+			status = write_completed_block(&shared->base, it);
+		UNLOCK(&shared->file_mtx);
+
+		LOCK(&shared->mtx);
+		if (shared->written_last == NULL) {
+			shared->written = list;
+		} else {
+			shared->written_last->next = list;
+		}
+
+		shared->written_last = last;
+		shared->written_count += count;
+
+		if (status != 0 && shared->status == 0) {
+			shared->status = status;
+			SIGNAL_ALL(&shared->queue_cond);
+		}
+
+		SIGNAL(&shared->done_cond);
+	}
+	UNLOCK(&shared->mtx);
+
+	return THREAD_EXIT_SUCCESS;
+}
+
 static void block_processor_destroy(sqfs_object_t *obj)
 {
 	thread_pool_processor_t *proc = (thread_pool_processor_t *)obj;
@@ -172,8 +356,12 @@ static void block_processor_destroy(sqfs_object_t *obj)
 	LOCK(&proc->mtx);
 	proc->status = -1;
 	SIGNAL_ALL(&proc->queue_cond);
+	SIGNAL_ALL(&proc->io_cond);
 	UNLOCK(&proc->mtx);
 
+	if (proc->have_io_thread)
+		THREAD_JOIN(proc->io_thread);
+
 	for (i = 0; i < proc->num_workers; ++i) {
 		if (proc->workers[i] != NULL) {
 			THREAD_JOIN(proc->workers[i]->thread);
@@ -181,35 +369,58 @@ static void block_processor_destroy(sqfs_object_t *obj)
 			if (proc->workers[i]->cmp != NULL)
 				sqfs_destroy(proc->workers[i]->cmp);
 
+			free(proc->workers[i]->scratch);
 			free(proc->workers[i]);
 		}
 	}
 
+	CONDITION_DESTROY(&proc->file_cond);
+	CONDITION_DESTROY(&proc->io_cond);
 	CONDITION_DESTROY(&proc->done_cond);
 	CONDITION_DESTROY(&proc->queue_cond);
+	MUTEX_DESTROY(&proc->file_mtx);
 	MUTEX_DESTROY(&proc->mtx);
 
-	free_blk_list(proc->proc_queue);
-	free_blk_list(proc->io_queue);
-	free_blk_list(proc->done);
+	release_blk_list(&proc->base, proc->written);
+
+	if (proc->proc_queue != NULL) {
+		free_blk_ring(proc->proc_queue, proc->ring_mask + 1);
+		free(proc->proc_queue);
+	}
+
+	window_cleanup(&proc->done);
+	window_cleanup(&proc->io_queue);
+
+	block_pool_cleanup(&proc->base);
+	frag_cache_cleanup(&proc->base);
+	file_dedup_cleanup(&proc->base);
+	file_handle_cleanup(&proc->base);
 	free(proc->base.blk_current);
 	free(proc->base.frag_block);
 	free(proc);
 }
 
-static thread_pool_processor_t *block_processor_create(size_t max_block_size,
-						       sqfs_compressor_t *cmp,
-						       unsigned int num_workers,
-						       size_t max_backlog,
-						       sqfs_block_writer_t *wr,
-						       sqfs_frag_table_t *tbl)
+static thread_pool_processor_t *
+block_processor_create(const sqfs_block_processor_desc_t *desc)
 {
+	unsigned int i, num_workers = desc->num_workers;
+	size_t max_backlog = desc->max_backlog;
 	thread_pool_processor_t *proc;
-	unsigned int i;
+	sqfs_u32 ring_size;
 
 	if (num_workers < 1)
 		num_workers = 1;
 
+	if (max_backlog < 1)
+		max_backlog = 1;
+
+	if (max_backlog > 0x80000000UL)
+		return NULL;
+
+	ring_size = 32;
+	while (ring_size < max_backlog)
+		ring_size <<= 1;
+
 	proc = alloc_flex(sizeof(*proc),
 			  sizeof(proc->workers[0]), num_workers);
 	if (proc == NULL)
@@ -217,22 +428,38 @@ static thread_pool_processor_t *block_processor_create(size_t max_block_size,
 
 	proc->num_workers = num_workers;
 	proc->max_backlog = max_backlog;
-	proc->base.max_block_size = max_block_size;
-	proc->base.cmp = cmp;
-	proc->base.frag_tbl = tbl;
-	proc->base.wr = wr;
+	proc->base.max_block_size = desc->max_block_size;
+	proc->base.max_free_blocks = max_backlog;
+	proc->base.cmp = desc->cmp;
+	proc->base.frag_tbl = desc->tbl;
+	proc->base.wr = desc->wr;
 	proc->base.stats.size = sizeof(proc->base.stats);
 	((sqfs_object_t *)proc)->destroy = block_processor_destroy;
 
-	for (i = 0; i < num_workers; ++i) {
-		proc->workers[i] = alloc_flex(sizeof(compress_worker_t),
-					      1, max_block_size);
+	proc->proc_queue = alloc_array(sizeof(proc->proc_queue[0]), ring_size);
+	if (proc->proc_queue == NULL)
+		goto fail;
 
+	proc->ring_mask = ring_size - 1;
+
+	if (window_init(&proc->done, ring_size))
+		goto fail;
+
+	if (window_init(&proc->io_queue, ring_size))
+		goto fail;
+
+	for (i = 0; i < num_workers; ++i) {
+		proc->workers[i] = calloc(1, sizeof(compress_worker_t));
 		if (proc->workers[i] == NULL)
 			goto fail;
 
+		proc->workers[i]->scratch = alloc_flex(sizeof(sqfs_block_t),
+						       1, desc->max_block_size);
+		if (proc->workers[i]->scratch == NULL)
+			goto fail;
+
 		proc->workers[i]->shared = proc;
-		proc->workers[i]->cmp = sqfs_copy(cmp);
+		proc->workers[i]->cmp = sqfs_copy(desc->cmp);
 
 		if (proc->workers[i]->cmp == NULL)
 			goto fail;
@@ -245,63 +472,81 @@ fail:
 }
 
 #if defined(_WIN32) || defined(__WINDOWS__)
-sqfs_block_processor_t *sqfs_block_processor_create(size_t max_block_size,
-						    sqfs_compressor_t *cmp,
-						    unsigned int num_workers,
-						    size_t max_backlog,
-						    sqfs_block_writer_t *wr,
-						    sqfs_frag_table_t *tbl)
+int sqfs_block_processor_create_ex(const sqfs_block_processor_desc_t *desc,
+				   sqfs_block_processor_t **out)
 {
 	thread_pool_processor_t *proc;
 	unsigned int i;
 
-	proc = block_processor_create(max_block_size, cmp, num_workers,
-				      max_backlog, wr, tbl);
+	if (desc->size != sizeof(sqfs_block_processor_desc_t))
+		return SQFS_ERROR_ARG_INVALID;
+
+	if (desc->flags & ~SQFS_BLOCK_PROCESSOR_ALL_FLAGS)
+		return SQFS_ERROR_UNSUPPORTED;
+
+	proc = block_processor_create(desc);
 	if (proc == NULL)
-		return NULL;
+		return SQFS_ERROR_ALLOC;
 
 	InitializeCriticalSection(&proc->mtx);
+	InitializeCriticalSection(&proc->file_mtx);
 	InitializeConditionVariable(&proc->queue_cond);
 	InitializeConditionVariable(&proc->done_cond);
+	InitializeConditionVariable(&proc->io_cond);
+	InitializeConditionVariable(&proc->file_cond);
 
-	for (i = 0; i < num_workers; ++i) {
+	for (i = 0; i < proc->num_workers; ++i) {
 		proc->workers[i]->thread = CreateThread(NULL, 0, worker_proc,
 							proc->workers[i], 0, 0);
 		if (proc->workers[i]->thread == NULL)
 			goto fail;
 	}
 
-	return (sqfs_block_processor_t *)proc;
+	if (desc->flags & SQFS_BLOCK_PROCESSOR_IO_THREAD) {
+		proc->io_thread = CreateThread(NULL, 0, io_thread_proc,
+					       proc, 0, 0);
+		if (proc->io_thread == NULL)
+			goto fail;
+
+		proc->have_io_thread = true;
+	}
+
+	*out = (sqfs_block_processor_t *)proc;
+	return 0;
 fail:
 	block_processor_destroy((sqfs_object_t *)proc);
-	return NULL;
+	return SQFS_ERROR_INTERNAL;
 }
 #else
-sqfs_block_processor_t *sqfs_block_processor_create(size_t max_block_size,
-						    sqfs_compressor_t *cmp,
-						    unsigned int num_workers,
-						    size_t max_backlog,
-						    sqfs_block_writer_t *wr,
-						    sqfs_frag_table_t *tbl)
+int sqfs_block_processor_create_ex(const sqfs_block_processor_desc_t *desc,
+				   sqfs_block_processor_t **out)
 {
 	thread_pool_processor_t *proc;
 	sigset_t set, oldset;
 	unsigned int i;
 	int ret;
 
-	proc = block_processor_create(max_block_size, cmp, num_workers,
-				      max_backlog, wr, tbl);
+	if (desc->size != sizeof(sqfs_block_processor_desc_t))
+		return SQFS_ERROR_ARG_INVALID;
+
+	if (desc->flags & ~SQFS_BLOCK_PROCESSOR_ALL_FLAGS)
+		return SQFS_ERROR_UNSUPPORTED;
+
+	proc = block_processor_create(desc);
 	if (proc == NULL)
-		return NULL;
+		return SQFS_ERROR_ALLOC;
 
 	proc->mtx = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+	proc->file_mtx = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
 	proc->queue_cond = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
 	proc->done_cond = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
+	proc->io_cond = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
+	proc->file_cond = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
 
 	sigfillset(&set);
 	pthread_sigmask(SIG_SETMASK, &set, &oldset);
 
-	for (i = 0; i < num_workers; ++i) {
+	for (i = 0; i < proc->num_workers; ++i) {
 		ret = pthread_create(&proc->workers[i]->thread, NULL,
 				     worker_proc, proc->workers[i]);
 
@@ -309,83 +554,80 @@ sqfs_block_processor_t *sqfs_block_processor_create(size_t max_block_size,
 			goto fail;
 	}
 
+	if (desc->flags & SQFS_BLOCK_PROCESSOR_IO_THREAD) {
+		ret = pthread_create(&proc->io_thread, NULL,
+				     io_thread_proc, proc);
+		if (ret != 0)
+			goto fail;
+
+		proc->have_io_thread = true;
+	}
+
 	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
-	return (sqfs_block_processor_t *)proc;
+	*out = (sqfs_block_processor_t *)proc;
+	return 0;
 fail:
 	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
 	block_processor_destroy((sqfs_object_t *)proc);
-	return NULL;
+	return SQFS_ERROR_INTERNAL;
 }
 #endif
 
 static void store_io_block(thread_pool_processor_t *proc, sqfs_block_t *blk)
 {
-	sqfs_block_t *it = proc->io_queue, *prev = NULL;
-
-	while (it != NULL && it->io_seq_num < blk->io_seq_num) {
-		prev = it;
-		it = it->next;
-	}
-
-	if (prev == NULL) {
-		blk->next = proc->io_queue;
-		proc->io_queue = blk;
-	} else {
-		blk->next = prev->next;
-		prev->next = blk;
-	}
-
+	window_put(&proc->io_queue, blk->io_seq_num, blk);
 	proc->backlog += 1;
+
+	if (proc->have_io_thread && blk->io_seq_num == proc->io_queue.next)
+		SIGNAL(&proc->io_cond);
 }
 
-static sqfs_block_t *try_dequeue_io(thread_pool_processor_t *proc)
+/*
+  Get the next run of blocks that the main thread has to take care of:
+  either blocks the I/O thread is done writing, or the blocks that it has
+  to write itself.
+ */
+static sqfs_block_t *dequeue_io_list(thread_pool_processor_t *proc,
+				     sqfs_block_t **list_last)
 {
-	sqfs_block_t *out;
+	sqfs_block_t *list;
+	sqfs_u32 count;
 
-	if (proc->io_queue == NULL)
-		return NULL;
+	if (!proc->have_io_thread) {
+		list = dequeue_io_run(proc, list_last, &count);
+		proc->backlog -= count;
+		return list;
+	}
 
-	if (proc->io_queue->io_seq_num != proc->io_deq_id)
-		return NULL;
+	list = proc->written;
+	*list_last = proc->written_last;
+	proc->backlog -= proc->written_count;
 
-	out = proc->io_queue;
-	proc->io_queue = out->next;
-	out->next = NULL;
-	proc->io_deq_id += 1;
-	proc->backlog -= 1;
-	return out;
+	proc->written = NULL;
+	proc->written_last = NULL;
+	proc->written_count = 0;
+	return list;
 }
 
 static sqfs_block_t *try_dequeue_done(thread_pool_processor_t *proc)
 {
-	sqfs_block_t *out;
-
-	if (proc->done == NULL)
-		return NULL;
+	sqfs_block_t *out = window_pop(&proc->done);
 
-	if (proc->done->proc_seq_num != proc->proc_deq_id)
-		return NULL;
+	if (out != NULL)
+		proc->backlog -= 1;
 
-	out = proc->done;
-	proc->done = out->next;
-	out->next = NULL;
-	proc->proc_deq_id += 1;
-	proc->backlog -= 1;
 	return out;
 }
 
 static void append_block(thread_pool_processor_t *proc, sqfs_block_t *block)
 {
-	if (proc->proc_queue_last == NULL) {
-		proc->proc_queue = proc->proc_queue_last = block;
-	} else {
-		proc->proc_queue_last->next = block;
-		proc->proc_queue_last = block;
-	}
-
 	block->proc_seq_num = proc->proc_enq_id++;
 	block->next = NULL;
+
+	proc->proc_queue[block->proc_seq_num & proc->ring_mask] = block;
 	proc->backlog += 1;
+
+	SIGNAL(&proc->queue_cond);
 }
 
 static int handle_io_queue(thread_pool_processor_t *proc, sqfs_block_t *list)
@@ -394,7 +636,12 @@ static int handle_io_queue(thread_pool_processor_t *proc, sqfs_block_t *list)
 	int status = 0;
 
 	while (status == 0 && it != NULL) {
-		status = process_completed_block(&proc->base, it);
+		if (proc->have_io_thread) {
+			status = update_written_block(&proc->base, it);
+		} else {
+			status = process_completed_block(&proc->base, it);
+		}
+
 		it = it->next;
 
 		if (status != 0) {
@@ -402,6 +649,7 @@ static int handle_io_queue(thread_pool_processor_t *proc, sqfs_block_t *list)
 			if (proc->status == 0)
 				proc->status = status;
 			SIGNAL_ALL(&proc->queue_cond);
+			SIGNAL_ALL(&proc->io_cond);
 			UNLOCK(&proc->mtx);
 		}
 	}
@@ -412,7 +660,7 @@ static int handle_io_queue(thread_pool_processor_t *proc, sqfs_block_t *list)
 int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block)
 {
 	thread_pool_processor_t *thproc = (thread_pool_processor_t *)proc;
-	sqfs_block_t *io_list = NULL, *io_list_last = NULL;
+	sqfs_block_t *io_list = NULL, *io_list_last = NULL, *run_last;
 	sqfs_block_t *blk, *fragblk, *free_list = NULL;
 	int status;
 
@@ -433,14 +681,14 @@ int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block)
 			}
 		}
 
-		blk = try_dequeue_io(thproc);
+		blk = dequeue_io_list(thproc, &run_last);
 		if (blk != NULL) {
 			if (io_list_last == NULL) {
-				io_list = io_list_last = blk;
+				io_list = blk;
 			} else {
 				io_list_last->next = blk;
-				io_list_last = blk;
 			}
+			io_list_last = run_last;
 			continue;
 		}
 
@@ -460,7 +708,6 @@ int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block)
 			if (fragblk != NULL) {
 				fragblk->io_seq_num = thproc->io_enq_id++;
 				append_block(thproc, fragblk);
-				SIGNAL_ALL(&thproc->queue_cond);
 			}
 		} else {
 			if (!(blk->flags & SQFS_BLK_FRAGMENT_BLOCK))
@@ -468,18 +715,82 @@ int append_to_work_queue(sqfs_block_processor_t *proc, sqfs_block_t *block)
 			store_io_block(thproc, blk);
 		}
 	}
-	SIGNAL_ALL(&thproc->queue_cond);
+	if (status != 0) {
+		SIGNAL_ALL(&thproc->queue_cond);
+		SIGNAL_ALL(&thproc->io_cond);
+	}
 	UNLOCK(&thproc->mtx);
-	free(block);
+	block_pool_put(proc, block);
 
 	if (status == 0)
 		status = handle_io_queue(thproc, io_list);
 
-	free_blk_list(io_list);
-	free_blk_list(free_list);
+	release_blk_list(proc, io_list);
+	release_blk_list(proc, free_list);
 	return status;
 }
 
+int read_output_file(sqfs_block_processor_t *proc, sqfs_u64 offset,
+		     void *buffer, size_t size)
+{
+	thread_pool_processor_t *thproc = (thread_pool_processor_t *)proc;
+	sqfs_file_t *file = sqfs_block_writer_get_file(proc->wr);
+	int ret;
+
+	if (!thproc->have_io_thread)
+		return file->read_at(file, offset, buffer, size);
+
+	LOCK(&thproc->file_mtx);
+	ret = file->read_at(file, offset, buffer, size);
+	UNLOCK(&thproc->file_mtx);
+	return ret;
+}
+
+void file_handle_mark_closed(sqfs_block_processor_t *proc,
+			     sqfs_block_processor_file_t *file)
+{
+	thread_pool_processor_t *thproc = (thread_pool_processor_t *)proc;
+
+	LOCK(&thproc->mtx);
+	file->closed = true;
+	SIGNAL_ALL(&thproc->file_cond);
+	UNLOCK(&thproc->mtx);
+}
+
+bool file_handle_wait_closed(sqfs_block_processor_t *proc,
+			     sqfs_block_processor_file_t *file, bool wait)
+{
+	thread_pool_processor_t *thproc = (thread_pool_processor_t *)proc;
+	bool closed;
+
+	LOCK(&thproc->mtx);
+	while (wait && !file->closed)
+		AWAIT(&thproc->file_cond, &thproc->mtx);
+	closed = file->closed;
+	UNLOCK(&thproc->mtx);
+
+	return closed;
+}
+
+int sqfs_block_processor_get_compressor_stats(const sqfs_block_processor_t *proc,
+					      sqfs_compressor_stats_t *stats)
+{
+	const thread_pool_processor_t *thproc =
+		(const thread_pool_processor_t *)proc;
+	unsigned int i;
+	int ret;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->size = sizeof(*stats);
+
+	ret = add_compressor_stats(stats, proc->cmp);
+
+	for (i = 0; ret == 0 && i < thproc->num_workers; ++i)
+		ret = add_compressor_stats(stats, thproc->workers[i]->cmp);
+
+	return ret;
+}
+
 int sqfs_block_processor_sync(sqfs_block_processor_t *proc)
 {
 	return append_to_work_queue(proc, NULL);
@@ -491,6 +802,10 @@ int sqfs_block_processor_finish(sqfs_block_processor_t *proc)
 	sqfs_block_t *blk;
 	int status;
 
+	status = sqfs_block_processor_commit_files(proc, 0);
+	if (status != 0)
+		return status;
+
 	status = append_to_work_queue(proc, NULL);
 
 	if (status == 0 && proc->frag_block != NULL) {
@@ -498,19 +813,20 @@ int sqfs_block_processor_finish(sqfs_block_processor_t *proc)
 		blk->next = NULL;
 		proc->frag_block = NULL;
 
-		status = block_processor_do_block(blk, proc->cmp,
-						  thproc->workers[0]->scratch,
-						  proc->max_block_size);
+		status = block_processor_do_block(proc, &blk, proc->cmp,
+						  &thproc->workers[0]->scratch);
 
+		/* everything else is done, the I/O thread is idle */
 		if (status == 0)
-			status = handle_io_queue(thproc, blk);
-		free(blk);
+			status = process_completed_block(proc, blk);
+		block_pool_put(proc, blk);
 
 		if (status != 0) {
 			LOCK(&thproc->mtx);
 			if (thproc->status == 0)
 				thproc->status = status;
 			SIGNAL_ALL(&thproc->queue_cond);
+			SIGNAL_ALL(&thproc->io_cond);
 			UNLOCK(&thproc->mtx);
 		}
 	}
@@ -0,0 +1,133 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * zero_block.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_KERNEL
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/*
+  Every kernel ORs together a chunk of the block and only then checks the
+  result, so data blocks are rejected after the first chunk and sparse
+  blocks are read exactly once. The remainder is done with plain words.
+ */
+static bool is_zero_generic(const sqfs_u8 *data, size_t size)
+{
+	sqfs_u64 w[4];
+
+	while (size >= sizeof(w)) {
+		memcpy(w, data, sizeof(w));
+
+		if ((w[0] | w[1] | w[2] | w[3]) != 0)
+			return false;
+
+		data += sizeof(w);
+		size -= sizeof(w);
+	}
+
+	while (size > 0) {
+		if (*(data++) != 0)
+			return false;
+		--size;
+	}
+
+	return true;
+}
+
+#if defined(HAVE_AVX2_KERNEL)
+__attribute__((target("avx2")))
+static bool is_zero_avx2(const sqfs_u8 *data, size_t size)
+{
+	__m256i a, b;
+
+	while (size >= 128) {
+		a = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)data),
+				    _mm256_loadu_si256((const __m256i *)
+						       (data + 32)));
+		b = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)
+						       (data + 64)),
+				    _mm256_loadu_si256((const __m256i *)
+						       (data + 96)));
+		a = _mm256_or_si256(a, b);
+
+		if (!_mm256_testz_si256(a, a))
+			return false;
+
+		data += 128;
+		size -= 128;
+	}
+
+	return is_zero_generic(data, size);
+}
+#endif
+
+#if defined(__SSE2__)
+static bool is_zero_sse2(const sqfs_u8 *data, size_t size)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i a, b;
+
+	while (size >= 64) {
+		a = _mm_or_si128(_mm_loadu_si128((const __m128i *)data),
+				 _mm_loadu_si128((const __m128i *)(data + 16)));
+		b = _mm_or_si128(_mm_loadu_si128((const __m128i *)(data + 32)),
+				 _mm_loadu_si128((const __m128i *)(data + 48)));
+		a = _mm_or_si128(a, b);
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, zero)) != 0xFFFF)
+			return false;
+
+		data += 64;
+		size -= 64;
+	}
+
+	return is_zero_generic(data, size);
+}
+#endif
+
+#if defined(__aarch64__)
+static bool is_zero_neon(const sqfs_u8 *data, size_t size)
+{
+	uint8x16_t a, b;
+
+	while (size >= 64) {
+		a = vorrq_u8(vld1q_u8(data), vld1q_u8(data + 16));
+		b = vorrq_u8(vld1q_u8(data + 32), vld1q_u8(data + 48));
+
+		if (vmaxvq_u8(vorrq_u8(a, b)) != 0)
+			return false;
+
+		data += 64;
+		size -= 64;
+	}
+
+	return is_zero_generic(data, size);
+}
+#endif
+
+bool is_zero_block(const sqfs_u8 *data, size_t size)
+{
+#if defined(HAVE_AVX2_KERNEL)
+	if (__builtin_cpu_supports("avx2"))
+		return is_zero_avx2(data, size);
+#endif
+#if defined(__SSE2__)
+	return is_zero_sse2(data, size);
+#elif defined(__aarch64__)
+	return is_zero_neon(data, size);
+#else
+	return is_zero_generic(data, size);
+#endif
+}
@@ -14,15 +14,23 @@
 #include "util.h"
 
 #include <stdlib.h>
-
-#define MK_BLK_HASH(chksum, size) \
-	(((sqfs_u64)(size) << 32) | (sqfs_u64)(chksum))
+#include <string.h>
 
 #define INIT_BLOCK_COUNT (128)
 
+#define VERIFY_CHUNK_SIZE (16384)
+
+#define NO_BLOCK ((size_t)-1)
+
 typedef struct {
 	sqfs_u64 offset;
 	sqfs_u64 hash;
+
+	/* on-disk size with the uncompressed bit, 0 for padding */
+	sqfs_u32 size;
+
+	/* next older block in the same hash bucket, or NO_BLOCK */
+	size_t next;
 } blk_info_t;
 
 struct sqfs_block_writer_t {
@@ -34,6 +42,17 @@ struct sqfs_block_writer_t {
 	blk_info_t *blocks;
 	size_t devblksz;
 
+	/*
+	  Hash index over the blocks, each bucket holding the index of the
+	  most recently added block that hashes to it. Blocks are only ever
+	  removed from the end of the list, i.e. from the bucket heads.
+	 */
+	size_t *buckets;
+	size_t num_buckets;
+
+	/* scratch space for comparing blocks, allocated on first use */
+	sqfs_u8 *verify_buffer;
+
 	sqfs_block_writer_stats_t stats;
 
 	const sqfs_block_hooks_t *hooks;
@@ -45,11 +64,69 @@ struct sqfs_block_writer_t {
 	size_t file_start;
 };
 
+static size_t bucket_index(const sqfs_block_writer_t *wr, size_t idx)
+{
+	sqfs_u64 hash = wr->blocks[idx].hash ^ wr->blocks[idx].size;
+
+	return (size_t)(hash ^ (hash >> 32)) & (wr->num_buckets - 1);
+}
+
+static void index_block(sqfs_block_writer_t *wr, size_t idx)
+{
+	size_t bucket;
+
+	if (wr->blocks[idx].size == 0) {
+		wr->blocks[idx].next = NO_BLOCK;
+		return;
+	}
+
+	bucket = bucket_index(wr, idx);
+	wr->blocks[idx].next = wr->buckets[bucket];
+	wr->buckets[bucket] = idx;
+}
+
+static void unindex_blocks(sqfs_block_writer_t *wr, size_t new_count)
+{
+	size_t bucket;
+
+	while (wr->num_blocks > new_count) {
+		wr->num_blocks -= 1;
+
+		if (wr->blocks[wr->num_blocks].size == 0)
+			continue;
+
+		bucket = bucket_index(wr, wr->num_blocks);
+		wr->buckets[bucket] = wr->blocks[wr->num_blocks].next;
+	}
+}
+
+static int grow_index(sqfs_block_writer_t *wr)
+{
+	size_t i, new_sz = wr->num_buckets * 2;
+	size_t *new;
+
+	new = realloc(wr->buckets, sizeof(wr->buckets[0]) * new_sz);
+	if (new == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	wr->buckets = new;
+	wr->num_buckets = new_sz;
+
+	for (i = 0; i < new_sz; ++i)
+		wr->buckets[i] = NO_BLOCK;
+
+	for (i = 0; i < wr->num_blocks; ++i)
+		index_block(wr, i);
+
+	return 0;
+}
+
 static int store_block_location(sqfs_block_writer_t *wr, sqfs_u64 offset,
-				sqfs_u32 size, sqfs_u32 chksum)
+				sqfs_u32 size, sqfs_u64 chksum)
 {
 	size_t new_sz;
 	void *new;
+	int err;
 
 	if (wr->num_blocks == wr->max_blocks) {
 		new_sz = wr->max_blocks * 2;
@@ -62,31 +139,161 @@ static int store_block_location(sqfs_block_writer_t *wr, sqfs_u64 offset,
 		wr->max_blocks = new_sz;
 	}
 
+	if (wr->num_blocks >= wr->num_buckets) {
+		err = grow_index(wr);
+		if (err)
+			return err;
+	}
+
 	wr->blocks[wr->num_blocks].offset = offset;
-	wr->blocks[wr->num_blocks].hash = MK_BLK_HASH(chksum, size);
+	wr->blocks[wr->num_blocks].hash = chksum;
+	wr->blocks[wr->num_blocks].size = size;
+	index_block(wr, wr->num_blocks);
 	wr->num_blocks += 1;
 	return 0;
 }
 
-static size_t deduplicate_blocks(sqfs_block_writer_t *wr, size_t count)
+static bool same_block(const sqfs_block_writer_t *wr, size_t a, size_t b)
+{
+	return wr->blocks[a].size == wr->blocks[b].size &&
+	       wr->blocks[a].hash == wr->blocks[b].hash;
+}
+
+static bool is_duplicate(const sqfs_block_writer_t *wr, size_t start,
+			 size_t count)
+{
+	size_t j;
+
+	for (j = 0; j < count; ++j) {
+		if (wr->blocks[start + j].size == 0)
+			return false;
+
+		if (!same_block(wr, start + j, wr->file_start + j))
+			return false;
+	}
+
+	return true;
+}
+
+static int compare_data(sqfs_block_writer_t *wr, sqfs_u64 a, sqfs_u64 b,
+			sqfs_u32 size)
+{
+	size_t diff;
+	int ret;
+
+	if (wr->file->read_at == NULL)
+		return SQFS_ERROR_UNSUPPORTED;
+
+	if (wr->verify_buffer == NULL) {
+		wr->verify_buffer = malloc(2 * VERIFY_CHUNK_SIZE);
+		if (wr->verify_buffer == NULL)
+			return SQFS_ERROR_ALLOC;
+	}
+
+	while (size > 0) {
+		diff = size > VERIFY_CHUNK_SIZE ? VERIFY_CHUNK_SIZE : size;
+
+		ret = wr->file->read_at(wr->file, a, wr->verify_buffer, diff);
+		if (ret)
+			return ret;
+
+		ret = wr->file->read_at(wr->file, b,
+					wr->verify_buffer + VERIFY_CHUNK_SIZE,
+					diff);
+		if (ret)
+			return ret;
+
+		if (memcmp(wr->verify_buffer,
+			   wr->verify_buffer + VERIFY_CHUNK_SIZE, diff) != 0)
+			return 1;
+
+		a += diff;
+		b += diff;
+		size -= diff;
+	}
+
+	return 0;
+}
+
+/*
+  Returns 0 if the blocks starting at index 'start' are identical to the
+  blocks of the current file, > 0 if not and < 0 on failure.
+ */
+static int verify_duplicate(sqfs_block_writer_t *wr, size_t start,
+			    size_t count)
 {
-	size_t i, j;
+	const blk_info_t *a, *b;
+	size_t j;
+	int ret;
+
+	for (j = 0; j < count; ++j) {
+		a = wr->blocks + start + j;
+		b = wr->blocks + wr->file_start + j;
 
-	for (i = 0; i < wr->file_start; ++i) {
-		for (j = 0; j < count; ++j) {
-			if (wr->blocks[i + j].hash == 0)
-				break;
+		if (a == b)
+			continue;
 
-			if (wr->blocks[i + j].hash !=
-			    wr->blocks[wr->file_start + j].hash)
-				break;
+		ret = compare_data(wr, a->offset, b->offset,
+				   SQFS_ON_DISK_BLOCK_SIZE(a->size));
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int deduplicate_blocks(sqfs_block_writer_t *wr, size_t count,
+			      bool verify, size_t *out)
+{
+	size_t i, found, lower = 0, head;
+	int ret;
+
+	wr->stats.dedup_lookups += 1;
+	*out = wr->file_start;
+
+	if (wr->blocks[wr->file_start].size == 0)
+		return 0;
+
+	head = wr->buckets[bucket_index(wr, wr->file_start)];
+
+	for (;;) {
+		/*
+		  The chain runs from newer to older blocks, but to produce
+		  the same result as a linear scan, the earliest matching
+		  position wins.
+		 */
+		found = wr->file_start;
+
+		for (i = head; i != NO_BLOCK; i = wr->blocks[i].next) {
+			if (i < lower || i >= wr->file_start ||
+			    !same_block(wr, i, wr->file_start))
+				continue;
+
+			wr->stats.dedup_candidates += 1;
+
+			if (is_duplicate(wr, i, count))
+				found = i;
 		}
 
-		if (j == count)
+		if (found == wr->file_start || !verify)
+			break;
+
+		ret = verify_duplicate(wr, found, count);
+		if (ret < 0)
+			return ret;
+		if (ret == 0)
 			break;
+
+		/* hash collision, retry with the later candidates */
+		wr->stats.dedup_collisions += 1;
+		lower = found + 1;
 	}
 
-	return i;
+	if (found < wr->file_start)
+		wr->stats.dedup_hits += 1;
+
+	*out = found;
+	return 0;
 }
 
 static int align_file(sqfs_block_writer_t *wr)
@@ -118,6 +325,8 @@ static int align_file(sqfs_block_writer_t *wr)
 
 static void block_writer_destroy(sqfs_object_t *wr)
 {
+	free(((sqfs_block_writer_t *)wr)->verify_buffer);
+	free(((sqfs_block_writer_t *)wr)->buckets);
 	free(((sqfs_block_writer_t *)wr)->blocks);
 	free(wr);
 }
@@ -126,6 +335,7 @@ sqfs_block_writer_t *sqfs_block_writer_create(sqfs_file_t *file,
 					      size_t devblksz, sqfs_u32 flags)
 {
 	sqfs_block_writer_t *wr;
+	size_t i;
 
 	if (flags != 0)
 		return NULL;
@@ -147,6 +357,17 @@ sqfs_block_writer_t *sqfs_block_writer_create(sqfs_file_t *file,
 		return NULL;
 	}
 
+	wr->num_buckets = INIT_BLOCK_COUNT;
+	wr->buckets = alloc_array(sizeof(wr->buckets[0]), wr->num_buckets);
+	if (wr->buckets == NULL) {
+		free(wr->blocks);
+		free(wr);
+		return NULL;
+	}
+
+	for (i = 0; i < wr->num_buckets; ++i)
+		wr->buckets[i] = NO_BLOCK;
+
 	return wr;
 }
 
@@ -162,7 +383,7 @@ int sqfs_block_writer_set_hooks(sqfs_block_writer_t *wr, void *user_ptr,
 }
 
 int sqfs_block_writer_write(sqfs_block_writer_t *wr, sqfs_u32 size,
-			    sqfs_u32 checksum, sqfs_u32 flags,
+			    sqfs_u64 checksum, sqfs_u32 flags,
 			    const sqfs_u8 *data, sqfs_u64 *location)
 {
 	size_t start, count;
@@ -229,8 +450,15 @@ int sqfs_block_writer_write(sqfs_block_writer_t *wr, sqfs_u32 size,
 
 		if (count == 0) {
 			*location = 0;
-		} else if (!(flags & SQFS_BLK_DONT_DEDUPLICATE)) {
-			start = deduplicate_blocks(wr, count);
+		} else if (flags & SQFS_BLK_DONT_DEDUPLICATE) {
+			*location = wr->blocks[wr->file_start].offset;
+		} else {
+			err = deduplicate_blocks(wr, count,
+						 (flags & SQFS_BLK_VERIFY_DEDUPLICATE) != 0,
+						 &start);
+			if (err)
+				return err;
+
 			offset = wr->blocks[start].offset;
 
 			*location = offset;
@@ -239,10 +467,11 @@ int sqfs_block_writer_write(sqfs_block_writer_t *wr, sqfs_u32 size,
 
 			offset = start + count;
 			if (offset >= wr->file_start) {
-				count = wr->num_blocks - offset;
-				wr->num_blocks = offset;
+				/* match overlaps the file itself, keep its head */
+				wr->start = wr->blocks[offset].offset;
+				unindex_blocks(wr, offset);
 			} else {
-				wr->num_blocks = wr->file_start;
+				unindex_blocks(wr, wr->file_start);
 			}
 
 			err = wr->file->truncate(wr->file, wr->start);
@@ -257,6 +486,11 @@ int sqfs_block_writer_write(sqfs_block_writer_t *wr, sqfs_u32 size,
 	return 0;
 }
 
+sqfs_file_t *sqfs_block_writer_get_file(const sqfs_block_writer_t *wr)
+{
+	return wr->file;
+}
+
 const sqfs_block_writer_stats_t
 *sqfs_block_writer_get_stats(const sqfs_block_writer_t *wr)
 {
@@ -121,6 +121,21 @@ int sqfs_compressor_create(const sqfs_compressor_config_t *cfg,
 	return compressors[cfg->id](cfg, out);
 }
 
+int sqfs_compressor_get_stats(const sqfs_compressor_t *cmp,
+			      sqfs_compressor_stats_t *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->size = sizeof(*stats);
+
+#ifdef WITH_GZIP
+	if (gzip_get_stats(cmp, stats) == 0)
+		return 0;
+#else
+	(void)cmp;
+#endif
+	return SQFS_ERROR_UNSUPPORTED;
+}
+
 const char *sqfs_compressor_name_from_id(SQFS_COMPRESSOR id)
 {
 	if (id < 0 || (size_t)id >= sizeof(names) / sizeof(names[0]))
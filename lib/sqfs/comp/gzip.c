@@ -21,14 +21,21 @@ typedef struct {
 	sqfs_u16 strategies;
 } gzip_options_t;
 
+/* input bytes tried with each strategy in SQFS_GZIP_SEARCH_SAMPLE mode */
+#define GZIP_SAMPLE_SIZE (16 * 1024)
+
 typedef struct {
 	sqfs_compressor_t base;
 
 	z_stream strm;
 	bool compress;
+	int search;
 
 	size_t block_size;
 	gzip_options_t opt;
+
+	/* counters of this instance only, copies start out with zero */
+	sqfs_compressor_stats_t stats;
 } gzip_compressor_t;
 
 static void gzip_destroy(sqfs_object_t *base)
@@ -55,6 +62,7 @@ static void gzip_get_configuration(const sqfs_compressor_t *base,
 	cfg->block_size = gzip->block_size;
 	cfg->opt.gzip.level = gzip->opt.level;
 	cfg->opt.gzip.window_size = gzip->opt.window;
+	cfg->opt.gzip.strategy_search = gzip->search;
 
 	if (!gzip->compress)
 		cfg->flags |= SQFS_COMP_FLAG_UNCOMPRESS;
@@ -126,12 +134,18 @@ static int find_strategy(gzip_compressor_t *gzip, const sqfs_u8 *in,
 			 sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
 {
 	int ret, strategy, selected = Z_DEFAULT_STRATEGY;
-	size_t i, length, minlength = 0;
+	size_t i, bit, winner = 0, length, minlength = 0;
 
-	for (i = 0x01; i & SQFS_COMP_FLAG_GZIP_ALL; i <<= 1) {
+	if (gzip->search == SQFS_GZIP_SEARCH_SAMPLE && size > GZIP_SAMPLE_SIZE)
+		size = GZIP_SAMPLE_SIZE;
+
+	for (i = 0x01, bit = 0; i & SQFS_COMP_FLAG_GZIP_ALL; i <<= 1, ++bit) {
 		if ((gzip->opt.strategies & i) == 0)
 			continue;
 
+		gzip->stats.trial_count += 1;
+		gzip->stats.trial_bytes += size;
+
 		ret = deflateReset(&gzip->strm);
 		if (ret != Z_OK)
 			return SQFS_ERROR_COMPRESSOR;
@@ -155,12 +169,18 @@ static int find_strategy(gzip_compressor_t *gzip, const sqfs_u8 *in,
 			if (minlength == 0 || length < minlength) {
 				minlength = length;
 				selected = strategy;
+				winner = bit;
 			}
 		} else if (ret != Z_OK && ret != Z_BUF_ERROR) {
 			return SQFS_ERROR_COMPRESSOR;
 		}
 	}
 
+	gzip->stats.search_count += 1;
+
+	if (minlength > 0)
+		gzip->stats.flag_wins[winner] += 1;
+
 	return selected;
 }
 
@@ -231,6 +251,8 @@ static sqfs_object_t *gzip_create_copy(const sqfs_object_t *cmp)
 
 	memcpy(gzip, cmp, sizeof(*gzip));
 	memset(&gzip->strm, 0, sizeof(gzip->strm));
+	memset(&gzip->stats, 0, sizeof(gzip->stats));
+	gzip->stats.size = sizeof(gzip->stats);
 
 	if (gzip->compress) {
 		ret = deflateInit2(&gzip->strm, gzip->opt.level, Z_DEFLATED,
@@ -247,6 +269,18 @@ static sqfs_object_t *gzip_create_copy(const sqfs_object_t *cmp)
 	return (sqfs_object_t *)gzip;
 }
 
+int gzip_get_stats(const sqfs_compressor_t *cmp,
+		   sqfs_compressor_stats_t *stats)
+{
+	const gzip_compressor_t *gzip = (const gzip_compressor_t *)cmp;
+
+	if (cmp->do_block != gzip_do_block)
+		return SQFS_ERROR_UNSUPPORTED;
+
+	memcpy(stats, &gzip->stats, sizeof(*stats));
+	return 0;
+}
+
 int gzip_compressor_create(const sqfs_compressor_config_t *cfg,
 			   sqfs_compressor_t **out)
 {
@@ -269,6 +303,9 @@ int gzip_compressor_create(const sqfs_compressor_config_t *cfg,
 		return SQFS_ERROR_UNSUPPORTED;
 	}
 
+	if (cfg->opt.gzip.strategy_search > SQFS_GZIP_SEARCH_SAMPLE)
+		return SQFS_ERROR_UNSUPPORTED;
+
 	gzip = calloc(1, sizeof(*gzip));
 	base = (sqfs_compressor_t *)gzip;
 
@@ -277,6 +314,7 @@ int gzip_compressor_create(const sqfs_compressor_config_t *cfg,
 
 	gzip->opt.level = cfg->opt.gzip.level;
 	gzip->opt.window = cfg->opt.gzip.window_size;
+	gzip->search = cfg->opt.gzip.strategy_search;
 	gzip->opt.strategies = cfg->flags & SQFS_COMP_FLAG_GZIP_ALL;
 	gzip->compress = (cfg->flags & SQFS_COMP_FLAG_UNCOMPRESS) == 0;
 	gzip->block_size = cfg->block_size;
@@ -300,6 +338,8 @@ int gzip_compressor_create(const sqfs_compressor_config_t *cfg,
 		return SQFS_ERROR_COMPRESSOR;
 	}
 
+	gzip->stats.size = sizeof(gzip->stats);
+
 	*out = base;
 	return 0;
 }
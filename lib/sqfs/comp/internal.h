@@ -31,6 +31,10 @@ SQFS_INTERNAL
 int gzip_compressor_create(const sqfs_compressor_config_t *cfg,
 			   sqfs_compressor_t **out);
 
+SQFS_INTERNAL
+int gzip_get_stats(const sqfs_compressor_t *cmp,
+		   sqfs_compressor_stats_t *stats);
+
 SQFS_INTERNAL
 int lz4_compressor_create(const sqfs_compressor_config_t *cfg,
 			  sqfs_compressor_t **out);
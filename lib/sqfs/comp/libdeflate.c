@@ -0,0 +1,260 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * libdeflate.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libdeflate.h>
+
+#include "internal.h"
+
+/*
+  A drop-in replacement for the zlib based gzip compressor. SquashFS always
+  compresses entire blocks in one go, which is exactly what the buffer to
+  buffer interface of libdeflate does, only faster. The output is a regular
+  zlib stream.
+ */
+
+typedef struct {
+	sqfs_u32 level;
+	sqfs_u16 window;
+	sqfs_u16 strategies;
+} gzip_options_t;
+
+typedef struct {
+	sqfs_compressor_t base;
+
+	struct libdeflate_compressor *cmp;
+	struct libdeflate_decompressor *dcmp;
+
+	size_t block_size;
+	gzip_options_t opt;
+} deflate_compressor_t;
+
+static void deflate_destroy(sqfs_object_t *base)
+{
+	deflate_compressor_t *gzip = (deflate_compressor_t *)base;
+
+	if (gzip->cmp != NULL)
+		libdeflate_free_compressor(gzip->cmp);
+
+	if (gzip->dcmp != NULL)
+		libdeflate_free_decompressor(gzip->dcmp);
+
+	free(gzip);
+}
+
+static void deflate_get_configuration(const sqfs_compressor_t *base,
+				      sqfs_compressor_config_t *cfg)
+{
+	const deflate_compressor_t *gzip = (const deflate_compressor_t *)base;
+
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->id = SQFS_COMP_GZIP;
+	cfg->flags = gzip->opt.strategies;
+	cfg->block_size = gzip->block_size;
+	cfg->opt.gzip.level = gzip->opt.level;
+	cfg->opt.gzip.window_size = gzip->opt.window;
+
+	if (gzip->cmp == NULL)
+		cfg->flags |= SQFS_COMP_FLAG_UNCOMPRESS;
+}
+
+static int deflate_write_options(sqfs_compressor_t *base, sqfs_file_t *file)
+{
+	deflate_compressor_t *gzip = (deflate_compressor_t *)base;
+	gzip_options_t opt;
+	sqfs_u32 level;
+
+	/* the higher libdeflate levels do not fit the zlib based range */
+	level = gzip->opt.level;
+	if (level > SQFS_GZIP_MAX_LEVEL)
+		level = SQFS_GZIP_MAX_LEVEL;
+
+	if (level == SQFS_GZIP_DEFAULT_LEVEL &&
+	    gzip->opt.window == SQFS_GZIP_DEFAULT_WINDOW &&
+	    gzip->opt.strategies == 0) {
+		return 0;
+	}
+
+	opt.level = htole32(level);
+	opt.window = htole16(gzip->opt.window);
+	opt.strategies = htole16(gzip->opt.strategies);
+
+	return sqfs_generic_write_options(file, &opt, sizeof(opt));
+}
+
+static int deflate_read_options(sqfs_compressor_t *base, sqfs_file_t *file)
+{
+	deflate_compressor_t *gzip = (deflate_compressor_t *)base;
+	gzip_options_t opt;
+	int ret;
+
+	ret = sqfs_generic_read_options(file, &opt, sizeof(opt));
+	if (ret)
+		return ret;
+
+	gzip->opt.level = le32toh(opt.level);
+	gzip->opt.window = le16toh(opt.window);
+	gzip->opt.strategies = le16toh(opt.strategies);
+
+	if (gzip->opt.level < 1 || gzip->opt.level > 9)
+		return SQFS_ERROR_UNSUPPORTED;
+
+	if (gzip->opt.window < 8 || gzip->opt.window > 15)
+		return SQFS_ERROR_UNSUPPORTED;
+
+	if (gzip->opt.strategies & ~SQFS_COMP_FLAG_GZIP_ALL)
+		return SQFS_ERROR_UNSUPPORTED;
+
+	return 0;
+}
+
+static sqfs_s32 deflate_comp_block(sqfs_compressor_t *base, const sqfs_u8 *in,
+				   sqfs_u32 size, sqfs_u8 *out,
+				   sqfs_u32 outsize)
+{
+	deflate_compressor_t *gzip = (deflate_compressor_t *)base;
+	size_t ret;
+
+	if (size >= 0x7FFFFFFF)
+		return SQFS_ERROR_ARG_INVALID;
+
+	ret = libdeflate_zlib_compress(gzip->cmp, in, size, out, outsize);
+
+	return ret < size ? ret : 0;
+}
+
+static sqfs_s32 deflate_uncomp_block(sqfs_compressor_t *base,
+				     const sqfs_u8 *in, sqfs_u32 size,
+				     sqfs_u8 *out, sqfs_u32 outsize)
+{
+	deflate_compressor_t *gzip = (deflate_compressor_t *)base;
+	enum libdeflate_result ret;
+	size_t written;
+
+	if (size >= 0x7FFFFFFF)
+		return SQFS_ERROR_ARG_INVALID;
+
+	ret = libdeflate_zlib_decompress(gzip->dcmp, in, size,
+					 out, outsize, &written);
+
+	if (ret == LIBDEFLATE_SUCCESS)
+		return written;
+
+	if (ret == LIBDEFLATE_INSUFFICIENT_SPACE)
+		return 0;
+
+	return SQFS_ERROR_COMPRESSOR;
+}
+
+static int alloc_state(deflate_compressor_t *gzip, bool compress)
+{
+	if (compress) {
+		gzip->cmp = libdeflate_alloc_compressor(gzip->opt.level);
+		return gzip->cmp == NULL ? -1 : 0;
+	}
+
+	gzip->dcmp = libdeflate_alloc_decompressor();
+	return gzip->dcmp == NULL ? -1 : 0;
+}
+
+static sqfs_object_t *deflate_create_copy(const sqfs_object_t *cmp)
+{
+	deflate_compressor_t *gzip = malloc(sizeof(*gzip));
+	bool compress;
+
+	if (gzip == NULL)
+		return NULL;
+
+	memcpy(gzip, cmp, sizeof(*gzip));
+	compress = gzip->cmp != NULL;
+	gzip->cmp = NULL;
+	gzip->dcmp = NULL;
+
+	if (alloc_state(gzip, compress)) {
+		free(gzip);
+		return NULL;
+	}
+
+	return (sqfs_object_t *)gzip;
+}
+
+/* there are no strategies to search, so all counters always stay zero */
+int gzip_get_stats(const sqfs_compressor_t *cmp,
+		   sqfs_compressor_stats_t *stats)
+{
+	if (cmp->do_block != deflate_comp_block &&
+	    cmp->do_block != deflate_uncomp_block) {
+		return SQFS_ERROR_UNSUPPORTED;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+	stats->size = sizeof(*stats);
+	return 0;
+}
+
+int gzip_compressor_create(const sqfs_compressor_config_t *cfg,
+			   sqfs_compressor_t **out)
+{
+	deflate_compressor_t *gzip;
+	sqfs_compressor_t *base;
+	bool compress;
+
+	if (cfg->flags & ~(SQFS_COMP_FLAG_GZIP_ALL |
+			   SQFS_COMP_FLAG_GENERIC_ALL)) {
+		return SQFS_ERROR_UNSUPPORTED;
+	}
+
+	if (cfg->opt.gzip.level < SQFS_GZIP_MIN_LEVEL ||
+	    cfg->opt.gzip.level > SQFS_GZIP_MAX_LEVEL_EXT) {
+		return SQFS_ERROR_UNSUPPORTED;
+	}
+
+	if (cfg->opt.gzip.window_size < SQFS_GZIP_MIN_WINDOW ||
+	    cfg->opt.gzip.window_size > SQFS_GZIP_MAX_WINDOW) {
+		return SQFS_ERROR_UNSUPPORTED;
+	}
+
+	if (cfg->opt.gzip.strategy_search > SQFS_GZIP_SEARCH_SAMPLE)
+		return SQFS_ERROR_UNSUPPORTED;
+
+	compress = (cfg->flags & SQFS_COMP_FLAG_UNCOMPRESS) == 0;
+
+	/* libdeflate always uses a 32k window and has no strategies */
+	if (compress && ((cfg->flags & SQFS_COMP_FLAG_GZIP_ALL) ||
+			 cfg->opt.gzip.window_size != SQFS_GZIP_MAX_WINDOW)) {
+		return SQFS_ERROR_UNSUPPORTED;
+	}
+
+	gzip = calloc(1, sizeof(*gzip));
+	base = (sqfs_compressor_t *)gzip;
+
+	if (gzip == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	gzip->opt.level = cfg->opt.gzip.level;
+	gzip->opt.window = cfg->opt.gzip.window_size;
+	gzip->opt.strategies = cfg->flags & SQFS_COMP_FLAG_GZIP_ALL;
+	gzip->block_size = cfg->block_size;
+	base->get_configuration = deflate_get_configuration;
+	base->do_block = compress ? deflate_comp_block : deflate_uncomp_block;
+	base->write_options = deflate_write_options;
+	base->read_options = deflate_read_options;
+	((sqfs_object_t *)base)->copy = deflate_create_copy;
+	((sqfs_object_t *)base)->destroy = deflate_destroy;
+
+	if (alloc_state(gzip, compress)) {
+		free(gzip);
+		return SQFS_ERROR_COMPRESSOR;
+	}
+
+	*out = base;
+	return 0;
+}
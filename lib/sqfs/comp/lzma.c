@@ -24,6 +24,9 @@
 typedef struct {
 	sqfs_compressor_t base;
 	size_t block_size;
+
+	/* reset for every block, instead of setting up a new encoder */
+	lzma_stream strm;
 } lzma_compressor_t;
 
 static int lzma_write_options(sqfs_compressor_t *base, sqfs_file_t *file)
@@ -43,7 +46,7 @@ static sqfs_s32 lzma_comp_block(sqfs_compressor_t *base, const sqfs_u8 *in,
 				sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
 {
 	lzma_compressor_t *lzma = (lzma_compressor_t *)base;
-	lzma_stream strm = LZMA_STREAM_INIT;
+	lzma_stream *strm = &lzma->strm;
 	lzma_options_lzma opt;
 	int ret;
 
@@ -53,23 +56,20 @@ static sqfs_s32 lzma_comp_block(sqfs_compressor_t *base, const sqfs_u8 *in,
 	lzma_lzma_preset(&opt, LZMA_DEFAULT_LEVEL);
 	opt.dict_size = lzma->block_size;
 
-	if (lzma_alone_encoder(&strm, &opt) != LZMA_OK) {
-		lzma_end(&strm);
+	if (lzma_alone_encoder(strm, &opt) != LZMA_OK)
 		return SQFS_ERROR_COMPRESSOR;
-	}
 
-	strm.next_out = out;
-	strm.avail_out = outsize;
-	strm.next_in = in;
-	strm.avail_in = size;
+	strm->next_out = out;
+	strm->avail_out = outsize;
+	strm->next_in = in;
+	strm->avail_in = size;
 
-	ret = lzma_code(&strm, LZMA_FINISH);
-	lzma_end(&strm);
+	ret = lzma_code(strm, LZMA_FINISH);
 
 	if (ret != LZMA_STREAM_END)
 		return ret == LZMA_OK ? 0 : SQFS_ERROR_COMPRESSOR;
 
-	if (strm.total_out > size)
+	if (strm->total_out > size)
 		return 0;
 
 	out[LZMA_SIZE_OFFSET    ] = size & 0xFF;
@@ -80,7 +80,7 @@ static sqfs_s32 lzma_comp_block(sqfs_compressor_t *base, const sqfs_u8 *in,
 	out[LZMA_SIZE_OFFSET + 5] = 0;
 	out[LZMA_SIZE_OFFSET + 6] = 0;
 	out[LZMA_SIZE_OFFSET + 7] = 0;
-	return strm.total_out;
+	return strm->total_out;
 }
 
 static sqfs_s32 lzma_uncomp_block(sqfs_compressor_t *base, const sqfs_u8 *in,
@@ -159,21 +159,26 @@ static void lzma_get_configuration(const sqfs_compressor_t *base,
 static sqfs_object_t *lzma_create_copy(const sqfs_object_t *cmp)
 {
 	lzma_compressor_t *copy = malloc(sizeof(*copy));
+	lzma_stream strm_init = LZMA_STREAM_INIT;
 
-	if (copy != NULL)
+	if (copy != NULL) {
 		memcpy(copy, cmp, sizeof(*copy));
+		copy->strm = strm_init;
+	}
 
 	return (sqfs_object_t *)copy;
 }
 
 static void lzma_destroy(sqfs_object_t *base)
 {
+	lzma_end(&((lzma_compressor_t *)base)->strm);
 	free(base);
 }
 
 int lzma_compressor_create(const sqfs_compressor_config_t *cfg,
 			   sqfs_compressor_t **out)
 {
+	lzma_stream strm_init = LZMA_STREAM_INIT;
 	sqfs_compressor_t *base;
 	lzma_compressor_t *lzma;
 
@@ -185,6 +190,7 @@ int lzma_compressor_create(const sqfs_compressor_config_t *cfg,
 	if (lzma == NULL)
 		return SQFS_ERROR_ALLOC;
 
+	lzma->strm = strm_init;
 	lzma->block_size = cfg->block_size;
 
 	if (lzma->block_size < SQFS_META_BLOCK_SIZE)
@@ -14,11 +14,33 @@
 
 #include "internal.h"
 
+/* the worst case size of a block, see lzma2_bound() in liblzma */
+#define LZMA2_CHUNK_MAX (1 << 16)
+#define LZMA2_CHUNK_OVERHEAD (3)
+
+/*
+  How much more often branch instructions have to show up in a block than
+  in random data, before guessing that it contains code of that kind.
+ */
+#define BCJ_MIN_HITS (16)
+#define BCJ_MIN_SCORE (4)
+
+/* ranks filters that match an executable header above all statistics */
+#define BCJ_HEADER_SCORE (0x10000000)
+
 typedef struct {
 	sqfs_compressor_t base;
 	size_t block_size;
 	size_t dict_size;
 	int flags;
+	int select;
+
+	/*
+	  Encoders that are reset for every block instead of creating new
+	  ones, so the match finder is not allocated and set up again each
+	  time. One for plain LZMA2, one for LZMA2 behind a BCJ filter.
+	 */
+	lzma_stream strm[2];
 } xz_compressor_t;
 
 typedef struct {
@@ -74,6 +96,117 @@ static int xz_read_options(sqfs_compressor_t *base, sqfs_file_t *file)
 	return 0;
 }
 
+/*
+  Produces the same output as lzma_stream_buffer_encode would for a single
+  block, but with an encoder that is kept around.
+ */
+static lzma_ret encode_stream(lzma_stream *strm, lzma_filter *filters,
+			      const sqfs_u8 *in, size_t size,
+			      sqfs_u8 *out, size_t *out_pos, size_t outsize)
+{
+	size_t pos, start, end, padding;
+	lzma_stream_flags flags;
+	lzma_block block;
+	lzma_index *idx;
+	sqfs_u32 crc;
+	lzma_ret ret;
+
+	if (size == 0 || outsize <= 2 * LZMA_STREAM_HEADER_SIZE)
+		return LZMA_BUF_ERROR;
+
+	memset(&flags, 0, sizeof(flags));
+	flags.check = LZMA_CHECK_CRC32;
+
+	ret = lzma_stream_header_encode(&flags, out);
+	if (ret != LZMA_OK)
+		return ret;
+
+	pos = LZMA_STREAM_HEADER_SIZE;
+
+	/* room for the stream footer, block check and padding */
+	end = outsize - LZMA_STREAM_HEADER_SIZE;
+	end -= (end - pos) & 3;
+
+	if (end - pos <= sizeof(crc))
+		return LZMA_BUF_ERROR;
+
+	end -= sizeof(crc);
+
+	memset(&block, 0, sizeof(block));
+	block.check = LZMA_CHECK_CRC32;
+	block.filters = filters;
+	block.uncompressed_size = size;
+	block.compressed_size = size + LZMA2_CHUNK_OVERHEAD *
+		((size + LZMA2_CHUNK_MAX - 1) / LZMA2_CHUNK_MAX) + 1;
+
+	ret = lzma_block_header_size(&block);
+	if (ret != LZMA_OK)
+		return ret;
+
+	if (end - pos <= block.header_size)
+		return LZMA_BUF_ERROR;
+
+	start = pos;
+	pos += block.header_size;
+
+	/* stop once the output gets bigger than an uncompressed block */
+	if (end - pos > block.compressed_size)
+		end = pos + block.compressed_size;
+
+	ret = lzma_raw_encoder(strm, filters);
+	if (ret != LZMA_OK)
+		return ret;
+
+	strm->next_in = in;
+	strm->avail_in = size;
+	strm->next_out = out + pos;
+	strm->avail_out = end - pos;
+
+	ret = lzma_code(strm, LZMA_FINISH);
+	if (ret != LZMA_STREAM_END)
+		return ret == LZMA_OK ? LZMA_BUF_ERROR : ret;
+
+	pos = end - strm->avail_out;
+	block.compressed_size = pos - (start + block.header_size);
+
+	ret = lzma_block_header_encode(&block, out + start);
+	if (ret != LZMA_OK)
+		return ret;
+
+	for (padding = block.compressed_size; padding & 3; ++padding)
+		out[pos++] = 0;
+
+	crc = htole32(lzma_crc32(in, size, 0));
+	memcpy(out + pos, &crc, sizeof(crc));
+	pos += sizeof(crc);
+
+	idx = lzma_index_init(NULL);
+	if (idx == NULL)
+		return LZMA_MEM_ERROR;
+
+	ret = lzma_index_append(idx, NULL, lzma_block_unpadded_size(&block),
+				block.uncompressed_size);
+
+	if (ret == LZMA_OK) {
+		ret = lzma_index_buffer_encode(idx, out, &pos,
+					       outsize -
+					       LZMA_STREAM_HEADER_SIZE);
+		flags.backward_size = lzma_index_size(idx);
+	}
+
+	lzma_index_end(idx, NULL);
+
+	if (ret != LZMA_OK)
+		return ret;
+
+	ret = lzma_stream_footer_encode(&flags, out + pos);
+	if (ret != LZMA_OK)
+		return ret;
+
+	*out_pos = pos + LZMA_STREAM_HEADER_SIZE;
+	return LZMA_OK;
+}
+
 static sqfs_s32 compress(xz_compressor_t *xz, lzma_vli filter,
 			 const sqfs_u8 *in, sqfs_u32 size,
 			 sqfs_u8 *out, sqfs_u32 outsize)
@@ -81,6 +214,7 @@ static sqfs_s32 compress(xz_compressor_t *xz, lzma_vli filter,
 	lzma_filter filters[5];
 	lzma_options_lzma opt;
 	size_t written = 0;
+	lzma_stream *strm;
 	lzma_ret ret;
 	int i = 0;
 
@@ -88,10 +222,12 @@ static sqfs_s32 compress(xz_compressor_t *xz, lzma_vli filter,
 		return SQFS_ERROR_COMPRESSOR;
 
 	opt.dict_size = xz->dict_size;
+	strm = xz->strm;
 
 	if (filter != LZMA_VLI_UNKNOWN) {
 		filters[i].id = filter;
 		filters[i].options = NULL;
+		strm = xz->strm + 1;
 		++i;
 	}
 
@@ -103,8 +239,7 @@ static sqfs_s32 compress(xz_compressor_t *xz, lzma_vli filter,
 	filters[i].options = NULL;
 	++i;
 
-	ret = lzma_stream_buffer_encode(filters, LZMA_CHECK_CRC32, NULL,
-					in, size, out, &written, outsize);
+	ret = encode_stream(strm, filters, in, size, out, &written, outsize);
 
 	if (ret == LZMA_OK)
 		return (written >= size) ? 0 : written;
@@ -135,43 +270,337 @@ static lzma_vli flag_to_vli(int flag)
 	return LZMA_VLI_UNKNOWN;
 }
 
-static sqfs_s32 xz_comp_block(sqfs_compressor_t *base, const sqfs_u8 *in,
-			      sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
+static sqfs_u16 get_u16(const sqfs_u8 *ptr, bool big_endian)
 {
-	xz_compressor_t *xz = (xz_compressor_t *)base;
-	lzma_vli filter, selected = LZMA_VLI_UNKNOWN;
-	sqfs_s32 ret, smallest;
-	size_t i;
+	if (big_endian)
+		return ((sqfs_u16)ptr[0] << 8) | ptr[1];
 
-	if (size >= 0x7FFFFFFF)
-		return SQFS_ERROR_ARG_INVALID;
+	return ((sqfs_u16)ptr[1] << 8) | ptr[0];
+}
 
-	ret = compress(xz, LZMA_VLI_UNKNOWN, in, size, out, outsize);
-	if (ret < 0 || xz->flags == 0)
-		return ret;
+static sqfs_u32 get_u32(const sqfs_u8 *ptr, bool big_endian)
+{
+	if (big_endian) {
+		return ((sqfs_u32)ptr[0] << 24) | ((sqfs_u32)ptr[1] << 16) |
+			((sqfs_u32)ptr[2] << 8) | ptr[3];
+	}
 
-	smallest = ret;
+	return ((sqfs_u32)ptr[3] << 24) | ((sqfs_u32)ptr[2] << 16) |
+		((sqfs_u32)ptr[1] << 8) | ptr[0];
+}
+
+/*
+  Data blocks of a file start at a block boundary, so the first block of an
+  executable starts with its ELF, PE or Mach-O header. Returns the filters
+  that fit the architecture in the header.
+ */
+static int guess_from_header(const sqfs_u8 *in, size_t size)
+{
+	sqfs_u32 offset, type;
+	bool big_endian;
+
+	if (size >= 20 && memcmp(in, "\x7F" "ELF", 4) == 0) {
+		switch (get_u16(in + 18, in[5] == 2)) {
+		case 3:		/* EM_386 */
+		case 62:	/* EM_X86_64 */
+			return SQFS_COMP_FLAG_XZ_X86;
+		case 20:	/* EM_PPC */
+		case 21:	/* EM_PPC64 */
+			return SQFS_COMP_FLAG_XZ_POWERPC;
+		case 50:	/* EM_IA_64 */
+			return SQFS_COMP_FLAG_XZ_IA64;
+		case 40:	/* EM_ARM */
+			return SQFS_COMP_FLAG_XZ_ARM |
+				SQFS_COMP_FLAG_XZ_ARMTHUMB;
+		case 2:		/* EM_SPARC */
+		case 18:	/* EM_SPARC32PLUS */
+		case 43:	/* EM_SPARCV9 */
+			return SQFS_COMP_FLAG_XZ_SPARC;
+		}
+		return 0;
+	}
+
+	if (size >= 0x40 && in[0] == 'M' && in[1] == 'Z') {
+		offset = get_u32(in + 0x3C, false);
+
+		if (offset > size - 6 || memcmp(in + offset, "PE\0\0", 4))
+			return 0;
+
+		switch (get_u16(in + offset + 4, false)) {
+		case 0x014C:	/* i386 */
+		case 0x8664:	/* AMD64 */
+			return SQFS_COMP_FLAG_XZ_X86;
+		case 0x01F0:	/* PowerPC */
+		case 0x01F1:	/* PowerPC with FPU */
+			return SQFS_COMP_FLAG_XZ_POWERPC;
+		case 0x0200:	/* IA64 */
+			return SQFS_COMP_FLAG_XZ_IA64;
+		case 0x01C0:	/* ARM */
+			return SQFS_COMP_FLAG_XZ_ARM;
+		case 0x01C2:	/* Thumb */
+		case 0x01C4:	/* ARMv7 Thumb-2 */
+			return SQFS_COMP_FLAG_XZ_ARMTHUMB;
+		}
+		return 0;
+	}
+
+	if (size < 8)
+		return 0;
+
+	switch (get_u32(in, true)) {
+	case 0xFEEDFACE:
+	case 0xFEEDFACF:
+		big_endian = true;
+		break;
+	case 0xCEFAEDFE:
+	case 0xCFFAEDFE:
+		big_endian = false;
+		break;
+	default:
+		return 0;
+	}
+
+	/* mask out the 64 bit ABI flag */
+	type = get_u32(in + 4, big_endian) & 0x00FFFFFF;
+
+	switch (type) {
+	case 7:		/* CPU_TYPE_X86 */
+		return SQFS_COMP_FLAG_XZ_X86;
+	case 12:	/* CPU_TYPE_ARM */
+		return SQFS_COMP_FLAG_XZ_ARM | SQFS_COMP_FLAG_XZ_ARMTHUMB;
+	case 14:	/* CPU_TYPE_SPARC */
+		return SQFS_COMP_FLAG_XZ_SPARC;
+	case 18:	/* CPU_TYPE_POWERPC */
+		return SQFS_COMP_FLAG_XZ_POWERPC;
+	}
+
+	return 0;
+}
+
+/*
+  Compares how often the branch instructions a filter converts show up,
+  to how often the same pattern appears in random data, i.e. once in
+  'rarity' tries.
+ */
+static size_t score(size_t hits, size_t tries, size_t rarity)
+{
+	size_t ratio;
+
+	if (hits < BCJ_MIN_HITS || tries == 0)
+		return 0;
+
+	ratio = (sqfs_u64)hits * rarity / tries;
+	return ratio >= BCJ_MIN_SCORE ? ratio : 0;
+}
+
+static size_t score_x86(const sqfs_u8 *in, size_t size)
+{
+	size_t i, hits = 0;
+
+	/* call/jmp with a rel32 that reaches less than 16M */
+	for (i = 0; i + 5 <= size; ++i) {
+		if ((in[i] & 0xFE) == 0xE8 &&
+		    (in[i + 4] == 0x00 || in[i + 4] == 0xFF)) {
+			++hits;
+		}
+	}
+
+	return score(hits, i, 16384);
+}
+
+static size_t score_powerpc(const sqfs_u8 *in, size_t size)
+{
+	size_t i, hits = 0;
+
+	/* bl, big endian */
+	for (i = 0; i + 4 <= size; i += 4) {
+		if ((in[i] & 0xFC) == 0x48 && (in[i + 3] & 0x03) == 0x01)
+			++hits;
+	}
+
+	return score(hits, i / 4, 256);
+}
+
+static size_t score_ia64(const sqfs_u8 *in, size_t size)
+{
+	static const sqfs_u32 branch_mask = 0x33CF0000;
+	static const sqfs_u32 reserved_mask = 0xC03000C0;
+	size_t i, hits = 0, reserved = 0;
+	sqfs_u32 tmpl;
+
+	/*
+	  A third of the bundle templates contain a branch, so there is no
+	  strong pattern to count. Instead, look for blocks full of branches,
+	  but without a single reserved template.
+	 */
+	for (i = 0; i + 16 <= size; i += 16) {
+		tmpl = 1UL << (in[i] & 0x1F);
+
+		if (tmpl & branch_mask)
+			++hits;
+
+		if (tmpl & reserved_mask)
+			++reserved;
+	}
+
+	if (reserved > 0 || hits < BCJ_MIN_HITS || hits < (i / 16) / 8)
+		return 0;
+
+	return BCJ_MIN_SCORE;
+}
+
+static size_t score_arm(const sqfs_u8 *in, size_t size)
+{
+	size_t i, hits = 0;
+
+	/* unconditional bl, little endian */
+	for (i = 0; i + 4 <= size; i += 4) {
+		if (in[i + 3] == 0xEB)
+			++hits;
+	}
+
+	return score(hits, i / 4, 256);
+}
+
+static size_t score_armthumb(const sqfs_u8 *in, size_t size)
+{
+	size_t i, tries = 0, hits = 0;
+
+	/* the two halves of a bl, little endian */
+	for (i = 0; i + 4 <= size; i += 2) {
+		++tries;
+
+		if ((in[i + 1] & 0xF8) == 0xF0 && (in[i + 3] & 0xF8) == 0xF8) {
+			++hits;
+			i += 2;
+		}
+	}
+
+	return score(hits, tries, 1024);
+}
+
+static size_t score_sparc(const sqfs_u8 *in, size_t size)
+{
+	size_t i, hits = 0;
+
+	/* call, with a displacement that reaches less than 16M */
+	for (i = 0; i + 4 <= size; i += 4) {
+		if ((in[i] == 0x40 && (in[i + 1] & 0xC0) == 0x00) ||
+		    (in[i] == 0x7F && (in[i + 1] & 0xC0) == 0xC0)) {
+			++hits;
+		}
+	}
+
+	return score(hits, i / 4, 512);
+}
+
+/*
+  Instead of trying all enabled filters, guess which ones are most likely
+  to help. Writes the filters to try to 'list', most likely first and
+  returns how many there are.
+ */
+static size_t guess_filters(const xz_compressor_t *xz, const sqfs_u8 *in,
+			    size_t size, lzma_vli *list, size_t max)
+{
+	size_t i, value, best[2] = { 0, 0 };
+	int header, flag[2] = { 0, 0 };
+
+	header = guess_from_header(in, size) & xz->flags;
 
 	for (i = 1; i & SQFS_COMP_FLAG_XZ_ALL; i <<= 1) {
 		if ((xz->flags & i) == 0)
 			continue;
 
-		filter = flag_to_vli(i);
+		switch (i) {
+		case SQFS_COMP_FLAG_XZ_X86:
+			value = score_x86(in, size);
+			break;
+		case SQFS_COMP_FLAG_XZ_POWERPC:
+			value = score_powerpc(in, size);
+			break;
+		case SQFS_COMP_FLAG_XZ_IA64:
+			value = score_ia64(in, size);
+			break;
+		case SQFS_COMP_FLAG_XZ_ARM:
+			value = score_arm(in, size);
+			break;
+		case SQFS_COMP_FLAG_XZ_ARMTHUMB:
+			value = score_armthumb(in, size);
+			break;
+		default:
+			value = score_sparc(in, size);
+			break;
+		}
+
+		if (header & i)
+			value += BCJ_HEADER_SCORE;
+
+		if (value > best[0]) {
+			best[1] = best[0];
+			flag[1] = flag[0];
+			best[0] = value;
+			flag[0] = i;
+		} else if (value > best[1]) {
+			best[1] = value;
+			flag[1] = i;
+		}
+	}
+
+	/* if a filter fits, not using one at all is the next best guess */
+	for (i = 0; i < max; ++i) {
+		list[i] = flag_to_vli(flag[i]);
+
+		if (flag[i] == 0)
+			return i + 1;
+	}
+
+	return max;
+}
+
+static sqfs_s32 xz_comp_block(sqfs_compressor_t *base, const sqfs_u8 *in,
+			      sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
+{
+	xz_compressor_t *xz = (xz_compressor_t *)base;
+	lzma_vli filters[7];
+	size_t i, count = 0, selected = 0;
+	sqfs_s32 ret, smallest = 0;
+
+	if (size >= 0x7FFFFFFF)
+		return SQFS_ERROR_ARG_INVALID;
 
-		ret = compress(xz, filter, in, size, out, outsize);
+	switch (xz->select) {
+	case SQFS_XZ_SELECT_GUESS:
+		count = guess_filters(xz, in, size, filters, 1);
+		break;
+	case SQFS_XZ_SELECT_GUESS_VERIFY:
+		count = guess_filters(xz, in, size, filters, 2);
+		break;
+	default:
+		filters[count++] = LZMA_VLI_UNKNOWN;
+
+		for (i = 1; i & SQFS_COMP_FLAG_XZ_ALL; i <<= 1) {
+			if (xz->flags & i)
+				filters[count++] = flag_to_vli(i);
+		}
+		break;
+	}
+
+	for (i = 0; i < count; ++i) {
+		ret = compress(xz, filters[i], in, size, out, outsize);
 		if (ret < 0)
 			return ret;
 
 		if (ret > 0 && (smallest == 0 || ret < smallest)) {
 			smallest = ret;
-			selected = filter;
+			selected = i;
 		}
 	}
 
-	if (smallest == 0)
-		return 0;
+	/* the output buffer still holds the last result */
+	if (smallest == 0 || selected == count - 1)
+		return smallest;
 
-	return compress(xz, selected, in, size, out, outsize);
+	return compress(xz, filters[selected], in, size, out, outsize);
 }
 
 static sqfs_s32 xz_uncomp_block(sqfs_compressor_t *base, const sqfs_u8 *in,
@@ -206,6 +635,7 @@ static void xz_get_configuration(const sqfs_compressor_t *base,
 	cfg->flags = xz->flags;
 	cfg->block_size = xz->block_size;
 	cfg->opt.xz.dict_size = xz->dict_size;
+	cfg->opt.xz.filter_select = xz->select;
 
 	if (base->do_block == xz_uncomp_block)
 		cfg->flags |= SQFS_COMP_FLAG_UNCOMPRESS;
@@ -214,22 +644,30 @@ static void xz_get_configuration(const sqfs_compressor_t *base,
 static sqfs_object_t *xz_create_copy(const sqfs_object_t *cmp)
 {
 	xz_compressor_t *xz = malloc(sizeof(*xz));
+	lzma_stream strm_init = LZMA_STREAM_INIT;
 
 	if (xz == NULL)
 		return NULL;
 
 	memcpy(xz, cmp, sizeof(*xz));
+	xz->strm[0] = strm_init;
+	xz->strm[1] = strm_init;
 	return (sqfs_object_t *)xz;
 }
 
 static void xz_destroy(sqfs_object_t *base)
 {
+	xz_compressor_t *xz = (xz_compressor_t *)base;
+
+	lzma_end(xz->strm);
+	lzma_end(xz->strm + 1);
 	free(base);
 }
 
 int xz_compressor_create(const sqfs_compressor_config_t *cfg,
 			 sqfs_compressor_t **out)
 {
+	lzma_stream strm_init = LZMA_STREAM_INIT;
 	sqfs_compressor_t *base;
 	xz_compressor_t *xz;
 
@@ -241,13 +679,20 @@ int xz_compressor_create(const sqfs_compressor_config_t *cfg,
 	if (!is_dict_size_valid(cfg->opt.xz.dict_size))
 		return SQFS_ERROR_UNSUPPORTED;
 
+	if (cfg->opt.xz.filter_select > SQFS_XZ_SELECT_GUESS_VERIFY)
+		return SQFS_ERROR_UNSUPPORTED;
+
 	xz = calloc(1, sizeof(*xz));
 	base = (sqfs_compressor_t *)xz;
 	if (xz == NULL)
 		return SQFS_ERROR_ALLOC;
 
+	xz->strm[0] = strm_init;
+	xz->strm[1] = strm_init;
+
 	xz->flags = cfg->flags;
 	xz->dict_size = cfg->opt.xz.dict_size;
+	xz->select = cfg->opt.xz.filter_select;
 	xz->block_size = cfg->block_size;
 	base->get_configuration = xz_get_configuration;
 	base->do_block = (cfg->flags & SQFS_COMP_FLAG_UNCOMPRESS) ?
@@ -20,7 +20,11 @@ typedef struct {
 	sqfs_compressor_t base;
 	size_t block_size;
 	ZSTD_CCtx *zctx;
+	ZSTD_DCtx *dctx;
 	int level;
+	int window_log;
+	int strategy;
+	int min_match;
 } zstd_compressor_t;
 
 typedef struct {
@@ -41,18 +45,70 @@ static int zstd_write_options(sqfs_compressor_t *base, sqfs_file_t *file)
 
 static int zstd_read_options(sqfs_compressor_t *base, sqfs_file_t *file)
 {
+	zstd_compressor_t *zstd = (zstd_compressor_t *)base;
 	zstd_options_t opt;
 	int ret;
-	(void)base;
 
 	ret = sqfs_generic_read_options(file, &opt, sizeof(opt));
 	if (ret)
 		return ret;
 
-	opt.level = le32toh(opt.level);
+	zstd->level = le32toh(opt.level);
 	return 0;
 }
 
+static bool is_param_valid(ZSTD_cParameter param, int value)
+{
+	ZSTD_bounds bounds = ZSTD_cParam_getBounds(param);
+
+	if (ZSTD_isError(bounds.error))
+		return false;
+
+	return value >= bounds.lowerBound && value <= bounds.upperBound;
+}
+
+static int set_param(ZSTD_CCtx *zctx, ZSTD_cParameter param, int value)
+{
+	size_t ret = ZSTD_CCtx_setParameter(zctx, param, value);
+
+	return ZSTD_isError(ret) ? SQFS_ERROR_COMPRESSOR : 0;
+}
+
+/*
+  The parameters stick to the context, instead of being applied again for
+  every block. A value of 0 leaves the choice to the compression level.
+ */
+static ZSTD_CCtx *create_cctx(const zstd_compressor_t *zstd)
+{
+	ZSTD_CCtx *zctx = ZSTD_createCCtx();
+
+	if (zctx == NULL)
+		return NULL;
+
+	if (set_param(zctx, ZSTD_c_compressionLevel, zstd->level))
+		goto fail;
+
+	if (zstd->window_log != 0 &&
+	    set_param(zctx, ZSTD_c_windowLog, zstd->window_log)) {
+		goto fail;
+	}
+
+	if (zstd->strategy != 0 &&
+	    set_param(zctx, ZSTD_c_strategy, zstd->strategy)) {
+		goto fail;
+	}
+
+	if (zstd->min_match != 0 &&
+	    set_param(zctx, ZSTD_c_minMatch, zstd->min_match)) {
+		goto fail;
+	}
+
+	return zctx;
+fail:
+	ZSTD_freeCCtx(zctx);
+	return NULL;
+}
+
 static sqfs_s32 zstd_comp_block(sqfs_compressor_t *base, const sqfs_u8 *in,
 				sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
 {
@@ -62,8 +118,7 @@ static sqfs_s32 zstd_comp_block(sqfs_compressor_t *base, const sqfs_u8 *in,
 	if (size >= 0x7FFFFFFF)
 		return SQFS_ERROR_ARG_INVALID;
 
-	ret = ZSTD_compressCCtx(zstd->zctx, out, outsize, in, size,
-				zstd->level);
+	ret = ZSTD_compress2(zstd->zctx, out, outsize, in, size);
 
 	if (ZSTD_isError(ret)) {
 		if (ZSTD_getErrorCode(ret) == ZSTD_error_dstSize_tooSmall)
@@ -78,13 +133,13 @@ static sqfs_s32 zstd_comp_block(sqfs_compressor_t *base, const sqfs_u8 *in,
 static sqfs_s32 zstd_uncomp_block(sqfs_compressor_t *base, const sqfs_u8 *in,
 				  sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
 {
+	zstd_compressor_t *zstd = (zstd_compressor_t *)base;
 	size_t ret;
-	(void)base;
 
 	if (outsize >= 0x7FFFFFFF)
 		return SQFS_ERROR_ARG_INVALID;
 
-	ret = ZSTD_decompress(out, outsize, in, size);
+	ret = ZSTD_decompressDCtx(zstd->dctx, out, outsize, in, size);
 
 	if (ZSTD_isError(ret))
 		return SQFS_ERROR_COMPRESSOR;
@@ -102,6 +157,9 @@ static void zstd_get_configuration(const sqfs_compressor_t *base,
 
 	cfg->block_size = zstd->block_size;
 	cfg->opt.zstd.level = zstd->level;
+	cfg->opt.zstd.window_log = zstd->window_log;
+	cfg->opt.zstd.strategy = zstd->strategy;
+	cfg->opt.zstd.min_match = zstd->min_match;
 
 	if (base->do_block == zstd_uncomp_block)
 		cfg->flags |= SQFS_COMP_FLAG_UNCOMPRESS;
@@ -116,14 +174,23 @@ static sqfs_object_t *zstd_create_copy(const sqfs_object_t *cmp)
 
 	memcpy(zstd, cmp, sizeof(*zstd));
 
-	zstd->zctx = ZSTD_createCCtx();
+	if (zstd->zctx != NULL) {
+		zstd->zctx = create_cctx(zstd);
+		if (zstd->zctx == NULL)
+			goto fail;
+	}
 
-	if (zstd->zctx == NULL) {
-		free(zstd);
-		return NULL;
+	if (zstd->dctx != NULL) {
+		zstd->dctx = ZSTD_createDCtx();
+		if (zstd->dctx == NULL)
+			goto fail;
 	}
 
 	return (sqfs_object_t *)zstd;
+fail:
+	ZSTD_freeCCtx(zstd->zctx);
+	free(zstd);
+	return NULL;
 }
 
 static void zstd_destroy(sqfs_object_t *base)
@@ -131,6 +198,7 @@ static void zstd_destroy(sqfs_object_t *base)
 	zstd_compressor_t *zstd = (zstd_compressor_t *)base;
 
 	ZSTD_freeCCtx(zstd->zctx);
+	ZSTD_freeDCtx(zstd->dctx);
 	free(zstd);
 }
 
@@ -148,14 +216,42 @@ int zstd_compressor_create(const sqfs_compressor_config_t *cfg,
 		return SQFS_ERROR_UNSUPPORTED;
 	}
 
+	/* a window larger than a block has nothing to look back into */
+	if (cfg->opt.zstd.window_log != 0 &&
+	    (!is_param_valid(ZSTD_c_windowLog, cfg->opt.zstd.window_log) ||
+	     cfg->opt.zstd.window_log >= 32 ||
+	     (1UL << (cfg->opt.zstd.window_log - 1)) >= cfg->block_size)) {
+		return SQFS_ERROR_UNSUPPORTED;
+	}
+
+	if (cfg->opt.zstd.strategy != 0 &&
+	    !is_param_valid(ZSTD_c_strategy, cfg->opt.zstd.strategy)) {
+		return SQFS_ERROR_UNSUPPORTED;
+	}
+
+	if (cfg->opt.zstd.min_match != 0 &&
+	    !is_param_valid(ZSTD_c_minMatch, cfg->opt.zstd.min_match)) {
+		return SQFS_ERROR_UNSUPPORTED;
+	}
+
 	zstd = calloc(1, sizeof(*zstd));
 	base = (sqfs_compressor_t *)zstd;
 	if (zstd == NULL)
 		return SQFS_ERROR_ALLOC;
 
 	zstd->block_size = cfg->block_size;
-	zstd->zctx = ZSTD_createCCtx();
-	if (zstd->zctx == NULL) {
+	zstd->level = cfg->opt.zstd.level;
+	zstd->window_log = cfg->opt.zstd.window_log;
+	zstd->strategy = cfg->opt.zstd.strategy;
+	zstd->min_match = cfg->opt.zstd.min_match;
+
+	if (cfg->flags & SQFS_COMP_FLAG_UNCOMPRESS) {
+		zstd->dctx = ZSTD_createDCtx();
+	} else {
+		zstd->zctx = create_cctx(zstd);
+	}
+
+	if (zstd->zctx == NULL && zstd->dctx == NULL) {
 		free(zstd);
 		return SQFS_ERROR_COMPRESSOR;
 	}
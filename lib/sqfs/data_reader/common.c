@@ -0,0 +1,823 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * common.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+/* number of full sized blocks the cache can hold by default */
+#define DEFAULT_CACHE_BLOCKS (4)
+
+#define INITIAL_BUCKETS (16)
+
+/* files with more blocks than this get a block offset index */
+#define INDEX_MIN_BLOCKS (32)
+
+static size_t cache_bucket(const sqfs_data_reader_t *data, sqfs_u64 location)
+{
+	location ^= location >> 29;
+	location *= 0xBF58476D1CE4E5B9ULL;
+	location ^= location >> 32;
+
+	return location & (data->num_buckets - 1);
+}
+
+static void cache_remove(sqfs_data_reader_t *data, cached_block_t *blk)
+{
+	cached_block_t **it = data->buckets + cache_bucket(data, blk->location);
+
+	while (*it != blk)
+		it = &((*it)->chain);
+
+	*it = blk->chain;
+
+	if (blk->prev == NULL) {
+		data->lru_first = blk->next;
+	} else {
+		blk->prev->next = blk->next;
+	}
+
+	if (blk->next == NULL) {
+		data->lru_last = blk->prev;
+	} else {
+		blk->next->prev = blk->prev;
+	}
+
+	data->stats.cached_blocks -= 1;
+	data->stats.cached_bytes -= sizeof(*blk) + data->block_size;
+	free(blk);
+}
+
+static void cache_clear(sqfs_data_reader_t *data)
+{
+	while (data->lru_first != NULL)
+		cache_remove(data, data->lru_first);
+}
+
+/* evicts least recently used blocks until the cache fits into the limit,
+   keeping at least the one given */
+static void cache_shrink(sqfs_data_reader_t *data, const cached_block_t *keep)
+{
+	while (data->stats.cached_bytes > data->max_cache_bytes &&
+	       data->lru_last != NULL && data->lru_last != keep) {
+		cache_remove(data, data->lru_last);
+		data->stats.evictions += 1;
+	}
+}
+
+static int cache_grow(sqfs_data_reader_t *data)
+{
+	size_t i, count = data->num_buckets ? data->num_buckets * 2 :
+					      INITIAL_BUCKETS;
+	cached_block_t **new, *it;
+
+	new = alloc_array(sizeof(new[0]), count);
+	if (new == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	for (i = 0; i < count; ++i)
+		new[i] = NULL;
+
+	free(data->buckets);
+	data->buckets = new;
+	data->num_buckets = count;
+
+	for (it = data->lru_first; it != NULL; it = it->next) {
+		i = cache_bucket(data, it->location);
+		it->chain = data->buckets[i];
+		data->buckets[i] = it;
+	}
+
+	return 0;
+}
+
+cached_block_t *cache_find(const sqfs_data_reader_t *data,
+			   sqfs_u64 location, sqfs_u32 disk_size)
+{
+	cached_block_t *blk;
+
+	if (data->num_buckets == 0)
+		return NULL;
+
+	blk = data->buckets[cache_bucket(data, location)];
+
+	while (blk != NULL) {
+		if (blk->location == location && blk->disk_size == disk_size)
+			break;
+		blk = blk->chain;
+	}
+
+	return blk;
+}
+
+static cached_block_t *cache_lookup(sqfs_data_reader_t *data,
+				    sqfs_u64 location, sqfs_u32 disk_size)
+{
+	cached_block_t *blk = cache_find(data, location, disk_size);
+
+	if (blk == NULL || blk == data->lru_first)
+		return blk;
+
+	blk->prev->next = blk->next;
+
+	if (blk->next == NULL) {
+		data->lru_last = blk->prev;
+	} else {
+		blk->next->prev = blk->prev;
+	}
+
+	blk->prev = NULL;
+	blk->next = data->lru_first;
+	data->lru_first->prev = blk;
+	data->lru_first = blk;
+	return blk;
+}
+
+static int cache_insert(sqfs_data_reader_t *data, cached_block_t *blk)
+{
+	size_t idx;
+	int err;
+
+	if (data->stats.cached_blocks >= data->num_buckets) {
+		err = cache_grow(data);
+		if (err)
+			return err;
+	}
+
+	idx = cache_bucket(data, blk->location);
+	blk->chain = data->buckets[idx];
+	data->buckets[idx] = blk;
+
+	blk->prev = NULL;
+	blk->next = data->lru_first;
+
+	if (data->lru_first == NULL) {
+		data->lru_last = blk;
+	} else {
+		data->lru_first->prev = blk;
+	}
+
+	data->lru_first = blk;
+	data->stats.cached_blocks += 1;
+	data->stats.cached_bytes += sizeof(*blk) + data->block_size;
+
+	cache_shrink(data, blk);
+	return 0;
+}
+
+static int read_block(sqfs_data_reader_t *data, sqfs_u64 off, sqfs_u32 size,
+		      sqfs_u32 max_size, sqfs_u8 *out, size_t *out_sz)
+{
+	sqfs_u32 on_disk_size;
+	sqfs_s32 ret;
+	int err;
+
+	*out_sz = max_size;
+
+	if (SQFS_IS_SPARSE_BLOCK(size)) {
+		memset(out, 0, max_size);
+		return 0;
+	}
+
+	on_disk_size = SQFS_ON_DISK_BLOCK_SIZE(size);
+
+	if (on_disk_size > max_size)
+		return SQFS_ERROR_OVERFLOW;
+
+	if (SQFS_IS_BLOCK_COMPRESSED(size)) {
+		err = data->file->read_at(data->file, off,
+					  data->scratch, on_disk_size);
+		if (err)
+			return err;
+
+		ret = data->cmp->do_block(data->cmp, data->scratch,
+					  on_disk_size, out, max_size);
+		if (ret <= 0)
+			return ret < 0 ? ret : SQFS_ERROR_OVERFLOW;
+
+		*out_sz = ret;
+	} else {
+		err = data->file->read_at(data->file, off,
+					  out, on_disk_size);
+		if (err)
+			return err;
+
+		*out_sz = on_disk_size;
+	}
+
+	return 0;
+}
+
+/*
+  Get a block through the cache. If it is a data block, the inode and block
+  index are passed along so it can be read ahead, fragment blocks are not.
+ */
+static int get_cached_block(sqfs_data_reader_t *data,
+			    const sqfs_inode_generic_t *inode, size_t index,
+			    sqfs_u64 location, sqfs_u32 size,
+			    cached_block_t **out)
+{
+	cached_block_t *blk;
+	int err;
+
+	blk = cache_lookup(data, location, size);
+	if (blk != NULL) {
+		data->stats.hits += 1;
+		*out = blk;
+		return 0;
+	}
+
+	err = SQFS_ERROR_NO_ENTRY;
+
+	if (inode != NULL && data->ra != NULL)
+		err = read_ahead_get(data, inode, index, location, &blk);
+
+	if (err == SQFS_ERROR_NO_ENTRY) {
+		data->stats.misses += 1;
+
+		blk = alloc_flex(sizeof(*blk), 1, data->block_size);
+		if (blk == NULL)
+			return SQFS_ERROR_ALLOC;
+
+		blk->location = location;
+		blk->disk_size = size;
+
+		err = read_block(data, location, size, data->block_size,
+				 blk->data, &blk->size);
+		if (err) {
+			free(blk);
+			return err;
+		}
+	} else if (err) {
+		return err;
+	}
+
+	err = cache_insert(data, blk);
+	if (err) {
+		free(blk);
+		return err;
+	}
+
+	*out = blk;
+	return 0;
+}
+
+static int get_fragment_block(sqfs_data_reader_t *data, size_t idx,
+			      cached_block_t **out)
+{
+	sqfs_fragment_t ent;
+	int ret;
+
+	ret = sqfs_frag_table_lookup(data->frag_tbl, idx, &ent);
+	if (ret != 0)
+		return ret;
+
+	return get_cached_block(data, NULL, 0, ent.start_offset, ent.size, out);
+}
+
+/*
+  Indices are matched by first block location, file size, block count and
+  the list of block sizes. Inodes sharing all of them are duplicates sharing
+  the same blocks, and can therefore share an index as well. The first three
+  alone are not enough, e.g. a fully sparse file may be placed at the start
+  of the next file, which can then have the same size and block count.
+ */
+static block_index_t *get_block_index(sqfs_data_reader_t *data,
+				      const sqfs_inode_generic_t *inode)
+{
+	size_t i, count = sqfs_inode_get_file_block_count(inode);
+	sqfs_u64 start, filesz;
+	block_index_t *idx;
+
+	sqfs_inode_get_file_block_start(inode, &start);
+	sqfs_inode_get_file_size(inode, &filesz);
+
+	for (i = 0; i < INDEX_SLOTS && data->index[i] != NULL; ++i) {
+		idx = data->index[i];
+
+		if (idx->blocks_start == start && idx->file_size == filesz &&
+		    idx->count == count &&
+		    memcmp(idx->sizes, inode->extra,
+			   count * sizeof(idx->sizes[0])) == 0) {
+			goto out;
+		}
+	}
+
+	idx = alloc_flex(sizeof(*idx), sizeof(idx->location[0]) +
+			 sizeof(idx->sizes[0]), count);
+	if (idx == NULL)
+		return NULL;
+
+	idx->blocks_start = start;
+	idx->file_size = filesz;
+	idx->count = count;
+	idx->sizes = (sqfs_u32 *)(idx->location + count);
+	memcpy(idx->sizes, inode->extra, count * sizeof(idx->sizes[0]));
+
+	for (i = 0; i < count; ++i) {
+		idx->location[i] = start;
+		start += SQFS_ON_DISK_BLOCK_SIZE(inode->extra[i]);
+	}
+
+	i = INDEX_SLOTS - 1;
+	free(data->index[i]);
+out:
+	memmove(data->index + 1, data->index, i * sizeof(data->index[0]));
+	data->index[0] = idx;
+	return idx;
+}
+
+static sqfs_u64 get_block_location(sqfs_data_reader_t *data,
+				   const sqfs_inode_generic_t *inode,
+				   size_t index)
+{
+	block_index_t *idx = NULL;
+	sqfs_u64 location;
+	size_t i;
+
+	if (sqfs_inode_get_file_block_count(inode) > INDEX_MIN_BLOCKS)
+		idx = get_block_index(data, inode);
+
+	if (idx != NULL)
+		return idx->location[index];
+
+	/* small file, or out of memory for the index */
+	sqfs_inode_get_file_block_start(inode, &location);
+
+	for (i = 0; i < index; ++i)
+		location += SQFS_ON_DISK_BLOCK_SIZE(inode->extra[i]);
+
+	return location;
+}
+
+static void data_reader_destroy(sqfs_object_t *obj)
+{
+	sqfs_data_reader_t *data = (sqfs_data_reader_t *)obj;
+	size_t i;
+
+	if (data->ra != NULL)
+		read_ahead_destroy(data->ra);
+
+	for (i = 0; i < INDEX_SLOTS; ++i)
+		free(data->index[i]);
+
+	cache_clear(data);
+	sqfs_destroy(data->frag_tbl);
+	free(data->buckets);
+	free(data);
+}
+
+static sqfs_object_t *data_reader_copy(const sqfs_object_t *obj)
+{
+	const sqfs_data_reader_t *data = (const sqfs_data_reader_t *)obj;
+	sqfs_data_reader_t *copy;
+
+	copy = alloc_flex(sizeof(*data), 1, data->block_size);
+	if (copy == NULL)
+		return NULL;
+
+	memcpy(copy, data, sizeof(*data) + data->block_size);
+
+	copy->frag_tbl = sqfs_copy(data->frag_tbl);
+	if (copy->frag_tbl == NULL) {
+		free(copy);
+		return NULL;
+	}
+
+	/* the copy starts out with an empty cache of the same size */
+	copy->lru_first = NULL;
+	copy->lru_last = NULL;
+	copy->buckets = NULL;
+	copy->num_buckets = 0;
+
+	memset(&copy->stats, 0, sizeof(copy->stats));
+	copy->stats.size = sizeof(copy->stats);
+
+	memset(copy->index, 0, sizeof(copy->index));
+
+	/* read ahead has to be enabled on the copy separately */
+	copy->ra = NULL;
+
+	/* XXX: file and cmp aren't deep-copied becaues data
+	        doesn't own them either. */
+	return (sqfs_object_t *)copy;
+}
+
+sqfs_data_reader_t *sqfs_data_reader_create(sqfs_file_t *file,
+					    size_t block_size,
+					    sqfs_compressor_t *cmp)
+{
+	sqfs_data_reader_t *data = alloc_flex(sizeof(*data), 1, block_size);
+
+	if (data == NULL)
+		return NULL;
+
+	data->frag_tbl = sqfs_frag_table_create(0);
+	if (data->frag_tbl == NULL) {
+		free(data);
+		return NULL;
+	}
+
+	((sqfs_object_t *)data)->destroy = data_reader_destroy;
+	((sqfs_object_t *)data)->copy = data_reader_copy;
+	data->file = file;
+	data->block_size = block_size;
+	data->cmp = cmp;
+	data->max_cache_bytes = DEFAULT_CACHE_BLOCKS *
+				(sizeof(cached_block_t) + block_size);
+	data->stats.size = sizeof(data->stats);
+	return data;
+}
+
+int sqfs_data_reader_load_fragment_table(sqfs_data_reader_t *data,
+					 const sqfs_super_t *super)
+{
+	cache_clear(data);
+
+	return sqfs_frag_table_read(data->frag_tbl, data->file,
+				    super, data->cmp);
+}
+
+/*
+  Get a full sized data block into a buffer of exactly unpacked_size bytes.
+  Blocks that are not cached yet are decoded in place and not added, so
+  streaming through a large file does not flush out hot blocks. Blocks that
+  a read ahead worker already decoded are moved into the cache regardless,
+  like in get_cached_block.
+ */
+static int load_block(sqfs_data_reader_t *data,
+		      const sqfs_inode_generic_t *inode, size_t index,
+		      sqfs_u64 off, sqfs_u8 *out, size_t unpacked_size,
+		      size_t *size)
+{
+	cached_block_t *blk;
+	int err;
+
+	if (SQFS_IS_SPARSE_BLOCK(inode->extra[index]))
+		goto out_read;
+
+	blk = cache_lookup(data, off, inode->extra[index]);
+
+	if (blk != NULL) {
+		data->stats.hits += 1;
+
+		if (blk->size > unpacked_size)
+			return SQFS_ERROR_OVERFLOW;
+
+		memcpy(out, blk->data, blk->size);
+		*size = blk->size;
+		return 0;
+	}
+
+	if (data->ra != NULL) {
+		err = read_ahead_get(data, inode, index, off, &blk);
+
+		if (err == 0) {
+			err = cache_insert(data, blk);
+			if (err) {
+				free(blk);
+				return err;
+			}
+
+			if (blk->size > unpacked_size)
+				return SQFS_ERROR_OVERFLOW;
+
+			memcpy(out, blk->data, blk->size);
+			*size = blk->size;
+			return 0;
+		}
+
+		if (err != SQFS_ERROR_NO_ENTRY)
+			return err;
+	}
+
+	data->stats.misses += 1;
+out_read:
+	return read_block(data, off, inode->extra[index],
+			  unpacked_size, out, size);
+}
+
+static size_t get_unpacked_size(const sqfs_data_reader_t *data,
+				const sqfs_inode_generic_t *inode,
+				size_t index)
+{
+	sqfs_u64 filesz;
+
+	sqfs_inode_get_file_size(inode, &filesz);
+	filesz -= (sqfs_u64)index * data->block_size;
+
+	return filesz < data->block_size ? filesz : data->block_size;
+}
+
+static int get_fragment_range(sqfs_data_reader_t *data,
+			      const sqfs_inode_generic_t *inode,
+			      const sqfs_u8 **out, size_t *size)
+{
+	sqfs_u32 frag_idx, frag_off, frag_sz;
+	cached_block_t *blk;
+	size_t block_count;
+	sqfs_u64 filesz;
+	int err;
+
+	sqfs_inode_get_file_size(inode, &filesz);
+	sqfs_inode_get_frag_location(inode, &frag_idx, &frag_off);
+	*size = 0;
+	*out = NULL;
+
+	block_count = sqfs_inode_get_file_block_count(inode);
+
+	if (block_count * data->block_size >= filesz)
+		return 0;
+
+	frag_sz = filesz % data->block_size;
+
+	err = get_fragment_block(data, frag_idx, &blk);
+	if (err)
+		return err;
+
+	if (frag_off + frag_sz > blk->size)
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	*out = blk->data + frag_off;
+	*size = frag_sz;
+	return 0;
+}
+
+int sqfs_data_reader_get_block(sqfs_data_reader_t *data,
+			       const sqfs_inode_generic_t *inode,
+			       size_t index, size_t *size, sqfs_u8 **out)
+{
+	size_t unpacked_size;
+	int err;
+
+	*size = 0;
+	*out = NULL;
+
+	if (index >= sqfs_inode_get_file_block_count(inode))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	unpacked_size = get_unpacked_size(data, inode, index);
+
+	*out = alloc_array(1, unpacked_size);
+	if (*out == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	err = load_block(data, inode, index,
+			 get_block_location(data, inode, index),
+			 *out, unpacked_size, size);
+	if (err) {
+		free(*out);
+		*out = NULL;
+		*size = 0;
+	}
+
+	return err;
+}
+
+int sqfs_data_reader_get_block_into(sqfs_data_reader_t *data,
+				    const sqfs_inode_generic_t *inode,
+				    size_t index, sqfs_u8 *buffer,
+				    size_t buffer_size, size_t *size)
+{
+	size_t unpacked_size;
+	int err;
+
+	*size = 0;
+
+	if (index >= sqfs_inode_get_file_block_count(inode))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	unpacked_size = get_unpacked_size(data, inode, index);
+	if (buffer_size < unpacked_size)
+		return SQFS_ERROR_OVERFLOW;
+
+	err = load_block(data, inode, index,
+			 get_block_location(data, inode, index),
+			 buffer, unpacked_size, size);
+	if (err)
+		*size = 0;
+
+	return err;
+}
+
+int sqfs_data_reader_borrow_block(sqfs_data_reader_t *data,
+				  const sqfs_inode_generic_t *inode,
+				  size_t index, size_t *size,
+				  const sqfs_u8 **out)
+{
+	size_t unpacked_size;
+	cached_block_t *blk;
+	int err;
+
+	*size = 0;
+	*out = NULL;
+
+	if (index >= sqfs_inode_get_file_block_count(inode))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	unpacked_size = get_unpacked_size(data, inode, index);
+
+	err = get_cached_block(data, inode, index,
+			       get_block_location(data, inode, index),
+			       inode->extra[index], &blk);
+	if (err)
+		return err;
+
+	if (SQFS_IS_SPARSE_BLOCK(inode->extra[index])) {
+		*size = unpacked_size;
+	} else if (blk->size > unpacked_size) {
+		return SQFS_ERROR_OVERFLOW;
+	} else {
+		*size = blk->size;
+	}
+
+	*out = blk->data;
+	return 0;
+}
+
+int sqfs_data_reader_get_fragment(sqfs_data_reader_t *data,
+				  const sqfs_inode_generic_t *inode,
+				  size_t *size, sqfs_u8 **out)
+{
+	const sqfs_u8 *ptr;
+	int err;
+
+	*out = NULL;
+
+	err = get_fragment_range(data, inode, &ptr, size);
+	if (err || *size == 0)
+		return err;
+
+	*out = alloc_array(1, *size);
+	if (*out == NULL) {
+		*size = 0;
+		return SQFS_ERROR_ALLOC;
+	}
+
+	memcpy(*out, ptr, *size);
+	return 0;
+}
+
+int sqfs_data_reader_get_fragment_into(sqfs_data_reader_t *data,
+				       const sqfs_inode_generic_t *inode,
+				       sqfs_u8 *buffer, size_t buffer_size,
+				       size_t *size)
+{
+	const sqfs_u8 *ptr;
+	int err;
+
+	err = get_fragment_range(data, inode, &ptr, size);
+	if (err)
+		return err;
+
+	if (*size > buffer_size) {
+		*size = 0;
+		return SQFS_ERROR_OVERFLOW;
+	}
+
+	if (*size > 0)
+		memcpy(buffer, ptr, *size);
+
+	return 0;
+}
+
+int sqfs_data_reader_borrow_fragment(sqfs_data_reader_t *data,
+				     const sqfs_inode_generic_t *inode,
+				     size_t *size, const sqfs_u8 **out)
+{
+	return get_fragment_range(data, inode, out, size);
+}
+
+sqfs_s32 sqfs_data_reader_read(sqfs_data_reader_t *data,
+			       const sqfs_inode_generic_t *inode,
+			       sqfs_u64 offset, void *buffer, sqfs_u32 size)
+{
+	sqfs_u32 frag_idx, frag_off, diff, total = 0;
+	size_t i, block_count, unpacked;
+	sqfs_u64 off, filesz, skip;
+	cached_block_t *blk;
+	char *ptr;
+	int err;
+
+	if (size >= 0x7FFFFFFF)
+		size = 0x7FFFFFFE;
+
+	/* work out file location and size */
+	sqfs_inode_get_file_size(inode, &filesz);
+	sqfs_inode_get_frag_location(inode, &frag_idx, &frag_off);
+	block_count = sqfs_inode_get_file_block_count(inode);
+
+	/* find location of the first block */
+	skip = offset / data->block_size;
+	if (skip > block_count)
+		skip = block_count;
+
+	i = skip;
+	skip *= data->block_size;
+	offset -= skip;
+	filesz = filesz > skip ? (filesz - skip) : 0;
+	off = i < block_count ? get_block_location(data, inode, i) : 0;
+
+	/* copy data from blocks */
+	while (i < block_count && size > 0 && filesz > 0) {
+		diff = data->block_size - offset;
+		if (size < diff)
+			diff = size;
+
+		if (SQFS_IS_SPARSE_BLOCK(inode->extra[i])) {
+			memset(buffer, 0, diff);
+		} else if (offset == 0 && diff == data->block_size) {
+			/* whole block, decode it into the buffer directly */
+			err = load_block(data, inode, i, off, buffer,
+					 diff, &unpacked);
+			if (err)
+				return err;
+
+			if (unpacked < diff)
+				memset((char *)buffer + unpacked, 0,
+				       diff - unpacked);
+
+			off += SQFS_ON_DISK_BLOCK_SIZE(inode->extra[i]);
+		} else {
+			err = get_cached_block(data, inode, i, off,
+					       inode->extra[i], &blk);
+			if (err)
+				return err;
+
+			memcpy(buffer, blk->data + offset, diff);
+			off += SQFS_ON_DISK_BLOCK_SIZE(inode->extra[i]);
+		}
+
+		if (filesz >= data->block_size) {
+			filesz -= data->block_size;
+		} else {
+			filesz = 0;
+		}
+
+		++i;
+		offset = 0;
+		size -= diff;
+		total += diff;
+		buffer = (char *)buffer + diff;
+	}
+
+	/* copy from fragment */
+	if (i == block_count && size > 0 && filesz > 0) {
+		err = get_fragment_block(data, frag_idx, &blk);
+		if (err)
+			return err;
+
+		if (frag_off + filesz > blk->size)
+			return SQFS_ERROR_OUT_OF_BOUNDS;
+
+		if (offset >= filesz)
+			return total;
+
+		if (offset + size > filesz)
+			size = filesz - offset;
+
+		if (size == 0)
+			return total;
+
+		ptr = (char *)blk->data + frag_off + offset;
+		memcpy(buffer, ptr, size);
+		total += size;
+	}
+
+	return total;
+}
+
+int sqfs_data_reader_set_cache_size(sqfs_data_reader_t *data, size_t size)
+{
+	data->max_cache_bytes = size;
+	cache_shrink(data, NULL);
+	return 0;
+}
+
+const sqfs_data_reader_stats_t
+*sqfs_data_reader_get_stats(const sqfs_data_reader_t *data)
+{
+	return &data->stats;
+}
+
+int sqfs_data_reader_set_read_ahead(sqfs_data_reader_t *data,
+				    unsigned int num_workers,
+				    size_t num_blocks)
+{
+	read_ahead_t *ra = NULL;
+	int err;
+
+	if (num_workers > 0 && num_blocks > 0) {
+		err = read_ahead_create(data, num_workers, num_blocks, &ra);
+		if (err)
+			return err;
+	}
+
+	if (data->ra != NULL)
+		read_ahead_destroy(data->ra);
+
+	data->ra = ra;
+	return 0;
+}
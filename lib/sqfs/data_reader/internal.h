@@ -0,0 +1,117 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * internal.h
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef INTERNAL_H
+#define INTERNAL_H
+
+#include "config.h"
+
+#include "sqfs/data_reader.h"
+#include "sqfs/compressor.h"
+#include "sqfs/frag_table.h"
+#include "sqfs/block.h"
+#include "sqfs/error.h"
+#include "sqfs/table.h"
+#include "sqfs/inode.h"
+#include "sqfs/io.h"
+#include "util.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* number of block offset indices kept around */
+#define INDEX_SLOTS (4)
+
+typedef struct read_ahead_t read_ahead_t;
+
+typedef struct cached_block_t {
+	/* LRU list, most recently used first */
+	struct cached_block_t *prev;
+	struct cached_block_t *next;
+
+	/* hash bucket chain */
+	struct cached_block_t *chain;
+
+	/* on-disk location and size word, as found in the inode */
+	sqfs_u64 location;
+	sqfs_u32 disk_size;
+
+	/* uncompressed size */
+	size_t size;
+	sqfs_u8 data[];
+} cached_block_t;
+
+typedef struct {
+	/* identifies the file, see get_block_index */
+	sqfs_u64 blocks_start;
+	sqfs_u64 file_size;
+	size_t count;
+
+	/* copy of the block size list, stored right after the locations */
+	sqfs_u32 *sizes;
+
+	/* on-disk location of each block */
+	sqfs_u64 location[];
+} block_index_t;
+
+struct sqfs_data_reader_t {
+	sqfs_object_t obj;
+
+	sqfs_frag_table_t *frag_tbl;
+	sqfs_compressor_t *cmp;
+	sqfs_file_t *file;
+
+	cached_block_t *lru_first;
+	cached_block_t *lru_last;
+
+	cached_block_t **buckets;
+	size_t num_buckets;
+
+	size_t max_cache_bytes;
+	sqfs_data_reader_stats_t stats;
+
+	/* most recently used first */
+	block_index_t *index[INDEX_SLOTS];
+
+	/* NULL if decompression is done on the calling thread only */
+	read_ahead_t *ra;
+
+	sqfs_u32 block_size;
+
+	sqfs_u8 scratch[];
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+SQFS_INTERNAL cached_block_t *cache_find(const sqfs_data_reader_t *data,
+					 sqfs_u64 location,
+					 sqfs_u32 disk_size);
+
+SQFS_INTERNAL int read_ahead_create(sqfs_data_reader_t *data,
+				    unsigned int num_workers,
+				    size_t max_blocks, read_ahead_t **out);
+
+SQFS_INTERNAL void read_ahead_destroy(read_ahead_t *ra);
+
+/*
+  Called when block number index of a file is not in the cache. Queues up
+  the following blocks for background decompression if the file is read
+  sequentially, and returns the requested block if it was queued earlier.
+  SQFS_ERROR_NO_ENTRY means the caller has to decompress it by itself.
+ */
+SQFS_INTERNAL int read_ahead_get(sqfs_data_reader_t *data,
+				 const sqfs_inode_generic_t *inode,
+				 size_t index, sqfs_u64 location,
+				 cached_block_t **out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INTERNAL_H */
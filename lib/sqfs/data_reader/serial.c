@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * serial.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+int read_ahead_create(sqfs_data_reader_t *data, unsigned int num_workers,
+		      size_t max_blocks, read_ahead_t **out)
+{
+	(void)data; (void)num_workers; (void)max_blocks; (void)out;
+	return SQFS_ERROR_UNSUPPORTED;
+}
+
+void read_ahead_destroy(read_ahead_t *ra)
+{
+	(void)ra;
+}
+
+int read_ahead_get(sqfs_data_reader_t *data,
+		   const sqfs_inode_generic_t *inode,
+		   size_t index, sqfs_u64 location, cached_block_t **out)
+{
+	(void)data; (void)inode; (void)index; (void)location; (void)out;
+	return SQFS_ERROR_NO_ENTRY;
+}
@@ -0,0 +1,467 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * winpthread.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+#if defined(_WIN32) || defined(__WINDOWS__)
+#	define WIN32_LEAN_AND_MEAN
+#	include <windows.h>
+#	define LOCK(mtx) EnterCriticalSection(mtx)
+#	define UNLOCK(mtx) LeaveCriticalSection(mtx)
+#	define AWAIT(cond, mtx) SleepConditionVariableCS(cond, mtx, INFINITE)
+#	define SIGNAL(cond) WakeConditionVariable(cond)
+#	define SIGNAL_ALL(cond) WakeAllConditionVariable(cond)
+#	define THREAD_JOIN(t) \
+		if (t != NULL) { \
+			WaitForSingleObject(t, INFINITE); \
+			CloseHandle(t); \
+		}
+#	define MUTEX_DESTROY(mtx) DeleteCriticalSection(mtx)
+#	define CONDITION_DESTROY(cond)
+#	define THREAD_EXIT_SUCCESS 0
+#	define THREAD_TYPE DWORD WINAPI
+#	define THREAD_ARG LPVOID
+#	define THREAD_HANDLE HANDLE
+#	define MUTEX_TYPE CRITICAL_SECTION
+#	define CONDITION_TYPE CONDITION_VARIABLE
+#else
+#	include <pthread.h>
+#	include <signal.h>
+#	define LOCK(mtx) pthread_mutex_lock(mtx)
+#	define UNLOCK(mtx) pthread_mutex_unlock(mtx)
+#	define AWAIT(cond, mtx) pthread_cond_wait(cond, mtx)
+#	define SIGNAL(cond) pthread_cond_signal(cond)
+#	define SIGNAL_ALL(cond) pthread_cond_broadcast(cond)
+#	define THREAD_JOIN(t) if (t != (pthread_t)0) { pthread_join(t, NULL); }
+#	define MUTEX_DESTROY(mtx) pthread_mutex_destroy(mtx)
+#	define CONDITION_DESTROY(cond) pthread_cond_destroy(cond)
+#	define THREAD_EXIT_SUCCESS NULL
+#	define THREAD_TYPE void *
+#	define THREAD_ARG void *
+#	define THREAD_HANDLE pthread_t
+#	define MUTEX_TYPE pthread_mutex_t
+#	define CONDITION_TYPE pthread_cond_t
+#endif
+
+/*
+  The thread owning the data reader does all the file access and bookkeeping.
+  It reads the compressed data of upcoming blocks and queues it up, worker
+  threads only decompress. The reader picks the blocks up when it gets to
+  them, so the results are the same as without read ahead.
+ */
+
+enum {
+	JOB_QUEUED = 0,
+	JOB_RUNNING,
+	JOB_DONE,
+};
+
+typedef struct ra_job_t {
+	struct ra_job_t *next;
+	cached_block_t *blk;
+	int state;
+	int status;
+	sqfs_u32 raw_size;
+	sqfs_u8 raw[];
+} ra_job_t;
+
+typedef struct {
+	read_ahead_t *shared;
+	sqfs_compressor_t *cmp;
+	THREAD_HANDLE thread;
+} ra_worker_t;
+
+struct read_ahead_t {
+	MUTEX_TYPE mtx;
+	CONDITION_TYPE queue_cond;
+	CONDITION_TYPE done_cond;
+
+	/* in submission order, shared with the workers */
+	ra_job_t *jobs;
+	bool terminate;
+
+	/* everything below is only touched by the reader thread */
+	size_t num_jobs;
+	size_t max_jobs;
+	sqfs_u32 block_size;
+
+	/* the file currently read sequentially */
+	sqfs_u64 stream_start;
+	sqfs_u64 stream_loc;
+	size_t stream_pos;
+	size_t stream_next;
+
+	/* the most recently requested block */
+	sqfs_u64 last_start;
+	size_t last_index;
+
+	unsigned int num_workers;
+	ra_worker_t workers[];
+};
+
+static ra_job_t *get_next_job(read_ahead_t *ra)
+{
+	ra_job_t *job;
+
+	for (;;) {
+		if (ra->terminate)
+			return NULL;
+
+		for (job = ra->jobs; job != NULL; job = job->next) {
+			if (job->state == JOB_QUEUED) {
+				job->state = JOB_RUNNING;
+				return job;
+			}
+		}
+
+		AWAIT(&ra->queue_cond, &ra->mtx);
+	}
+}
+
+static THREAD_TYPE worker_proc(THREAD_ARG arg)
+{
+	ra_worker_t *worker = arg;
+	read_ahead_t *ra = worker->shared;
+	ra_job_t *job = NULL;
+	sqfs_s32 ret;
+
+	for (;;) {
+		LOCK(&ra->mtx);
+		if (job != NULL) {
+			job->state = JOB_DONE;
+			SIGNAL_ALL(&ra->done_cond);
+		}
+
+		job = get_next_job(ra);
+		UNLOCK(&ra->mtx);
+
+		if (job == NULL)
+			break;
+
+		ret = worker->cmp->do_block(worker->cmp, job->raw,
+					    job->raw_size, job->blk->data,
+					    ra->block_size);
+
+		if (ret > 0) {
+			job->blk->size = ret;
+			job->status = 0;
+		} else {
+			job->status = ret < 0 ? ret : SQFS_ERROR_OVERFLOW;
+		}
+	}
+
+	return THREAD_EXIT_SUCCESS;
+}
+
+static void free_job(ra_job_t *job)
+{
+	free(job->blk);
+	free(job);
+}
+
+/* drops all jobs no worker is busy with, must be called with the lock held */
+static void drop_idle_jobs(read_ahead_t *ra, const ra_job_t *end)
+{
+	ra_job_t **it = &ra->jobs, *job;
+
+	while (*it != NULL && *it != end) {
+		job = *it;
+
+		if (job->state == JOB_RUNNING) {
+			it = &job->next;
+		} else {
+			*it = job->next;
+			free_job(job);
+			ra->num_jobs -= 1;
+		}
+	}
+}
+
+static void cancel_all(read_ahead_t *ra)
+{
+	LOCK(&ra->mtx);
+	for (;;) {
+		drop_idle_jobs(ra, NULL);
+		if (ra->jobs == NULL)
+			break;
+
+		AWAIT(&ra->done_cond, &ra->mtx);
+	}
+	UNLOCK(&ra->mtx);
+}
+
+static int submit(sqfs_data_reader_t *data, sqfs_u64 location, sqfs_u32 size)
+{
+	sqfs_u32 on_disk_size = SQFS_ON_DISK_BLOCK_SIZE(size);
+	read_ahead_t *ra = data->ra;
+	ra_job_t *job, **it;
+	int err;
+
+	/* leave broken blocks to the reader, which reports the error */
+	if (on_disk_size > data->block_size)
+		return SQFS_ERROR_OVERFLOW;
+
+	job = alloc_flex(sizeof(*job), 1, on_disk_size);
+	if (job == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	job->blk = alloc_flex(sizeof(*job->blk), 1, data->block_size);
+	if (job->blk == NULL) {
+		free(job);
+		return SQFS_ERROR_ALLOC;
+	}
+
+	err = data->file->read_at(data->file, location,
+				  job->raw, on_disk_size);
+	if (err) {
+		free_job(job);
+		return err;
+	}
+
+	job->blk->location = location;
+	job->blk->disk_size = size;
+	job->raw_size = on_disk_size;
+
+	LOCK(&ra->mtx);
+	it = &ra->jobs;
+	while (*it != NULL)
+		it = &((*it)->next);
+
+	*it = job;
+	SIGNAL(&ra->queue_cond);
+	UNLOCK(&ra->mtx);
+
+	ra->num_jobs += 1;
+	data->stats.read_ahead_blocks += 1;
+	return 0;
+}
+
+static int take(read_ahead_t *ra, sqfs_u64 location, sqfs_u32 size,
+		cached_block_t **out)
+{
+	ra_job_t **it, *job;
+	int status;
+
+	LOCK(&ra->mtx);
+	for (job = ra->jobs; job != NULL; job = job->next) {
+		if (job->blk->location == location &&
+		    job->blk->disk_size == size) {
+			break;
+		}
+	}
+
+	if (job == NULL) {
+		UNLOCK(&ra->mtx);
+		return SQFS_ERROR_NO_ENTRY;
+	}
+
+	while (job->state != JOB_DONE)
+		AWAIT(&ra->done_cond, &ra->mtx);
+
+	/* anything queued before it has been skipped by the reader */
+	drop_idle_jobs(ra, job);
+
+	it = &ra->jobs;
+	while (*it != job)
+		it = &((*it)->next);
+
+	*it = job->next;
+	UNLOCK(&ra->mtx);
+
+	ra->num_jobs -= 1;
+	status = job->status;
+	*out = job->blk;
+	free(job);
+
+	if (status) {
+		free(*out);
+		*out = NULL;
+	}
+
+	return status;
+}
+
+int read_ahead_get(sqfs_data_reader_t *data,
+		   const sqfs_inode_generic_t *inode,
+		   size_t index, sqfs_u64 location, cached_block_t **out)
+{
+	size_t count = sqfs_inode_get_file_block_count(inode);
+	read_ahead_t *ra = data->ra;
+	bool sequential = false;
+	sqfs_u64 start;
+	sqfs_u32 size;
+	int err;
+
+	sqfs_inode_get_file_block_start(inode, &start);
+
+	if (start == ra->stream_start && index > ra->stream_pos &&
+	    index < ra->stream_next) {
+		sequential = true;
+	} else if (index == 0 || (start == ra->last_start &&
+				  index == ra->last_index + 1)) {
+		cancel_all(ra);
+		ra->stream_start = start;
+		ra->stream_next = index + 1;
+		ra->stream_loc = location +
+			SQFS_ON_DISK_BLOCK_SIZE(inode->extra[index]);
+		sequential = true;
+	}
+
+	ra->last_start = start;
+	ra->last_index = index;
+
+	if (sequential) {
+		ra->stream_pos = index;
+
+		while (ra->stream_next < count && ra->num_jobs < ra->max_jobs &&
+		       ra->stream_next <= index + ra->max_jobs) {
+			size = inode->extra[ra->stream_next];
+
+			if (!SQFS_IS_SPARSE_BLOCK(size) &&
+			    SQFS_IS_BLOCK_COMPRESSED(size) &&
+			    cache_find(data, ra->stream_loc, size) == NULL) {
+				if (submit(data, ra->stream_loc, size))
+					break;
+			}
+
+			ra->stream_loc += SQFS_ON_DISK_BLOCK_SIZE(size);
+			ra->stream_next += 1;
+		}
+	}
+
+	err = take(ra, location, inode->extra[index], out);
+	if (err == 0)
+		data->stats.read_ahead_hits += 1;
+
+	return err;
+}
+
+void read_ahead_destroy(read_ahead_t *ra)
+{
+	ra_job_t *job;
+	unsigned int i;
+
+	LOCK(&ra->mtx);
+	ra->terminate = true;
+	SIGNAL_ALL(&ra->queue_cond);
+	UNLOCK(&ra->mtx);
+
+	for (i = 0; i < ra->num_workers; ++i) {
+		THREAD_JOIN(ra->workers[i].thread);
+
+		if (ra->workers[i].cmp != NULL)
+			sqfs_destroy(ra->workers[i].cmp);
+	}
+
+	while (ra->jobs != NULL) {
+		job = ra->jobs;
+		ra->jobs = job->next;
+		free_job(job);
+	}
+
+	CONDITION_DESTROY(&ra->done_cond);
+	CONDITION_DESTROY(&ra->queue_cond);
+	MUTEX_DESTROY(&ra->mtx);
+	free(ra);
+}
+
+static read_ahead_t *read_ahead_alloc(sqfs_data_reader_t *data,
+				      unsigned int num_workers,
+				      size_t max_blocks)
+{
+	read_ahead_t *ra;
+	unsigned int i;
+
+	ra = alloc_flex(sizeof(*ra), sizeof(ra->workers[0]), num_workers);
+	if (ra == NULL)
+		return NULL;
+
+	ra->max_jobs = max_blocks;
+	ra->block_size = data->block_size;
+	ra->num_workers = num_workers;
+	ra->last_index = (size_t)-1;
+
+	for (i = 0; i < num_workers; ++i) {
+		ra->workers[i].shared = ra;
+		ra->workers[i].cmp = sqfs_copy(data->cmp);
+
+		if (ra->workers[i].cmp == NULL)
+			goto fail;
+	}
+
+	return ra;
+fail:
+	while (i-- > 0)
+		sqfs_destroy(ra->workers[i].cmp);
+	free(ra);
+	return NULL;
+}
+
+#if defined(_WIN32) || defined(__WINDOWS__)
+int read_ahead_create(sqfs_data_reader_t *data, unsigned int num_workers,
+		      size_t max_blocks, read_ahead_t **out)
+{
+	read_ahead_t *ra;
+	unsigned int i;
+
+	ra = read_ahead_alloc(data, num_workers, max_blocks);
+	if (ra == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	InitializeCriticalSection(&ra->mtx);
+	InitializeConditionVariable(&ra->queue_cond);
+	InitializeConditionVariable(&ra->done_cond);
+
+	for (i = 0; i < num_workers; ++i) {
+		ra->workers[i].thread = CreateThread(NULL, 0, worker_proc,
+						     ra->workers + i, 0, 0);
+		if (ra->workers[i].thread == NULL)
+			goto fail;
+	}
+
+	*out = ra;
+	return 0;
+fail:
+	read_ahead_destroy(ra);
+	return SQFS_ERROR_INTERNAL;
+}
+#else
+int read_ahead_create(sqfs_data_reader_t *data, unsigned int num_workers,
+		      size_t max_blocks, read_ahead_t **out)
+{
+	sigset_t set, oldset;
+	read_ahead_t *ra;
+	unsigned int i;
+	int ret;
+
+	ra = read_ahead_alloc(data, num_workers, max_blocks);
+	if (ra == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	ra->mtx = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+	ra->queue_cond = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
+	ra->done_cond = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
+
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+
+	for (i = 0; i < num_workers; ++i) {
+		ret = pthread_create(&ra->workers[i].thread, NULL,
+				     worker_proc, ra->workers + i);
+		if (ret != 0)
+			goto fail;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	*out = ra;
+	return 0;
+fail:
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	read_ahead_destroy(ra);
+	return SQFS_ERROR_INTERNAL;
+}
+#endif
@@ -11,14 +11,61 @@
 #include "sqfs/dir_reader.h"
 #include "sqfs/compressor.h"
 #include "sqfs/super.h"
+#include "sqfs/block.h"
 #include "sqfs/inode.h"
 #include "sqfs/error.h"
 #include "sqfs/dir.h"
 #include "util.h"
 
+#include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
 
+#define DENTRY_INITIAL_BUCKETS (64)
+
+/* the entry does not exist in the directory */
+#define DENTRY_NEGATIVE (0x01)
+
+/* the entry is a directory and the listing fields are valid */
+#define DENTRY_DIR (0x02)
+
+/* identifies a directory through the location and size of its listing */
+typedef struct {
+	sqfs_u64 listing;
+	sqfs_u32 size;
+} dir_key_t;
+
+typedef struct dentry_t {
+	struct dentry_t *prev;
+	struct dentry_t *next;
+
+	/* next entry in the same hash bucket */
+	struct dentry_t *chain;
+
+	sqfs_u32 hash;
+	sqfs_u16 flags;
+	sqfs_u16 name_len;
+
+	dir_key_t parent;
+
+	/* the inode that the name refers to and, if it is a directory,
+	   its own listing, so a path walk does not have to read it */
+	sqfs_u64 inode_ref;
+	dir_key_t dir;
+
+	char name[];
+} dentry_t;
+
+/* book keeping for sqfs_dir_reader_read_all, offsets into the listing */
+typedef struct {
+	sqfs_u64 inode_ref;
+	size_t index;
+	size_t node;
+	size_t inode;
+} listing_ent_t;
+
+#define LISTING_ALIGN(x) (((x) + 7) & ~((size_t)7))
+
 struct sqfs_dir_reader_t {
 	sqfs_object_t base;
 
@@ -34,14 +81,209 @@ struct sqfs_dir_reader_t {
 	size_t start_size;
 	sqfs_u16 dir_offset;
 	sqfs_u16 inode_offset;
+
+	/* copy of the directory index of the open directory, if it has one */
+	sqfs_u8 *dir_index;
+	size_t dir_index_size;
+	size_t dir_index_max;
+
+	/* optional cache of path component lookups, most recent first */
+	dentry_t **buckets;
+	size_t num_buckets;
+
+	dentry_t *lru_first;
+	dentry_t *lru_last;
+
+	size_t max_cache_bytes;
+	sqfs_dir_reader_stats_t stats;
+
+	/* listing of the root directory, valid if have_root is set */
+	dir_key_t root;
+	bool have_root;
+
+	/* scratch space for sqfs_dir_reader_read_all, kept around */
+	listing_ent_t *listing;
+	size_t listing_max;
 };
 
+static sqfs_u32 dentry_hash(const dir_key_t *parent, const char *name,
+			    size_t len)
+{
+	sqfs_u64 x = parent->listing ^ ((sqfs_u64)parent->size << 48);
+
+	x ^= x >> 29;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 32;
+
+	return xxh32(name, len) ^ (sqfs_u32)x;
+}
+
+static void cache_remove(sqfs_dir_reader_t *rd, dentry_t *ent)
+{
+	dentry_t **it = rd->buckets + (ent->hash & (rd->num_buckets - 1));
+
+	while (*it != ent)
+		it = &((*it)->chain);
+
+	*it = ent->chain;
+
+	if (ent->prev == NULL) {
+		rd->lru_first = ent->next;
+	} else {
+		ent->prev->next = ent->next;
+	}
+
+	if (ent->next == NULL) {
+		rd->lru_last = ent->prev;
+	} else {
+		ent->next->prev = ent->prev;
+	}
+
+	rd->stats.cached_entries -= 1;
+	rd->stats.cached_bytes -= sizeof(*ent) + ent->name_len;
+	free(ent);
+}
+
+static void cache_shrink(sqfs_dir_reader_t *rd)
+{
+	while (rd->lru_last != NULL &&
+	       rd->stats.cached_bytes > rd->max_cache_bytes) {
+		cache_remove(rd, rd->lru_last);
+		rd->stats.evictions += 1;
+	}
+}
+
+static int cache_grow(sqfs_dir_reader_t *rd)
+{
+	size_t i, count = rd->num_buckets ? rd->num_buckets * 2 :
+					    DENTRY_INITIAL_BUCKETS;
+	dentry_t **new, *it;
+
+	new = alloc_array(sizeof(new[0]), count);
+	if (new == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	for (i = 0; i < count; ++i)
+		new[i] = NULL;
+
+	free(rd->buckets);
+	rd->buckets = new;
+	rd->num_buckets = count;
+
+	for (it = rd->lru_first; it != NULL; it = it->next) {
+		i = it->hash & (count - 1);
+		it->chain = rd->buckets[i];
+		rd->buckets[i] = it;
+	}
+
+	return 0;
+}
+
+static dentry_t *cache_lookup(sqfs_dir_reader_t *rd, const dir_key_t *parent,
+			      const char *name, size_t len)
+{
+	sqfs_u32 hash = dentry_hash(parent, name, len);
+	dentry_t *ent = NULL;
+
+	if (rd->num_buckets > 0)
+		ent = rd->buckets[hash & (rd->num_buckets - 1)];
+
+	for (; ent != NULL; ent = ent->chain) {
+		if (ent->hash == hash && ent->name_len == len &&
+		    ent->parent.listing == parent->listing &&
+		    ent->parent.size == parent->size &&
+		    memcmp(ent->name, name, len) == 0) {
+			break;
+		}
+	}
+
+	if (ent == NULL || ent == rd->lru_first)
+		return ent;
+
+	ent->prev->next = ent->next;
+
+	if (ent->next == NULL) {
+		rd->lru_last = ent->prev;
+	} else {
+		ent->next->prev = ent->prev;
+	}
+
+	ent->prev = NULL;
+	ent->next = rd->lru_first;
+	rd->lru_first->prev = ent;
+	rd->lru_first = ent;
+	return ent;
+}
+
+static int cache_insert(sqfs_dir_reader_t *rd, const dir_key_t *parent,
+			const char *name, size_t len, sqfs_u16 flags,
+			sqfs_u64 inode_ref, const dir_key_t *dir)
+{
+	dentry_t *ent;
+	size_t idx;
+	int err;
+
+	if (len > 0xFFFF || sizeof(*ent) + len > rd->max_cache_bytes)
+		return 0;
+
+	if (rd->stats.cached_entries >= rd->num_buckets) {
+		err = cache_grow(rd);
+		if (err)
+			return err;
+	}
+
+	ent = alloc_flex(sizeof(*ent), 1, len);
+	if (ent == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	ent->hash = dentry_hash(parent, name, len);
+	ent->flags = flags;
+	ent->name_len = len;
+	ent->parent = *parent;
+	ent->inode_ref = inode_ref;
+	if (dir != NULL)
+		ent->dir = *dir;
+	memcpy(ent->name, name, len);
+
+	idx = ent->hash & (rd->num_buckets - 1);
+	ent->chain = rd->buckets[idx];
+	rd->buckets[idx] = ent;
+
+	ent->next = rd->lru_first;
+
+	if (rd->lru_first == NULL) {
+		rd->lru_last = ent;
+	} else {
+		rd->lru_first->prev = ent;
+	}
+
+	rd->lru_first = ent;
+	rd->stats.cached_entries += 1;
+	rd->stats.cached_bytes += sizeof(*ent) + len;
+
+	cache_shrink(rd);
+	return 0;
+}
+
+static void cache_clear(sqfs_dir_reader_t *rd)
+{
+	while (rd->lru_first != NULL)
+		cache_remove(rd, rd->lru_first);
+
+	free(rd->buckets);
+	rd->buckets = NULL;
+	rd->num_buckets = 0;
+}
+
 static void dir_reader_destroy(sqfs_object_t *obj)
 {
 	sqfs_dir_reader_t *rd = (sqfs_dir_reader_t *)obj;
 
+	cache_clear(rd);
+	free(rd->listing);
 	sqfs_destroy(rd->meta_inode);
 	sqfs_destroy(rd->meta_dir);
+	free(rd->dir_index);
 	free(rd);
 }
 
@@ -55,6 +297,26 @@ static sqfs_object_t *dir_reader_copy(const sqfs_object_t *obj)
 
 	memcpy(copy, rd, sizeof(*copy));
 
+	/* the copy starts out with an empty cache of the same size */
+	copy->buckets = NULL;
+	copy->num_buckets = 0;
+	copy->lru_first = NULL;
+	copy->lru_last = NULL;
+
+	memset(&copy->stats, 0, sizeof(copy->stats));
+	copy->stats.size = sizeof(copy->stats);
+
+	copy->listing = NULL;
+	copy->listing_max = 0;
+
+	if (rd->dir_index != NULL) {
+		copy->dir_index = malloc(rd->dir_index_max);
+		if (copy->dir_index == NULL)
+			goto fail_index;
+
+		memcpy(copy->dir_index, rd->dir_index, rd->dir_index_size);
+	}
+
 	copy->meta_inode = sqfs_copy(rd->meta_inode);
 	if (copy->meta_inode == NULL)
 		goto fail_mino;
@@ -67,6 +329,8 @@ static sqfs_object_t *dir_reader_copy(const sqfs_object_t *obj)
 fail_mdir:
 	sqfs_destroy(copy->meta_inode);
 fail_mino:
+	free(copy->dir_index);
+fail_index:
 	free(copy);
 	return NULL;
 }
@@ -110,15 +374,61 @@ sqfs_dir_reader_t *sqfs_dir_reader_create(const sqfs_super_t *super,
 
 	((sqfs_object_t *)rd)->destroy = dir_reader_destroy;
 	((sqfs_object_t *)rd)->copy = dir_reader_copy;
+	rd->stats.size = sizeof(rd->stats);
 	rd->super = super;
 	return rd;
 }
 
+int sqfs_dir_reader_set_dentry_cache_size(sqfs_dir_reader_t *rd, size_t size)
+{
+	rd->max_cache_bytes = size;
+	cache_shrink(rd);
+
+	if (size == 0)
+		cache_clear(rd);
+
+	return 0;
+}
+
+const sqfs_dir_reader_stats_t
+*sqfs_dir_reader_get_stats(const sqfs_dir_reader_t *rd)
+{
+	return &rd->stats;
+}
+
+void sqfs_dir_reader_set_cache(sqfs_dir_reader_t *rd, sqfs_meta_cache_t *cache)
+{
+	sqfs_meta_reader_set_cache(rd->meta_inode, cache);
+	sqfs_meta_reader_set_cache(rd->meta_dir, cache);
+}
+
+int sqfs_dir_reader_preload(sqfs_dir_reader_t *rd, size_t max_size)
+{
+	int ret, status = 0;
+
+	ret = sqfs_meta_reader_preload(rd->meta_inode, max_size);
+	if (ret == SQFS_ERROR_OVERFLOW) {
+		status = ret;
+	} else if (ret) {
+		return ret;
+	}
+
+	ret = sqfs_meta_reader_preload(rd->meta_dir, max_size);
+	if (ret == SQFS_ERROR_OVERFLOW) {
+		status = ret;
+	} else if (ret) {
+		return ret;
+	}
+
+	return status;
+}
+
 int sqfs_dir_reader_open_dir(sqfs_dir_reader_t *rd,
 			     const sqfs_inode_generic_t *inode)
 {
 	sqfs_u64 block_start;
 	size_t size, offset;
+	sqfs_u8 *new;
 
 	if (inode->base.type == SQFS_INODE_DIR) {
 		size = inode->data.dir.size;
@@ -132,9 +442,28 @@ int sqfs_dir_reader_open_dir(sqfs_dir_reader_t *rd,
 		return SQFS_ERROR_NOT_DIR;
 	}
 
+	rd->dir_index_size = 0;
+
+	if (inode->base.type == SQFS_INODE_EXT_DIR &&
+	    inode->data.dir_ext.inodex_count > 0) {
+		if (inode->payload_bytes_used > rd->dir_index_max) {
+			new = realloc(rd->dir_index,
+				      inode->payload_bytes_used);
+			if (new == NULL)
+				return SQFS_ERROR_ALLOC;
+
+			rd->dir_index = new;
+			rd->dir_index_max = inode->payload_bytes_used;
+		}
+
+		memcpy(rd->dir_index, inode->extra, inode->payload_bytes_used);
+		rd->dir_index_size = inode->payload_bytes_used;
+	}
+
 	memset(&rd->hdr, 0, sizeof(rd->hdr));
 	rd->size = size;
 	rd->entries = 0;
+	rd->start_size = size;
 
 	if (rd->size <= sizeof(rd->hdr))
 		return 0;
@@ -143,28 +472,38 @@ int sqfs_dir_reader_open_dir(sqfs_dir_reader_t *rd,
 
 	rd->dir_block_start = block_start;
 	rd->dir_offset = offset;
-	rd->start_size = size;
 
 	return sqfs_meta_reader_seek(rd->meta_dir, block_start, offset);
 }
 
+static int read_header(sqfs_dir_reader_t *rd)
+{
+	int err;
+
+	if (rd->entries)
+		return 0;
+
+	if (rd->size < sizeof(rd->hdr))
+		return 1;
+
+	err = sqfs_meta_reader_read_dir_header(rd->meta_dir, &rd->hdr);
+	if (err)
+		return err;
+
+	rd->size -= sizeof(rd->hdr);
+	rd->entries = rd->hdr.count + 1;
+	return 0;
+}
+
 int sqfs_dir_reader_read(sqfs_dir_reader_t *rd, sqfs_dir_entry_t **out)
 {
 	sqfs_dir_entry_t *ent;
 	size_t count;
 	int err;
 
-	if (!rd->entries) {
-		if (rd->size < sizeof(rd->hdr))
-			return 1;
-
-		err = sqfs_meta_reader_read_dir_header(rd->meta_dir, &rd->hdr);
-		if (err)
-			return err;
-
-		rd->size -= sizeof(rd->hdr);
-		rd->entries = rd->hdr.count + 1;
-	}
+	err = read_header(rd);
+	if (err)
+		return err;
 
 	err = sqfs_meta_reader_read_dir_ent(rd->meta_dir, &ent);
 	if (err)
@@ -195,29 +534,143 @@ int sqfs_dir_reader_rewind(sqfs_dir_reader_t *rd)
 				     rd->dir_offset);
 }
 
-int sqfs_dir_reader_find(sqfs_dir_reader_t *rd, const char *name)
+/*
+  Reads the next entry and compares its name against the given one, in
+  small chunks straight from the meta data reader, so nothing needs to be
+  allocated. Returns a positive value at the end of the listing.
+ */
+static int compare_next(sqfs_dir_reader_t *rd, const char *name, size_t len,
+			int *result)
 {
-	sqfs_dir_entry_t *ent;
-	int ret;
+	size_t n, diff, pos = 0, remain;
+	sqfs_dir_entry_t ent;
+	sqfs_u8 buffer[64];
+	int err, cmp = 0;
 
-	if (rd->size != rd->start_size) {
-		ret = sqfs_dir_reader_rewind(rd);
-		if (ret)
-			return ret;
+	err = read_header(rd);
+	if (err)
+		return err;
+
+	err = sqfs_meta_reader_read(rd->meta_dir, &ent, sizeof(ent));
+	if (err)
+		return err;
+
+	ent.offset = le16toh(ent.offset);
+	ent.size = le16toh(ent.size);
+
+	for (remain = ent.size + 1; remain > 0; remain -= diff) {
+		diff = remain < sizeof(buffer) ? remain : sizeof(buffer);
+
+		err = sqfs_meta_reader_read(rd->meta_dir, buffer, diff);
+		if (err)
+			return err;
+
+		if (cmp == 0) {
+			if (pos < len) {
+				n = (len - pos) < diff ? (len - pos) : diff;
+				cmp = memcmp(buffer, name + pos, n);
+
+				if (cmp == 0 && n < diff)
+					cmp = 1;
+			} else {
+				cmp = 1;
+			}
+		}
+
+		pos += diff;
+	}
+
+	if (cmp == 0 && pos < len)
+		cmp = -1;
+
+	if (sizeof(ent) + ent.size + 1 > rd->size) {
+		rd->size = 0;
+		rd->entries = 0;
+	} else {
+		rd->size -= sizeof(ent) + ent.size + 1;
+		rd->entries -= 1;
+	}
+
+	rd->inode_offset = ent.offset;
+	*result = cmp;
+	return 0;
+}
+
+/*
+  The directory index holds the name of the first entry after some of the
+  headers. Since the listing is sorted, the search can start at the last
+  header whose first entry does not come after the name we are looking for.
+  The index is walked in memory, so this costs no I/O.
+ */
+static int seek_index(sqfs_dir_reader_t *rd, const char *name, size_t len)
+{
+	const sqfs_dir_index_t *best = NULL;
+	size_t pos = 0, n, namelen;
+	sqfs_dir_index_t ent;
+	sqfs_u64 block;
+	int cmp;
+
+	while (rd->dir_index_size - pos > sizeof(ent)) {
+		memcpy(&ent, rd->dir_index + pos, sizeof(ent));
+		namelen = ent.size + 1;
+
+		if (namelen > rd->dir_index_size - pos - sizeof(ent))
+			break;
+
+		n = namelen < len ? namelen : len;
+		cmp = memcmp(rd->dir_index + pos + sizeof(ent), name, n);
+
+		if (cmp > 0 || (cmp == 0 && namelen > len))
+			break;
+
+		if (ent.index + sizeof(rd->hdr) <= rd->start_size)
+			best = (const sqfs_dir_index_t *)(rd->dir_index + pos);
+
+		pos += sizeof(ent) + namelen;
+	}
+
+	if (best == NULL) {
+		if (rd->size == rd->start_size)
+			return 0;
+
+		return sqfs_dir_reader_rewind(rd);
 	}
 
+	memcpy(&ent, best, sizeof(ent));
+
+	memset(&rd->hdr, 0, sizeof(rd->hdr));
+	rd->size = rd->start_size - ent.index;
+	rd->entries = 0;
+
+	block = rd->super->directory_table_start + ent.start_block;
+
+	return sqfs_meta_reader_seek(rd->meta_dir, block,
+				     (rd->dir_offset + ent.index) %
+				     SQFS_META_BLOCK_SIZE);
+}
+
+static int find_entry(sqfs_dir_reader_t *rd, const char *name, size_t len)
+{
+	int ret, cmp = 0;
+
+	ret = seek_index(rd, name, len);
+	if (ret)
+		return ret;
+
 	do {
-		ret = sqfs_dir_reader_read(rd, &ent);
+		ret = compare_next(rd, name, len, &cmp);
 		if (ret < 0)
 			return ret;
 		if (ret > 0)
 			return SQFS_ERROR_NO_ENTRY;
+	} while (cmp < 0);
 
-		ret = strcmp((const char *)ent->name, name);
-		free(ent);
-	} while (ret < 0);
+	return cmp == 0 ? 0 : SQFS_ERROR_NO_ENTRY;
+}
 
-	return ret == 0 ? 0 : SQFS_ERROR_NO_ENTRY;
+int sqfs_dir_reader_find(sqfs_dir_reader_t *rd, const char *name)
+{
+	return find_entry(rd, name, strlen(name));
 }
 
 int sqfs_dir_reader_get_inode(sqfs_dir_reader_t *rd,
@@ -242,17 +695,60 @@ int sqfs_dir_reader_get_root_inode(sqfs_dir_reader_t *rd,
 					   block_start, offset, inode);
 }
 
+static int get_dir_key(const sqfs_inode_generic_t *inode, dir_key_t *key)
+{
+	if (inode->base.type == SQFS_INODE_DIR) {
+		key->listing = ((sqfs_u64)inode->data.dir.start_block << 16) |
+			       inode->data.dir.offset;
+		key->size = inode->data.dir.size;
+	} else if (inode->base.type == SQFS_INODE_EXT_DIR) {
+		key->listing =
+			((sqfs_u64)inode->data.dir_ext.start_block << 16) |
+			inode->data.dir_ext.offset;
+		key->size = inode->data.dir_ext.size;
+	} else {
+		return SQFS_ERROR_NOT_DIR;
+	}
+
+	return 0;
+}
+
+static int read_inode_ref(sqfs_dir_reader_t *rd, sqfs_u64 ref,
+			  sqfs_inode_generic_t **inode)
+{
+	return sqfs_meta_reader_read_inode(rd->meta_inode, rd->super,
+					   ref >> 16, ref & 0xFFFF, inode);
+}
+
+/*
+  If the dentry cache is enabled, every component is first looked up there,
+  keyed by the listing of the parent directory and the name. A hit gives us
+  the inode reference of the entry and the listing of the entry if it is a
+  directory, so the inodes along the way only have to be read if a later
+  component misses, or for the final one.
+ */
 int sqfs_dir_reader_find_by_path(sqfs_dir_reader_t *rd,
 				 const sqfs_inode_generic_t *start,
 				 const char *path, sqfs_inode_generic_t **out)
 {
 	sqfs_inode_generic_t *inode;
-	sqfs_dir_entry_t *ent;
+	sqfs_u16 flags = 0;
+	dir_key_t key, dir;
+	sqfs_u64 ref = 0;
 	const char *ptr;
+	dentry_t *ent;
 	int ret = 0;
 
-	if (start == NULL) {
+	if (start == NULL && rd->have_root && rd->max_cache_bytes > 0) {
+		inode = NULL;
+		ref = rd->super->root_inode_ref;
+		flags = DENTRY_DIR;
+		key = rd->root;
+	} else if (start == NULL) {
 		ret = sqfs_dir_reader_get_root_inode(rd, &inode);
+
+		if (ret == 0 && get_dir_key(inode, &rd->root) == 0)
+			rd->have_root = true;
 	} else {
 		inode = alloc_flex(sizeof(*inode), 1,
 				   start->payload_bytes_used);
@@ -274,11 +770,6 @@ int sqfs_dir_reader_find_by_path(sqfs_dir_reader_t *rd,
 			continue;
 		}
 
-		ret = sqfs_dir_reader_open_dir(rd, inode);
-		free(inode);
-		if (ret)
-			return ret;
-
 		ptr = strchr(path, '/');
 		if (ptr == NULL) {
 			ptr = strchr(path, '\\');
@@ -289,30 +780,275 @@ int sqfs_dir_reader_find_by_path(sqfs_dir_reader_t *rd,
 			}
 		}
 
-		do {
-			ret = sqfs_dir_reader_read(rd, &ent);
-			if (ret < 0)
+		if (inode != NULL) {
+			ret = get_dir_key(inode, &key);
+			if (ret)
+				goto fail;
+		} else if (!(flags & DENTRY_DIR)) {
+			return SQFS_ERROR_NOT_DIR;
+		}
+
+		ent = cache_lookup(rd, &key, path, ptr - path);
+
+		if (ent != NULL && (ent->flags & DENTRY_NEGATIVE)) {
+			rd->stats.negative_hits += 1;
+			ret = SQFS_ERROR_NO_ENTRY;
+			goto fail;
+		}
+
+		if (ent != NULL) {
+			rd->stats.hits += 1;
+			free(inode);
+			inode = NULL;
+
+			ref = ent->inode_ref;
+			flags = ent->flags;
+			key = ent->dir;
+			path = ptr;
+			continue;
+		}
+
+		if (rd->max_cache_bytes > 0)
+			rd->stats.misses += 1;
+
+		if (inode == NULL) {
+			ret = read_inode_ref(rd, ref, &inode);
+			if (ret)
 				return ret;
+		}
 
-			if (ret == 0) {
-				ret = strncmp((const char *)ent->name,
-					      path, ptr - path);
-				if (ret == 0)
-					ret = ent->name[ptr - path];
-				free(ent);
-			}
-		} while (ret < 0);
+		ret = sqfs_dir_reader_open_dir(rd, inode);
+		free(inode);
+		if (ret)
+			return ret;
 
-		if (ret > 0)
-			return SQFS_ERROR_NO_ENTRY;
+		ret = find_entry(rd, path, ptr - path);
+		if (ret == SQFS_ERROR_NO_ENTRY) {
+			ret = cache_insert(rd, &key, path, ptr - path,
+					   DENTRY_NEGATIVE, 0, NULL);
+			return ret ? ret : SQFS_ERROR_NO_ENTRY;
+		}
+		if (ret)
+			return ret;
 
 		ret = sqfs_dir_reader_get_inode(rd, &inode);
 		if (ret)
 			return ret;
 
+		ref = ((sqfs_u64)rd->hdr.start_block << 16) | rd->inode_offset;
+		flags = get_dir_key(inode, &dir) == 0 ? DENTRY_DIR : 0;
+
+		ret = cache_insert(rd, &key, path, ptr - path, flags, ref,
+				   flags ? &dir : NULL);
+		if (ret)
+			goto fail;
+
 		path = ptr;
 	}
 
+	if (inode == NULL) {
+		ret = read_inode_ref(rd, ref, &inode);
+		if (ret)
+			return ret;
+	}
+
 	*out = inode;
 	return 0;
+fail:
+	free(inode);
+	return ret;
+}
+
+static int listing_grow(sqfs_u8 **data, size_t *max, size_t used, size_t size)
+{
+	size_t new_max = *max;
+	sqfs_u8 *new;
+
+	if (SZ_ADD_OV(used, size, &size))
+		return SQFS_ERROR_OVERFLOW;
+
+	if (size <= *max)
+		return 0;
+
+	while (new_max < size) {
+		if (SZ_MUL_OV(new_max, 2, &new_max))
+			return SQFS_ERROR_OVERFLOW;
+	}
+
+	new = realloc(*data, new_max);
+	if (new == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	*data = new;
+	*max = new_max;
+	return 0;
+}
+
+static int compare_inode_ref(const void *lhs, const void *rhs)
+{
+	const listing_ent_t *l = lhs, *r = rhs;
+
+	if (l->inode_ref == r->inode_ref)
+		return 0;
+
+	return l->inode_ref < r->inode_ref ? -1 : 1;
+}
+
+/*
+  The listing is built in a single buffer that grows as needed, so
+  everything is referred to by offsets until it is complete. First come
+  the nodes with their names in directory order, then the inodes in the
+  order they were read, then the array of pointers to the nodes.
+ */
+int sqfs_dir_reader_read_all(sqfs_dir_reader_t *rd, sqfs_u32 flags,
+			     sqfs_dir_listing_t **out)
+{
+	size_t i, count = 0, used, max, size;
+	sqfs_inode_generic_t *inode;
+	sqfs_dir_listing_t *list;
+	sqfs_dir_node_t *node;
+	listing_ent_t *new;
+	sqfs_dir_entry_t ent;
+	sqfs_u16 *diff_u16;
+	sqfs_u8 *data;
+	int ret;
+
+	if (flags & ~SQFS_DIR_LISTING_ALL_FLAGS)
+		return SQFS_ERROR_UNSUPPORTED;
+
+	if (rd->size != rd->start_size) {
+		ret = sqfs_dir_reader_rewind(rd);
+		if (ret)
+			return ret;
+	}
+
+	used = LISTING_ALIGN(sizeof(*list));
+	max = used + 2 * rd->start_size;
+
+	data = malloc(max);
+	if (data == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	for (;;) {
+		ret = read_header(rd);
+		if (ret > 0)
+			break;
+		if (ret < 0)
+			goto fail;
+
+		ret = sqfs_meta_reader_read(rd->meta_dir, &ent, sizeof(ent));
+		if (ret)
+			goto fail;
+
+		ent.offset = le16toh(ent.offset);
+		ent.type = le16toh(ent.type);
+		ent.size = le16toh(ent.size);
+
+		diff_u16 = (sqfs_u16 *)&ent.inode_diff;
+		*diff_u16 = le16toh(*diff_u16);
+
+		if (sizeof(ent) + ent.size + 1 > rd->size) {
+			rd->size = 0;
+			rd->entries = 0;
+		} else {
+			rd->size -= sizeof(ent) + ent.size + 1;
+			rd->entries -= 1;
+		}
+
+		if (count == rd->listing_max) {
+			size = rd->listing_max ? rd->listing_max * 2 : 64;
+
+			new = realloc(rd->listing, size * sizeof(new[0]));
+			if (new == NULL) {
+				ret = SQFS_ERROR_ALLOC;
+				goto fail;
+			}
+
+			rd->listing = new;
+			rd->listing_max = size;
+		}
+
+		size = LISTING_ALIGN(sizeof(*node) + ent.size + 2);
+
+		ret = listing_grow(&data, &max, used, size);
+		if (ret)
+			goto fail;
+
+		node = (sqfs_dir_node_t *)(data + used);
+		node->inode = NULL;
+		node->inode_ref = ((sqfs_u64)rd->hdr.start_block << 16) |
+				  ent.offset;
+		node->inode_number = rd->hdr.inode_number + ent.inode_diff;
+		node->type = ent.type;
+		node->name[ent.size + 1] = '\0';
+
+		ret = sqfs_meta_reader_read(rd->meta_dir, node->name,
+					    ent.size + 1);
+		if (ret)
+			goto fail;
+
+		rd->listing[count].inode_ref = node->inode_ref;
+		rd->listing[count].index = count;
+		rd->listing[count].node = used;
+		count += 1;
+		used += size;
+	}
+
+	qsort(rd->listing, count, sizeof(rd->listing[0]), compare_inode_ref);
+
+	for (i = 0; i < count; ++i) {
+		ret = sqfs_meta_reader_read_inode(rd->meta_inode, rd->super,
+						  rd->listing[i].inode_ref >> 16,
+						  rd->listing[i].inode_ref &
+						  0xFFFF, &inode);
+		if (ret)
+			goto fail;
+
+		size = LISTING_ALIGN(sizeof(*inode) +
+				     inode->payload_bytes_available);
+
+		ret = listing_grow(&data, &max, used, size);
+		if (ret) {
+			free(inode);
+			goto fail;
+		}
+
+		memcpy(data + used, inode,
+		       sizeof(*inode) + inode->payload_bytes_available);
+		free(inode);
+
+		rd->listing[i].inode = used;
+		used += size;
+	}
+
+	if (SZ_MUL_OV(count, sizeof(list->entries[0]), &size)) {
+		ret = SQFS_ERROR_OVERFLOW;
+		goto fail;
+	}
+
+	ret = listing_grow(&data, &max, used, size);
+	if (ret)
+		goto fail;
+
+	list = (sqfs_dir_listing_t *)data;
+	list->count = count;
+	list->entries = (sqfs_dir_node_t **)(data + used);
+
+	for (i = 0; i < count; ++i) {
+		node = (sqfs_dir_node_t *)(data + rd->listing[i].node);
+		node->inode = (sqfs_inode_generic_t *)(data +
+						       rd->listing[i].inode);
+
+		if (flags & SQFS_DIR_LISTING_SORT_INODES) {
+			list->entries[i] = node;
+		} else {
+			list->entries[rd->listing[i].index] = node;
+		}
+	}
+
+	*out = list;
+	return 0;
+fail:
+	free(data);
+	return ret;
 }
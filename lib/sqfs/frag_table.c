@@ -25,7 +25,7 @@ typedef struct chunk_info_t {
 	sqfs_u32 index;
 	sqfs_u32 offset;
 	sqfs_u32 size;
-	sqfs_u32 hash;
+	sqfs_u64 hash;
 } chunk_info_t;
 
 
@@ -39,10 +39,15 @@ struct sqfs_frag_table_t {
 	struct hash_table *ht;
 };
 
+static uint32_t fold_hash(sqfs_u64 hash)
+{
+	return (uint32_t)(hash ^ (hash >> 32));
+}
+
 static uint32_t chunk_info_hash(const void *key)
 {
 	const chunk_info_t *chunk = key;
-	return chunk->hash;
+	return fold_hash(chunk->hash);
 }
 
 static bool chunk_info_equals(const void *a, const void *b)
@@ -70,15 +75,54 @@ static sqfs_object_t *frag_table_copy(const sqfs_object_t *obj)
 {
 	const sqfs_frag_table_t *tbl = (const sqfs_frag_table_t *)obj;
 	sqfs_frag_table_t *copy;
+	chunk_info_t *chunk;
+	bool failed = false;
 
 	copy = malloc(sizeof(*copy));
 	if (copy == NULL)
 		return NULL;
 
 	memcpy(copy, tbl, sizeof(*tbl));
+	copy->table = NULL;
+
+	if (tbl->capacity > 0) {
+		copy->table = malloc(sizeof(tbl->table[0]) * tbl->capacity);
+		if (copy->table == NULL)
+			goto fail_table;
+
+		memcpy(copy->table, tbl->table,
+		       sizeof(tbl->table[0]) * tbl->used);
+	}
 
 	copy->ht = hash_table_clone(tbl->ht);
+	if (copy->ht == NULL)
+		goto fail_ht;
+
+	/* the chunk records are owned by the table, so duplicate them too */
+	hash_table_foreach(copy->ht, entry) {
+		chunk = failed ? NULL : malloc(sizeof(*chunk));
+
+		if (chunk == NULL) {
+			failed = true;
+		} else {
+			memcpy(chunk, entry->data, sizeof(*chunk));
+		}
+
+		entry->key = chunk;
+		entry->data = chunk;
+	}
+
+	if (failed) {
+		hash_table_destroy(copy->ht, delete_function);
+		goto fail_ht;
+	}
+
 	return (sqfs_object_t *)copy;
+fail_ht:
+	free(copy->table);
+fail_table:
+	free(copy);
+	return NULL;
 }
 
 sqfs_frag_table_t *sqfs_frag_table_create(sqfs_u32 flags)
@@ -252,9 +296,24 @@ size_t sqfs_frag_table_get_size(sqfs_frag_table_t *tbl)
 
 int sqfs_frag_table_add_tail_end(sqfs_frag_table_t *tbl,
 				 sqfs_u32 index, sqfs_u32 offset,
-				 sqfs_u32 size, sqfs_u32 hash)
+				 sqfs_u32 size, sqfs_u64 hash)
 {
-	chunk_info_t *new = calloc(1, sizeof(*new));
+	struct hash_entry *entry;
+	chunk_info_t *new, search;
+
+	search.hash = hash;
+	search.size = size;
+
+	/* a chunk with the same hash and size is replaced by the newer one */
+	entry = hash_table_search_pre_hashed(tbl->ht, fold_hash(hash), &search);
+	if (entry != NULL) {
+		new = entry->data;
+		new->index = index;
+		new->offset = offset;
+		return 0;
+	}
+
+	new = calloc(1, sizeof(*new));
 	if (new == NULL)
 		return SQFS_ERROR_ALLOC;
 
@@ -263,13 +322,17 @@ int sqfs_frag_table_add_tail_end(sqfs_frag_table_t *tbl,
 	new->size = size;
 	new->hash = hash;
 
-	hash_table_insert_pre_hashed(tbl->ht, new->hash, new, new);
+	if (hash_table_insert_pre_hashed(tbl->ht, fold_hash(new->hash),
+					 new, new) == NULL) {
+		free(new);
+		return SQFS_ERROR_ALLOC;
+	}
 
 	return 0;
 }
 
 int sqfs_frag_table_find_tail_end(sqfs_frag_table_t *tbl,
-				  sqfs_u32 hash, sqfs_u32 size,
+				  sqfs_u64 hash, sqfs_u32 size,
 				  sqfs_u32 *index, sqfs_u32 *offset)
 {
 	struct hash_entry *entry;
@@ -278,7 +341,8 @@ int sqfs_frag_table_find_tail_end(sqfs_frag_table_t *tbl,
 	search.hash = hash;
 	search.size = size;
 
-	entry = hash_table_search_pre_hashed(tbl->ht, hash, &search);
+	entry = hash_table_search_pre_hashed(tbl->ht, fold_hash(hash),
+					      &search);
 	if (!entry)
 		return SQFS_ERROR_NO_ENTRY;
 
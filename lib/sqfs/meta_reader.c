@@ -17,6 +17,46 @@
 #include <stdlib.h>
 #include <string.h>
 
+#define INITIAL_BUCKETS (64)
+
+typedef struct meta_block_t {
+	struct meta_block_t *prev;
+	struct meta_block_t *next;
+
+	/* next block in the same hash bucket */
+	struct meta_block_t *chain;
+
+	sqfs_u64 location;
+	sqfs_u64 next_block;
+	size_t size;
+
+	sqfs_u8 data[];
+} meta_block_t;
+
+struct sqfs_meta_cache_t {
+	sqfs_object_t base;
+
+	meta_block_t **buckets;
+	size_t num_buckets;
+
+	/* most recently used first */
+	meta_block_t *lru_first;
+	meta_block_t *lru_last;
+
+	size_t max_size;
+
+	sqfs_meta_cache_stats_t stats;
+};
+
+typedef struct {
+	sqfs_u64 location;
+	sqfs_u64 next_block;
+
+	/* location of the uncompressed data in the preloaded table */
+	size_t offset;
+	size_t size;
+} meta_index_t;
+
 struct sqfs_meta_reader_t {
 	sqfs_object_t base;
 
@@ -39,6 +79,19 @@ struct sqfs_meta_reader_t {
 	/* A pointer to the compressor to use for extracting data */
 	sqfs_compressor_t *cmp;
 
+	/* An optional cache of uncompressed blocks, not owned by us */
+	sqfs_meta_cache_t *cache;
+
+	/* If preloaded, all blocks uncompressed back to back and an index
+	   sorted by on-disk location */
+	sqfs_u8 *table;
+	meta_index_t *index;
+	size_t num_blocks;
+
+	/* Points to the uncompressed data of the current block, either
+	   the data buffer below or a block in the preloaded table */
+	const sqfs_u8 *block;
+
 	/* The raw data read from the input file */
 	sqfs_u8 data[SQFS_META_BLOCK_SIZE];
 
@@ -46,8 +99,180 @@ struct sqfs_meta_reader_t {
 	sqfs_u8 scratch[SQFS_META_BLOCK_SIZE];
 };
 
-static void meta_reader_destroy(sqfs_object_t *m)
+static size_t cache_bucket(const sqfs_meta_cache_t *cache, sqfs_u64 location)
+{
+	location ^= location >> 29;
+	location *= 0xBF58476D1CE4E5B9ULL;
+	location ^= location >> 32;
+
+	return location & (cache->num_buckets - 1);
+}
+
+static void cache_remove(sqfs_meta_cache_t *cache, meta_block_t *blk)
+{
+	meta_block_t **it = cache->buckets + cache_bucket(cache, blk->location);
+
+	while (*it != blk)
+		it = &((*it)->chain);
+
+	*it = blk->chain;
+
+	if (blk->prev == NULL) {
+		cache->lru_first = blk->next;
+	} else {
+		blk->prev->next = blk->next;
+	}
+
+	if (blk->next == NULL) {
+		cache->lru_last = blk->prev;
+	} else {
+		blk->next->prev = blk->prev;
+	}
+
+	cache->stats.cached_blocks -= 1;
+	cache->stats.cached_bytes -= sizeof(*blk) + blk->size;
+	free(blk);
+}
+
+static int cache_grow(sqfs_meta_cache_t *cache)
+{
+	size_t i, count = cache->num_buckets ? cache->num_buckets * 2 :
+					       INITIAL_BUCKETS;
+	meta_block_t **new, *it;
+
+	new = alloc_array(sizeof(new[0]), count);
+	if (new == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	for (i = 0; i < count; ++i)
+		new[i] = NULL;
+
+	free(cache->buckets);
+	cache->buckets = new;
+	cache->num_buckets = count;
+
+	for (it = cache->lru_first; it != NULL; it = it->next) {
+		i = cache_bucket(cache, it->location);
+		it->chain = cache->buckets[i];
+		cache->buckets[i] = it;
+	}
+
+	return 0;
+}
+
+static meta_block_t *cache_lookup(sqfs_meta_cache_t *cache,
+				  sqfs_u64 location)
+{
+	meta_block_t *blk = NULL;
+
+	if (cache->num_buckets > 0)
+		blk = cache->buckets[cache_bucket(cache, location)];
+
+	while (blk != NULL && blk->location != location)
+		blk = blk->chain;
+
+	if (blk == NULL || blk == cache->lru_first)
+		return blk;
+
+	blk->prev->next = blk->next;
+
+	if (blk->next == NULL) {
+		cache->lru_last = blk->prev;
+	} else {
+		blk->next->prev = blk->prev;
+	}
+
+	blk->prev = NULL;
+	blk->next = cache->lru_first;
+	cache->lru_first->prev = blk;
+	cache->lru_first = blk;
+	return blk;
+}
+
+static int cache_insert(sqfs_meta_cache_t *cache, sqfs_u64 location,
+			sqfs_u64 next_block, const sqfs_u8 *data, size_t size)
+{
+	meta_block_t *blk;
+	size_t idx;
+	int err;
+
+	if (cache->stats.cached_blocks >= cache->num_buckets) {
+		err = cache_grow(cache);
+		if (err)
+			return err;
+	}
+
+	blk = alloc_flex(sizeof(*blk), 1, size);
+	if (blk == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	blk->location = location;
+	blk->next_block = next_block;
+	blk->size = size;
+	memcpy(blk->data, data, size);
+
+	idx = cache_bucket(cache, location);
+	blk->chain = cache->buckets[idx];
+	cache->buckets[idx] = blk;
+
+	blk->next = cache->lru_first;
+
+	if (cache->lru_first == NULL) {
+		cache->lru_last = blk;
+	} else {
+		cache->lru_first->prev = blk;
+	}
+
+	cache->lru_first = blk;
+	cache->stats.cached_blocks += 1;
+	cache->stats.cached_bytes += sizeof(*blk) + size;
+
+	/* evict least recently used blocks, but keep the new one */
+	while (cache->stats.cached_bytes > cache->max_size &&
+	       cache->lru_last != blk) {
+		cache_remove(cache, cache->lru_last);
+		cache->stats.evictions += 1;
+	}
+
+	return 0;
+}
+
+static void meta_cache_destroy(sqfs_object_t *obj)
+{
+	sqfs_meta_cache_t *cache = (sqfs_meta_cache_t *)obj;
+
+	while (cache->lru_first != NULL)
+		cache_remove(cache, cache->lru_first);
+
+	free(cache->buckets);
+	free(cache);
+}
+
+sqfs_meta_cache_t *sqfs_meta_cache_create(size_t max_size)
 {
+	sqfs_meta_cache_t *cache = calloc(1, sizeof(*cache));
+
+	if (cache == NULL)
+		return NULL;
+
+	((sqfs_object_t *)cache)->destroy = meta_cache_destroy;
+	cache->max_size = max_size;
+	cache->stats.size = sizeof(cache->stats);
+	return cache;
+}
+
+const sqfs_meta_cache_stats_t
+*sqfs_meta_cache_get_stats(const sqfs_meta_cache_t *cache)
+{
+	return &cache->stats;
+}
+
+static void meta_reader_destroy(sqfs_object_t *obj)
+{
+	sqfs_meta_reader_t *m = (sqfs_meta_reader_t *)obj;
+
+	free(m->table);
+	free(m->index);
 	free(m);
 }
 
@@ -56,12 +281,38 @@ static sqfs_object_t *meta_reader_copy(const sqfs_object_t *obj)
 	const sqfs_meta_reader_t *m = (const sqfs_meta_reader_t *)obj;
 	sqfs_meta_reader_t *copy = malloc(sizeof(*copy));
 
-	if (copy != NULL) {
-		memcpy(copy, m, sizeof(*m));
-	}
+	size_t size;
+
+	if (copy == NULL)
+		return NULL;
+
+	memcpy(copy, m, sizeof(*m));
+	copy->block = copy->data;
 
 	/* XXX: cmp and file aren't deep-copied because m
 	        doesn't own them either. */
+	if (m->index != NULL) {
+		size = m->index[m->num_blocks - 1].offset +
+			m->index[m->num_blocks - 1].size;
+
+		copy->table = malloc(size);
+		copy->index = alloc_array(sizeof(m->index[0]), m->num_blocks);
+
+		if (copy->table == NULL || copy->index == NULL) {
+			free(copy->table);
+			free(copy->index);
+			free(copy);
+			return NULL;
+		}
+
+		memcpy(copy->table, m->table, size);
+		memcpy(copy->index, m->index,
+		       sizeof(m->index[0]) * m->num_blocks);
+
+		if (m->block != m->data)
+			copy->block = copy->table + (m->block - m->table);
+	}
+
 	return (sqfs_object_t *)copy;
 }
 
@@ -80,12 +331,156 @@ sqfs_meta_reader_t *sqfs_meta_reader_create(sqfs_file_t *file,
 	m->limit = limit;
 	m->file = file;
 	m->cmp = cmp;
+	m->block = m->data;
 	return m;
 }
 
+static const meta_index_t *index_lookup(const sqfs_meta_reader_t *m,
+					sqfs_u64 location)
+{
+	size_t first = 0, last = m->num_blocks;
+
+	while (first < last) {
+		size_t mid = first + (last - first) / 2;
+
+		if (m->index[mid].location == location)
+			return m->index + mid;
+
+		if (m->index[mid].location < location) {
+			first = mid + 1;
+		} else {
+			last = mid;
+		}
+	}
+
+	return NULL;
+}
+
+/* walks the block headers in a raw copy of the table, stops at anything
+   that does not look like a meta data block */
+static size_t count_blocks(const sqfs_u8 *raw, size_t raw_size)
+{
+	size_t pos = 0, count = 0;
+	sqfs_u16 header;
+	size_t size;
+
+	while (raw_size - pos >= sizeof(header)) {
+		memcpy(&header, raw + pos, sizeof(header));
+		size = le16toh(header) & 0x7FFF;
+
+		if (size > SQFS_META_BLOCK_SIZE ||
+		    size > raw_size - pos - sizeof(header)) {
+			break;
+		}
+
+		pos += size + sizeof(header);
+		count += 1;
+	}
+
+	return count;
+}
+
+int sqfs_meta_reader_preload(sqfs_meta_reader_t *m, size_t max_size)
+{
+	size_t i, raw_size, count, pos = 0, used = 0;
+	sqfs_u8 *raw, *table, *new;
+	meta_index_t *index;
+	sqfs_u16 header;
+	sqfs_u32 size;
+	sqfs_s32 ret;
+	int err;
+
+	if (m->limit <= m->start)
+		return 0;
+
+	if (m->limit - m->start > max_size)
+		return SQFS_ERROR_OVERFLOW;
+
+	raw_size = m->limit - m->start;
+	raw = malloc(raw_size);
+	if (raw == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	err = m->file->read_at(m->file, m->start, raw, raw_size);
+	if (err)
+		goto out_raw;
+
+	count = count_blocks(raw, raw_size);
+	if (count == 0)
+		goto out_raw;
+
+	if (count > max_size / SQFS_META_BLOCK_SIZE) {
+		err = SQFS_ERROR_OVERFLOW;
+		goto out_raw;
+	}
+
+	table = alloc_array(SQFS_META_BLOCK_SIZE, count);
+	index = alloc_array(sizeof(index[0]), count);
+	if (table == NULL || index == NULL) {
+		err = SQFS_ERROR_ALLOC;
+		goto out_alloc;
+	}
+
+	/* Blocks that fail to decompress are left out of the index, so
+	   seeking to them takes the regular path and reports the error. */
+	for (i = 0; i < count; ++i) {
+		memcpy(&header, raw + pos, sizeof(header));
+		header = le16toh(header);
+		size = header & 0x7FFF;
+
+		if (header & 0x8000) {
+			memcpy(table + used, raw + pos + 2, size);
+			ret = size;
+		} else {
+			ret = m->cmp->do_block(m->cmp, raw + pos + 2, size,
+					       table + used,
+					       SQFS_META_BLOCK_SIZE);
+		}
+
+		if (ret <= 0)
+			break;
+
+		index[i].location = m->start + pos;
+		index[i].next_block = m->start + pos + 2 + size;
+		index[i].offset = used;
+		index[i].size = ret;
+
+		used += ret;
+		pos += size + 2;
+	}
+
+	if (i == 0)
+		goto out_alloc;
+
+	new = realloc(table, used);
+	if (new != NULL)
+		table = new;
+
+	if (m->block != m->data) {
+		memcpy(m->data, m->block, m->data_used);
+		m->block = m->data;
+	}
+
+	free(m->table);
+	free(m->index);
+	m->table = table;
+	m->index = index;
+	m->num_blocks = i;
+	free(raw);
+	return 0;
+out_alloc:
+	free(table);
+	free(index);
+out_raw:
+	free(raw);
+	return err;
+}
+
 int sqfs_meta_reader_seek(sqfs_meta_reader_t *m, sqfs_u64 block_start,
 			  size_t offset)
 {
+	const meta_index_t *ent;
+	meta_block_t *blk;
 	bool compressed;
 	sqfs_u16 header;
 	sqfs_u32 size;
@@ -103,6 +498,46 @@ int sqfs_meta_reader_seek(sqfs_meta_reader_t *m, sqfs_u64 block_start,
 		return 0;
 	}
 
+	if (m->index != NULL) {
+		ent = index_lookup(m, block_start);
+
+		if (ent != NULL) {
+			if (offset >= ent->size)
+				return SQFS_ERROR_OUT_OF_BOUNDS;
+
+			m->block = m->table + ent->offset;
+			m->data_used = ent->size;
+			m->block_offset = block_start;
+			m->next_block = ent->next_block;
+			m->offset = offset;
+			return 0;
+		}
+	}
+
+	if (m->cache != NULL) {
+		blk = cache_lookup(m->cache, block_start);
+
+		if (blk != NULL) {
+			m->cache->stats.hits += 1;
+
+			if (blk->next_block > m->limit)
+				return SQFS_ERROR_OUT_OF_BOUNDS;
+
+			if (offset >= blk->size)
+				return SQFS_ERROR_OUT_OF_BOUNDS;
+
+			memcpy(m->data, blk->data, blk->size);
+			m->block = m->data;
+			m->data_used = blk->size;
+			m->block_offset = block_start;
+			m->next_block = blk->next_block;
+			m->offset = offset;
+			return 0;
+		}
+
+		m->cache->stats.misses += 1;
+	}
+
 	err = m->file->read_at(m->file, block_start, &header, 2);
 	if (err)
 		return err;
@@ -117,6 +552,8 @@ int sqfs_meta_reader_seek(sqfs_meta_reader_t *m, sqfs_u64 block_start,
 	if ((block_start + 2 + size) > m->limit)
 		return SQFS_ERROR_OUT_OF_BOUNDS;
 
+	m->block = m->data;
+
 	err = m->file->read_at(m->file, block_start + 2, m->data, size);
 	if (err)
 		return err;
@@ -134,6 +571,14 @@ int sqfs_meta_reader_seek(sqfs_meta_reader_t *m, sqfs_u64 block_start,
 		m->data_used = size;
 	}
 
+	if (m->cache != NULL) {
+		err = cache_insert(m->cache, block_start,
+				   block_start + size + 2,
+				   m->data, m->data_used);
+		if (err)
+			return err;
+	}
+
 	if (offset >= m->data_used)
 		return SQFS_ERROR_OUT_OF_BOUNDS;
 
@@ -143,6 +588,12 @@ int sqfs_meta_reader_seek(sqfs_meta_reader_t *m, sqfs_u64 block_start,
 	return 0;
 }
 
+void sqfs_meta_reader_set_cache(sqfs_meta_reader_t *m,
+				sqfs_meta_cache_t *cache)
+{
+	m->cache = cache;
+}
+
 void sqfs_meta_reader_get_position(const sqfs_meta_reader_t *m,
 				   sqfs_u64 *block_start, size_t *offset)
 {
@@ -168,7 +619,7 @@ int sqfs_meta_reader_read(sqfs_meta_reader_t *m, void *data, size_t size)
 		if (diff > size)
 			diff = size;
 
-		memcpy(data, m->data + m->offset, diff);
+		memcpy(data, m->block + m->offset, diff);
 
 		m->offset += diff;
 		data = (char *)data + diff;
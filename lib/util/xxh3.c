@@ -0,0 +1,489 @@
+/*
+ * xxHash - Extremely Fast Hash algorithm
+ * Copyright (C) 2019-2020, Yann Collet.
+ *
+ * BSD 2-Clause License (http://www.opensource.org/licenses/bsd-license.php)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ * This is a condensed version of XXH3_64bits from xxHash 0.8, limited to the
+ * default secret and seed, adapted for use in libsquashfs. It produces the
+ * same hash values as the original. For the complete source, see below.
+ *
+ * You can contact the author at:
+ * - xxHash homepage: http://cyan4973.github.io/xxHash/
+ * - xxHash source repository: https://github.com/Cyan4973/xxHash
+ */
+#include "config.h"
+#include "util.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_KERNEL
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define STRIPE_LEN (64)
+#define SECRET_SIZE (192)
+#define SECRET_CONSUME_RATE (8)
+#define STRIPES_PER_BLOCK ((SECRET_SIZE - STRIPE_LEN) / SECRET_CONSUME_RATE)
+#define BLOCK_LEN (STRIPE_LEN * STRIPES_PER_BLOCK)
+#define ACC_NB (STRIPE_LEN / sizeof(sqfs_u64))
+
+#define MIDSIZE_MAX (240)
+#define MIDSIZE_STARTOFFSET (3)
+#define MIDSIZE_LASTOFFSET (17)
+#define SECRET_SIZE_MIN (136)
+#define SECRET_LASTACC_START (7)
+#define SECRET_MERGEACCS_START (11)
+
+#define xxh_rotl64(x, r) ((x << r) | (x >> (64 - r)))
+
+static const sqfs_u32 PRIME32_1 = 0x9E3779B1U;
+static const sqfs_u32 PRIME32_2 = 0x85EBCA77U;
+static const sqfs_u32 PRIME32_3 = 0xC2B2AE3DU;
+
+static const sqfs_u64 PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const sqfs_u64 PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const sqfs_u64 PRIME64_3 = 0x165667B19E3779F9ULL;
+static const sqfs_u64 PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const sqfs_u64 PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static const sqfs_u64 PRIME_MX1 = 0x165667919E3779F9ULL;
+static const sqfs_u64 PRIME_MX2 = 0x9FB21C651E98DF25ULL;
+
+static const sqfs_u8 secret[SECRET_SIZE] = {
+	0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe,
+	0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+	0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb,
+	0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+	0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78,
+	0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+	0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e,
+	0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+	0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb,
+	0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+	0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e,
+	0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+	0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f,
+	0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+	0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31,
+	0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+	0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3,
+	0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+	0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49,
+	0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+	0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc,
+	0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+	0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28,
+	0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+static sqfs_u32 XXH_readLE32(const sqfs_u8 *ptr)
+{
+	sqfs_u32 value;
+	memcpy(&value, ptr, sizeof(value));
+	return le32toh(value);
+}
+
+static sqfs_u64 XXH_readLE64(const sqfs_u8 *ptr)
+{
+	sqfs_u64 value;
+	memcpy(&value, ptr, sizeof(value));
+	return le64toh(value);
+}
+
+static sqfs_u64 swap64(sqfs_u64 x)
+{
+	return ((x << 56) & 0xFF00000000000000ULL) |
+		((x << 40) & 0x00FF000000000000ULL) |
+		((x << 24) & 0x0000FF0000000000ULL) |
+		((x << 8)  & 0x000000FF00000000ULL) |
+		((x >> 8)  & 0x00000000FF000000ULL) |
+		((x >> 24) & 0x0000000000FF0000ULL) |
+		((x >> 40) & 0x000000000000FF00ULL) |
+		((x >> 56) & 0x00000000000000FFULL);
+}
+
+/* the 128 bit product of two 64 bit values, folded into 64 bits */
+static sqfs_u64 mul128_fold64(sqfs_u64 lhs, sqfs_u64 rhs)
+{
+#if defined(__SIZEOF_INT128__)
+	__uint128_t product = (__uint128_t)lhs * (__uint128_t)rhs;
+
+	return (sqfs_u64)product ^ (sqfs_u64)(product >> 64);
+#else
+	sqfs_u64 lo_lo = (lhs & 0xFFFFFFFF) * (rhs & 0xFFFFFFFF);
+	sqfs_u64 hi_lo = (lhs >> 32) * (rhs & 0xFFFFFFFF);
+	sqfs_u64 lo_hi = (lhs & 0xFFFFFFFF) * (rhs >> 32);
+	sqfs_u64 hi_hi = (lhs >> 32) * (rhs >> 32);
+	sqfs_u64 cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+	sqfs_u64 upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+	sqfs_u64 lower = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+
+	return lower ^ upper;
+#endif
+}
+
+static sqfs_u64 xxh64_avalanche(sqfs_u64 h64)
+{
+	h64 ^= h64 >> 33;
+	h64 *= PRIME64_2;
+	h64 ^= h64 >> 29;
+	h64 *= PRIME64_3;
+	h64 ^= h64 >> 32;
+	return h64;
+}
+
+static sqfs_u64 xxh3_avalanche(sqfs_u64 h64)
+{
+	h64 ^= h64 >> 37;
+	h64 *= PRIME_MX1;
+	h64 ^= h64 >> 32;
+	return h64;
+}
+
+static sqfs_u64 xxh3_rrmxmx(sqfs_u64 h64, sqfs_u64 len)
+{
+	h64 ^= xxh_rotl64(h64, 49) ^ xxh_rotl64(h64, 24);
+	h64 *= PRIME_MX2;
+	h64 ^= (h64 >> 35) + len;
+	h64 *= PRIME_MX2;
+	h64 ^= h64 >> 28;
+	return h64;
+}
+
+static sqfs_u64 mix16B(const sqfs_u8 *in, const sqfs_u8 *sec)
+{
+	return mul128_fold64(XXH_readLE64(in) ^ XXH_readLE64(sec),
+			     XXH_readLE64(in + 8) ^ XXH_readLE64(sec + 8));
+}
+
+static sqfs_u64 len_0to16(const sqfs_u8 *in, size_t len)
+{
+	sqfs_u64 lo, hi, acc;
+	sqfs_u32 combined;
+
+	if (len > 8) {
+		lo = XXH_readLE64(in) ^
+			(XXH_readLE64(secret + 24) ^ XXH_readLE64(secret + 32));
+		hi = XXH_readLE64(in + len - 8) ^
+			(XXH_readLE64(secret + 40) ^ XXH_readLE64(secret + 48));
+		acc = len + swap64(lo) + hi + mul128_fold64(lo, hi);
+		return xxh3_avalanche(acc);
+	}
+
+	if (len >= 4) {
+		acc = XXH_readLE32(in + len - 4) +
+			((sqfs_u64)XXH_readLE32(in) << 32);
+		acc ^= XXH_readLE64(secret + 8) ^ XXH_readLE64(secret + 16);
+		return xxh3_rrmxmx(acc, len);
+	}
+
+	if (len > 0) {
+		combined = ((sqfs_u32)in[0] << 16) |
+			((sqfs_u32)in[len >> 1] << 24) |
+			((sqfs_u32)in[len - 1]) | ((sqfs_u32)len << 8);
+		acc = (sqfs_u64)combined ^
+			(XXH_readLE32(secret) ^ XXH_readLE32(secret + 4));
+		return xxh64_avalanche(acc);
+	}
+
+	return xxh64_avalanche(XXH_readLE64(secret + 56) ^
+			       XXH_readLE64(secret + 64));
+}
+
+static sqfs_u64 len_17to128(const sqfs_u8 *in, size_t len)
+{
+	sqfs_u64 acc = len * PRIME64_1;
+
+	if (len > 32) {
+		if (len > 64) {
+			if (len > 96) {
+				acc += mix16B(in + 48, secret + 96);
+				acc += mix16B(in + len - 64, secret + 112);
+			}
+			acc += mix16B(in + 32, secret + 64);
+			acc += mix16B(in + len - 48, secret + 80);
+		}
+		acc += mix16B(in + 16, secret + 32);
+		acc += mix16B(in + len - 32, secret + 48);
+	}
+
+	acc += mix16B(in, secret);
+	acc += mix16B(in + len - 16, secret + 16);
+	return xxh3_avalanche(acc);
+}
+
+static sqfs_u64 len_129to240(const sqfs_u8 *in, size_t len)
+{
+	sqfs_u64 acc = len * PRIME64_1;
+	size_t i, rounds = len / 16;
+
+	for (i = 0; i < 8; ++i)
+		acc += mix16B(in + 16 * i, secret + 16 * i);
+
+	acc = xxh3_avalanche(acc);
+
+	for (i = 8; i < rounds; ++i) {
+		acc += mix16B(in + 16 * i,
+			      secret + 16 * (i - 8) + MIDSIZE_STARTOFFSET);
+	}
+
+	acc += mix16B(in + len - 16,
+		      secret + SECRET_SIZE_MIN - MIDSIZE_LASTOFFSET);
+	return xxh3_avalanche(acc);
+}
+
+/*
+  Long inputs are processed in stripes of 64 bytes, feeding 8 independent
+  accumulators that are scrambled after every block of 16 stripes. This is
+  the part that benefits from SIMD and the only one that is dispatched.
+ */
+#if !defined(__SSE2__)
+static void accumulate_512_scalar(sqfs_u64 *acc, const sqfs_u8 *in,
+				  const sqfs_u8 *sec)
+{
+	sqfs_u64 data_val, data_key;
+	size_t i;
+
+	for (i = 0; i < ACC_NB; ++i) {
+		data_val = XXH_readLE64(in + 8 * i);
+		data_key = data_val ^ XXH_readLE64(sec + 8 * i);
+		acc[i ^ 1] += data_val;
+		acc[i] += (data_key & 0xFFFFFFFF) * (data_key >> 32);
+	}
+}
+
+static void scramble_scalar(sqfs_u64 *acc, const sqfs_u8 *sec)
+{
+	sqfs_u64 a;
+	size_t i;
+
+	for (i = 0; i < ACC_NB; ++i) {
+		a = acc[i];
+		a ^= a >> 47;
+		a ^= XXH_readLE64(sec + 8 * i);
+		acc[i] = a * PRIME32_1;
+	}
+}
+
+static void hash_long_scalar(sqfs_u64 *acc, const sqfs_u8 *in, size_t len)
+{
+	size_t i, n, blocks = (len - 1) / BLOCK_LEN, stripes;
+
+	for (n = 0; n < blocks; ++n) {
+		for (i = 0; i < STRIPES_PER_BLOCK; ++i) {
+			accumulate_512_scalar(acc, in + n * BLOCK_LEN +
+					      i * STRIPE_LEN,
+					      secret + i * SECRET_CONSUME_RATE);
+		}
+
+		scramble_scalar(acc, secret + SECRET_SIZE - STRIPE_LEN);
+	}
+
+	stripes = ((len - 1) - BLOCK_LEN * blocks) / STRIPE_LEN;
+
+	for (i = 0; i < stripes; ++i) {
+		accumulate_512_scalar(acc, in + blocks * BLOCK_LEN +
+				      i * STRIPE_LEN,
+				      secret + i * SECRET_CONSUME_RATE);
+	}
+
+	accumulate_512_scalar(acc, in + len - STRIPE_LEN,
+			      secret + SECRET_SIZE - STRIPE_LEN -
+			      SECRET_LASTACC_START);
+}
+#else
+static void hash_long_sse2(sqfs_u64 *acc_out, const sqfs_u8 *in, size_t len)
+{
+	size_t i, j, n, blocks = (len - 1) / BLOCK_LEN, stripes;
+	const __m128i prime32 = _mm_set1_epi32((int)PRIME32_1);
+	__m128i acc[4], data, key, dk, prod, sum;
+	const sqfs_u8 *p, *s;
+
+	for (j = 0; j < 4; ++j)
+		acc[j] = _mm_loadu_si128((const __m128i *)(acc_out + 2 * j));
+
+#define ACCUMULATE(ptr, sec) \
+	for (j = 0; j < 4; ++j) { \
+		data = _mm_loadu_si128((const __m128i *)((ptr) + 16 * j)); \
+		key = _mm_loadu_si128((const __m128i *)((sec) + 16 * j)); \
+		dk = _mm_xor_si128(data, key); \
+		prod = _mm_mul_epu32(dk, _mm_shuffle_epi32(dk, 0x31)); \
+		sum = _mm_add_epi64(acc[j], _mm_shuffle_epi32(data, 0x4E)); \
+		acc[j] = _mm_add_epi64(prod, sum); \
+	}
+
+	for (n = 0; n < blocks; ++n) {
+		for (i = 0; i < STRIPES_PER_BLOCK; ++i) {
+			p = in + n * BLOCK_LEN + i * STRIPE_LEN;
+			s = secret + i * SECRET_CONSUME_RATE;
+			ACCUMULATE(p, s)
+		}
+
+		s = secret + SECRET_SIZE - STRIPE_LEN;
+
+		for (j = 0; j < 4; ++j) {
+			dk = _mm_xor_si128(acc[j], _mm_srli_epi64(acc[j], 47));
+			key = _mm_loadu_si128((const __m128i *)(s + 16 * j));
+			dk = _mm_xor_si128(dk, key);
+			prod = _mm_mul_epu32(_mm_shuffle_epi32(dk, 0x31),
+					     prime32);
+			acc[j] = _mm_add_epi64(_mm_mul_epu32(dk, prime32),
+					       _mm_slli_epi64(prod, 32));
+		}
+	}
+
+	stripes = ((len - 1) - BLOCK_LEN * blocks) / STRIPE_LEN;
+
+	for (i = 0; i < stripes; ++i) {
+		p = in + blocks * BLOCK_LEN + i * STRIPE_LEN;
+		s = secret + i * SECRET_CONSUME_RATE;
+		ACCUMULATE(p, s)
+	}
+
+	p = in + len - STRIPE_LEN;
+	s = secret + SECRET_SIZE - STRIPE_LEN - SECRET_LASTACC_START;
+	ACCUMULATE(p, s)
+#undef ACCUMULATE
+
+	for (j = 0; j < 4; ++j)
+		_mm_storeu_si128((__m128i *)(acc_out + 2 * j), acc[j]);
+}
+#endif
+
+#if defined(HAVE_AVX2_KERNEL)
+__attribute__((target("avx2")))
+static void hash_long_avx2(sqfs_u64 *acc_out, const sqfs_u8 *in, size_t len)
+{
+	size_t i, j, n, blocks = (len - 1) / BLOCK_LEN, stripes;
+	const __m256i prime32 = _mm256_set1_epi32((int)PRIME32_1);
+	__m256i acc[2], data, key, dk, prod, sum;
+	const sqfs_u8 *p, *s;
+
+	for (j = 0; j < 2; ++j)
+		acc[j] = _mm256_loadu_si256((const __m256i *)(acc_out + 4 * j));
+
+#define ACCUMULATE(ptr, sec) \
+	for (j = 0; j < 2; ++j) { \
+		data = _mm256_loadu_si256((const __m256i *)((ptr) + 32 * j)); \
+		key = _mm256_loadu_si256((const __m256i *)((sec) + 32 * j)); \
+		dk = _mm256_xor_si256(data, key); \
+		prod = _mm256_mul_epu32(dk, _mm256_shuffle_epi32(dk, 0x31)); \
+		sum = _mm256_add_epi64(acc[j], \
+				       _mm256_shuffle_epi32(data, 0x4E)); \
+		acc[j] = _mm256_add_epi64(prod, sum); \
+	}
+
+	for (n = 0; n < blocks; ++n) {
+		for (i = 0; i < STRIPES_PER_BLOCK; ++i) {
+			p = in + n * BLOCK_LEN + i * STRIPE_LEN;
+			s = secret + i * SECRET_CONSUME_RATE;
+			ACCUMULATE(p, s)
+		}
+
+		s = secret + SECRET_SIZE - STRIPE_LEN;
+
+		for (j = 0; j < 2; ++j) {
+			dk = _mm256_xor_si256(acc[j],
+					      _mm256_srli_epi64(acc[j], 47));
+			key = _mm256_loadu_si256((const __m256i *)
+						 (s + 32 * j));
+			dk = _mm256_xor_si256(dk, key);
+			prod = _mm256_mul_epu32(_mm256_shuffle_epi32(dk, 0x31),
+						prime32);
+			acc[j] = _mm256_add_epi64(_mm256_mul_epu32(dk, prime32),
+						  _mm256_slli_epi64(prod, 32));
+		}
+	}
+
+	stripes = ((len - 1) - BLOCK_LEN * blocks) / STRIPE_LEN;
+
+	for (i = 0; i < stripes; ++i) {
+		p = in + blocks * BLOCK_LEN + i * STRIPE_LEN;
+		s = secret + i * SECRET_CONSUME_RATE;
+		ACCUMULATE(p, s)
+	}
+
+	p = in + len - STRIPE_LEN;
+	s = secret + SECRET_SIZE - STRIPE_LEN - SECRET_LASTACC_START;
+	ACCUMULATE(p, s)
+#undef ACCUMULATE
+
+	for (j = 0; j < 2; ++j)
+		_mm256_storeu_si256((__m256i *)(acc_out + 4 * j), acc[j]);
+}
+#endif
+
+static sqfs_u64 hash_long(const sqfs_u8 *in, size_t len)
+{
+	sqfs_u64 acc[ACC_NB] = {
+		PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3,
+		PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1,
+	};
+	sqfs_u64 result = len * PRIME64_1;
+	const sqfs_u8 *sec = secret + SECRET_MERGEACCS_START;
+	size_t i;
+
+#if defined(HAVE_AVX2_KERNEL)
+	if (__builtin_cpu_supports("avx2")) {
+		hash_long_avx2(acc, in, len);
+	} else
+#endif
+	{
+#if defined(__SSE2__)
+		hash_long_sse2(acc, in, len);
+#else
+		hash_long_scalar(acc, in, len);
+#endif
+	}
+
+	for (i = 0; i < ACC_NB; i += 2) {
+		result += mul128_fold64(acc[i] ^ XXH_readLE64(sec + 8 * i),
+					acc[i + 1] ^
+					XXH_readLE64(sec + 8 * i + 8));
+	}
+
+	return xxh3_avalanche(result);
+}
+
+sqfs_u64 xxh3_64(const void *input, const size_t len)
+{
+	const sqfs_u8 *in = (const sqfs_u8 *)input;
+
+	if (len <= 16)
+		return len_0to16(in, len);
+
+	if (len <= 128)
+		return len_17to128(in, len);
+
+	if (len <= MIDSIZE_MAX)
+		return len_129to240(in, len);
+
+	return hash_long(in, len);
+}
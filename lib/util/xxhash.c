@@ -110,3 +110,93 @@ sqfs_u32 xxh32(const void *input, const size_t len)
 	h32 ^= h32 >> 16;
 	return h32;
 }
+
+#define xxh_rotl64(x, r) ((x << r) | (x >> (64 - r)))
+
+static const sqfs_u64 PRIME64_1 = 11400714785074694791ULL;
+static const sqfs_u64 PRIME64_2 = 14029467366897019727ULL;
+static const sqfs_u64 PRIME64_3 =  1609587929392839161ULL;
+static const sqfs_u64 PRIME64_4 =  9650029242287828579ULL;
+static const sqfs_u64 PRIME64_5 =  2870177450012600261ULL;
+
+static sqfs_u64 xxh64_round(sqfs_u64 acc, sqfs_u64 input)
+{
+	acc += input * PRIME64_2;
+	acc = xxh_rotl64(acc, 31);
+	acc *= PRIME64_1;
+	return acc;
+}
+
+static sqfs_u64 xxh64_merge_round(sqfs_u64 acc, sqfs_u64 val)
+{
+	val = xxh64_round(0, val);
+	acc ^= val;
+	acc = acc * PRIME64_1 + PRIME64_4;
+	return acc;
+}
+
+static sqfs_u64 XXH_readLE64(const sqfs_u8 *ptr)
+{
+	sqfs_u64 value;
+	memcpy(&value, ptr, sizeof(value));
+	return le64toh(value);
+}
+
+sqfs_u64 xxh64(const void *input, const size_t len)
+{
+	const sqfs_u8 *p = (const sqfs_u8 *)input;
+	const sqfs_u8 *const b_end = p + len;
+	sqfs_u64 h64;
+
+	if (len >= 32) {
+		const sqfs_u8 *const limit = b_end - 32;
+		sqfs_u64 v1 = PRIME64_1 + PRIME64_2;
+		sqfs_u64 v2 = PRIME64_2;
+		sqfs_u64 v3 = 0;
+		sqfs_u64 v4 = 0 - PRIME64_1;
+
+		do {
+			v1 = xxh64_round(v1, XXH_readLE64(p     ));
+			v2 = xxh64_round(v2, XXH_readLE64(p +  8));
+			v3 = xxh64_round(v3, XXH_readLE64(p + 16));
+			v4 = xxh64_round(v4, XXH_readLE64(p + 24));
+			p += 32;
+		} while (p <= limit);
+
+		h64 = xxh_rotl64(v1, 1) + xxh_rotl64(v2, 7) +
+			xxh_rotl64(v3, 12) + xxh_rotl64(v4, 18);
+		h64 = xxh64_merge_round(h64, v1);
+		h64 = xxh64_merge_round(h64, v2);
+		h64 = xxh64_merge_round(h64, v3);
+		h64 = xxh64_merge_round(h64, v4);
+	} else {
+		h64 = PRIME64_5;
+	}
+
+	h64 += (sqfs_u64)len;
+
+	while (p + 8 <= b_end) {
+		h64 ^= xxh64_round(0, XXH_readLE64(p));
+		h64 = xxh_rotl64(h64, 27) * PRIME64_1 + PRIME64_4;
+		p += 8;
+	}
+
+	if (p + 4 <= b_end) {
+		h64 ^= (sqfs_u64)XXH_readLE32(p) * PRIME64_1;
+		h64 = xxh_rotl64(h64, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+
+	while (p < b_end) {
+		h64 ^= (*p) * PRIME64_5;
+		h64 = xxh_rotl64(h64, 11) * PRIME64_1;
+		p++;
+	}
+
+	h64 ^= h64 >> 33;
+	h64 *= PRIME64_2;
+	h64 ^= h64 >> 29;
+	h64 *= PRIME64_3;
+	h64 ^= h64 >> 32;
+	return h64;
+}
@@ -0,0 +1,246 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * blkproc_bench.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "sqfs/block_processor.h"
+#include "sqfs/block_writer.h"
+#include "sqfs/frag_table.h"
+#include "sqfs/compressor.h"
+#include "sqfs/inode.h"
+#include "sqfs/error.h"
+#include "sqfs/io.h"
+#include "mem_file.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#define BLOCK_SIZE (128 * 1024)
+#define FILE_SIZE (1024 * 1024 + 1234)
+#define NUM_WORKER_STEPS (7)
+
+/* compressible, but never repeating input, so deduplication stays out */
+static void generate_input(sqfs_u8 *data, size_t size)
+{
+	static const char *words[] = {
+		"squash ", "block ", "inode ", "fragment ", "table ",
+		"directory ", "compress ", "xattr ", "super ", "data ",
+	};
+	sqfs_u32 state = 0xDEADBEEF, counter = 0;
+	const char *w;
+	size_t len;
+
+	while (size > 0) {
+		state = state * 1103515245 + 12345;
+		w = words[(state >> 16) % 10];
+		len = strlen(w);
+
+		if ((counter++ % 8) == 0) {
+			if (size < 4)
+				break;
+			memcpy(data, &state, 4);
+			data += 4;
+			size -= 4;
+		}
+
+		if (len > size)
+			len = size;
+
+		memcpy(data, w, len);
+		data += len;
+		size -= len;
+	}
+}
+
+static double get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static int run_bench(SQFS_COMPRESSOR id, unsigned int num_workers,
+		     sqfs_u32 flags, const sqfs_u8 *input, size_t total,
+		     mem_file_t **out, double *duration)
+{
+	sqfs_inode_generic_t **inodes = NULL;
+	sqfs_block_processor_desc_t desc;
+	sqfs_compressor_config_t cfg;
+	sqfs_block_processor_t *proc;
+	sqfs_compressor_t *cmp;
+	sqfs_block_writer_t *wr;
+	sqfs_frag_table_t *tbl;
+	size_t i, count, diff;
+	int ret = -1;
+	double start;
+
+	/*
+	  Write to memory, so the benchmark measures the processing pipeline
+	  and not the disk. The result is also used to check that the output
+	  is identical, no matter how many workers are used.
+	 */
+	*out = mem_file_create();
+	if (*out == NULL)
+		return -1;
+
+	count = (total + FILE_SIZE - 1) / FILE_SIZE;
+	inodes = calloc(count, sizeof(inodes[0]));
+	if (inodes == NULL)
+		goto out_file;
+
+	sqfs_compressor_config_init(&cfg, id, BLOCK_SIZE, 0);
+
+	if (sqfs_compressor_create(&cfg, &cmp))
+		goto out_inodes;
+
+	wr = sqfs_block_writer_create((sqfs_file_t *)*out, 4096, 0);
+	if (wr == NULL)
+		goto out_cmp;
+
+	tbl = sqfs_frag_table_create(0);
+	if (tbl == NULL)
+		goto out_wr;
+
+	memset(&desc, 0, sizeof(desc));
+	desc.size = sizeof(desc);
+	desc.max_block_size = BLOCK_SIZE;
+	desc.num_workers = num_workers;
+	desc.max_backlog = 10 * num_workers;
+	desc.flags = flags;
+	desc.cmp = cmp;
+	desc.wr = wr;
+	desc.tbl = tbl;
+
+	if (sqfs_block_processor_create_ex(&desc, &proc))
+		goto out_tbl;
+
+	start = get_time();
+
+	for (i = 0; i < count; ++i) {
+		diff = total - i * FILE_SIZE;
+		if (diff > FILE_SIZE)
+			diff = FILE_SIZE;
+
+		if (sqfs_block_processor_begin_file(proc, inodes + i, 0))
+			goto out_proc;
+
+		if (sqfs_block_processor_append(proc, input + i * FILE_SIZE,
+						diff)) {
+			goto out_proc;
+		}
+
+		if (sqfs_block_processor_end_file(proc))
+			goto out_proc;
+	}
+
+	if (sqfs_block_processor_finish(proc))
+		goto out_proc;
+
+	*duration = get_time() - start;
+	ret = 0;
+out_proc:
+	sqfs_destroy(proc);
+out_tbl:
+	sqfs_destroy(tbl);
+out_wr:
+	sqfs_destroy(wr);
+out_cmp:
+	sqfs_destroy(cmp);
+out_inodes:
+	for (i = 0; i < count; ++i)
+		free(inodes[i]);
+	free(inodes);
+out_file:
+	if (ret != 0) {
+		sqfs_destroy(*out);
+		*out = NULL;
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int num_workers;
+	int status = EXIT_FAILURE;
+	mem_file_t *ref, *out;
+	bool mismatch = false;
+	const char *result;
+	sqfs_u32 flags;
+	size_t total, i;
+	double dt;
+	sqfs_u8 *input;
+	int id;
+
+	id = sqfs_compressor_id_from_name(argc > 1 ? argv[1] : "gzip");
+	if (id < 0) {
+		fputs("Unknown compressor.\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	total = (argc > 2 ? strtoul(argv[2], NULL, 0) : 64) * 1024 * 1024;
+
+	input = malloc(total);
+	if (input == NULL) {
+		perror("allocating input buffer");
+		return EXIT_FAILURE;
+	}
+
+	generate_input(input, total);
+
+	printf("%-8s %-10s %-10s %-10s %s\n", "workers", "I/O thread",
+	       "seconds", "MiB/s", "output");
+
+	ref = NULL;
+
+	for (i = 0; i < 2 * NUM_WORKER_STEPS; ++i) {
+		num_workers = 1U << (i / 2);
+		flags = (i % 2) ? SQFS_BLOCK_PROCESSOR_IO_THREAD : 0;
+
+		if (run_bench(id, num_workers, flags, input, total,
+			      &out, &dt)) {
+			fprintf(stderr, "Benchmark with %u workers failed.\n",
+				num_workers);
+			goto out;
+		}
+
+		if (ref == NULL) {
+			result = "reference";
+		} else if (ref->size != out->size ||
+			   memcmp(ref->data, out->data, ref->size) != 0) {
+			result = "MISMATCH";
+			mismatch = true;
+		} else {
+			result = "identical";
+		}
+
+		printf("%-8u %-10s %-10.3f %-10.1f %s\n", num_workers,
+		       flags ? "yes" : "no", dt,
+		       (double)total / (1024.0 * 1024.0) / dt, result);
+
+		if (ref == NULL) {
+			ref = out;
+		} else {
+			sqfs_destroy(out);
+		}
+	}
+
+	if (mismatch) {
+		fputs("Output differs depending on the number of workers "
+		      "or the I/O thread!\n", stderr);
+		goto out;
+	}
+
+	status = EXIT_SUCCESS;
+out:
+	if (ref != NULL)
+		sqfs_destroy(ref);
+	free(input);
+	return status;
+}
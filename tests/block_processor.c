@@ -0,0 +1,784 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * block_processor.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "sqfs/block_processor.h"
+#include "sqfs/block_writer.h"
+#include "sqfs/frag_table.h"
+#include "sqfs/compressor.h"
+#include "sqfs/inode.h"
+#include "sqfs/error.h"
+#include "sqfs/block.h"
+#include "mem_file.h"
+#include "test.h"
+
+#define BLK_SIZE (4096)
+#define NUM_FILES (7)
+#define NUM_FRAG_FILES (400)
+#define TAIL_SIZE (400)
+
+static sqfs_u8 file_data[1024 * 1024];
+static mem_file_t file = MEM_FILE_INIT(file_data);
+
+static sqfs_u8 content[3 * BLK_SIZE + 1000];
+
+/*
+  Wraps the file above, to check that the block processor never reads
+  from it while the I/O thread is writing.
+ */
+static volatile int writing;
+static size_t reads;
+static bool overlap;
+
+static int checked_read_at(sqfs_file_t *base, sqfs_u64 offset,
+			   void *buffer, size_t size)
+{
+	(void)base;
+
+	if (writing)
+		overlap = true;
+
+	reads += 1;
+	return mem_read_at((sqfs_file_t *)&file, offset, buffer, size);
+}
+
+static int checked_write_at(sqfs_file_t *base, sqfs_u64 offset,
+			    const void *buffer, size_t size)
+{
+	volatile int i;
+	int ret;
+
+	(void)base;
+	writing = 1;
+
+	/* make the write take a while */
+	for (i = 0; i < 1000000; ++i)
+		;
+
+	ret = mem_write_at((sqfs_file_t *)&file, offset, buffer, size);
+	writing = 0;
+	return ret;
+}
+
+static sqfs_u64 checked_get_size(const sqfs_file_t *base)
+{
+	(void)base;
+	return file.size;
+}
+
+static int checked_truncate(sqfs_file_t *base, sqfs_u64 size)
+{
+	(void)base;
+	return mem_truncate((sqfs_file_t *)&file, size);
+}
+
+static sqfs_file_t checked_file = {
+	.read_at = checked_read_at,
+	.write_at = checked_write_at,
+	.get_size = checked_get_size,
+	.truncate = checked_truncate,
+};
+
+static sqfs_compressor_t *create_compressor(void)
+{
+	sqfs_compressor_config_t cfg;
+	sqfs_compressor_t *cmp;
+	int id;
+
+	for (id = SQFS_COMP_MIN; id <= SQFS_COMP_MAX; ++id) {
+		if (sqfs_compressor_config_init(&cfg, id, BLK_SIZE, 0))
+			continue;
+
+		if (sqfs_compressor_create(&cfg, &cmp) == 0)
+			return cmp;
+	}
+
+	return NULL;
+}
+
+static int write_file(sqfs_block_processor_t *proc,
+		      sqfs_inode_generic_t **inode, sqfs_u32 flags,
+		      const char *digest, size_t size)
+{
+	TEST_EQUAL_I(sqfs_block_processor_begin_file(proc, inode, flags), 0);
+
+	if (digest != NULL) {
+		TEST_EQUAL_I(sqfs_block_processor_set_file_digest(proc, digest,
+								  strlen(digest)),
+			     0);
+	}
+
+	TEST_EQUAL_I(sqfs_block_processor_append(proc, content, size), 0);
+	return sqfs_block_processor_end_file(proc);
+}
+
+static void check_same_data(const sqfs_inode_generic_t *a,
+			    const sqfs_inode_generic_t *b)
+{
+	sqfs_u32 frag_a, frag_b, off_a, off_b;
+	sqfs_u64 start_a, start_b;
+
+	TEST_EQUAL_UI(a->payload_bytes_used, b->payload_bytes_used);
+	TEST_ASSERT(memcmp(a->extra, b->extra, a->payload_bytes_used) == 0);
+
+	TEST_EQUAL_I(sqfs_inode_get_file_block_start(a, &start_a), 0);
+	TEST_EQUAL_I(sqfs_inode_get_file_block_start(b, &start_b), 0);
+	TEST_EQUAL_UI(start_a, start_b);
+
+	TEST_EQUAL_I(sqfs_inode_get_frag_location(a, &frag_a, &off_a), 0);
+	TEST_EQUAL_I(sqfs_inode_get_frag_location(b, &frag_b, &off_b), 0);
+	TEST_EQUAL_UI(frag_a, frag_b);
+	TEST_EQUAL_UI(off_a, off_b);
+}
+
+static void test_incompressible(sqfs_compressor_t *cmp)
+{
+	const sqfs_block_processor_stats_t *stats;
+	sqfs_inode_generic_t *inodes[3];
+	sqfs_block_processor_t *proc;
+	sqfs_block_writer_t *wr;
+	sqfs_frag_table_t *tbl;
+	sqfs_u32 state = 1234;
+	sqfs_u8 *random;
+	size_t i;
+
+	random = malloc(2 * BLK_SIZE);
+	TEST_NOT_NULL(random);
+
+	for (i = 0; i < 2 * BLK_SIZE; ++i) {
+		state = state * 1103515245 + 12345;
+		random[i] = state >> 24;
+	}
+
+	for (i = 0; i < sizeof(content); ++i)
+		content[i] = 'a' + (i * i) % 13;
+
+	file.size = 0;
+
+	wr = sqfs_block_writer_create((sqfs_file_t *)&file, 4096, 0);
+	TEST_NOT_NULL(wr);
+
+	tbl = sqfs_frag_table_create(0);
+	TEST_NOT_NULL(tbl);
+
+	proc = sqfs_block_processor_create(BLK_SIZE, cmp, 4, 10, wr, tbl);
+	TEST_NOT_NULL(proc);
+
+	TEST_EQUAL_I(sqfs_block_processor_set_entropy_threshold(proc, 101),
+		     SQFS_ERROR_ARG_INVALID);
+	TEST_EQUAL_I(sqfs_block_processor_set_entropy_threshold(proc, 98), 0);
+
+	memset(inodes, 0, sizeof(inodes));
+
+	/* random data is stored as is, ordinary data is still compressed */
+	TEST_EQUAL_I(sqfs_block_processor_begin_file(proc, inodes, 0), 0);
+	TEST_EQUAL_I(sqfs_block_processor_append(proc, random,
+						 2 * BLK_SIZE), 0);
+	TEST_EQUAL_I(sqfs_block_processor_end_file(proc), 0);
+
+	TEST_EQUAL_I(write_file(proc, inodes + 1, SQFS_BLK_DONT_DEDUPLICATE,
+				NULL, 2 * BLK_SIZE), 0);
+
+	/* a known compressed format is not compressed at all */
+	memcpy(content, "\x1F\x8B\x08", 3);
+
+	TEST_EQUAL_I(write_file(proc, inodes + 2, SQFS_BLK_DONT_DEDUPLICATE,
+				NULL, 2 * BLK_SIZE), 0);
+
+	TEST_EQUAL_I(sqfs_block_processor_set_entropy_threshold(proc, 90),
+		     SQFS_ERROR_SEQUENCE);
+
+	TEST_EQUAL_I(sqfs_block_processor_finish(proc), 0);
+
+	TEST_EQUAL_UI(inodes[0]->extra[0], BLK_SIZE | (1 << 24));
+	TEST_EQUAL_UI(inodes[0]->extra[1], BLK_SIZE | (1 << 24));
+	TEST_ASSERT(inodes[1]->extra[0] < BLK_SIZE);
+	TEST_ASSERT(inodes[1]->extra[1] < BLK_SIZE);
+	TEST_EQUAL_UI(inodes[2]->extra[0], BLK_SIZE | (1 << 24));
+	TEST_EQUAL_UI(inodes[2]->extra[1], BLK_SIZE | (1 << 24));
+
+	stats = sqfs_block_processor_get_stats(proc);
+	TEST_EQUAL_UI(stats->incompressible_block_count, 4);
+	TEST_EQUAL_UI(stats->incompressible_bytes, 4 * BLK_SIZE);
+
+	for (i = 0; i < 3; ++i)
+		free(inodes[i]);
+
+	sqfs_destroy(proc);
+	sqfs_destroy(tbl);
+	sqfs_destroy(wr);
+	free(random);
+}
+
+static void test_compressor_stats(void)
+{
+	sqfs_compressor_stats_t cmp_stats, proc_stats;
+	const sqfs_block_processor_stats_t *stats;
+	sqfs_inode_generic_t *inodes[NUM_FILES];
+	sqfs_compressor_config_t cfg;
+	sqfs_block_processor_t *proc;
+	sqfs_block_writer_t *wr;
+	sqfs_frag_table_t *tbl;
+	sqfs_compressor_t *cmp;
+	sqfs_u64 blocks;
+	size_t i;
+
+	/* only the gzip compressor searches between strategies */
+	if (sqfs_compressor_config_init(&cfg, SQFS_COMP_GZIP, BLK_SIZE,
+					SQFS_COMP_FLAG_GZIP_DEFAULT |
+					SQFS_COMP_FLAG_GZIP_HUFFMAN)) {
+		return;
+	}
+
+	if (sqfs_compressor_create(&cfg, &cmp))
+		return;
+
+	if (sqfs_compressor_get_stats(cmp, &cmp_stats)) {
+		sqfs_destroy(cmp);
+		return;
+	}
+
+	for (i = 0; i < sizeof(content); ++i)
+		content[i] = 'a' + (i * i) % 13;
+
+	file.size = 0;
+
+	wr = sqfs_block_writer_create((sqfs_file_t *)&file, 4096, 0);
+	TEST_NOT_NULL(wr);
+
+	tbl = sqfs_frag_table_create(0);
+	TEST_NOT_NULL(tbl);
+
+	proc = sqfs_block_processor_create(BLK_SIZE, cmp, 4, 10, wr, tbl);
+	TEST_NOT_NULL(proc);
+
+	memset(inodes, 0, sizeof(inodes));
+
+	for (i = 0; i < NUM_FILES; ++i) {
+		TEST_EQUAL_I(write_file(proc, inodes + i,
+					SQFS_BLK_DONT_DEDUPLICATE, NULL,
+					sizeof(content)), 0);
+	}
+
+	TEST_EQUAL_I(sqfs_block_processor_finish(proc), 0);
+
+	/* every block was searched once, by whichever copy got it */
+	stats = sqfs_block_processor_get_stats(proc);
+	TEST_EQUAL_UI(stats->data_block_count, NUM_FILES * 3);
+	TEST_ASSERT(stats->frag_block_count > 0);
+	blocks = stats->data_block_count + stats->frag_block_count;
+
+	TEST_EQUAL_I(sqfs_block_processor_get_compressor_stats(proc,
+							       &proc_stats), 0);
+	TEST_EQUAL_UI(proc_stats.size, sizeof(proc_stats));
+	TEST_EQUAL_UI(proc_stats.search_count, blocks);
+	TEST_EQUAL_UI(proc_stats.trial_count, 2 * blocks);
+	TEST_EQUAL_UI(proc_stats.flag_wins[0], blocks);
+
+	/* the compressor itself only counts the blocks it did on its own */
+	TEST_EQUAL_I(sqfs_compressor_get_stats(cmp, &cmp_stats), 0);
+	TEST_ASSERT(cmp_stats.search_count <= proc_stats.search_count);
+	TEST_ASSERT(cmp_stats.search_count > 0);
+
+	for (i = 0; i < NUM_FILES; ++i)
+		free(inodes[i]);
+
+	sqfs_destroy(proc);
+	sqfs_destroy(tbl);
+	sqfs_destroy(wr);
+	sqfs_destroy(cmp);
+}
+
+/* data, a hole, data and a hole at the end, spanning several blocks */
+static const size_t sparse_layout[] = {
+	100, 3 * BLK_SIZE + 50, 200, 2 * BLK_SIZE,
+};
+
+static sqfs_u8 zeros[3 * BLK_SIZE + 50];
+
+static int write_sparse_file(sqfs_block_processor_t *proc,
+			     sqfs_inode_generic_t **inode, sqfs_u32 flags,
+			     bool use_holes)
+{
+	size_t i, size;
+
+	TEST_EQUAL_I(sqfs_block_processor_begin_file(proc, inode, flags), 0);
+
+	for (i = 0; i < sizeof(sparse_layout) / sizeof(size_t); ++i) {
+		size = sparse_layout[i];
+
+		if (i % 2 == 0) {
+			TEST_EQUAL_I(sqfs_block_processor_append(proc, content,
+								 size), 0);
+		} else if (use_holes) {
+			TEST_EQUAL_I(sqfs_block_processor_append_sparse(proc,
+									size),
+				     0);
+		} else {
+			TEST_EQUAL_I(sqfs_block_processor_append(proc, zeros,
+								 size), 0);
+		}
+	}
+
+	return sqfs_block_processor_end_file(proc);
+}
+
+static void test_sparse(sqfs_compressor_t *cmp)
+{
+	const sqfs_block_processor_stats_t *stats;
+	sqfs_inode_generic_t *inodes[4];
+	sqfs_block_processor_t *proc;
+	sqfs_block_writer_t *wr;
+	sqfs_frag_table_t *tbl;
+	sqfs_u64 size, size_a, size_b;
+	size_t i;
+
+	for (i = 0; i < sizeof(content); ++i)
+		content[i] = 'a' + (i * i) % 13;
+
+	file.size = 0;
+
+	wr = sqfs_block_writer_create((sqfs_file_t *)&file, 4096, 0);
+	TEST_NOT_NULL(wr);
+
+	tbl = sqfs_frag_table_create(0);
+	TEST_NOT_NULL(tbl);
+
+	proc = sqfs_block_processor_create(BLK_SIZE, cmp, 4, 10, wr, tbl);
+	TEST_NOT_NULL(proc);
+
+	memset(inodes, 0, sizeof(inodes));
+
+	TEST_EQUAL_I(sqfs_block_processor_append_sparse(proc, 10),
+		     SQFS_ERROR_SEQUENCE);
+
+	/* holes end up exactly like explicitly appended zeros */
+	TEST_EQUAL_I(write_sparse_file(proc, inodes + 0,
+				       SQFS_BLK_DONT_DEDUPLICATE, false), 0);
+	TEST_EQUAL_I(write_sparse_file(proc, inodes + 1,
+				       SQFS_BLK_DONT_DEDUPLICATE, true), 0);
+
+	/* and are recognized as the same content by early deduplication */
+	TEST_EQUAL_I(write_sparse_file(proc, inodes + 2,
+				       SQFS_BLK_EARLY_DEDUPLICATE, false), 0);
+	TEST_EQUAL_I(sqfs_block_processor_sync(proc), 0);
+	size = file.size;
+
+	TEST_EQUAL_I(write_sparse_file(proc, inodes + 3,
+				       SQFS_BLK_EARLY_DEDUPLICATE, true), 0);
+	TEST_EQUAL_I(sqfs_block_processor_finish(proc), 0);
+	TEST_EQUAL_UI(file.size, size);
+
+	TEST_EQUAL_UI(inodes[0]->payload_bytes_used,
+		      inodes[1]->payload_bytes_used);
+	TEST_EQUAL_UI(inodes[0]->payload_bytes_used, 6 * sizeof(sqfs_u32));
+	TEST_ASSERT(memcmp(inodes[0]->extra, inodes[1]->extra,
+			   inodes[0]->payload_bytes_used) == 0);
+
+	TEST_EQUAL_UI(inodes[1]->extra[1], 0);
+	TEST_EQUAL_UI(inodes[1]->extra[2], 0);
+	TEST_EQUAL_UI(inodes[1]->extra[4], 0);
+	TEST_EQUAL_UI(inodes[1]->extra[5], 0);
+	TEST_ASSERT(inodes[1]->extra[0] != 0);
+	TEST_ASSERT(inodes[1]->extra[3] != 0);
+
+	for (i = 0; i < 4; ++i) {
+		TEST_EQUAL_UI(inodes[i]->base.type, SQFS_INODE_EXT_FILE);
+		TEST_EQUAL_UI(inodes[i]->data.file_ext.sparse,
+			      3 * BLK_SIZE + 350);
+	}
+
+	TEST_EQUAL_I(sqfs_inode_get_file_size(inodes[0], &size_a), 0);
+	TEST_EQUAL_I(sqfs_inode_get_file_size(inodes[1], &size_b), 0);
+	TEST_EQUAL_UI(size_a, size_b);
+	TEST_EQUAL_UI(size_a, 5 * BLK_SIZE + 350);
+
+	stats = sqfs_block_processor_get_stats(proc);
+	TEST_EQUAL_UI(stats->early_dedup_file_count, 1);
+
+	for (i = 0; i < 4; ++i)
+		free(inodes[i]);
+
+	sqfs_destroy(proc);
+	sqfs_destroy(tbl);
+	sqfs_destroy(wr);
+}
+
+static void test_dedup(sqfs_compressor_t *cmp, sqfs_u32 flags)
+{
+	sqfs_inode_generic_t *inodes[NUM_FILES];
+	const sqfs_block_processor_stats_t *stats;
+	sqfs_block_processor_desc_t desc;
+	sqfs_block_processor_t *proc;
+	sqfs_block_writer_t *wr;
+	sqfs_frag_table_t *tbl;
+	sqfs_u64 size, start;
+	size_t i;
+
+	for (i = 0; i < sizeof(content); ++i)
+		content[i] = (i * 7) ^ (i >> 8);
+
+	file.size = 0;
+
+	wr = sqfs_block_writer_create((sqfs_file_t *)&file, 4096, 0);
+	TEST_NOT_NULL(wr);
+
+	tbl = sqfs_frag_table_create(0);
+	TEST_NOT_NULL(tbl);
+
+	memset(&desc, 0, sizeof(desc));
+	desc.size = sizeof(desc);
+	desc.max_block_size = BLK_SIZE;
+	desc.num_workers = 4;
+	desc.max_backlog = 10;
+	desc.flags = flags;
+	desc.cmp = cmp;
+	desc.wr = wr;
+	desc.tbl = tbl;
+
+	TEST_EQUAL_I(sqfs_block_processor_create_ex(&desc, &proc), 0);
+
+	memset(inodes, 0, sizeof(inodes));
+
+	/* the second copy of a file is not written at all */
+	TEST_EQUAL_I(write_file(proc, inodes + 0, SQFS_BLK_EARLY_DEDUPLICATE,
+				NULL, sizeof(content)), 0);
+	TEST_EQUAL_I(sqfs_block_processor_sync(proc), 0);
+	size = file.size;
+
+	TEST_EQUAL_I(write_file(proc, inodes + 1, SQFS_BLK_EARLY_DEDUPLICATE,
+				NULL, sizeof(content)), 0);
+	TEST_EQUAL_I(sqfs_block_processor_sync(proc), 0);
+	TEST_EQUAL_UI(file.size, size);
+
+	/* a caller provided digest is trusted, no matter the content */
+	TEST_EQUAL_I(write_file(proc, inodes + 2, 0, "digest",
+				2 * BLK_SIZE), 0);
+	TEST_EQUAL_I(sqfs_block_processor_sync(proc), 0);
+	size = file.size;
+
+	TEST_EQUAL_I(write_file(proc, inodes + 3, 0, "digest",
+				2 * BLK_SIZE), 0);
+	TEST_EQUAL_I(sqfs_block_processor_sync(proc), 0);
+	TEST_EQUAL_UI(file.size, size);
+
+	/* but a size mismatch is reported */
+	TEST_EQUAL_I(write_file(proc, inodes + 4, 0, "digest", BLK_SIZE),
+		     SQFS_ERROR_CORRUPTED);
+
+	/* without tail end packing, the last block still ends the file */
+	TEST_EQUAL_I(write_file(proc, inodes + 5, SQFS_BLK_DONT_FRAGMENT |
+				SQFS_BLK_DONT_DEDUPLICATE, NULL,
+				sizeof(content)), 0);
+	TEST_EQUAL_I(sqfs_block_processor_sync(proc), 0);
+
+	/* no early deduplication against files with a different layout */
+	TEST_EQUAL_I(write_file(proc, inodes + 6, SQFS_BLK_DONT_FRAGMENT |
+				SQFS_BLK_EARLY_DEDUPLICATE, NULL,
+				sizeof(content)), 0);
+
+	TEST_EQUAL_I(sqfs_block_processor_finish(proc), 0);
+
+	check_same_data(inodes[0], inodes[1]);
+	check_same_data(inodes[2], inodes[3]);
+
+	TEST_EQUAL_I(sqfs_inode_get_file_block_start(inodes[5], &start), 0);
+	TEST_ASSERT(start > 0);
+	TEST_EQUAL_UI(inodes[5]->payload_bytes_used, 4 * sizeof(sqfs_u32));
+
+	/* the block writer deduplicated the last one instead */
+	check_same_data(inodes[5], inodes[6]);
+
+	stats = sqfs_block_processor_get_stats(proc);
+	TEST_EQUAL_UI(stats->early_dedup_file_count, 2);
+	TEST_EQUAL_UI(stats->early_dedup_bytes,
+		      sizeof(content) + 2 * BLK_SIZE);
+
+	for (i = 0; i < NUM_FILES; ++i)
+		free(inodes[i]);
+
+	sqfs_destroy(proc);
+	sqfs_destroy(tbl);
+	sqfs_destroy(wr);
+}
+
+/*
+  Small files that duplicate fragments from fragment blocks that were
+  written out long ago are verified by reading those back, while the I/O
+  thread keeps writing the data blocks of the files in between.
+ */
+static void get_tail(size_t i, sqfs_u8 *out)
+{
+	memset(out, 'A' + i % 26, TAIL_SIZE);
+	sprintf((char *)out, "%u", (unsigned int)i);
+}
+
+static void test_verify_read_back(sqfs_compressor_t *cmp)
+{
+	sqfs_inode_generic_t *inodes[2 * NUM_FRAG_FILES];
+	const sqfs_block_processor_stats_t *stats;
+	sqfs_block_processor_desc_t desc;
+	sqfs_block_processor_t *proc;
+	sqfs_block_writer_t *wr;
+	sqfs_frag_table_t *tbl;
+	size_t i, j, k, size;
+
+	file.size = 0;
+	overlap = false;
+	reads = 0;
+
+	wr = sqfs_block_writer_create(&checked_file, 4096, 0);
+	TEST_NOT_NULL(wr);
+
+	tbl = sqfs_frag_table_create(0);
+	TEST_NOT_NULL(tbl);
+
+	memset(&desc, 0, sizeof(desc));
+	desc.size = sizeof(desc);
+	desc.max_block_size = BLK_SIZE;
+	desc.num_workers = 4;
+	desc.max_backlog = 10;
+	desc.flags = SQFS_BLOCK_PROCESSOR_IO_THREAD;
+	desc.cmp = cmp;
+	desc.wr = wr;
+	desc.tbl = tbl;
+
+	TEST_EQUAL_I(sqfs_block_processor_create_ex(&desc, &proc), 0);
+
+	memset(inodes, 0, sizeof(inodes));
+
+	for (i = 0; i < 2 * NUM_FRAG_FILES; ++i) {
+		k = i / 2;
+
+		if (i % 2) {
+			/* repeat the tail end of a file from long ago */
+			get_tail(k / 2, content);
+			size = TAIL_SIZE;
+		} else {
+			for (j = 0; j < BLK_SIZE; ++j)
+				content[j] = (j * 13) ^ k;
+
+			get_tail(k, content + BLK_SIZE);
+			size = BLK_SIZE + TAIL_SIZE;
+		}
+
+		TEST_EQUAL_I(write_file(proc, inodes + i,
+					SQFS_BLK_VERIFY_DEDUPLICATE,
+					NULL, size), 0);
+	}
+
+	TEST_EQUAL_I(sqfs_block_processor_finish(proc), 0);
+	TEST_ASSERT(!overlap);
+	TEST_ASSERT(reads > 0);
+
+	stats = sqfs_block_processor_get_stats(proc);
+	TEST_EQUAL_UI(stats->frag_verify_failed, 0);
+	TEST_EQUAL_UI(stats->actual_frag_count, NUM_FRAG_FILES);
+
+	for (i = 0; i < 2 * NUM_FRAG_FILES; ++i)
+		free(inodes[i]);
+
+	sqfs_destroy(proc);
+	sqfs_destroy(tbl);
+	sqfs_destroy(wr);
+}
+
+/*
+  Verification may only be asked for after fragment blocks were flushed
+  without keeping a copy. Those that are still in flight cannot be
+  compared, so the fragment is stored again instead.
+ */
+static void test_verify_late(sqfs_compressor_t *cmp)
+{
+	sqfs_inode_generic_t *inodes[NUM_FRAG_FILES + 2 * NUM_FILES];
+	const sqfs_block_processor_stats_t *stats;
+	sqfs_block_processor_desc_t desc;
+	sqfs_block_processor_t *proc;
+	sqfs_block_writer_t *wr;
+	sqfs_frag_table_t *tbl;
+	size_t i, count = 0;
+
+	file.size = 0;
+	overlap = false;
+
+	wr = sqfs_block_writer_create(&checked_file, 4096, 0);
+	TEST_NOT_NULL(wr);
+
+	tbl = sqfs_frag_table_create(0);
+	TEST_NOT_NULL(tbl);
+
+	memset(&desc, 0, sizeof(desc));
+	desc.size = sizeof(desc);
+	desc.max_block_size = BLK_SIZE;
+	desc.num_workers = 4;
+	desc.max_backlog = 10;
+	desc.flags = SQFS_BLOCK_PROCESSOR_IO_THREAD;
+	desc.cmp = cmp;
+	desc.wr = wr;
+	desc.tbl = tbl;
+
+	TEST_EQUAL_I(sqfs_block_processor_create_ex(&desc, &proc), 0);
+
+	memset(inodes, 0, sizeof(inodes));
+
+	for (i = 0; i < NUM_FRAG_FILES; ++i) {
+		get_tail(i, content);
+		TEST_EQUAL_I(write_file(proc, inodes + count++, 0, NULL,
+					TAIL_SIZE), 0);
+	}
+
+	/* repeat the most recent ones, from the last few fragment blocks */
+	for (i = NUM_FRAG_FILES - 2 * NUM_FILES; i < NUM_FRAG_FILES; ++i) {
+		get_tail(i, content);
+		TEST_EQUAL_I(write_file(proc, inodes + count++,
+					SQFS_BLK_VERIFY_DEDUPLICATE,
+					NULL, TAIL_SIZE), 0);
+	}
+
+	TEST_EQUAL_I(sqfs_block_processor_finish(proc), 0);
+	TEST_ASSERT(!overlap);
+
+	stats = sqfs_block_processor_get_stats(proc);
+	TEST_EQUAL_UI(stats->actual_frag_count,
+		      NUM_FRAG_FILES + stats->frag_verify_failed);
+
+	for (i = 0; i < count; ++i)
+		free(inodes[i]);
+
+	sqfs_destroy(proc);
+	sqfs_destroy(tbl);
+	sqfs_destroy(wr);
+}
+
+static void pack_files(sqfs_compressor_t *cmp,
+		       sqfs_inode_generic_t **inodes, bool use_handles)
+{
+	sqfs_block_processor_file_t *handles[NUM_FILES];
+	sqfs_block_processor_t *proc;
+	sqfs_block_writer_t *wr;
+	sqfs_frag_table_t *tbl;
+	size_t i, size;
+
+	file.size = 0;
+
+	wr = sqfs_block_writer_create((sqfs_file_t *)&file, 4096, 0);
+	TEST_NOT_NULL(wr);
+
+	tbl = sqfs_frag_table_create(0);
+	TEST_NOT_NULL(tbl);
+
+	proc = sqfs_block_processor_create(BLK_SIZE, cmp, 4, 10, wr, tbl);
+	TEST_NOT_NULL(proc);
+
+	memset(inodes, 0, NUM_FILES * sizeof(inodes[0]));
+
+	if (!use_handles) {
+		for (i = 0; i < NUM_FILES; ++i) {
+			TEST_EQUAL_I(write_file(proc, inodes + i, 0, NULL,
+						i * 1500 + 100), 0);
+		}
+		goto out;
+	}
+
+	for (i = 0; i < NUM_FILES; ++i) {
+		TEST_EQUAL_I(sqfs_block_processor_open_file(proc, inodes + i,
+							    0, handles + i),
+			     0);
+	}
+
+	TEST_EQUAL_I(sqfs_block_processor_begin_file(proc, inodes, 0),
+		     SQFS_ERROR_SEQUENCE);
+
+	/* fill and complete the files in reverse order */
+	for (i = NUM_FILES; i-- > 0; ) {
+		size = i * 1500 + 100;
+
+		TEST_EQUAL_I(sqfs_block_processor_file_append(handles[i],
+							      content, 50),
+			     0);
+		TEST_EQUAL_I(sqfs_block_processor_file_append(handles[i],
+							      content + 50,
+							      size - 50), 0);
+		sqfs_block_processor_file_close(handles[i]);
+
+		/* nothing can be committed before the first one is done */
+		TEST_EQUAL_I(sqfs_block_processor_commit_files(proc,
+							       NUM_FILES), 0);
+		TEST_ASSERT((inodes[NUM_FILES - 1] == NULL) == (i > 0));
+	}
+out:
+	TEST_EQUAL_I(sqfs_block_processor_finish(proc), 0);
+
+	sqfs_destroy(proc);
+	sqfs_destroy(tbl);
+	sqfs_destroy(wr);
+}
+
+static void test_open_files(sqfs_compressor_t *cmp)
+{
+	sqfs_inode_generic_t *expected[NUM_FILES], *inodes[NUM_FILES];
+	sqfs_u8 *data;
+	sqfs_u64 size;
+	size_t i;
+
+	for (i = 0; i < sizeof(content); ++i)
+		content[i] = (i * 7) ^ (i >> 8);
+
+	pack_files(cmp, expected, false);
+
+	size = file.size;
+	data = malloc(size);
+	TEST_NOT_NULL(data);
+	memcpy(data, file.data, size);
+
+	/* the same output, no matter in what order the files are filled */
+	pack_files(cmp, inodes, true);
+
+	TEST_EQUAL_UI(file.size, size);
+	TEST_ASSERT(memcmp(file.data, data, size) == 0);
+
+	for (i = 0; i < NUM_FILES; ++i) {
+		TEST_NOT_NULL(inodes[i]);
+		check_same_data(expected[i], inodes[i]);
+		free(expected[i]);
+		free(inodes[i]);
+	}
+
+	free(data);
+}
+
+int main(void)
+{
+	sqfs_block_processor_desc_t desc;
+	sqfs_block_processor_t *proc;
+	sqfs_compressor_t *cmp;
+
+	cmp = create_compressor();
+	TEST_NOT_NULL(cmp);
+
+	memset(&desc, 0, sizeof(desc));
+	desc.size = sizeof(desc) - 1;
+	TEST_EQUAL_I(sqfs_block_processor_create_ex(&desc, &proc),
+		     SQFS_ERROR_ARG_INVALID);
+
+	desc.size = sizeof(desc);
+	desc.flags = ~SQFS_BLOCK_PROCESSOR_ALL_FLAGS;
+	TEST_EQUAL_I(sqfs_block_processor_create_ex(&desc, &proc),
+		     SQFS_ERROR_UNSUPPORTED);
+
+	test_dedup(cmp, 0);
+	test_dedup(cmp, SQFS_BLOCK_PROCESSOR_IO_THREAD);
+	test_incompressible(cmp);
+	test_compressor_stats();
+	test_sparse(cmp);
+	test_open_files(cmp);
+	test_verify_read_back(cmp);
+	test_verify_late(cmp);
+
+	sqfs_destroy(cmp);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,162 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * block_writer.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "sqfs/block_writer.h"
+#include "sqfs/error.h"
+#include "sqfs/block.h"
+#include "mem_file.h"
+#include "test.h"
+
+#define BLK_SIZE (16)
+
+static sqfs_u8 file_data[64 * 1024];
+static mem_file_t file = MEM_FILE_INIT(file_data);
+
+/*
+  Write a file made up of blocks with the given checksums. The block data is
+  derived from the checksum, unless a different fill byte is specified.
+ */
+static sqfs_u64 write_file_ex(sqfs_block_writer_t *wr, const sqfs_u32 *blocks,
+			      size_t count, sqfs_u32 extra_flags, int fill)
+{
+	sqfs_u8 data[BLK_SIZE];
+	sqfs_u64 location;
+	sqfs_u32 flags;
+	size_t i;
+
+	for (i = 0; i < count; ++i) {
+		flags = extra_flags;
+		if (i == 0)
+			flags |= SQFS_BLK_FIRST_BLOCK;
+		if (i == count - 1)
+			flags |= SQFS_BLK_LAST_BLOCK;
+
+		memset(data, fill >= 0 ? fill : (int)(blocks[i] & 0xFF),
+		       sizeof(data));
+
+		TEST_EQUAL_I(sqfs_block_writer_write(wr, sizeof(data),
+						     blocks[i], flags, data,
+						     &location), 0);
+	}
+
+	return location;
+}
+
+static sqfs_u64 write_file(sqfs_block_writer_t *wr, const sqfs_u32 *blocks,
+			   size_t count)
+{
+	return write_file_ex(wr, blocks, count, 0, -1);
+}
+
+int main(void)
+{
+	static const sqfs_u32 file_a[] = { 1, 2, 3 };
+	static const sqfs_u32 file_b[] = { 2, 3 };
+	static const sqfs_u32 file_c[] = { 3, 4, 5 };
+	static const sqfs_u32 file_d[] = { 5 };
+	static const sqfs_u32 file_e[] = { 5, 5 };
+	const sqfs_block_writer_stats_t *stats;
+	sqfs_u64 loc_a, loc_c, loc_d, loc, size;
+	sqfs_block_writer_t *wr;
+	sqfs_u32 blocks[2];
+	size_t i;
+
+	wr = sqfs_block_writer_create((sqfs_file_t *)&file, 4096, 0);
+	TEST_NOT_NULL(wr);
+
+	/* unique files are written as is */
+	loc_a = write_file(wr, file_a, 3);
+	TEST_EQUAL_UI(loc_a, 0);
+	TEST_EQUAL_UI(file.size, 3 * BLK_SIZE);
+
+	/* a tail of an existing file is found */
+	loc = write_file(wr, file_b, 2);
+	TEST_EQUAL_UI(loc, loc_a + BLK_SIZE);
+	TEST_EQUAL_UI(file.size, 3 * BLK_SIZE);
+
+	/* partial overlap is not a duplicate */
+	loc_c = write_file(wr, file_c, 3);
+	TEST_EQUAL_UI(loc_c, 3 * BLK_SIZE);
+	TEST_EQUAL_UI(file.size, 6 * BLK_SIZE);
+
+	/* the earliest match wins */
+	loc_d = write_file(wr, file_d, 1);
+	TEST_EQUAL_UI(loc_d, loc_c + 2 * BLK_SIZE);
+	TEST_EQUAL_UI(file.size, 6 * BLK_SIZE);
+
+	/* a match may extend into the blocks of the file itself */
+	loc = write_file(wr, file_e, 2);
+	TEST_EQUAL_UI(loc, loc_c + 2 * BLK_SIZE);
+	TEST_EQUAL_UI(file.size, 7 * BLK_SIZE);
+
+	stats = sqfs_block_writer_get_stats(wr);
+	TEST_EQUAL_UI(stats->dedup_lookups, 5);
+	TEST_EQUAL_UI(stats->dedup_hits, 3);
+	TEST_EQUAL_UI(stats->blocks_written, 7);
+
+	/* grow the index well beyond its initial size */
+	for (i = 0; i < 1000; ++i) {
+		blocks[0] = 1000 + 2 * i;
+		blocks[1] = 1000 + 2 * i + 1;
+
+		size = file.size;
+		loc = write_file(wr, blocks, 2);
+		TEST_EQUAL_UI(loc, size);
+	}
+
+	TEST_EQUAL_UI(file.size, (7 + 2000) * BLK_SIZE);
+
+	/* duplicates of old and new files are still found */
+	loc = write_file(wr, file_a, 3);
+	TEST_EQUAL_UI(loc, loc_a);
+
+	blocks[0] = 1000;
+	blocks[1] = 1001;
+	loc = write_file(wr, blocks, 2);
+	TEST_EQUAL_UI(loc, 7 * BLK_SIZE);
+
+	blocks[0] = 2998;
+	blocks[1] = 2999;
+	loc = write_file(wr, blocks, 2);
+	TEST_EQUAL_UI(loc, (7 + 1998) * BLK_SIZE);
+
+	TEST_EQUAL_UI(file.size, (7 + 2000) * BLK_SIZE);
+
+	stats = sqfs_block_writer_get_stats(wr);
+	TEST_EQUAL_UI(stats->dedup_hits, 6);
+	TEST_EQUAL_UI(stats->blocks_written, 7 + 2000);
+
+	/* a hash match with different data is only caught when verifying */
+	loc = write_file_ex(wr, file_a, 3, 0, 0xAA);
+	TEST_EQUAL_UI(loc, loc_a);
+
+	size = file.size;
+	loc = write_file_ex(wr, file_a, 3, SQFS_BLK_VERIFY_DEDUPLICATE, 0xAA);
+	TEST_EQUAL_UI(loc, size);
+	TEST_EQUAL_UI(file.size, size + 3 * BLK_SIZE);
+
+	stats = sqfs_block_writer_get_stats(wr);
+	TEST_EQUAL_UI(stats->dedup_collisions, 1);
+
+	/* a later candidate that actually matches is still found */
+	loc = write_file_ex(wr, file_a, 3, SQFS_BLK_VERIFY_DEDUPLICATE, 0xAA);
+	TEST_EQUAL_UI(loc, size);
+	TEST_EQUAL_UI(file.size, size + 3 * BLK_SIZE);
+
+	/* as is a verified match with the earliest copy */
+	loc = write_file_ex(wr, file_a, 3, SQFS_BLK_VERIFY_DEDUPLICATE, -1);
+	TEST_EQUAL_UI(loc, loc_a);
+	TEST_EQUAL_UI(file.size, size + 3 * BLK_SIZE);
+
+	stats = sqfs_block_writer_get_stats(wr);
+	TEST_EQUAL_UI(stats->dedup_collisions, 2);
+	TEST_EQUAL_UI(stats->dedup_hits, 9);
+
+	sqfs_destroy(wr);
+	return EXIT_SUCCESS;
+}
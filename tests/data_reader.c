@@ -0,0 +1,421 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * data_reader.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "sqfs/data_reader.h"
+#include "sqfs/frag_table.h"
+#include "sqfs/super.h"
+#include "sqfs/error.h"
+#include "sqfs/inode.h"
+#include "sqfs/block.h"
+#include "mem_file.h"
+#include "test.h"
+
+#define BLK_SIZE (16)
+#define NUM_BLOCKS (16)
+#define FRAG_START (NUM_BLOCKS * BLK_SIZE)
+#define PACKED_BLOCKS (20)
+
+#define UNCOMPRESSED(size) ((size) | (1 << 24))
+
+static sqfs_u8 file_data[4096];
+static mem_file_t file = MEM_FILE_INIT(file_data);
+
+/* stores every meta data block uncompressed */
+static sqfs_compressor_t cmp = {
+	.do_block = store_block,
+};
+
+/* "decompresses" blocks by inverting them, can be shared by worker threads */
+static sqfs_s32 invert_block(sqfs_compressor_t *cmp, const sqfs_u8 *in,
+			     sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
+{
+	sqfs_u32 i;
+	(void)cmp;
+
+	if (size > outsize)
+		return SQFS_ERROR_OVERFLOW;
+
+	for (i = 0; i < size; ++i)
+		out[i] = ~in[i];
+
+	return size;
+}
+
+static sqfs_object_t *invert_copy(const sqfs_object_t *obj)
+{
+	return (sqfs_object_t *)obj;
+}
+
+static void invert_destroy(sqfs_object_t *obj)
+{
+	(void)obj;
+}
+
+static sqfs_compressor_t invert_cmp = {
+	.base = {
+		.destroy = invert_destroy,
+		.copy = invert_copy,
+	},
+	.do_block = invert_block,
+};
+
+/*
+  Data block i is filled with the byte value i + 1, the fragment block holds
+  the tail ends of both files, with the byte values 0x40 and up.
+ */
+static void create_image(sqfs_super_t *super)
+{
+	sqfs_frag_table_t *tbl;
+	sqfs_u32 index;
+	size_t i;
+
+	for (i = 0; i < NUM_BLOCKS; ++i)
+		memset(file.data + i * BLK_SIZE, i + 1, BLK_SIZE);
+
+	for (i = 0; i < BLK_SIZE; ++i)
+		file.data[FRAG_START + i] = 0x40 + i;
+
+	file.size = FRAG_START + BLK_SIZE;
+
+	tbl = sqfs_frag_table_create(0);
+	TEST_NOT_NULL(tbl);
+	TEST_EQUAL_I(sqfs_frag_table_append(tbl, FRAG_START,
+					    UNCOMPRESSED(BLK_SIZE), &index), 0);
+	TEST_EQUAL_UI(index, 0);
+
+	memset(super, 0, sizeof(*super));
+	TEST_EQUAL_I(sqfs_frag_table_write(tbl, (sqfs_file_t *)&file,
+					   super, &cmp), 0);
+	sqfs_destroy(tbl);
+
+	super->directory_table_start = 0;
+	super->id_table_start = file.size;
+	super->export_table_start = 0xFFFFFFFFFFFFFFFFUL;
+	super->bytes_used = file.size;
+}
+
+/* appends compressed blocks filled with 0x80 + i after the fragment table */
+static sqfs_u64 append_packed_blocks(void)
+{
+	sqfs_u64 start = file.size;
+	size_t i;
+
+	for (i = 0; i < PACKED_BLOCKS; ++i)
+		memset(file.data + start + i * BLK_SIZE, ~(0x80 + i), BLK_SIZE);
+
+	file.size += PACKED_BLOCKS * BLK_SIZE;
+	return start;
+}
+
+static sqfs_inode_generic_t *create_inode(size_t first, size_t count,
+					  sqfs_u32 frag_off, sqfs_u32 frag_sz)
+{
+	sqfs_inode_generic_t *inode;
+	size_t i;
+
+	inode = calloc(1, sizeof(*inode) + count * sizeof(sqfs_u32));
+	TEST_NOT_NULL(inode);
+
+	inode->base.type = SQFS_INODE_FILE;
+	inode->payload_bytes_available = count * sizeof(sqfs_u32);
+	inode->payload_bytes_used = count * sizeof(sqfs_u32);
+	inode->data.file.blocks_start = first * BLK_SIZE;
+	inode->data.file.fragment_index = 0;
+	inode->data.file.fragment_offset = frag_off;
+	inode->data.file.file_size = count * BLK_SIZE + frag_sz;
+
+	for (i = 0; i < count; ++i)
+		inode->extra[i] = UNCOMPRESSED(BLK_SIZE);
+
+	return inode;
+}
+
+/* every third block is backed by data, the others are sparse */
+static sqfs_inode_generic_t *create_sparse_inode(size_t count)
+{
+	sqfs_inode_generic_t *inode = create_inode(0, count, 0, 0);
+	size_t i;
+
+	for (i = 0; i < count; ++i) {
+		if (i % 3)
+			inode->extra[i] = 0;
+	}
+
+	return inode;
+}
+
+static void check_read(sqfs_data_reader_t *rd,
+		       const sqfs_inode_generic_t *inode,
+		       sqfs_u64 offset, sqfs_u32 size, int fill)
+{
+	sqfs_u8 buffer[BLK_SIZE];
+	sqfs_u32 i;
+
+	TEST_EQUAL_I(sqfs_data_reader_read(rd, inode, offset,
+					   buffer, size), (int)size);
+
+	for (i = 0; i < size; ++i) {
+		if (fill < 0) {
+			TEST_EQUAL_UI(buffer[i], (sqfs_u32)-fill + i);
+		} else {
+			TEST_EQUAL_UI(buffer[i], (sqfs_u32)fill);
+		}
+	}
+}
+
+int main(void)
+{
+	const sqfs_data_reader_stats_t *stats;
+	sqfs_inode_generic_t *a, *b, *c, *d, *e;
+	sqfs_data_reader_t *rd, *copy;
+	sqfs_u8 *out, buffer[BLK_SIZE];
+	const sqfs_u8 *ptr, *ptr2;
+	sqfs_super_t super;
+	sqfs_u64 packed;
+	size_t i, size;
+	int ret;
+
+	create_image(&super);
+	packed = append_packed_blocks();
+	a = create_inode(0, 4, 0, 5);
+	b = create_inode(4, 4, 8, 6);
+	c = create_sparse_inode(3 * NUM_BLOCKS);
+
+	rd = sqfs_data_reader_create((sqfs_file_t *)&file, BLK_SIZE, &cmp);
+	TEST_NOT_NULL(rd);
+	TEST_EQUAL_I(sqfs_data_reader_load_fragment_table(rd, &super), 0);
+
+	stats = sqfs_data_reader_get_stats(rd);
+	TEST_EQUAL_UI(stats->size, sizeof(*stats));
+
+	/* interleaved reads from two files do not thrash */
+	for (i = 0; i < 4; ++i) {
+		check_read(rd, a, i * BLK_SIZE, BLK_SIZE / 2, i + 1);
+		check_read(rd, b, i * BLK_SIZE, BLK_SIZE / 2, i + 5);
+		check_read(rd, a, i * BLK_SIZE + BLK_SIZE / 2,
+			   BLK_SIZE / 2, i + 1);
+		check_read(rd, b, i * BLK_SIZE + BLK_SIZE / 2,
+			   BLK_SIZE / 2, i + 5);
+	}
+
+	TEST_EQUAL_UI(stats->misses, 8);
+	TEST_EQUAL_UI(stats->hits, 8);
+	TEST_EQUAL_UI(stats->cached_blocks, 4);
+	TEST_EQUAL_UI(stats->evictions, 4);
+
+	/* so do tail ends sharing a fragment block */
+	check_read(rd, a, 4 * BLK_SIZE, 5, -0x40);
+	check_read(rd, b, 4 * BLK_SIZE, 6, -0x48);
+	check_read(rd, a, 4 * BLK_SIZE, 5, -0x40);
+
+	TEST_EQUAL_I(sqfs_data_reader_get_fragment(rd, b, &size, &out), 0);
+	TEST_EQUAL_UI(size, 6);
+	TEST_EQUAL_UI(out[0], 0x48);
+	free(out);
+
+	TEST_EQUAL_UI(stats->misses, 9);
+	TEST_EQUAL_UI(stats->hits, 11);
+
+	/* the most recently used blocks are kept */
+	check_read(rd, b, 3 * BLK_SIZE, BLK_SIZE, 8);
+	check_read(rd, a, 3 * BLK_SIZE, BLK_SIZE, 4);
+	TEST_EQUAL_UI(stats->misses, 9);
+	TEST_EQUAL_UI(stats->hits, 13);
+
+	check_read(rd, a, 1, BLK_SIZE - 1, 1);
+	TEST_EQUAL_UI(stats->misses, 10);
+
+	/* whole blocks that are not cached are not added either */
+	TEST_EQUAL_I(sqfs_data_reader_get_block(rd, b, 0, &size, &out), 0);
+	TEST_EQUAL_UI(size, BLK_SIZE);
+	TEST_EQUAL_UI(out[0], 5);
+	free(out);
+
+	TEST_EQUAL_I(sqfs_data_reader_get_block(rd, a, 0, &size, &out), 0);
+	TEST_EQUAL_UI(size, BLK_SIZE);
+	TEST_EQUAL_UI(out[BLK_SIZE - 1], 1);
+	free(out);
+
+	TEST_EQUAL_UI(stats->misses, 11);
+	TEST_EQUAL_UI(stats->hits, 14);
+	TEST_EQUAL_UI(stats->cached_blocks, 4);
+
+	/* shrinking the cache drops blocks right away */
+	TEST_EQUAL_I(sqfs_data_reader_set_cache_size(rd, 0), 0);
+	TEST_EQUAL_UI(stats->cached_blocks, 0);
+	TEST_EQUAL_UI(stats->cached_bytes, 0);
+
+	check_read(rd, a, 1, BLK_SIZE - 1, 1);
+	check_read(rd, a, 1, BLK_SIZE - 1, 1);
+	check_read(rd, b, 1, BLK_SIZE - 1, 5);
+	TEST_EQUAL_UI(stats->cached_blocks, 1);
+	TEST_EQUAL_UI(stats->misses, 13);
+	TEST_EQUAL_UI(stats->hits, 15);
+
+	/* a copy gets a cache of its own */
+	copy = sqfs_copy(rd);
+	TEST_NOT_NULL(copy);
+	stats = sqfs_data_reader_get_stats(copy);
+	TEST_EQUAL_UI(stats->cached_blocks, 0);
+	TEST_EQUAL_UI(stats->misses, 0);
+
+	check_read(copy, b, 4 * BLK_SIZE, 6, -0x48);
+	check_read(copy, b, 1, BLK_SIZE - 1, 5);
+	TEST_EQUAL_UI(stats->cached_blocks, 1);
+	TEST_EQUAL_UI(stats->misses, 2);
+
+	/* whole blocks are read into the buffer directly */
+	check_read(copy, b, BLK_SIZE, BLK_SIZE, 6);
+	TEST_EQUAL_UI(stats->cached_blocks, 1);
+	TEST_EQUAL_UI(stats->misses, 3);
+
+	TEST_EQUAL_I(sqfs_data_reader_get_block_into(copy, b, 1, buffer,
+						     BLK_SIZE - 1, &size),
+		     SQFS_ERROR_OVERFLOW);
+	TEST_EQUAL_I(sqfs_data_reader_get_block_into(copy, b, 1, buffer,
+						     sizeof(buffer), &size), 0);
+	TEST_EQUAL_UI(size, BLK_SIZE);
+	TEST_EQUAL_UI(buffer[0], 6);
+	TEST_EQUAL_UI(buffer[BLK_SIZE - 1], 6);
+	TEST_EQUAL_UI(stats->cached_blocks, 1);
+	TEST_EQUAL_UI(stats->misses, 4);
+
+	/* borrowed blocks are taken from the cache */
+	TEST_EQUAL_I(sqfs_data_reader_borrow_block(copy, b, 1,
+						   &size, &ptr), 0);
+	TEST_EQUAL_UI(size, BLK_SIZE);
+	TEST_EQUAL_UI(ptr[0], 6);
+	TEST_EQUAL_UI(stats->misses, 5);
+
+	TEST_EQUAL_I(sqfs_data_reader_borrow_block(copy, b, 1,
+						   &size, &ptr2), 0);
+	TEST_ASSERT(ptr == ptr2);
+	TEST_EQUAL_UI(stats->hits, 1);
+
+	TEST_EQUAL_I(sqfs_data_reader_get_fragment_into(copy, a, buffer, 4,
+							&size),
+		     SQFS_ERROR_OVERFLOW);
+	TEST_EQUAL_I(sqfs_data_reader_get_fragment_into(copy, a, buffer,
+							sizeof(buffer),
+							&size), 0);
+	TEST_EQUAL_UI(size, 5);
+	TEST_EQUAL_UI(buffer[0], 0x40);
+	TEST_EQUAL_UI(buffer[4], 0x44);
+
+	TEST_EQUAL_I(sqfs_data_reader_borrow_fragment(copy, b, &size, &ptr), 0);
+	TEST_EQUAL_UI(size, 6);
+	TEST_EQUAL_UI(ptr[0], 0x48);
+	TEST_EQUAL_UI(ptr[5], 0x4D);
+	TEST_EQUAL_UI(stats->misses, 6);
+	TEST_EQUAL_UI(stats->hits, 3);
+
+	TEST_EQUAL_I(sqfs_data_reader_borrow_fragment(copy, c, &size, &ptr), 0);
+	TEST_EQUAL_UI(size, 0);
+	TEST_NULL(ptr);
+
+	/* random access to a larger file with sparse blocks */
+	for (i = 3 * NUM_BLOCKS; i-- > 0; ) {
+		check_read(copy, c, i * BLK_SIZE + 3, BLK_SIZE - 3,
+			   (i % 3) ? 0 : (i / 3 + 1));
+
+		TEST_EQUAL_I(sqfs_data_reader_get_block(rd, c, i,
+							&size, &out), 0);
+		TEST_EQUAL_UI(size, BLK_SIZE);
+		TEST_EQUAL_UI(out[BLK_SIZE - 1], (i % 3) ? 0 : (i / 3 + 1));
+		free(out);
+	}
+
+	check_read(copy, c, 2 * BLK_SIZE - 4, 8, 0);
+	TEST_EQUAL_I(sqfs_data_reader_read(copy, c, 3 * NUM_BLOCKS * BLK_SIZE,
+					   &size, 1), 0);
+
+	/*
+	  A fully sparse file, placed where the next file starts, does not
+	  share its block index with a file of the same size that does.
+	 */
+	d = create_inode(0, 3 * NUM_BLOCKS, 0, 0);
+	e = create_inode(0, 3 * NUM_BLOCKS, 0, 0);
+	for (i = 0; i < 3 * NUM_BLOCKS; ++i)
+		d->extra[i] = 0;
+
+	check_read(copy, d, 5 * BLK_SIZE, BLK_SIZE, 0);
+
+	for (i = 0; i < NUM_BLOCKS; ++i)
+		check_read(copy, e, i * BLK_SIZE, BLK_SIZE, i + 1);
+
+	check_read(copy, d, 7 * BLK_SIZE, BLK_SIZE, 0);
+	free(d);
+	free(e);
+
+	sqfs_destroy(copy);
+	sqfs_destroy(rd);
+	free(c);
+
+	/* sequential reads are decompressed ahead of time if supported */
+	c = create_inode(0, PACKED_BLOCKS, 0, 0);
+	c->data.file.blocks_start = packed;
+	for (i = 0; i < PACKED_BLOCKS; ++i)
+		c->extra[i] = BLK_SIZE;
+
+	rd = sqfs_data_reader_create((sqfs_file_t *)&file, BLK_SIZE,
+				     &invert_cmp);
+	TEST_NOT_NULL(rd);
+	TEST_EQUAL_I(sqfs_data_reader_load_fragment_table(rd, &super), 0);
+	stats = sqfs_data_reader_get_stats(rd);
+
+	ret = sqfs_data_reader_set_read_ahead(rd, 2, 4);
+	if (ret != SQFS_ERROR_UNSUPPORTED)
+		TEST_EQUAL_I(ret, 0);
+
+	for (i = 0; i < PACKED_BLOCKS; ++i) {
+		TEST_EQUAL_I(sqfs_data_reader_get_block(rd, c, i,
+							&size, &out), 0);
+		TEST_EQUAL_UI(size, BLK_SIZE);
+		TEST_EQUAL_UI(out[0], 0x80 + i);
+		TEST_EQUAL_UI(out[BLK_SIZE - 1], 0x80 + i);
+		free(out);
+	}
+
+	/* blocks read ahead are not misses and end up in the cache */
+	if (ret == 0) {
+		TEST_EQUAL_UI(stats->misses, 1);
+		TEST_EQUAL_UI(stats->read_ahead_hits, PACKED_BLOCKS - 1);
+		TEST_EQUAL_UI(stats->cached_blocks, 4);
+		TEST_EQUAL_UI(stats->hits, 0);
+
+		check_read(rd, c, (PACKED_BLOCKS - 1) * BLK_SIZE, BLK_SIZE,
+			   0x80 + PACKED_BLOCKS - 1);
+		TEST_EQUAL_UI(stats->hits, 1);
+		TEST_EQUAL_UI(stats->misses, 1);
+	} else {
+		TEST_EQUAL_UI(stats->misses, PACKED_BLOCKS);
+		TEST_EQUAL_UI(stats->cached_blocks, 0);
+	}
+
+	for (i = 0; i < PACKED_BLOCKS; ++i)
+		check_read(rd, c, i * BLK_SIZE, BLK_SIZE, 0x80 + i);
+
+	/* random access is decompressed on the calling thread */
+	check_read(rd, c, 7 * BLK_SIZE, BLK_SIZE, 0x87);
+
+	if (ret == 0) {
+		TEST_EQUAL_UI(stats->read_ahead_blocks,
+			      2 * (PACKED_BLOCKS - 1));
+		TEST_EQUAL_UI(stats->read_ahead_hits,
+			      2 * (PACKED_BLOCKS - 1));
+	}
+
+	TEST_EQUAL_I(sqfs_data_reader_set_read_ahead(rd, 0, 0), 0);
+	check_read(rd, c, 3 * BLK_SIZE, BLK_SIZE, 0x83);
+
+	sqfs_destroy(rd);
+	free(a);
+	free(b);
+	free(c);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,186 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * dentry_cache.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "sqfs/dir_reader.h"
+#include "sqfs/error.h"
+#include "compat.h"
+#include "image.h"
+#include "test.h"
+
+static sqfs_u8 file_data[64 * 1024];
+static mem_file_t file = MEM_FILE_INIT(file_data);
+
+static sqfs_compressor_t cmp = {
+	.do_block = store_block,
+};
+
+static test_image_t img;
+
+/*
+  /a/b/f0 ... /a/b/f9 are inodes 1 to 10, /a/b is 11, /a/x is 12, /a is 13,
+  /c is 14 and the root is 15.
+ */
+static void create_image(void)
+{
+	sqfs_u64 refs[10], b, x, a, c;
+	char name[8];
+	size_t i;
+
+	image_begin(&img, &file, &cmp);
+
+	for (i = 0; i < 10; ++i)
+		refs[i] = image_write_file(&img, i + 1, 0);
+
+	TEST_EQUAL_I(sqfs_dir_writer_begin(img.dw, 0), 0);
+	for (i = 0; i < 10; ++i) {
+		sprintf(name, "f%u", (unsigned int)i);
+		TEST_EQUAL_I(sqfs_dir_writer_add_entry(img.dw, name, i + 1,
+						       refs[i],
+						       S_IFREG | 0644), 0);
+	}
+	TEST_EQUAL_I(sqfs_dir_writer_end(img.dw), 0);
+	b = image_write_dir(&img, 0, 13, 11);
+
+	x = image_write_file(&img, 12, 0);
+
+	TEST_EQUAL_I(sqfs_dir_writer_begin(img.dw, 0), 0);
+	TEST_EQUAL_I(sqfs_dir_writer_add_entry(img.dw, "b", 11, b,
+					       S_IFDIR | 0755), 0);
+	TEST_EQUAL_I(sqfs_dir_writer_add_entry(img.dw, "x", 12, x,
+					       S_IFREG | 0644), 0);
+	TEST_EQUAL_I(sqfs_dir_writer_end(img.dw), 0);
+	a = image_write_dir(&img, 1, 15, 13);
+
+	c = image_write_file(&img, 14, 0);
+
+	TEST_EQUAL_I(sqfs_dir_writer_begin(img.dw, 0), 0);
+	TEST_EQUAL_I(sqfs_dir_writer_add_entry(img.dw, "a", 13, a,
+					       S_IFDIR | 0755), 0);
+	TEST_EQUAL_I(sqfs_dir_writer_add_entry(img.dw, "c", 14, c,
+					       S_IFREG | 0644), 0);
+	TEST_EQUAL_I(sqfs_dir_writer_end(img.dw), 0);
+
+	image_finish(&img, image_write_dir(&img, 1, 0, 15));
+}
+
+static void check_path(sqfs_dir_reader_t *rd,
+		       const sqfs_inode_generic_t *start, const char *path,
+		       sqfs_u32 number)
+{
+	sqfs_inode_generic_t *inode;
+
+	TEST_EQUAL_I(sqfs_dir_reader_find_by_path(rd, start, path, &inode), 0);
+	TEST_EQUAL_UI(inode->base.inode_number, number);
+	free(inode);
+}
+
+static void check_fail(sqfs_dir_reader_t *rd, const char *path, int error)
+{
+	sqfs_inode_generic_t *inode;
+
+	TEST_EQUAL_I(sqfs_dir_reader_find_by_path(rd, NULL, path, &inode),
+		     error);
+}
+
+static void check_stats(const sqfs_dir_reader_stats_t *stats, sqfs_u64 hits,
+			sqfs_u64 negative_hits, sqfs_u64 misses)
+{
+	TEST_EQUAL_UI(stats->hits, hits);
+	TEST_EQUAL_UI(stats->negative_hits, negative_hits);
+	TEST_EQUAL_UI(stats->misses, misses);
+}
+
+int main(void)
+{
+	const sqfs_dir_reader_stats_t *stats;
+	sqfs_inode_generic_t *dir;
+	sqfs_dir_reader_t *rd, *copy;
+	sqfs_u64 entries;
+
+	create_image();
+
+	rd = sqfs_dir_reader_create(&img.super, &cmp, (sqfs_file_t *)&file);
+	TEST_NOT_NULL(rd);
+
+	stats = sqfs_dir_reader_get_stats(rd);
+	TEST_EQUAL_UI(stats->size, sizeof(*stats));
+
+	/* the cache is off by default */
+	check_path(rd, NULL, "/a/b/f3", 4);
+	check_fail(rd, "/a/b/f10", SQFS_ERROR_NO_ENTRY);
+	check_stats(stats, 0, 0, 0);
+	TEST_EQUAL_UI(stats->cached_entries, 0);
+
+	TEST_EQUAL_I(sqfs_dir_reader_set_dentry_cache_size(rd, 4096), 0);
+
+	/* every component is looked up once, then served from the cache */
+	check_path(rd, NULL, "/a/b/f3", 4);
+	check_stats(stats, 0, 0, 3);
+	TEST_EQUAL_UI(stats->cached_entries, 3);
+
+	check_path(rd, NULL, "a//b/f3", 4);
+	check_stats(stats, 3, 0, 3);
+
+	check_path(rd, NULL, "a\\b", 11);
+	check_path(rd, NULL, "/a/b/f9", 10);
+	check_stats(stats, 7, 0, 4);
+
+	check_path(rd, NULL, "/c", 14);
+	check_path(rd, NULL, "", 15);
+	check_stats(stats, 7, 0, 5);
+
+	/* names that do not exist are remembered as well */
+	check_fail(rd, "/a/b/f10", SQFS_ERROR_NO_ENTRY);
+	check_stats(stats, 9, 0, 6);
+	check_fail(rd, "/a/b/f10", SQFS_ERROR_NO_ENTRY);
+	check_fail(rd, "/a/b/f10/foo", SQFS_ERROR_NO_ENTRY);
+	check_stats(stats, 13, 2, 6);
+
+	/* so are entries that are not directories */
+	check_fail(rd, "/a/x/foo", SQFS_ERROR_NOT_DIR);
+	check_stats(stats, 14, 2, 7);
+	check_fail(rd, "/a/x/foo", SQFS_ERROR_NOT_DIR);
+	check_stats(stats, 16, 2, 7);
+	check_path(rd, NULL, "/a/x", 12);
+
+	/* starting from a sub directory uses the same entries */
+	TEST_EQUAL_I(sqfs_dir_reader_find_by_path(rd, NULL, "a", &dir), 0);
+	check_path(rd, dir, "b/f3", 4);
+	check_stats(stats, 21, 2, 7);
+	free(dir);
+
+	/* a copy starts out with an empty cache of the same size */
+	copy = sqfs_copy(rd);
+	TEST_NOT_NULL(copy);
+	check_path(copy, NULL, "/a/b/f3", 4);
+	check_stats(sqfs_dir_reader_get_stats(copy), 0, 0, 3);
+	check_stats(stats, 21, 2, 7);
+	sqfs_destroy(copy);
+
+	/* lowering the limit drops the least recently used entries */
+	entries = stats->cached_entries;
+	TEST_EQUAL_UI(stats->evictions, 0);
+
+	TEST_EQUAL_I(sqfs_dir_reader_set_dentry_cache_size(rd,
+						stats->cached_bytes / 2), 0);
+	TEST_ASSERT(stats->cached_entries < entries);
+	TEST_EQUAL_UI(stats->evictions, entries - stats->cached_entries);
+
+	check_path(rd, NULL, "/a/b/f3", 4);
+	check_path(rd, NULL, "/a/b/f9", 10);
+
+	TEST_EQUAL_I(sqfs_dir_reader_set_dentry_cache_size(rd, 0), 0);
+	TEST_EQUAL_UI(stats->cached_entries, 0);
+	TEST_EQUAL_UI(stats->cached_bytes, 0);
+
+	check_path(rd, NULL, "/a/b/f3", 4);
+	TEST_EQUAL_UI(stats->cached_entries, 0);
+
+	sqfs_destroy(rd);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,170 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * dir_listing.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "sqfs/dir_reader.h"
+#include "sqfs/error.h"
+#include "sqfs/dir.h"
+#include "compat.h"
+#include "image.h"
+#include "test.h"
+
+static sqfs_u8 file_data[64 * 1024];
+static mem_file_t file = MEM_FILE_INIT(file_data);
+
+static sqfs_compressor_t cmp = {
+	.do_block = store_block,
+};
+
+static test_image_t img;
+
+/*
+  The root contains "empty", "f0" to "f9" and "link". The inodes of the
+  files are written in reverse order, so f9 comes first on disk. The files
+  f0 to f9 are inodes 1 to 10, link is 11, empty is 12 and the root is 13.
+ */
+static void create_image(void)
+{
+	sqfs_u64 refs[10], link, dir;
+	char name[8];
+	size_t i;
+
+	image_begin(&img, &file, &cmp);
+
+	for (i = 10; i > 0; --i)
+		refs[i - 1] = image_write_file(&img, i, i * 100);
+
+	link = image_write_slink(&img, 11, "target");
+
+	TEST_EQUAL_I(sqfs_dir_writer_begin(img.dw, 0), 0);
+	TEST_EQUAL_I(sqfs_dir_writer_end(img.dw), 0);
+	dir = image_write_dir(&img, 0, 13, 12);
+
+	TEST_EQUAL_I(sqfs_dir_writer_begin(img.dw, 0), 0);
+	TEST_EQUAL_I(sqfs_dir_writer_add_entry(img.dw, "empty", 12, dir,
+					       S_IFDIR | 0755), 0);
+	for (i = 0; i < 10; ++i) {
+		sprintf(name, "f%u", (unsigned int)i);
+		TEST_EQUAL_I(sqfs_dir_writer_add_entry(img.dw, name, i + 1,
+						       refs[i],
+						       S_IFREG | 0644), 0);
+	}
+	TEST_EQUAL_I(sqfs_dir_writer_add_entry(img.dw, "link", 11, link,
+					       S_IFLNK | 0777), 0);
+	TEST_EQUAL_I(sqfs_dir_writer_end(img.dw), 0);
+
+	image_finish(&img, image_write_dir(&img, 1, 0, 13));
+}
+
+static void check_node(const sqfs_dir_node_t *n, const char *name,
+		       sqfs_u32 number)
+{
+	TEST_STR_EQUAL((const char *)n->name, name);
+	TEST_EQUAL_UI(n->inode_number, number);
+	TEST_NOT_NULL(n->inode);
+	TEST_EQUAL_UI(n->inode->base.inode_number, number);
+
+	if (number <= 10) {
+		TEST_EQUAL_UI(n->type, SQFS_INODE_FILE);
+		TEST_EQUAL_UI(n->inode->base.type, SQFS_INODE_FILE);
+		TEST_EQUAL_UI(n->inode->data.file.file_size, number * 100);
+	} else if (number == 11) {
+		TEST_EQUAL_UI(n->type, SQFS_INODE_SLINK);
+		TEST_EQUAL_UI(n->inode->base.type, SQFS_INODE_SLINK);
+		TEST_STR_EQUAL((const char *)n->inode->extra, "target");
+	} else {
+		TEST_EQUAL_UI(n->type, SQFS_INODE_DIR);
+		TEST_EQUAL_UI(n->inode->base.type, SQFS_INODE_DIR);
+	}
+}
+
+static void check_sorted(const sqfs_dir_listing_t *list)
+{
+	char name[8];
+	size_t i;
+
+	TEST_EQUAL_UI(list->count, 12);
+	check_node(list->entries[0], "empty", 12);
+
+	for (i = 0; i < 10; ++i) {
+		sprintf(name, "f%u", (unsigned int)i);
+		check_node(list->entries[i + 1], name, i + 1);
+	}
+
+	check_node(list->entries[11], "link", 11);
+}
+
+int main(void)
+{
+	sqfs_inode_generic_t *root, *empty;
+	sqfs_dir_listing_t *list;
+	sqfs_dir_entry_t *ent;
+	sqfs_dir_reader_t *rd;
+	char name[8];
+	size_t i;
+
+	create_image();
+
+	rd = sqfs_dir_reader_create(&img.super, &cmp, (sqfs_file_t *)&file);
+	TEST_NOT_NULL(rd);
+
+	TEST_EQUAL_I(sqfs_dir_reader_get_root_inode(rd, &root), 0);
+	TEST_EQUAL_I(sqfs_dir_reader_open_dir(rd, root), 0);
+
+	TEST_EQUAL_I(sqfs_dir_reader_read_all(rd, 0x80, &list),
+		     SQFS_ERROR_UNSUPPORTED);
+
+	/* entries are in directory order by default */
+	TEST_EQUAL_I(sqfs_dir_reader_read_all(rd, 0, &list), 0);
+	check_sorted(list);
+	free(list);
+
+	/* the reader is at the end afterwards */
+	TEST_ASSERT(sqfs_dir_reader_read(rd, &ent) > 0);
+
+	/* a partially read directory is listed from the start */
+	TEST_EQUAL_I(sqfs_dir_reader_rewind(rd), 0);
+	TEST_EQUAL_I(sqfs_dir_reader_read(rd, &ent), 0);
+	TEST_STR_EQUAL((const char *)ent->name, "empty");
+	free(ent);
+
+	TEST_EQUAL_I(sqfs_dir_reader_read_all(rd, 0, &list), 0);
+	check_sorted(list);
+	free(list);
+
+	/* or by inode location */
+	TEST_EQUAL_I(sqfs_dir_reader_read_all(rd, SQFS_DIR_LISTING_SORT_INODES,
+					      &list), 0);
+	TEST_EQUAL_UI(list->count, 12);
+
+	for (i = 0; i < 10; ++i) {
+		sprintf(name, "f%u", 9 - (unsigned int)i);
+		check_node(list->entries[i], name, 10 - i);
+	}
+
+	check_node(list->entries[10], "link", 11);
+	check_node(list->entries[11], "empty", 12);
+
+	for (i = 1; i < list->count; ++i) {
+		TEST_ASSERT(list->entries[i - 1]->inode_ref <
+			    list->entries[i]->inode_ref);
+	}
+	free(list);
+
+	/* an empty directory yields an empty listing */
+	TEST_EQUAL_I(sqfs_dir_reader_find_by_path(rd, NULL, "empty", &empty),
+		     0);
+	TEST_EQUAL_I(sqfs_dir_reader_open_dir(rd, empty), 0);
+	TEST_EQUAL_I(sqfs_dir_reader_read_all(rd, 0, &list), 0);
+	TEST_EQUAL_UI(list->count, 0);
+	free(list);
+
+	sqfs_destroy(rd);
+	free(empty);
+	free(root);
+	return EXIT_SUCCESS;
+}
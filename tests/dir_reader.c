@@ -0,0 +1,166 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * dir_reader.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "sqfs/dir_reader.h"
+#include "sqfs/error.h"
+#include "sqfs/dir.h"
+#include "compat.h"
+#include "image.h"
+#include "test.h"
+
+#define NUM_ENTRIES (3000)
+
+static sqfs_u8 file_data[1024 * 1024];
+static mem_file_t file = MEM_FILE_INIT(file_data);
+
+static sqfs_compressor_t cmp = {
+	.do_block = store_block,
+};
+
+static sqfs_inode_generic_t *big, *small, *empty;
+static char names[NUM_ENTRIES][128];
+static test_image_t img;
+
+/* names have varying length, some longer than the chunks used for lookup */
+static void get_name(size_t i, char *buffer)
+{
+	size_t len;
+
+	sprintf(buffer, "file_%05u_", (unsigned int)i);
+	len = strlen(buffer);
+
+	memset(buffer + len, 'a' + i % 26, (i * 7) % 100);
+	buffer[len + (i * 7) % 100] = '\0';
+}
+
+static sqfs_inode_generic_t *write_dir(sqfs_dir_writer_t *dw, size_t count,
+				       const char *prefix)
+{
+	char buffer[32];
+	size_t i;
+
+	TEST_EQUAL_I(sqfs_dir_writer_begin(dw, 0), 0);
+
+	for (i = 0; i < count; ++i) {
+		if (prefix == NULL) {
+			get_name(i, names[i]);
+		} else {
+			sprintf(buffer, "%s%u", prefix, (unsigned int)i);
+		}
+
+		TEST_EQUAL_I(sqfs_dir_writer_add_entry(dw, prefix == NULL ?
+						       names[i] : buffer,
+						       i + 1, (i / 50) << 16,
+						       S_IFREG | 0644), 0);
+	}
+
+	TEST_EQUAL_I(sqfs_dir_writer_end(dw), 0);
+	return sqfs_dir_writer_create_inode(dw, 0, 0xFFFFFFFF, 0);
+}
+
+/* only the directory table is needed, there are no inodes */
+static void create_image(void)
+{
+	image_begin(&img, &file, &cmp);
+
+	big = write_dir(img.dw, NUM_ENTRIES, NULL);
+	small = write_dir(img.dw, 5, "s");
+	empty = write_dir(img.dw, 0, "");
+	TEST_NOT_NULL(big);
+	TEST_NOT_NULL(small);
+	TEST_NOT_NULL(empty);
+
+	image_finish(&img, 0);
+}
+
+/* a successful lookup leaves the reader positioned after the entry */
+static void check_find(sqfs_dir_reader_t *rd, size_t i)
+{
+	sqfs_dir_entry_t *ent;
+
+	TEST_EQUAL_I(sqfs_dir_reader_find(rd, names[i]), 0);
+
+	if (i == NUM_ENTRIES - 1) {
+		TEST_ASSERT(sqfs_dir_reader_read(rd, &ent) > 0);
+	} else {
+		TEST_EQUAL_I(sqfs_dir_reader_read(rd, &ent), 0);
+		TEST_STR_EQUAL((const char *)ent->name, names[i + 1]);
+		free(ent);
+	}
+}
+
+static void check_missing(sqfs_dir_reader_t *rd, size_t i)
+{
+	char buffer[sizeof(names[0]) + 1];
+	size_t len = strlen(names[i]);
+
+	memcpy(buffer, names[i], len);
+	strcpy(buffer + len, "_");
+	TEST_EQUAL_I(sqfs_dir_reader_find(rd, buffer),
+		     SQFS_ERROR_NO_ENTRY);
+
+	buffer[len - 1] = '\0';
+	TEST_EQUAL_I(sqfs_dir_reader_find(rd, buffer),
+		     SQFS_ERROR_NO_ENTRY);
+}
+
+int main(void)
+{
+	sqfs_dir_reader_t *rd, *copy;
+	size_t i;
+
+	create_image();
+
+	TEST_EQUAL_UI(big->base.type, SQFS_INODE_EXT_DIR);
+	TEST_ASSERT(big->data.dir_ext.inodex_count > 1);
+	TEST_EQUAL_UI(small->base.type, SQFS_INODE_DIR);
+
+	rd = sqfs_dir_reader_create(&img.super, &cmp, (sqfs_file_t *)&file);
+	TEST_NOT_NULL(rd);
+
+	/* look up every entry, in both directions, through the index */
+	TEST_EQUAL_I(sqfs_dir_reader_open_dir(rd, big), 0);
+
+	for (i = 0; i < NUM_ENTRIES; ++i) {
+		check_find(rd, i);
+		check_missing(rd, i);
+	}
+
+	for (i = NUM_ENTRIES; i > 0; --i)
+		check_find(rd, i - 1);
+
+	TEST_EQUAL_I(sqfs_dir_reader_find(rd, ""), SQFS_ERROR_NO_ENTRY);
+	TEST_EQUAL_I(sqfs_dir_reader_find(rd, "a"), SQFS_ERROR_NO_ENTRY);
+	TEST_EQUAL_I(sqfs_dir_reader_find(rd, "zzz"), SQFS_ERROR_NO_ENTRY);
+
+	/* a copy carries its own index */
+	copy = sqfs_copy(rd);
+	TEST_NOT_NULL(copy);
+	check_find(copy, NUM_ENTRIES / 2);
+
+	/* directories without an index are still searched */
+	TEST_EQUAL_I(sqfs_dir_reader_open_dir(rd, small), 0);
+	TEST_EQUAL_I(sqfs_dir_reader_find(rd, "s3"), 0);
+	TEST_EQUAL_I(sqfs_dir_reader_find(rd, "s1"), 0);
+	TEST_EQUAL_I(sqfs_dir_reader_find(rd, "s5"), SQFS_ERROR_NO_ENTRY);
+	TEST_EQUAL_I(sqfs_dir_reader_find(rd, names[0]), SQFS_ERROR_NO_ENTRY);
+
+	TEST_EQUAL_I(sqfs_dir_reader_open_dir(rd, empty), 0);
+	TEST_EQUAL_I(sqfs_dir_reader_find(rd, "s3"), SQFS_ERROR_NO_ENTRY);
+	TEST_EQUAL_I(sqfs_dir_reader_find(rd, names[0]), SQFS_ERROR_NO_ENTRY);
+
+	check_find(copy, NUM_ENTRIES - 1);
+	check_find(copy, 0);
+
+	sqfs_destroy(copy);
+	sqfs_destroy(rd);
+	free(big);
+	free(small);
+	free(empty);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,280 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * gzip_bench.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "sqfs/compressor.h"
+#include "sqfs/error.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <zlib.h>
+
+#define BLOCK_SIZE (128 * 1024)
+
+/*
+  Compares the libdeflate based gzip compressor against the bundled zlib.
+  Everything libdeflate produces is also extracted with zlib, to make sure
+  the blocks stay readable by everything else.
+ */
+static const unsigned int levels[] = { 1, 6, 9, 12 };
+
+#define NUM_LEVELS (sizeof(levels) / sizeof(levels[0]))
+
+/* compressible, but never repeating input */
+static void generate_input(sqfs_u8 *data, size_t size)
+{
+	static const char *words[] = {
+		"squash ", "block ", "inode ", "fragment ", "table ",
+		"directory ", "compress ", "xattr ", "super ", "data ",
+	};
+	sqfs_u32 state = 0xDEADBEEF, counter = 0;
+	const char *w;
+	size_t len;
+
+	while (size > 0) {
+		state = state * 1103515245 + 12345;
+		w = words[(state >> 16) % 10];
+		len = strlen(w);
+
+		if ((counter++ % 8) == 0) {
+			if (size < 4)
+				break;
+			memcpy(data, &state, 4);
+			data += 4;
+			size -= 4;
+		}
+
+		if (len > size)
+			len = size;
+
+		memcpy(data, w, len);
+		data += len;
+		size -= len;
+	}
+}
+
+static double get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static sqfs_s32 zlib_deflate(z_stream *strm, const sqfs_u8 *in,
+			     sqfs_u8 *out)
+{
+	int ret;
+
+	if (deflateReset(strm) != Z_OK)
+		return -1;
+
+	strm->next_in = in;
+	strm->avail_in = BLOCK_SIZE;
+	strm->next_out = out;
+	strm->avail_out = BLOCK_SIZE;
+
+	ret = deflate(strm, Z_FINISH);
+	if (ret == Z_STREAM_END)
+		return strm->total_out;
+
+	return (ret == Z_OK || ret == Z_BUF_ERROR) ? 0 : -1;
+}
+
+static sqfs_s32 zlib_inflate(z_stream *strm, const sqfs_u8 *in,
+			     sqfs_u32 size, sqfs_u8 *out)
+{
+	if (inflateReset(strm) != Z_OK)
+		return -1;
+
+	strm->next_in = in;
+	strm->avail_in = size;
+	strm->next_out = out;
+	strm->avail_out = BLOCK_SIZE;
+
+	if (inflate(strm, Z_FINISH) != Z_STREAM_END)
+		return -1;
+
+	return strm->total_out;
+}
+
+int main(int argc, char **argv)
+{
+	double start, t_zcomp, t_dcomp, t_zinf, t_dinf;
+	sqfs_compressor_t *cmp = NULL, *dcmp = NULL;
+	sqfs_u64 zsize, dsize, insize;
+	sqfs_u8 *input, *out, *buffer;
+	int status = EXIT_FAILURE;
+	sqfs_compressor_config_t cfg;
+	size_t i, j, count;
+	const sqfs_u8 *blk;
+	z_stream zdef, zinf;
+	bool have_zlib = false;
+	sqfs_s32 ret, dsize_blk;
+
+	count = argc > 1 ? strtoul(argv[1], NULL, 0) : 64;
+	if (count == 0)
+		count = 1;
+
+	memset(&zdef, 0, sizeof(zdef));
+	memset(&zinf, 0, sizeof(zinf));
+
+	input = malloc(count * BLOCK_SIZE);
+	out = malloc(BLOCK_SIZE);
+	buffer = malloc(BLOCK_SIZE);
+
+	if (input == NULL || out == NULL || buffer == NULL) {
+		perror("allocating buffers");
+		goto out;
+	}
+
+	generate_input(input, count * BLOCK_SIZE);
+	insize = (sqfs_u64)count * BLOCK_SIZE;
+
+	if (inflateInit(&zinf) != Z_OK) {
+		fputs("Cannot initialize zlib inflate.\n", stderr);
+		goto out;
+	}
+
+	sqfs_compressor_config_init(&cfg, SQFS_COMP_GZIP, BLOCK_SIZE,
+				    SQFS_COMP_FLAG_UNCOMPRESS);
+
+	if (sqfs_compressor_create(&cfg, &dcmp)) {
+		fputs("Cannot create gzip decompressor.\n", stderr);
+		goto out;
+	}
+
+	printf("%-5s %-22s %-22s %-24s\n", "level", "compress (zlib/ldefl)",
+	       "ratio (zlib/ldefl)", "extract (zlib/ldefl)");
+
+	for (i = 0; i < NUM_LEVELS; ++i) {
+		sqfs_compressor_config_init(&cfg, SQFS_COMP_GZIP,
+					    BLOCK_SIZE, 0);
+		cfg.opt.gzip.level = levels[i];
+
+		if (sqfs_compressor_create(&cfg, &cmp)) {
+			fprintf(stderr, "Cannot create gzip compressor with "
+				"level %u. Is libdeflate used?\n", levels[i]);
+			goto out;
+		}
+
+		if (levels[i] <= Z_BEST_COMPRESSION) {
+			if (deflateInit2(&zdef, levels[i], Z_DEFLATED,
+					 15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+				fputs("Cannot initialize zlib deflate.\n",
+				      stderr);
+				goto out;
+			}
+
+			have_zlib = true;
+		}
+
+		t_zcomp = t_dcomp = t_zinf = t_dinf = 0.0;
+		zsize = dsize = 0;
+
+		for (j = 0; j < count; ++j) {
+			blk = input + j * BLOCK_SIZE;
+
+			if (have_zlib) {
+				start = get_time();
+				ret = zlib_deflate(&zdef, blk, out);
+				t_zcomp += get_time() - start;
+
+				if (ret < 0) {
+					fputs("zlib failed to compress a "
+					      "block.\n", stderr);
+					goto out;
+				}
+
+				zsize += ret > 0 ? ret : BLOCK_SIZE;
+			}
+
+			start = get_time();
+			ret = cmp->do_block(cmp, blk, BLOCK_SIZE,
+					    out, BLOCK_SIZE);
+			t_dcomp += get_time() - start;
+
+			if (ret < 0) {
+				fprintf(stderr, "libdeflate failed to compress "
+					"a block: error %d.\n", (int)ret);
+				goto out;
+			}
+
+			if (ret == 0) {
+				dsize += BLOCK_SIZE;
+				continue;
+			}
+
+			dsize += ret;
+			dsize_blk = ret;
+
+			start = get_time();
+			ret = zlib_inflate(&zinf, out, ret, buffer);
+			t_zinf += get_time() - start;
+
+			if (ret != BLOCK_SIZE)
+				goto fail_verify;
+
+			if (memcmp(buffer, blk, BLOCK_SIZE) != 0)
+				goto fail_verify;
+
+			start = get_time();
+			ret = dcmp->do_block(dcmp, out, dsize_blk, buffer,
+					     BLOCK_SIZE);
+			t_dinf += get_time() - start;
+
+			if (ret != BLOCK_SIZE)
+				goto fail_verify;
+
+			if (memcmp(buffer, blk, BLOCK_SIZE) != 0)
+				goto fail_verify;
+		}
+
+		if (have_zlib) {
+			deflateEnd(&zdef);
+			have_zlib = false;
+			printf("%-5u %8.1f/%-8.1f ms   %6.2f/%-6.2f %%      "
+			       "%6.1f/%-6.1f us/blk\n", levels[i],
+			       t_zcomp * 1000.0, t_dcomp * 1000.0,
+			       100.0 * zsize / insize, 100.0 * dsize / insize,
+			       t_zinf * 1000000.0 / count,
+			       t_dinf * 1000000.0 / count);
+		} else {
+			printf("%-5u %8s/%-8.1f ms   %6s/%-6.2f %%      "
+			       "%6.1f/%-6.1f us/blk\n", levels[i],
+			       "-", t_dcomp * 1000.0,
+			       "-", 100.0 * dsize / insize,
+			       t_zinf * 1000000.0 / count,
+			       t_dinf * 1000000.0 / count);
+		}
+
+		sqfs_destroy(cmp);
+		cmp = NULL;
+	}
+
+	status = EXIT_SUCCESS;
+out:
+	if (have_zlib)
+		deflateEnd(&zdef);
+	if (cmp != NULL)
+		sqfs_destroy(cmp);
+	if (dcmp != NULL)
+		sqfs_destroy(dcmp);
+	inflateEnd(&zinf);
+	free(buffer);
+	free(out);
+	free(input);
+	return status;
+fail_verify:
+	fprintf(stderr, "Block %u compressed by libdeflate at level %u does "
+		"not extract to the original data!\n", (unsigned int)j,
+		levels[i]);
+	goto out;
+}
@@ -0,0 +1,173 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * gzip_libdeflate.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "sqfs/compressor.h"
+#include "sqfs/super.h"
+#include "sqfs/error.h"
+#include "mem_file.h"
+#include "test.h"
+
+#define BLOCK_SIZE (64 * 1024)
+
+static sqfs_u8 block[BLOCK_SIZE];
+static sqfs_u8 out[BLOCK_SIZE];
+static sqfs_u8 check[BLOCK_SIZE];
+
+static sqfs_u8 file_data[sizeof(sqfs_super_t) + 64];
+static mem_file_t file = MEM_FILE_INIT(file_data);
+
+static void fill_block(void)
+{
+	sqfs_u32 state = 42;
+	size_t i;
+
+	for (i = 0; i < sizeof(block); ++i) {
+		state = state * 1103515245 + 12345;
+		block[i] = 'a' + (state >> 16) % 8;
+	}
+}
+
+static int create(sqfs_u16 flags, sqfs_u16 level, sqfs_u16 window,
+		  sqfs_compressor_t **out)
+{
+	sqfs_compressor_config_t cfg;
+
+	TEST_EQUAL_I(sqfs_compressor_config_init(&cfg, SQFS_COMP_GZIP,
+						 BLOCK_SIZE, flags), 0);
+	cfg.opt.gzip.level = level;
+	cfg.opt.gzip.window_size = window;
+
+	return sqfs_compressor_create(&cfg, out);
+}
+
+static void round_trip(sqfs_compressor_t *cmp)
+{
+	sqfs_compressor_t *uncmp;
+	sqfs_s32 ret;
+
+	ret = cmp->do_block(cmp, block, sizeof(block), out, sizeof(out));
+	TEST_ASSERT(ret > 0);
+	TEST_ASSERT((size_t)ret < sizeof(block));
+
+	TEST_EQUAL_I(create(SQFS_COMP_FLAG_UNCOMPRESS, SQFS_GZIP_DEFAULT_LEVEL,
+			    SQFS_GZIP_DEFAULT_WINDOW, &uncmp), 0);
+	TEST_EQUAL_I(uncmp->do_block(uncmp, out, ret, check, sizeof(check)),
+		     BLOCK_SIZE);
+	TEST_ASSERT(memcmp(block, check, sizeof(block)) == 0);
+	sqfs_destroy(uncmp);
+}
+
+static void test_narrowed_options(void)
+{
+	sqfs_compressor_t *cmp;
+
+	/* no strategies and no window other than 32k for compressing */
+	TEST_EQUAL_I(create(SQFS_COMP_FLAG_GZIP_DEFAULT, SQFS_GZIP_DEFAULT_LEVEL,
+			    SQFS_GZIP_DEFAULT_WINDOW, &cmp),
+		     SQFS_ERROR_UNSUPPORTED);
+	TEST_EQUAL_I(create(SQFS_COMP_FLAG_GZIP_RLE, SQFS_GZIP_DEFAULT_LEVEL,
+			    SQFS_GZIP_DEFAULT_WINDOW, &cmp),
+		     SQFS_ERROR_UNSUPPORTED);
+	TEST_EQUAL_I(create(0, SQFS_GZIP_DEFAULT_LEVEL, 14, &cmp),
+		     SQFS_ERROR_UNSUPPORTED);
+
+	/* but images made with them can still be unpacked */
+	TEST_EQUAL_I(create(SQFS_COMP_FLAG_UNCOMPRESS |
+			    SQFS_COMP_FLAG_GZIP_RLE,
+			    SQFS_GZIP_DEFAULT_LEVEL, 8, &cmp), 0);
+	sqfs_destroy(cmp);
+
+	/* the libdeflate levels go beyond the zlib ones */
+	TEST_EQUAL_I(create(0, SQFS_GZIP_MAX_LEVEL_EXT + 1,
+			    SQFS_GZIP_DEFAULT_WINDOW, &cmp),
+		     SQFS_ERROR_UNSUPPORTED);
+}
+
+static void test_levels(void)
+{
+	sqfs_compressor_config_t cfg;
+	sqfs_compressor_stats_t stats;
+	sqfs_compressor_t *cmp, *copy;
+	sqfs_u16 level;
+
+	for (level = SQFS_GZIP_MIN_LEVEL; level <= SQFS_GZIP_MAX_LEVEL_EXT;
+	     ++level) {
+		TEST_EQUAL_I(create(0, level, SQFS_GZIP_DEFAULT_WINDOW,
+				    &cmp), 0);
+
+		cmp->get_configuration(cmp, &cfg);
+		TEST_EQUAL_UI(cfg.opt.gzip.level, level);
+		TEST_EQUAL_UI(cfg.opt.gzip.window_size,
+			      SQFS_GZIP_DEFAULT_WINDOW);
+
+		round_trip(cmp);
+
+		copy = sqfs_copy(cmp);
+		TEST_NOT_NULL(copy);
+		sqfs_destroy(cmp);
+		round_trip(copy);
+
+		/* there is nothing to search, but the counters are there */
+		TEST_EQUAL_I(sqfs_compressor_get_stats(copy, &stats), 0);
+		TEST_EQUAL_UI(stats.size, sizeof(stats));
+		TEST_EQUAL_UI(stats.search_count, 0);
+		TEST_EQUAL_UI(stats.trial_count, 0);
+		sqfs_destroy(copy);
+	}
+}
+
+static void test_write_options(void)
+{
+	sqfs_compressor_config_t cfg;
+	sqfs_compressor_t *cmp;
+	size_t off = sizeof(sqfs_super_t);
+
+	/* levels up to 9 are stored as is */
+	file.size = 0;
+	TEST_EQUAL_I(create(0, 5, SQFS_GZIP_DEFAULT_WINDOW, &cmp), 0);
+	TEST_EQUAL_I(cmp->write_options(cmp, (sqfs_file_t *)&file), 10);
+	TEST_EQUAL_UI(file.size, off + 10);
+	TEST_EQUAL_UI(file.data[off], 8);
+	TEST_EQUAL_UI(file.data[off + 1], 0x80);
+	TEST_EQUAL_UI(file.data[off + 2], 5);
+	TEST_EQUAL_UI(file.data[off + 6], SQFS_GZIP_DEFAULT_WINDOW);
+	sqfs_destroy(cmp);
+
+	/* the higher ones as 9, the default, which is not written at all */
+	file.size = 0;
+	TEST_EQUAL_I(create(0, 12, SQFS_GZIP_DEFAULT_WINDOW, &cmp), 0);
+	TEST_EQUAL_I(cmp->write_options(cmp, (sqfs_file_t *)&file), 0);
+	TEST_EQUAL_UI(file.size, 0);
+	sqfs_destroy(cmp);
+
+	/* they are not accepted when reading them back either */
+	file.size = 0;
+	TEST_EQUAL_I(create(0, 5, SQFS_GZIP_DEFAULT_WINDOW, &cmp), 0);
+	TEST_EQUAL_I(cmp->write_options(cmp, (sqfs_file_t *)&file), 10);
+	sqfs_destroy(cmp);
+
+	TEST_EQUAL_I(create(SQFS_COMP_FLAG_UNCOMPRESS, SQFS_GZIP_DEFAULT_LEVEL,
+			    SQFS_GZIP_DEFAULT_WINDOW, &cmp), 0);
+	TEST_EQUAL_I(cmp->read_options(cmp, (sqfs_file_t *)&file), 0);
+	cmp->get_configuration(cmp, &cfg);
+	TEST_EQUAL_UI(cfg.opt.gzip.level, 5);
+
+	file.data[off + 2] = 10;
+	TEST_EQUAL_I(cmp->read_options(cmp, (sqfs_file_t *)&file),
+		     SQFS_ERROR_UNSUPPORTED);
+	sqfs_destroy(cmp);
+}
+
+int main(void)
+{
+	fill_block();
+	test_narrowed_options();
+	test_levels();
+	test_write_options();
+	return EXIT_SUCCESS;
+}
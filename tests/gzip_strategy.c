@@ -0,0 +1,181 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * gzip_strategy.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "sqfs/compressor.h"
+#include "sqfs/error.h"
+#include "test.h"
+
+#define BLOCK_SIZE (64 * 1024)
+#define SAMPLE_SIZE (16 * 1024)
+#define SMALL_SIZE (4000)
+
+#define BIT_DEFAULT (0)
+#define BIT_HUFFMAN (2)
+
+static sqfs_u8 block[BLOCK_SIZE];
+static sqfs_u8 out[BLOCK_SIZE];
+static sqfs_u8 check[BLOCK_SIZE];
+static sqfs_u32 rnd_state;
+
+static const char *words[] = {
+	"the ", "quick ", "brown ", "fox ", "jumps ", "over ", "lazy ",
+	"dog ", "squash ", "file ", "system ", "block ", "inode ",
+	"fragment ", "table ", "directory ",
+};
+
+static sqfs_u32 rnd(void)
+{
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return rnd_state >> 16;
+}
+
+/* text made of a few words, easy to match for anything but huffman only */
+static void fill_words(sqfs_u8 *data, size_t size)
+{
+	const char *w;
+	size_t i = 0;
+
+	while (i < size) {
+		w = words[rnd() % (sizeof(words) / sizeof(words[0]))];
+
+		while (*w != '\0' && i < size)
+			data[i++] = *(w++);
+	}
+}
+
+static sqfs_compressor_t *create(int search, bool uncompress)
+{
+	sqfs_compressor_config_t cfg;
+	sqfs_compressor_t *cmp;
+	sqfs_u16 flags;
+
+	flags = SQFS_COMP_FLAG_GZIP_DEFAULT | SQFS_COMP_FLAG_GZIP_HUFFMAN;
+
+	TEST_EQUAL_I(sqfs_compressor_config_init(&cfg, SQFS_COMP_GZIP,
+						 BLOCK_SIZE, flags), 0);
+	cfg.opt.gzip.strategy_search = search;
+
+	if (uncompress)
+		cfg.flags |= SQFS_COMP_FLAG_UNCOMPRESS;
+
+	TEST_EQUAL_I(sqfs_compressor_create(&cfg, &cmp), 0);
+	return cmp;
+}
+
+static void get_stats(const sqfs_compressor_t *cmp,
+		      sqfs_compressor_stats_t *stats)
+{
+	TEST_EQUAL_I(sqfs_compressor_get_stats(cmp, stats), 0);
+	TEST_EQUAL_UI(stats->size, sizeof(*stats));
+}
+
+static void round_trip(sqfs_compressor_t *cmp, sqfs_u32 size)
+{
+	sqfs_compressor_t *uncmp;
+	sqfs_s32 ret;
+
+	ret = cmp->do_block(cmp, block, size, out, sizeof(out));
+	TEST_ASSERT(ret > 0);
+	TEST_ASSERT((sqfs_u32)ret < size);
+
+	uncmp = create(SQFS_GZIP_SEARCH_FULL, true);
+	TEST_EQUAL_I(uncmp->do_block(uncmp, out, ret, check, sizeof(check)),
+		     (sqfs_s32)size);
+	TEST_ASSERT(memcmp(block, check, size) == 0);
+	sqfs_destroy(uncmp);
+}
+
+static void test_search(int search, sqfs_u64 trial_size)
+{
+	sqfs_compressor_stats_t stats;
+	sqfs_compressor_t *cmp;
+
+	rnd_state = 42;
+	fill_words(block, sizeof(block));
+
+	cmp = create(search, false);
+
+	get_stats(cmp, &stats);
+	TEST_EQUAL_UI(stats.search_count, 0);
+	TEST_EQUAL_UI(stats.trial_count, 0);
+	TEST_EQUAL_UI(stats.trial_bytes, 0);
+
+	/* both strategies are tried, on a part of the block or all of it */
+	round_trip(cmp, BLOCK_SIZE);
+
+	get_stats(cmp, &stats);
+	TEST_EQUAL_UI(stats.search_count, 1);
+	TEST_EQUAL_UI(stats.trial_count, 2);
+	TEST_EQUAL_UI(stats.trial_bytes, 2 * trial_size);
+	TEST_EQUAL_UI(stats.flag_wins[BIT_DEFAULT], 1);
+	TEST_EQUAL_UI(stats.flag_wins[BIT_HUFFMAN], 0);
+
+	/* blocks smaller than the sample are always tried as a whole */
+	round_trip(cmp, SMALL_SIZE);
+
+	get_stats(cmp, &stats);
+	TEST_EQUAL_UI(stats.search_count, 2);
+	TEST_EQUAL_UI(stats.trial_count, 4);
+	TEST_EQUAL_UI(stats.trial_bytes, 2 * trial_size + 2 * SMALL_SIZE);
+	TEST_EQUAL_UI(stats.flag_wins[BIT_DEFAULT], 2);
+	TEST_EQUAL_UI(stats.flag_wins[BIT_HUFFMAN], 0);
+
+	sqfs_destroy(cmp);
+}
+
+static void test_copies(void)
+{
+	sqfs_compressor_stats_t stats;
+	sqfs_compressor_t *cmp, *copy;
+
+	rnd_state = 1337;
+	fill_words(block, sizeof(block));
+
+	cmp = create(SQFS_GZIP_SEARCH_SAMPLE, false);
+	round_trip(cmp, BLOCK_SIZE);
+
+	/* a copy starts out with its own, empty counters */
+	copy = sqfs_copy(cmp);
+	TEST_NOT_NULL(copy);
+
+	get_stats(copy, &stats);
+	TEST_EQUAL_UI(stats.search_count, 0);
+	TEST_EQUAL_UI(stats.trial_count, 0);
+	TEST_EQUAL_UI(stats.trial_bytes, 0);
+	TEST_EQUAL_UI(stats.flag_wins[BIT_DEFAULT], 0);
+
+	round_trip(copy, BLOCK_SIZE);
+	round_trip(copy, SMALL_SIZE);
+
+	get_stats(copy, &stats);
+	TEST_EQUAL_UI(stats.search_count, 2);
+	TEST_EQUAL_UI(stats.trial_count, 4);
+
+	get_stats(cmp, &stats);
+	TEST_EQUAL_UI(stats.search_count, 1);
+	TEST_EQUAL_UI(stats.trial_count, 2);
+
+	/* and outlives the original */
+	sqfs_destroy(cmp);
+	round_trip(copy, BLOCK_SIZE);
+
+	get_stats(copy, &stats);
+	TEST_EQUAL_UI(stats.search_count, 3);
+	TEST_EQUAL_UI(stats.trial_count, 6);
+	TEST_EQUAL_UI(stats.flag_wins[BIT_DEFAULT], 3);
+
+	sqfs_destroy(copy);
+}
+
+int main(void)
+{
+	test_search(SQFS_GZIP_SEARCH_FULL, BLOCK_SIZE);
+	test_search(SQFS_GZIP_SEARCH_SAMPLE, SAMPLE_SIZE);
+	test_copies();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,103 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * hash_bench.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#define MAX_SIZE (1024 * 1024)
+
+/* every data block and fragment is hashed once for deduplication */
+static const size_t sizes[] = {
+	64, 1024, 4096, 8192, 128 * 1024, 1024 * 1024,
+};
+
+#define NUM_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static sqfs_u64 hash32(const void *data, size_t size)
+{
+	return xxh32(data, size);
+}
+
+static const struct {
+	const char *name;
+	sqfs_u64 (*hash)(const void *data, size_t size);
+} hashes[] = {
+	{ "xxh32", hash32 },
+	{ "xxh64", xxh64 },
+	{ "xxh3_64", xxh3_64 },
+};
+
+#define NUM_HASHES (sizeof(hashes) / sizeof(hashes[0]))
+
+static double get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+int main(int argc, char **argv)
+{
+	size_t i, j, k, rounds, total;
+	volatile sqfs_u64 sink = 0;
+	double start, elapsed;
+	sqfs_u32 state = 1234;
+	sqfs_u8 *data;
+
+	total = argc > 1 ? strtoul(argv[1], NULL, 0) : 256;
+	if (total == 0)
+		total = 1;
+
+	total *= 1024 * 1024;
+
+	/* the start is moved around a little, to not always be aligned */
+	data = malloc(MAX_SIZE + 64);
+	if (data == NULL) {
+		perror("allocating buffer");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < MAX_SIZE + 64; ++i) {
+		state = state * 1103515245 + 12345;
+		data[i] = state >> 24;
+	}
+
+	printf("%-8s", "size");
+	for (j = 0; j < NUM_HASHES; ++j)
+		printf(" %12s", hashes[j].name);
+	fputs(" (MiB/s)\n", stdout);
+
+	for (i = 0; i < NUM_SIZES; ++i) {
+		rounds = total / sizes[i];
+		printf("%-8u", (unsigned int)sizes[i]);
+
+		for (j = 0; j < NUM_HASHES; ++j) {
+			start = get_time();
+
+			for (k = 0; k < rounds; ++k) {
+				sink += hashes[j].hash(data + (k % 64),
+						       sizes[i]);
+			}
+
+			elapsed = get_time() - start;
+
+			printf(" %12.1f", (double)rounds * sizes[i] /
+			       (1024.0 * 1024.0) / elapsed);
+		}
+
+		fputc('\n', stdout);
+	}
+
+	free(data);
+	return EXIT_SUCCESS;
+}
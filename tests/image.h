@@ -0,0 +1,137 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * image.h
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "sqfs/meta_writer.h"
+#include "sqfs/dir_writer.h"
+#include "sqfs/super.h"
+#include "sqfs/inode.h"
+#include "mem_file.h"
+
+/* the inode table starts here, so no inode has a reference of zero */
+#define IMAGE_TABLE_START (16)
+
+/*
+  Helpers to put an inode table and a directory table into a memory file,
+  enough to read the directory hierarchy back. Everything else in the super
+  block is left empty.
+ */
+typedef struct {
+	mem_file_t *file;
+	sqfs_meta_writer_t *im;
+	sqfs_meta_writer_t *dm;
+	sqfs_dir_writer_t *dw;
+	sqfs_super_t super;
+} test_image_t;
+
+static ATTRIB_UNUSED void image_begin(test_image_t *img, mem_file_t *file,
+				      sqfs_compressor_t *cmp)
+{
+	memset(img, 0, sizeof(*img));
+	img->file = file;
+	file->size = IMAGE_TABLE_START;
+
+	img->im = sqfs_meta_writer_create((sqfs_file_t *)file, cmp, 0);
+	img->dm = sqfs_meta_writer_create((sqfs_file_t *)file, cmp,
+					  SQFS_META_WRITER_KEEP_IN_MEMORY);
+	TEST_NOT_NULL(img->im);
+	TEST_NOT_NULL(img->dm);
+	img->dw = sqfs_dir_writer_create(img->dm, 0);
+	TEST_NOT_NULL(img->dw);
+
+	img->super.block_size = SQFS_DEFAULT_BLOCK_SIZE;
+	img->super.inode_table_start = IMAGE_TABLE_START;
+}
+
+/* write an inode, free it and return a reference to it */
+static ATTRIB_UNUSED sqfs_u64 image_write_inode(test_image_t *img,
+						sqfs_inode_generic_t *inode,
+						sqfs_u32 number)
+{
+	sqfs_u64 block;
+	sqfs_u32 offset;
+
+	TEST_NOT_NULL(inode);
+	inode->base.mode = 0755;
+	inode->base.inode_number = number;
+
+	sqfs_meta_writer_get_position(img->im, &block, &offset);
+	TEST_EQUAL_I(sqfs_meta_writer_write_inode(img->im, inode), 0);
+	free(inode);
+
+	return (block << 16) | offset;
+}
+
+static ATTRIB_UNUSED sqfs_u64 image_write_file(test_image_t *img,
+					       sqfs_u32 number, sqfs_u32 size)
+{
+	sqfs_inode_generic_t *inode = calloc(1, sizeof(*inode));
+
+	TEST_NOT_NULL(inode);
+	inode->base.type = SQFS_INODE_FILE;
+	inode->data.file.fragment_index = 0xFFFFFFFF;
+	inode->data.file.fragment_offset = 0xFFFFFFFF;
+	inode->data.file.file_size = size;
+
+	return image_write_inode(img, inode, number);
+}
+
+static ATTRIB_UNUSED sqfs_u64 image_write_slink(test_image_t *img,
+						sqfs_u32 number,
+						const char *target)
+{
+	size_t len = strlen(target);
+	sqfs_inode_generic_t *inode = calloc(1, sizeof(*inode) + len + 1);
+
+	TEST_NOT_NULL(inode);
+	inode->base.type = SQFS_INODE_SLINK;
+	inode->data.slink.nlink = 1;
+	inode->data.slink.target_size = len;
+	inode->payload_bytes_available = len + 1;
+	inode->payload_bytes_used = len;
+	memcpy(inode->extra, target, len);
+
+	return image_write_inode(img, inode, number);
+}
+
+/* write the inode of the directory that was just ended in the dir writer */
+static ATTRIB_UNUSED sqfs_u64 image_write_dir(test_image_t *img,
+					      size_t hlinks, sqfs_u32 parent,
+					      sqfs_u32 number)
+{
+	sqfs_inode_generic_t *inode;
+
+	inode = sqfs_dir_writer_create_inode(img->dw, hlinks, 0xFFFFFFFF,
+					     parent);
+
+	return image_write_inode(img, inode, number);
+}
+
+/* write the directory table after the inode table and fill in the super */
+static ATTRIB_UNUSED void image_finish(test_image_t *img, sqfs_u64 root_ref)
+{
+	img->super.root_inode_ref = root_ref;
+
+	TEST_EQUAL_I(sqfs_meta_writer_flush(img->im), 0);
+	img->super.directory_table_start = img->file->size;
+
+	TEST_EQUAL_I(sqfs_meta_writer_flush(img->dm), 0);
+	TEST_EQUAL_I(sqfs_meta_write_write_to_file(img->dm), 0);
+	img->super.id_table_start = img->file->size;
+	img->super.fragment_table_start = 0xFFFFFFFFFFFFFFFFUL;
+	img->super.export_table_start = 0xFFFFFFFFFFFFFFFFUL;
+
+	sqfs_destroy(img->dw);
+	sqfs_destroy(img->dm);
+	sqfs_destroy(img->im);
+	img->dw = NULL;
+	img->dm = NULL;
+	img->im = NULL;
+}
+
+#endif /* IMAGE_H */
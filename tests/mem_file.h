@@ -0,0 +1,139 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * mem_file.h
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef MEM_FILE_H
+#define MEM_FILE_H
+
+#include "sqfs/compressor.h"
+#include "sqfs/error.h"
+#include "sqfs/io.h"
+#include "test.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+  A memory backed file. Either it uses a fixed buffer supplied through
+  MEM_FILE_INIT, or it is created with mem_file_create and the buffer grows
+  as needed.
+ */
+typedef struct {
+	sqfs_file_t base;
+
+	sqfs_u8 *data;
+	sqfs_u64 size;
+	sqfs_u64 capacity;
+	bool dynamic;
+} mem_file_t;
+
+static ATTRIB_UNUSED int mem_read_at(sqfs_file_t *base, sqfs_u64 offset,
+				     void *buffer, size_t size)
+{
+	mem_file_t *file = (mem_file_t *)base;
+
+	if (offset > file->size || size > (file->size - offset))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	memcpy(buffer, file->data + offset, size);
+	return 0;
+}
+
+static ATTRIB_UNUSED int mem_truncate(sqfs_file_t *base, sqfs_u64 size)
+{
+	mem_file_t *file = (mem_file_t *)base;
+	sqfs_u64 new_cap;
+	void *new;
+
+	if (size > file->capacity) {
+		if (!file->dynamic)
+			return SQFS_ERROR_OUT_OF_BOUNDS;
+
+		new_cap = file->capacity ? file->capacity : 4096;
+		while (new_cap < size)
+			new_cap *= 2;
+
+		new = realloc(file->data, new_cap);
+		if (new == NULL)
+			return SQFS_ERROR_ALLOC;
+
+		file->data = new;
+		file->capacity = new_cap;
+	}
+
+	if (size > file->size)
+		memset(file->data + file->size, 0, size - file->size);
+
+	file->size = size;
+	return 0;
+}
+
+static ATTRIB_UNUSED int mem_write_at(sqfs_file_t *base, sqfs_u64 offset,
+				      const void *buffer, size_t size)
+{
+	mem_file_t *file = (mem_file_t *)base;
+	int ret;
+
+	if (offset > (sqfs_u64)SIZE_MAX - size)
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	if ((offset + size) > file->size) {
+		ret = mem_truncate(base, offset + size);
+		if (ret)
+			return ret;
+	}
+
+	memcpy(file->data + offset, buffer, size);
+	return 0;
+}
+
+static ATTRIB_UNUSED sqfs_u64 mem_get_size(const sqfs_file_t *base)
+{
+	return ((const mem_file_t *)base)->size;
+}
+
+#define MEM_FILE_INIT(buffer) {			\
+		.base = {				\
+			.read_at = mem_read_at,		\
+			.write_at = mem_write_at,	\
+			.get_size = mem_get_size,	\
+			.truncate = mem_truncate,	\
+		},					\
+		.data = (buffer),			\
+		.capacity = sizeof(buffer),		\
+	}
+
+static ATTRIB_UNUSED void mem_destroy(sqfs_object_t *obj)
+{
+	free(((mem_file_t *)obj)->data);
+	free(obj);
+}
+
+static ATTRIB_UNUSED mem_file_t *mem_file_create(void)
+{
+	mem_file_t *file = calloc(1, sizeof(*file));
+
+	if (file == NULL)
+		return NULL;
+
+	((sqfs_object_t *)file)->destroy = mem_destroy;
+	file->base.read_at = mem_read_at;
+	file->base.write_at = mem_write_at;
+	file->base.get_size = mem_get_size;
+	file->base.truncate = mem_truncate;
+	file->dynamic = true;
+	return file;
+}
+
+/* a compressor that stores all blocks uncompressed */
+static ATTRIB_UNUSED sqfs_s32 store_block(sqfs_compressor_t *cmp,
+					  const sqfs_u8 *in, sqfs_u32 size,
+					  sqfs_u8 *out, sqfs_u32 outsize)
+{
+	(void)cmp; (void)in; (void)size; (void)out; (void)outsize;
+	return 0;
+}
+
+#endif /* MEM_FILE_H */
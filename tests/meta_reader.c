@@ -0,0 +1,204 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * meta_reader.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "sqfs/meta_reader.h"
+#include "sqfs/error.h"
+#include "mem_file.h"
+#include "compat.h"
+#include "test.h"
+
+#define NUM_BLOCKS (4)
+
+static sqfs_u8 file_data[4096];
+static mem_file_t file = MEM_FILE_INIT(file_data);
+
+/* all blocks are stored uncompressed */
+static sqfs_s32 fail_block(sqfs_compressor_t *cmp, const sqfs_u8 *in,
+			   sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
+{
+	(void)cmp; (void)in; (void)size; (void)out; (void)outsize;
+	return SQFS_ERROR_CORRUPTED;
+}
+
+static sqfs_compressor_t cmp = {
+	.do_block = fail_block,
+};
+
+static sqfs_u64 block_start[NUM_BLOCKS + 1];
+
+/* block i holds 100 + i bytes with the value i + 1, after some padding */
+static void create_image(void)
+{
+	sqfs_u16 header;
+	size_t i, size;
+
+	file.size = 16;
+
+	for (i = 0; i < NUM_BLOCKS; ++i) {
+		block_start[i] = file.size;
+		size = 100 + i;
+
+		header = htole16(0x8000 | size);
+		memcpy(file.data + file.size, &header, sizeof(header));
+		memset(file.data + file.size + 2, i + 1, size);
+
+		file.size += size + 2;
+	}
+
+	block_start[NUM_BLOCKS] = file.size;
+}
+
+static void check_read(sqfs_meta_reader_t *m, size_t size, int value)
+{
+	sqfs_u8 buffer[16];
+	size_t i;
+
+	TEST_EQUAL_I(sqfs_meta_reader_read(m, buffer, size), 0);
+
+	for (i = 0; i < size; ++i)
+		TEST_EQUAL_UI(buffer[i], value);
+}
+
+int main(void)
+{
+	const sqfs_meta_cache_stats_t *stats;
+	sqfs_meta_reader_t *a, *b, *c;
+	sqfs_meta_cache_t *cache;
+	sqfs_u64 start;
+	size_t offset;
+
+	create_image();
+
+	cache = sqfs_meta_cache_create(1024 * 1024);
+	TEST_NOT_NULL(cache);
+
+	stats = sqfs_meta_cache_get_stats(cache);
+	TEST_EQUAL_UI(stats->size, sizeof(*stats));
+
+	a = sqfs_meta_reader_create((sqfs_file_t *)&file, &cmp,
+				    0, block_start[NUM_BLOCKS]);
+	b = sqfs_meta_reader_create((sqfs_file_t *)&file, &cmp,
+				    0, block_start[NUM_BLOCKS]);
+	TEST_NOT_NULL(a);
+	TEST_NOT_NULL(b);
+
+	sqfs_meta_reader_set_cache(a, cache);
+	sqfs_meta_reader_set_cache(b, cache);
+
+	/* blocks decompressed by one reader are picked up by the other */
+	TEST_EQUAL_I(sqfs_meta_reader_seek(a, block_start[0], 0), 0);
+	check_read(a, 4, 1);
+	TEST_EQUAL_UI(stats->misses, 1);
+	TEST_EQUAL_UI(stats->hits, 0);
+
+	TEST_EQUAL_I(sqfs_meta_reader_seek(b, block_start[0], 10), 0);
+	check_read(b, 4, 1);
+	TEST_EQUAL_UI(stats->misses, 1);
+	TEST_EQUAL_UI(stats->hits, 1);
+
+	/* including ones read implicitly when crossing a block boundary */
+	TEST_EQUAL_I(sqfs_meta_reader_seek(a, block_start[0], 98), 0);
+	check_read(a, 2, 1);
+	check_read(a, 2, 2);
+	TEST_EQUAL_UI(stats->misses, 2);
+
+	sqfs_meta_reader_get_position(a, &start, &offset);
+	TEST_EQUAL_UI(start, block_start[1]);
+	TEST_EQUAL_UI(offset, 2);
+
+	TEST_EQUAL_I(sqfs_meta_reader_seek(b, block_start[1], 0), 0);
+	check_read(b, 4, 2);
+	TEST_EQUAL_I(sqfs_meta_reader_seek(a, block_start[0], 50), 0);
+	check_read(a, 4, 1);
+	TEST_EQUAL_UI(stats->misses, 2);
+	TEST_EQUAL_UI(stats->hits, 3);
+	TEST_EQUAL_UI(stats->cached_blocks, 2);
+	TEST_EQUAL_UI(stats->evictions, 0);
+
+	/* cached blocks are still bounds checked */
+	TEST_EQUAL_I(sqfs_meta_reader_seek(b, block_start[0], 100),
+		     SQFS_ERROR_OUT_OF_BOUNDS);
+
+	c = sqfs_meta_reader_create((sqfs_file_t *)&file, &cmp,
+				    0, block_start[1] + 10);
+	TEST_NOT_NULL(c);
+	sqfs_meta_reader_set_cache(c, cache);
+
+	TEST_EQUAL_I(sqfs_meta_reader_seek(c, block_start[1], 0),
+		     SQFS_ERROR_OUT_OF_BOUNDS);
+	TEST_EQUAL_I(sqfs_meta_reader_seek(c, block_start[0], 0), 0);
+	check_read(c, 4, 1);
+	sqfs_destroy(c);
+
+	/* without a cache, nothing is counted */
+	sqfs_meta_reader_set_cache(b, NULL);
+	TEST_EQUAL_I(sqfs_meta_reader_seek(b, block_start[2], 0), 0);
+	check_read(b, 4, 3);
+	TEST_EQUAL_UI(stats->misses, 2);
+	TEST_EQUAL_UI(stats->hits, 6);
+	sqfs_destroy(cache);
+
+	/* the cache size is bounded, but the last block is always kept */
+	cache = sqfs_meta_cache_create(0);
+	TEST_NOT_NULL(cache);
+	stats = sqfs_meta_cache_get_stats(cache);
+	sqfs_meta_reader_set_cache(a, cache);
+
+	TEST_EQUAL_I(sqfs_meta_reader_seek(a, block_start[3], 0), 0);
+	TEST_EQUAL_I(sqfs_meta_reader_seek(a, block_start[2], 0), 0);
+	TEST_EQUAL_I(sqfs_meta_reader_seek(a, block_start[3], 0), 0);
+	check_read(a, 4, 4);
+
+	TEST_EQUAL_UI(stats->misses, 3);
+	TEST_EQUAL_UI(stats->hits, 0);
+	TEST_EQUAL_UI(stats->evictions, 2);
+	TEST_EQUAL_UI(stats->cached_blocks, 1);
+	TEST_ASSERT(stats->cached_bytes >= 103);
+
+	sqfs_destroy(a);
+	sqfs_destroy(b);
+	sqfs_destroy(cache);
+
+	/* preloading requires the entire range to fit */
+	a = sqfs_meta_reader_create((sqfs_file_t *)&file, &cmp,
+				    block_start[0], block_start[NUM_BLOCKS]);
+	TEST_NOT_NULL(a);
+	TEST_EQUAL_I(sqfs_meta_reader_seek(a, block_start[3], 0), 0);
+
+	TEST_EQUAL_I(sqfs_meta_reader_preload(a, 100), SQFS_ERROR_OVERFLOW);
+	TEST_EQUAL_I(sqfs_meta_reader_preload(a, 1024 * 1024), 0);
+
+	/* after that, the file is no longer accessed */
+	file.size = 0;
+
+	check_read(a, 4, 4);
+	TEST_EQUAL_I(sqfs_meta_reader_seek(a, block_start[1], 99), 0);
+	check_read(a, 2, 2);
+	check_read(a, 2, 3);
+	TEST_EQUAL_I(sqfs_meta_reader_seek(a, block_start[0], 100),
+		     SQFS_ERROR_OUT_OF_BOUNDS);
+
+	b = sqfs_copy(a);
+	TEST_NOT_NULL(b);
+	check_read(b, 4, 3);
+	TEST_EQUAL_I(sqfs_meta_reader_seek(b, block_start[0], 0), 0);
+	check_read(b, 4, 1);
+	sqfs_destroy(b);
+
+	check_read(a, 4, 3);
+	TEST_EQUAL_I(sqfs_meta_reader_seek(a, block_start[3], 102), 0);
+	check_read(a, 1, 4);
+	TEST_EQUAL_I(sqfs_meta_reader_read(a, &offset, 1),
+		     SQFS_ERROR_OUT_OF_BOUNDS);
+
+	/* other locations are still read from disk */
+	TEST_EQUAL_I(sqfs_meta_reader_seek(a, block_start[1] + 1, 0),
+		     SQFS_ERROR_OUT_OF_BOUNDS);
+	sqfs_destroy(a);
+	return EXIT_SUCCESS;
+}
@@ -44,8 +44,67 @@ static const struct {
 	},
 };
 
+static const struct {
+	const char *plaintext;
+	sqfs_u64 digest;
+} test_vectors64[] = {
+	{
+		.plaintext = "",
+		.digest = 0xEF46DB3751D8E999ULL,
+	},
+	{
+		.plaintext = "a",
+		.digest = 0xD24EC4F1A98C6E5BULL,
+	},
+	{
+		.plaintext = "abc",
+		.digest = 0x44BC2CF5AD770999ULL,
+	},
+	{
+		.plaintext = "Nobody inspects the spammish repetition",
+		.digest = 0xFBCEA83C8A378BF1ULL,
+	},
+};
+
+static const struct {
+	const char *plaintext;
+	sqfs_u64 digest;
+} test_vectors3[] = {
+	{
+		.plaintext = "",
+		.digest = 0x2D06800538D394C2ULL,
+	},
+	{
+		.plaintext = "a",
+		.digest = 0xE6C632B61E964E1FULL,
+	},
+	{
+		.plaintext = "abc",
+		.digest = 0x78AF5F94892F3950ULL,
+	},
+	{
+		.plaintext = "Nobody inspects the spammish repetition",
+		.digest = 0x6CB00603B5CC47E9ULL,
+	},
+};
+
+/* larger inputs, to cover every size class and the vectorized loop */
+static const struct {
+	size_t size;
+	sqfs_u64 digest;
+} test_vectors3_long[] = {
+	{ 100, 0x6DBB812CF19D012EULL },
+	{ 200, 0x7C64F3B17285E96AULL },
+	{ 241, 0x541B19226F0052E8ULL },
+	{ 1024, 0xF8CAE2B9BC3B4A23ULL },
+	{ 4099, 0x9F81C7B188837353ULL },
+};
+
+static sqfs_u8 long_input[4099];
+
 int main(void)
 {
+	sqfs_u64 hash64;
 	sqfs_u32 hash;
 	size_t i;
 
@@ -61,5 +120,56 @@ int main(void)
 		}
 	}
 
+	for (i = 0; i < sizeof(test_vectors64) / sizeof(test_vectors64[0]);
+	     ++i) {
+		hash64 = xxh64(test_vectors64[i].plaintext,
+			       strlen(test_vectors64[i].plaintext));
+
+		if (hash64 != test_vectors64[i].digest) {
+			fprintf(stderr, "64 bit test case " PRI_SZ " failed!\n",
+				i);
+			fprintf(stderr, "Expected result: 0x%016llX\n",
+				(unsigned long long)test_vectors64[i].digest);
+			fprintf(stderr, "Actual result:   0x%016llX\n",
+				(unsigned long long)hash64);
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (i = 0; i < sizeof(test_vectors3) / sizeof(test_vectors3[0]);
+	     ++i) {
+		hash64 = xxh3_64(test_vectors3[i].plaintext,
+				 strlen(test_vectors3[i].plaintext));
+
+		if (hash64 != test_vectors3[i].digest) {
+			fprintf(stderr, "XXH3 test case " PRI_SZ " failed!\n",
+				i);
+			fprintf(stderr, "Expected result: 0x%016llX\n",
+				(unsigned long long)test_vectors3[i].digest);
+			fprintf(stderr, "Actual result:   0x%016llX\n",
+				(unsigned long long)hash64);
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (i = 0; i < sizeof(long_input); ++i)
+		long_input[i] = (i * 7) ^ (i >> 8);
+
+	for (i = 0; i < sizeof(test_vectors3_long) /
+		     sizeof(test_vectors3_long[0]); ++i) {
+		hash64 = xxh3_64(long_input, test_vectors3_long[i].size);
+
+		if (hash64 != test_vectors3_long[i].digest) {
+			fprintf(stderr, "XXH3 test case with " PRI_SZ
+				" bytes failed!\n", test_vectors3_long[i].size);
+			fprintf(stderr, "Expected result: 0x%016llX\n",
+				(unsigned long long)
+				test_vectors3_long[i].digest);
+			fprintf(stderr, "Actual result:   0x%016llX\n",
+				(unsigned long long)hash64);
+			return EXIT_FAILURE;
+		}
+	}
+
 	return EXIT_SUCCESS;
 }
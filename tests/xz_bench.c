@@ -0,0 +1,269 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * xz_bench.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "sqfs/compressor.h"
+#include "sqfs/error.h"
+#include "sqfs/block.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <lzma.h>
+
+#define BLOCK_SIZE (128 * 1024)
+
+/*
+  The reference encoders set up a new liblzma encoder for every block, the
+  way the compressors used to do it. The compressors must produce the exact
+  same output while reusing their encoders.
+ */
+static sqfs_s32 ref_xz_encode(lzma_vli filter, const sqfs_u8 *in,
+			      sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
+{
+	lzma_filter filters[3];
+	lzma_options_lzma opt;
+	size_t written = 0;
+	lzma_ret ret;
+	int i = 0;
+
+	lzma_lzma_preset(&opt, LZMA_PRESET_DEFAULT);
+	opt.dict_size = BLOCK_SIZE;
+
+	if (filter != LZMA_VLI_UNKNOWN) {
+		filters[i].id = filter;
+		filters[i].options = NULL;
+		++i;
+	}
+
+	filters[i].id = LZMA_FILTER_LZMA2;
+	filters[i].options = &opt;
+	++i;
+
+	filters[i].id = LZMA_VLI_UNKNOWN;
+	filters[i].options = NULL;
+
+	ret = lzma_stream_buffer_encode(filters, LZMA_CHECK_CRC32, NULL,
+					in, size, out, &written, outsize);
+
+	if (ret == LZMA_OK)
+		return (written >= size) ? 0 : written;
+
+	return ret == LZMA_BUF_ERROR ? 0 : SQFS_ERROR_COMPRESSOR;
+}
+
+static sqfs_s32 ref_xz(const sqfs_u8 *in, sqfs_u32 size,
+		       sqfs_u8 *out, sqfs_u32 outsize)
+{
+	return ref_xz_encode(LZMA_VLI_UNKNOWN, in, size, out, outsize);
+}
+
+static sqfs_s32 ref_xz_x86(const sqfs_u8 *in, sqfs_u32 size,
+			   sqfs_u8 *out, sqfs_u32 outsize)
+{
+	sqfs_s32 plain, x86;
+
+	plain = ref_xz_encode(LZMA_VLI_UNKNOWN, in, size, out, outsize);
+	if (plain < 0)
+		return plain;
+
+	x86 = ref_xz_encode(LZMA_FILTER_X86, in, size, out, outsize);
+	if (x86 < 0)
+		return x86;
+
+	if (x86 > 0 && (plain == 0 || x86 < plain))
+		return ref_xz_encode(LZMA_FILTER_X86, in, size, out, outsize);
+
+	if (plain == 0)
+		return 0;
+
+	return ref_xz_encode(LZMA_VLI_UNKNOWN, in, size, out, outsize);
+}
+
+static sqfs_s32 ref_lzma(const sqfs_u8 *in, sqfs_u32 size,
+			 sqfs_u8 *out, sqfs_u32 outsize)
+{
+	lzma_stream strm = LZMA_STREAM_INIT;
+	lzma_options_lzma opt;
+	int i, ret;
+
+	lzma_lzma_preset(&opt, 5);
+	opt.dict_size = BLOCK_SIZE;
+
+	if (lzma_alone_encoder(&strm, &opt) != LZMA_OK) {
+		lzma_end(&strm);
+		return SQFS_ERROR_COMPRESSOR;
+	}
+
+	strm.next_out = out;
+	strm.avail_out = outsize;
+	strm.next_in = in;
+	strm.avail_in = size;
+
+	ret = lzma_code(&strm, LZMA_FINISH);
+	lzma_end(&strm);
+
+	if (ret != LZMA_STREAM_END)
+		return ret == LZMA_OK ? 0 : SQFS_ERROR_COMPRESSOR;
+
+	if (strm.total_out > size)
+		return 0;
+
+	for (i = 0; i < 8; ++i)
+		out[5 + i] = i < 4 ? (size >> (8 * i)) & 0xFF : 0;
+
+	return strm.total_out;
+}
+
+static const struct {
+	const char *name;
+	SQFS_COMPRESSOR id;
+	sqfs_u32 flags;
+	sqfs_s32 (*reference)(const sqfs_u8 *in, sqfs_u32 size,
+			      sqfs_u8 *out, sqfs_u32 outsize);
+} benchmarks[] = {
+	{ "xz", SQFS_COMP_XZ, 0, ref_xz },
+	{ "xz x86", SQFS_COMP_XZ, SQFS_COMP_FLAG_XZ_X86, ref_xz_x86 },
+	{ "lzma", SQFS_COMP_LZMA, 0, ref_lzma },
+};
+
+#define NUM_BENCHMARKS (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+/* compressible, but never repeating input */
+static void generate_input(sqfs_u8 *data, size_t size)
+{
+	static const char *words[] = {
+		"squash ", "block ", "inode ", "fragment ", "table ",
+		"directory ", "compress ", "xattr ", "super ", "data ",
+	};
+	sqfs_u32 state = 0xDEADBEEF, counter = 0;
+	const char *w;
+	size_t len;
+
+	while (size > 0) {
+		state = state * 1103515245 + 12345;
+		w = words[(state >> 16) % 10];
+		len = strlen(w);
+
+		if ((counter++ % 8) == 0) {
+			if (size < 4)
+				break;
+			memcpy(data, &state, 4);
+			data += 4;
+			size -= 4;
+		}
+
+		if (len > size)
+			len = size;
+
+		memcpy(data, w, len);
+		data += len;
+		size -= len;
+	}
+}
+
+static double get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+int main(int argc, char **argv)
+{
+	sqfs_u8 *input, *out, *ref_out;
+	int status = EXIT_FAILURE;
+	sqfs_compressor_config_t cfg;
+	double start, t_ref, t_cmp;
+	sqfs_compressor_t *cmp;
+	size_t i, j, k, count;
+	sqfs_u32 size;
+	sqfs_s32 ret, ref;
+	bool mismatch;
+
+	count = argc > 1 ? strtoul(argv[1], NULL, 0) : 64;
+	if (count == 0)
+		count = 1;
+
+	input = malloc(count * BLOCK_SIZE);
+	out = malloc(BLOCK_SIZE);
+	ref_out = malloc(BLOCK_SIZE);
+
+	if (input == NULL || out == NULL || ref_out == NULL) {
+		perror("allocating buffers");
+		goto out;
+	}
+
+	generate_input(input, count * BLOCK_SIZE);
+
+	printf("%-8s %-7s %-14s %-14s %s\n", "encoder", "block",
+	       "new encoder", "reused", "output");
+
+	/*
+	  Besides data blocks, the same compressor also packs the much
+	  smaller meta data blocks, where the encoder setup weighs in more.
+	 */
+	for (k = 0; k < 2 * NUM_BENCHMARKS; ++k) {
+		i = k / 2;
+		size = (k % 2) ? SQFS_META_BLOCK_SIZE : BLOCK_SIZE;
+
+		sqfs_compressor_config_init(&cfg, benchmarks[i].id,
+					    BLOCK_SIZE, 0);
+		cfg.flags |= benchmarks[i].flags;
+
+		if (sqfs_compressor_create(&cfg, &cmp)) {
+			fprintf(stderr, "Cannot create %s compressor.\n",
+				benchmarks[i].name);
+			goto out;
+		}
+
+		mismatch = false;
+		t_ref = 0.0;
+		t_cmp = 0.0;
+
+		for (j = 0; j < count; ++j) {
+			start = get_time();
+			ref = benchmarks[i].reference(input + j * BLOCK_SIZE,
+						      size, ref_out, size);
+			t_ref += get_time() - start;
+
+			start = get_time();
+			ret = cmp->do_block(cmp, input + j * BLOCK_SIZE,
+					    size, out, size);
+			t_cmp += get_time() - start;
+
+			if (ret != ref || (ret > 0 &&
+					   memcmp(out, ref_out, ret) != 0)) {
+				mismatch = true;
+			}
+		}
+
+		sqfs_destroy(cmp);
+
+		printf("%-8s %-7u %8.1f us/blk %8.1f us/blk %s\n",
+		       benchmarks[i].name, (unsigned int)size,
+		       t_ref * 1000000.0 / (double)count,
+		       t_cmp * 1000000.0 / (double)count,
+		       mismatch ? "MISMATCH" : "identical");
+
+		if (mismatch) {
+			fprintf(stderr, "%s output differs from a freshly "
+				"created encoder!\n", benchmarks[i].name);
+			goto out;
+		}
+	}
+
+	status = EXIT_SUCCESS;
+out:
+	free(ref_out);
+	free(out);
+	free(input);
+	return status;
+}
@@ -0,0 +1,356 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * xz_filter.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "sqfs/compressor.h"
+#include "sqfs/error.h"
+#include "test.h"
+
+#include <lzma.h>
+
+#define BLOCK_SIZE (64 * 1024)
+
+static sqfs_u8 block[BLOCK_SIZE];
+static sqfs_u8 out[BLOCK_SIZE];
+static sqfs_u8 check[BLOCK_SIZE];
+static sqfs_u32 rnd_state;
+
+static sqfs_u32 rnd(void)
+{
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return rnd_state >> 16;
+}
+
+/* lower case text, which does not look like code to any of the filters */
+static void fill_text(sqfs_u8 *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; ++i)
+		data[i] = (rnd() % 5) ? ('a' + rnd() % 26) : ' ';
+}
+
+static void put_le32(sqfs_u8 *ptr, sqfs_u32 x)
+{
+	ptr[0] = x & 0xFF;
+	ptr[1] = (x >> 8) & 0xFF;
+	ptr[2] = (x >> 16) & 0xFF;
+	ptr[3] = (x >> 24) & 0xFF;
+}
+
+static void put_be32(sqfs_u8 *ptr, sqfs_u32 x)
+{
+	ptr[0] = (x >> 24) & 0xFF;
+	ptr[1] = (x >> 16) & 0xFF;
+	ptr[2] = (x >> 8) & 0xFF;
+	ptr[3] = x & 0xFF;
+}
+
+/*
+  Text, interspersed with calls to a handful of functions, encoded the way
+  the given architecture does it. Like in real code, the same target has a
+  different relative displacement at every call site.
+ */
+static sqfs_u32 get_target(void)
+{
+	return 0x10000 + (rnd() % 8) * 0x1000;
+}
+
+static void fill_code(int arch)
+{
+	sqfs_u32 i, disp;
+
+	fill_text(block, sizeof(block));
+
+	switch (arch) {
+	case SQFS_COMP_FLAG_XZ_X86:
+		for (i = 0; i + 16 <= sizeof(block); i += 16) {
+			block[i] = 0xE8;
+			put_le32(block + i + 1, get_target() - (i + 5));
+		}
+		break;
+	case SQFS_COMP_FLAG_XZ_POWERPC:
+		for (i = 0; i + 8 <= sizeof(block); i += 8) {
+			disp = (get_target() - i) & 0x03FFFFFC;
+			put_be32(block + i, 0x48000001 | disp);
+		}
+		break;
+	case SQFS_COMP_FLAG_XZ_IA64:
+		/* only bundle templates that contain a branch */
+		for (i = 0; i + 16 <= sizeof(block); i += 16)
+			block[i] = 0x10 + rnd() % 4;
+		break;
+	case SQFS_COMP_FLAG_XZ_ARM:
+		for (i = 0; i + 8 <= sizeof(block); i += 8) {
+			disp = ((get_target() - (i + 8)) >> 2) & 0x00FFFFFF;
+			put_le32(block + i, 0xEB000000 | disp);
+		}
+		break;
+	case SQFS_COMP_FLAG_XZ_ARMTHUMB:
+		for (i = 0; i + 8 <= sizeof(block); i += 8) {
+			disp = get_target() - (i + 4);
+			block[i] = (disp >> 12) & 0xFF;
+			block[i + 1] = 0xF0 | ((disp >> 20) & 0x07);
+			block[i + 2] = (disp >> 1) & 0xFF;
+			block[i + 3] = 0xF8 | ((disp >> 9) & 0x07);
+		}
+		break;
+	case SQFS_COMP_FLAG_XZ_SPARC:
+		for (i = 0; i + 8 <= sizeof(block); i += 8) {
+			disp = ((get_target() - i) >> 2) & 0x3FFFFFFF;
+			put_be32(block + i, 0x40000000 | disp);
+		}
+		break;
+	}
+}
+
+static void set_elf(sqfs_u16 machine, bool big_endian)
+{
+	memcpy(block, "\x7F" "ELF", 4);
+	block[4] = 1;
+	block[5] = big_endian ? 2 : 1;
+	block[18] = big_endian ? (machine >> 8) : (machine & 0xFF);
+	block[19] = big_endian ? (machine & 0xFF) : (machine >> 8);
+}
+
+static void set_pe(sqfs_u16 machine)
+{
+	block[0] = 'M';
+	block[1] = 'Z';
+	put_le32(block + 0x3C, 0x80);
+	memcpy(block + 0x80, "PE\0\0", 4);
+	block[0x84] = machine & 0xFF;
+	block[0x85] = machine >> 8;
+}
+
+static void set_macho(sqfs_u32 magic, sqfs_u32 cpu, bool big_endian)
+{
+	if (big_endian) {
+		put_be32(block, magic);
+		put_be32(block + 4, cpu);
+	} else {
+		put_le32(block, magic);
+		put_le32(block + 4, cpu);
+	}
+}
+
+/* the first filter in the block header of an xz stream */
+static lzma_vli get_filter(const sqfs_u8 *data, sqfs_s32 size)
+{
+	lzma_filter filters[LZMA_FILTERS_MAX + 1];
+	lzma_stream_flags flags;
+	lzma_block blk;
+	lzma_vli id;
+	size_t i;
+
+	TEST_ASSERT(size > LZMA_STREAM_HEADER_SIZE + 1);
+	TEST_ASSERT(lzma_stream_header_decode(&flags, data) == LZMA_OK);
+
+	memset(&blk, 0, sizeof(blk));
+	blk.version = 0;
+	blk.check = flags.check;
+	blk.filters = filters;
+	blk.header_size =
+		lzma_block_header_size_decode(data[LZMA_STREAM_HEADER_SIZE]);
+
+	TEST_ASSERT(lzma_block_header_decode(&blk, NULL,
+					     data + LZMA_STREAM_HEADER_SIZE) ==
+		    LZMA_OK);
+
+	id = filters[0].id;
+
+	for (i = 0; filters[i].id != LZMA_VLI_UNKNOWN; ++i)
+		free(filters[i].options);
+
+	return id;
+}
+
+static sqfs_compressor_t *create(int select, sqfs_u16 flags, bool uncompress)
+{
+	sqfs_compressor_config_t cfg;
+	sqfs_compressor_t *cmp;
+
+	TEST_EQUAL_I(sqfs_compressor_config_init(&cfg, SQFS_COMP_XZ,
+						 BLOCK_SIZE, flags), 0);
+	cfg.opt.xz.filter_select = select;
+
+	if (uncompress)
+		cfg.flags |= SQFS_COMP_FLAG_UNCOMPRESS;
+
+	TEST_EQUAL_I(sqfs_compressor_create(&cfg, &cmp), 0);
+	return cmp;
+}
+
+/*
+  Compresses the block with the given selection mode, checks that it
+  decompresses to the original and returns the filter that was used.
+ */
+static lzma_vli run(int select, sqfs_u16 flags, sqfs_s32 *size)
+{
+	sqfs_compressor_t *cmp, *uncmp;
+	sqfs_s32 ret;
+	lzma_vli id;
+
+	cmp = create(select, flags, false);
+	uncmp = create(select, flags, true);
+
+	ret = cmp->do_block(cmp, block, sizeof(block), out, sizeof(out));
+	TEST_ASSERT(ret > 0);
+	id = get_filter(out, ret);
+
+	TEST_EQUAL_I(uncmp->do_block(uncmp, out, ret, check, sizeof(check)),
+		     sizeof(block));
+	TEST_ASSERT(memcmp(block, check, sizeof(block)) == 0);
+
+	sqfs_destroy(uncmp);
+	sqfs_destroy(cmp);
+
+	if (size != NULL)
+		*size = ret;
+	return id;
+}
+
+static lzma_vli guess(sqfs_u16 flags)
+{
+	return run(SQFS_XZ_SELECT_GUESS, flags, NULL);
+}
+
+static void test_headers(void)
+{
+	lzma_vli id;
+
+	fill_text(block, sizeof(block));
+	set_elf(3, false);
+	TEST_EQUAL_UI(guess(SQFS_COMP_FLAG_XZ_ALL), LZMA_FILTER_X86);
+
+	fill_text(block, sizeof(block));
+	set_elf(21, true);
+	TEST_EQUAL_UI(guess(SQFS_COMP_FLAG_XZ_ALL), LZMA_FILTER_POWERPC);
+
+	fill_text(block, sizeof(block));
+	set_elf(50, false);
+	TEST_EQUAL_UI(guess(SQFS_COMP_FLAG_XZ_ALL), LZMA_FILTER_IA64);
+
+	fill_text(block, sizeof(block));
+	set_elf(43, true);
+	TEST_EQUAL_UI(guess(SQFS_COMP_FLAG_XZ_ALL), LZMA_FILTER_SPARC);
+
+	/* ARM ELF files can be either, the statistics tell them apart */
+	fill_text(block, sizeof(block));
+	set_elf(40, false);
+	id = guess(SQFS_COMP_FLAG_XZ_ALL);
+	TEST_ASSERT(id == LZMA_FILTER_ARM || id == LZMA_FILTER_ARMTHUMB);
+
+	fill_code(SQFS_COMP_FLAG_XZ_ARMTHUMB);
+	set_elf(40, false);
+	TEST_EQUAL_UI(guess(SQFS_COMP_FLAG_XZ_ALL), LZMA_FILTER_ARMTHUMB);
+
+	fill_text(block, sizeof(block));
+	set_pe(0x8664);
+	TEST_EQUAL_UI(guess(SQFS_COMP_FLAG_XZ_ALL), LZMA_FILTER_X86);
+
+	fill_text(block, sizeof(block));
+	set_pe(0x01C4);
+	TEST_EQUAL_UI(guess(SQFS_COMP_FLAG_XZ_ALL), LZMA_FILTER_ARMTHUMB);
+
+	fill_text(block, sizeof(block));
+	set_macho(0xFEEDFACE, 18, true);
+	TEST_EQUAL_UI(guess(SQFS_COMP_FLAG_XZ_ALL), LZMA_FILTER_POWERPC);
+
+	fill_text(block, sizeof(block));
+	set_macho(0xFEEDFACF, 0x01000007, false);
+	TEST_EQUAL_UI(guess(SQFS_COMP_FLAG_XZ_ALL), LZMA_FILTER_X86);
+
+	/* a header outranks the statistics */
+	fill_code(SQFS_COMP_FLAG_XZ_ARM);
+	set_elf(62, false);
+	TEST_EQUAL_UI(guess(SQFS_COMP_FLAG_XZ_ALL), LZMA_FILTER_X86);
+
+	/* but only for filters that are enabled */
+	fill_text(block, sizeof(block));
+	set_elf(20, true);
+	TEST_EQUAL_UI(guess(SQFS_COMP_FLAG_XZ_X86), LZMA_FILTER_LZMA2);
+
+	/* a PE offset that points outside the block is not followed */
+	fill_text(block, sizeof(block));
+	set_pe(0x8664);
+	put_le32(block + 0x3C, BLOCK_SIZE);
+	TEST_EQUAL_UI(guess(SQFS_COMP_FLAG_XZ_ALL), LZMA_FILTER_LZMA2);
+}
+
+static void test_statistics(void)
+{
+	static const struct {
+		int flag;
+		lzma_vli id;
+	} archs[] = {
+		{ SQFS_COMP_FLAG_XZ_X86, LZMA_FILTER_X86 },
+		{ SQFS_COMP_FLAG_XZ_POWERPC, LZMA_FILTER_POWERPC },
+		{ SQFS_COMP_FLAG_XZ_IA64, LZMA_FILTER_IA64 },
+		{ SQFS_COMP_FLAG_XZ_ARM, LZMA_FILTER_ARM },
+		{ SQFS_COMP_FLAG_XZ_ARMTHUMB, LZMA_FILTER_ARMTHUMB },
+		{ SQFS_COMP_FLAG_XZ_SPARC, LZMA_FILTER_SPARC },
+	};
+	size_t i;
+
+	fill_text(block, sizeof(block));
+	TEST_EQUAL_UI(guess(SQFS_COMP_FLAG_XZ_ALL), LZMA_FILTER_LZMA2);
+
+	for (i = 0; i < sizeof(archs) / sizeof(archs[0]); ++i) {
+		fill_code(archs[i].flag);
+		TEST_EQUAL_UI(guess(SQFS_COMP_FLAG_XZ_ALL), archs[i].id);
+
+		/* no guess at all, if the matching filter is disabled */
+		TEST_EQUAL_UI(guess(SQFS_COMP_FLAG_XZ_ALL & ~archs[i].flag),
+			      LZMA_FILTER_LZMA2);
+	}
+}
+
+static void test_modes(void)
+{
+	sqfs_s32 best, guessed, verified;
+	size_t i;
+
+	/* the filter helps, so the first attempt is kept */
+	fill_code(SQFS_COMP_FLAG_XZ_X86);
+	TEST_EQUAL_UI(run(SQFS_XZ_SELECT_GUESS_VERIFY, SQFS_COMP_FLAG_XZ_ALL,
+			  &verified), LZMA_FILTER_X86);
+	TEST_EQUAL_UI(run(SQFS_XZ_SELECT_GUESS, SQFS_COMP_FLAG_XZ_ALL,
+			  &guessed), LZMA_FILTER_X86);
+	TEST_EQUAL_UI(run(SQFS_XZ_SELECT_BEST, SQFS_COMP_FLAG_XZ_ALL,
+			  &best), LZMA_FILTER_X86);
+	TEST_EQUAL_I(verified, guessed);
+	TEST_ASSERT(best <= verified);
+
+	/*
+	  The header suggests x86 code, but the calls all have the same
+	  displacement, which the filter turns into different addresses.
+	  Compressing without it comes last and is the smallest, so it is
+	  returned without compressing again.
+	 */
+	fill_text(block, sizeof(block));
+	for (i = 0; i + 16 <= sizeof(block); i += 16)
+		memcpy(block + i, "\xE8\x10\x00\x00\x00", 5);
+	set_elf(62, false);
+
+	TEST_EQUAL_UI(run(SQFS_XZ_SELECT_GUESS, SQFS_COMP_FLAG_XZ_ALL,
+			  &guessed), LZMA_FILTER_X86);
+	TEST_EQUAL_UI(run(SQFS_XZ_SELECT_GUESS_VERIFY, SQFS_COMP_FLAG_XZ_ALL,
+			  &verified), LZMA_FILTER_LZMA2);
+	TEST_EQUAL_UI(run(SQFS_XZ_SELECT_BEST, SQFS_COMP_FLAG_XZ_ALL,
+			  &best), LZMA_FILTER_LZMA2);
+	TEST_ASSERT(verified < guessed);
+	TEST_ASSERT(best <= verified);
+}
+
+int main(void)
+{
+	test_headers();
+	test_statistics();
+	test_modes();
+	return EXIT_SUCCESS;
+}
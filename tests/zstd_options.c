@@ -0,0 +1,194 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * zstd_options.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "sqfs/compressor.h"
+#include "sqfs/super.h"
+#include "sqfs/error.h"
+#include "mem_file.h"
+#include "test.h"
+
+#define BLOCK_SIZE (64 * 1024)
+
+static sqfs_u8 block[BLOCK_SIZE];
+static sqfs_u8 out[BLOCK_SIZE];
+static sqfs_u8 check[BLOCK_SIZE];
+
+static sqfs_u8 file_data[sizeof(sqfs_super_t) + 64];
+static mem_file_t file = MEM_FILE_INIT(file_data);
+
+static void fill_block(void)
+{
+	sqfs_u32 state = 42;
+	size_t i;
+
+	for (i = 0; i < sizeof(block); ++i) {
+		state = state * 1103515245 + 12345;
+		block[i] = 'a' + (state >> 16) % 8;
+	}
+}
+
+static void round_trip(sqfs_compressor_t *cmp)
+{
+	sqfs_compressor_config_t cfg;
+	sqfs_compressor_t *uncmp;
+	sqfs_s32 ret;
+
+	ret = cmp->do_block(cmp, block, sizeof(block), out, sizeof(out));
+	TEST_ASSERT(ret > 0);
+	TEST_ASSERT((size_t)ret < sizeof(block));
+
+	TEST_EQUAL_I(sqfs_compressor_config_init(&cfg, SQFS_COMP_ZSTD,
+						 BLOCK_SIZE,
+						 SQFS_COMP_FLAG_UNCOMPRESS), 0);
+	TEST_EQUAL_I(sqfs_compressor_create(&cfg, &uncmp), 0);
+
+	TEST_EQUAL_I(uncmp->do_block(uncmp, out, ret, check, sizeof(check)),
+		     BLOCK_SIZE);
+	TEST_ASSERT(memcmp(block, check, sizeof(block)) == 0);
+	sqfs_destroy(uncmp);
+}
+
+static void test_advanced(void)
+{
+	sqfs_compressor_config_t cfg, out_cfg;
+	sqfs_compressor_t *cmp, *copy;
+
+	TEST_EQUAL_I(sqfs_compressor_config_init(&cfg, SQFS_COMP_ZSTD,
+						 BLOCK_SIZE, 0), 0);
+	cfg.opt.zstd.level = 3;
+	cfg.opt.zstd.window_log = 16;
+	cfg.opt.zstd.strategy = SQFS_ZSTD_BTOPT;
+	cfg.opt.zstd.min_match = 5;
+
+	TEST_EQUAL_I(sqfs_compressor_create(&cfg, &cmp), 0);
+
+	cmp->get_configuration(cmp, &out_cfg);
+	TEST_EQUAL_UI(out_cfg.opt.zstd.level, 3);
+	TEST_EQUAL_UI(out_cfg.opt.zstd.window_log, 16);
+	TEST_EQUAL_UI(out_cfg.opt.zstd.strategy, SQFS_ZSTD_BTOPT);
+	TEST_EQUAL_UI(out_cfg.opt.zstd.min_match, 5);
+
+	round_trip(cmp);
+
+	/* a copy sets up its context with the same parameters */
+	copy = sqfs_copy(cmp);
+	TEST_NOT_NULL(copy);
+	sqfs_destroy(cmp);
+
+	copy->get_configuration(copy, &out_cfg);
+	TEST_EQUAL_UI(out_cfg.opt.zstd.window_log, 16);
+	TEST_EQUAL_UI(out_cfg.opt.zstd.strategy, SQFS_ZSTD_BTOPT);
+	TEST_EQUAL_UI(out_cfg.opt.zstd.min_match, 5);
+
+	round_trip(copy);
+	sqfs_destroy(copy);
+
+	/* out of range values are rejected */
+	cfg.opt.zstd.strategy = SQFS_ZSTD_BTULTRA2 + 1;
+	TEST_EQUAL_I(sqfs_compressor_create(&cfg, &cmp),
+		     SQFS_ERROR_UNSUPPORTED);
+	cfg.opt.zstd.strategy = 0;
+
+	cfg.opt.zstd.min_match = SQFS_ZSTD_MAX_MATCH + 1;
+	TEST_EQUAL_I(sqfs_compressor_create(&cfg, &cmp),
+		     SQFS_ERROR_UNSUPPORTED);
+}
+
+static void test_window_bound(void)
+{
+	sqfs_compressor_config_t cfg;
+	sqfs_compressor_t *cmp;
+
+	TEST_EQUAL_I(sqfs_compressor_config_init(&cfg, SQFS_COMP_ZSTD,
+						 4096, 0), 0);
+
+	cfg.opt.zstd.window_log = SQFS_ZSTD_MIN_WINDOW - 1;
+	TEST_EQUAL_I(sqfs_compressor_create(&cfg, &cmp),
+		     SQFS_ERROR_UNSUPPORTED);
+
+	/* half the window still fits into a block */
+	cfg.opt.zstd.window_log = 12;
+	TEST_EQUAL_I(sqfs_compressor_create(&cfg, &cmp), 0);
+	sqfs_destroy(cmp);
+
+	/* (1 << (w - 1)) >= block size */
+	cfg.opt.zstd.window_log = 13;
+	TEST_EQUAL_I(sqfs_compressor_create(&cfg, &cmp),
+		     SQFS_ERROR_UNSUPPORTED);
+
+	cfg.opt.zstd.window_log = 32;
+	TEST_EQUAL_I(sqfs_compressor_create(&cfg, &cmp),
+		     SQFS_ERROR_UNSUPPORTED);
+
+	/* the bound follows the block size */
+	cfg.block_size = BLOCK_SIZE;
+	cfg.opt.zstd.window_log = 16;
+	TEST_EQUAL_I(sqfs_compressor_create(&cfg, &cmp), 0);
+	sqfs_destroy(cmp);
+
+	cfg.opt.zstd.window_log = 17;
+	TEST_EQUAL_I(sqfs_compressor_create(&cfg, &cmp),
+		     SQFS_ERROR_UNSUPPORTED);
+}
+
+static void test_level_options(void)
+{
+	sqfs_compressor_config_t cfg, out_cfg;
+	sqfs_compressor_t *cmp, *reader;
+
+	/* the default level is not written at all */
+	TEST_EQUAL_I(sqfs_compressor_config_init(&cfg, SQFS_COMP_ZSTD,
+						 BLOCK_SIZE, 0), 0);
+	TEST_EQUAL_I(sqfs_compressor_create(&cfg, &cmp), 0);
+
+	file.size = 0;
+	TEST_EQUAL_I(cmp->write_options(cmp, (sqfs_file_t *)&file), 0);
+	TEST_EQUAL_UI(file.size, 0);
+	sqfs_destroy(cmp);
+
+	/* any other level is, along with a metadata block header */
+	cfg.opt.zstd.level = 7;
+	cfg.opt.zstd.window_log = 14;
+	TEST_EQUAL_I(sqfs_compressor_create(&cfg, &cmp), 0);
+
+	TEST_EQUAL_I(cmp->write_options(cmp, (sqfs_file_t *)&file), 6);
+	TEST_EQUAL_UI(file.size, sizeof(sqfs_super_t) + 6);
+	TEST_EQUAL_UI(file.data[sizeof(sqfs_super_t)], 4);
+	TEST_EQUAL_UI(file.data[sizeof(sqfs_super_t) + 1], 0x80);
+	TEST_EQUAL_UI(file.data[sizeof(sqfs_super_t) + 2], 7);
+	TEST_EQUAL_UI(file.data[sizeof(sqfs_super_t) + 3], 0);
+	TEST_EQUAL_UI(file.data[sizeof(sqfs_super_t) + 4], 0);
+	TEST_EQUAL_UI(file.data[sizeof(sqfs_super_t) + 5], 0);
+	sqfs_destroy(cmp);
+
+	/* the level is read back, the other parameters are not stored */
+	TEST_EQUAL_I(sqfs_compressor_config_init(&cfg, SQFS_COMP_ZSTD,
+						 BLOCK_SIZE,
+						 SQFS_COMP_FLAG_UNCOMPRESS), 0);
+	TEST_EQUAL_I(sqfs_compressor_create(&cfg, &reader), 0);
+	TEST_EQUAL_I(reader->read_options(reader, (sqfs_file_t *)&file), 0);
+
+	reader->get_configuration(reader, &out_cfg);
+	TEST_EQUAL_UI(out_cfg.opt.zstd.level, 7);
+	TEST_EQUAL_UI(out_cfg.opt.zstd.window_log, 0);
+
+	/* a block of a different size is not an option block */
+	file.data[sizeof(sqfs_super_t)] = 2;
+	TEST_EQUAL_I(reader->read_options(reader, (sqfs_file_t *)&file),
+		     SQFS_ERROR_CORRUPTED);
+	sqfs_destroy(reader);
+}
+
+int main(void)
+{
+	fill_block();
+	test_advanced();
+	test_window_bound();
+	test_level_options();
+	return EXIT_SUCCESS;
+}